@@ -0,0 +1,561 @@
+/*
+ * autotune.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "common.h"
+#include "autotune.h"
+#include "bufpool.h"
+#include "threadpool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#define bytes_per_pixel 4
+
+/* Decisions for one matrix */
+typedef struct {
+	char name[32];
+
+	int decided[AUTOTUNE_CLASS_COUNT];
+	AutotuneChoice choice[AUTOTUNE_CLASS_COUNT];
+
+	/* Median time of the choice on the class's square */
+	double ms[AUTOTUNE_CLASS_COUNT];
+} AutotuneEntry;
+
+/* The whole image split into bands of rows across the thread pool */
+typedef struct {
+	uint8_t *src, *dst;
+	int stride, w, h;
+	Filter2D *filter;
+	FilterVariant variant;
+	int band_h;
+	SDL_atomic_t rc;
+} AutotuneBands;
+
+static const int class_sizes[AUTOTUNE_CLASS_COUNT] = {AUTOTUNE_SMALL_SIZE, AUTOTUNE_LARGE_SIZE};
+static const char *class_names[AUTOTUNE_CLASS_COUNT] = {"small", "large"};
+
+/* Grows with the registry, loaded kernels aren't limited in number */
+static AutotuneEntry *entries;
+static int entry_count, entry_capacity;
+static SDL_SpinLock entries_lock;
+
+/* Only one thread tunes at a time, the others use the default meanwhile */
+static SDL_SpinLock tuning_lock;
+static int tune_on_first_use = 1;
+
+static char cache_file[FILENAME_MAX] = AUTOTUNE_DEFAULT_FILE;
+
+/* The CPU model and the number of threads, since the threaded variants depend on it */
+static void autotune_cpu_key(char *out, size_t size)
+{
+	char model[128] = "unknown CPU";
+
+#if defined(__x86_64__) || defined(__i386__)
+	/* The brand string is 48 bytes in three leaves, __get_cpuid() fails if they're missing */
+	unsigned int brand[13] = {0};
+
+	if(__get_cpuid(0x80000002, &brand[0], &brand[1], &brand[2], &brand[3]) &&
+			__get_cpuid(0x80000003, &brand[4], &brand[5], &brand[6], &brand[7]) &&
+			__get_cpuid(0x80000004, &brand[8], &brand[9], &brand[10], &brand[11])) {
+		const char *name = (const char*)brand;
+
+		while(*name == ' ') name++;
+		if(*name) snprintf(model, sizeof(model), "%s", name);
+	}
+#endif
+
+#ifdef __linux__
+	char line[256];
+	FILE *f = strcmp(model, "unknown CPU") == 0 ? fopen("/proc/cpuinfo", "r") : NULL;
+
+	if(f) {
+		while(fgets(line, sizeof(line), f)) {
+			char *colon = strchr(line, ':');
+
+			if(strncmp(line, "model name", 10) != 0 || !colon) continue;
+
+			snprintf(model, sizeof(model), "%s", colon + 2);
+			model[strcspn(model, "\r\n")] = 0;
+			break;
+		}
+
+		fclose(f);
+	}
+#endif
+
+	snprintf(out, size, "%s, %d threads", model, SDL_GetCPUCount());
+}
+
+/* The time of the build; build.sh compiles every module again, so it changes with the code */
+static void autotune_build_key(char *out, size_t size)
+{
+#ifdef __VERSION__
+	const char *compiler = __VERSION__;
+#else
+	const char *compiler = "unknown compiler";
+#endif
+
+#ifdef __SSE2__
+	const char *isa = ", sse2";
+#else
+	const char *isa = "";
+#endif
+
+	snprintf(out, size, "%s %s, %s%s", __DATE__, __TIME__, compiler, isa);
+}
+
+void __attribute__((destructor)) autotune_finalize(void)
+{
+	free(entries);
+}
+
+/* Index of the entry of a matrix, added if `create` is set; -1 if there's none or no memory. Under entries_lock */
+static int autotune_find(const char *name, int create)
+{
+	int i;
+
+	for(i=0; i<entry_count; i++) {
+		if(strcmp(entries[i].name, name) == 0) return i;
+	}
+
+	if(!create) {
+		return -1;
+	}
+
+	if(entry_count == entry_capacity) {
+		int capacity = entry_capacity ? entry_capacity * 2 : AUTOTUNE_INITIAL_ENTRIES;
+		AutotuneEntry *grown = realloc(entries, capacity * sizeof(AutotuneEntry));
+
+		if(!grown) return -1;
+
+		entries = grown;
+		entry_capacity = capacity;
+	}
+
+	memset(&entries[entry_count], 0, sizeof(AutotuneEntry));
+	snprintf(entries[entry_count].name, sizeof(entries[entry_count].name), "%s", name);
+
+	return entry_count++;
+}
+
+/* RC_OUTOFMEM if the decision couldn't be stored */
+static RETCODE autotune_set(const char *name, AutotuneClass cls, const AutotuneChoice *choice, double ms)
+{
+	SDL_AtomicLock(&entries_lock);
+
+	int i = autotune_find(name, 1);
+
+	if(i >= 0) {
+		entries[i].decided[cls] = 1;
+		entries[i].choice[cls] = *choice;
+		entries[i].ms[cls] = ms;
+	}
+
+	SDL_AtomicUnlock(&entries_lock);
+
+	return i >= 0 ? RC_OK : RC_OUTOFMEM;
+}
+
+RETCODE autotune_load(const char *filename)
+{
+	char line[256], cpu[192], build[192], name[64], cls[16], variant[16], threading[16];
+	AutotuneChoice choice;
+	double ms;
+	int i, known = 0;
+
+	snprintf(cache_file, sizeof(cache_file), "%s", filename);
+
+	FILE *f = fopen(filename, "r");
+	if(!f) return RC_FALSE;
+
+	autotune_cpu_key(cpu, sizeof(cpu));
+	autotune_build_key(build, sizeof(build));
+
+	while(fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\r\n")] = 0;
+
+		if(line[0] == '#' || line[0] == 0) {
+			continue;
+		}
+
+		/* Both keys come first, decisions of another machine or build are stale */
+		if(strncmp(line, "cpu ", 4) == 0 || strncmp(line, "build ", 6) == 0) {
+			if(strcmp(line + (line[0] == 'c' ? 4 : 6), line[0] == 'c' ? cpu : build) != 0) {
+				break;
+			}
+
+			known++;
+			continue;
+		}
+
+		if(known < 2) {
+			break;
+		}
+
+		if(sscanf(line, "%63s %15s %15s %15s %lf", name, cls, variant, threading, &ms) != 5) {
+			continue;
+		}
+
+		choice.variant = strcmp(variant, filter_variant_name(FILTER_VARIANT_SPARSE)) == 0 ? FILTER_VARIANT_SPARSE : FILTER_VARIANT_GENERIC;
+		choice.threaded = strcmp(threading, "threaded") == 0;
+
+		for(i=0; i<AUTOTUNE_CLASS_COUNT; i++) {
+			if(strcmp(cls, class_names[i]) == 0) {
+				autotune_set(name, i, &choice, ms);
+			}
+		}
+	}
+
+	fclose(f);
+
+	return known == 2 ? RC_OK : RC_FALSE;
+}
+
+RETCODE autotune_save(const char *filename)
+{
+	char cpu[192], build[192];
+	int i, c;
+
+	FILE *f = fopen(filename, "w");
+	if(!f) return RC_FAIL;
+
+	autotune_cpu_key(cpu, sizeof(cpu));
+	autotune_build_key(build, sizeof(build));
+
+	fprintf(f, "# Fastest way to apply each convolution matrix (CourseWork_DIP --tune)\n");
+	fprintf(f, "cpu %s\n", cpu);
+	fprintf(f, "build %s\n", build);
+
+	SDL_AtomicLock(&entries_lock);
+
+	for(i=0; i<entry_count; i++) {
+		for(c=0; c<AUTOTUNE_CLASS_COUNT; c++) {
+			if(!entries[i].decided[c]) continue;
+
+			fprintf(f, "%s %s %s %s %.4f\n", entries[i].name, class_names[c], filter_variant_name(entries[i].choice[c].variant),
+					entries[i].choice[c].threaded ? "threaded" : "serial", entries[i].ms[c]);
+		}
+	}
+
+	SDL_AtomicUnlock(&entries_lock);
+
+	RETCODE rc = ferror(f) ? RC_FAIL : RC_OK;
+	fclose(f);
+
+	return rc;
+}
+
+void autotune_set_first_use(int enable)
+{
+	tune_on_first_use = enable;
+}
+
+static void autotune_band_proc(void *arg, int band)
+{
+	AutotuneBands *b = arg;
+	SDL_Rect rect = {0, band * b->band_h, b->w, b->band_h};
+
+	if(rect.y + rect.h > b->h) {
+		rect.h = b->h - rect.y;
+	}
+
+	RETCODE rc = filter_apply_rect_variant(b->src, b->dst, b->stride, b->w, b->h, &rect, b->filter, b->variant);
+	if(failed(rc)) {
+		SDL_AtomicSet(&b->rc, rc);
+	}
+}
+
+static RETCODE autotune_run(void *src, void *dst, int stride, int w, int h, Filter2D *filter, const AutotuneChoice *choice)
+{
+	if(!choice->threaded) {
+		SDL_Rect rect = {0, 0, w, h};
+
+		return filter_apply_rect_variant(src, dst, stride, w, h, &rect, filter, choice->variant);
+	}
+
+	AutotuneBands b = {
+		.src = src,
+		.dst = dst,
+		.stride = stride,
+		.w = w,
+		.h = h,
+		.filter = filter,
+		.variant = choice->variant,
+	};
+	SDL_AtomicSet(&b.rc, RC_OK);
+
+	int bands = threadpool_split_rows(h, &b.band_h);
+	threadpool_parallel_for(bands, autotune_band_proc, &b);
+
+	return SDL_AtomicGet(&b.rc);
+}
+
+/* Smooth gradients with noise, so that no tap sees a flat image */
+static void autotune_fill(uint8_t *pixels, int stride, int w, int h)
+{
+	uint32_t seed = 0x2545f491;
+	int i, j;
+
+	for(j=0; j<h; j++) {
+		uint8_t *p = pixels + (size_t)j * stride;
+
+		for(i=0; i<w; i++, p += bytes_per_pixel) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+
+			p[0] = 255;
+			p[1] = (uint8_t)(i * 255 / w + (seed & 31));
+			p[2] = (uint8_t)(j * 255 / h + ((seed >> 5) & 31));
+			p[3] = (uint8_t)(seed >> 24);
+		}
+	}
+}
+
+static int autotune_compare_times(const void *a, const void *b)
+{
+	double ta = *(const double*)a, tb = *(const double*)b;
+
+	return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+/**
+ * Times every candidate (ms[variant][threaded], negative if it failed or differed from
+ * the reference) and returns the fastest one in *best.
+ */
+static RETCODE autotune_measure(Filter2D *filter, AutotuneClass cls, int runs, double ms[FILTER_VARIANT_COUNT][2], AutotuneChoice *best, double *best_ms)
+{
+	double times[AUTOTUNE_RUNS * 4];
+	uint8_t *src, *ref, *out;
+	int stride, v, t, n, j;
+	RETCODE rc = RC_OK;
+
+	const int size = class_sizes[cls];
+
+	if(runs > (int)(sizeof(times) / sizeof(times[0]))) runs = sizeof(times) / sizeof(times[0]);
+	if(runs < 1) runs = 1;
+
+	src = bufpool_alloc_bitmap(size, size, &stride);
+	ref = bufpool_alloc_bitmap(size, size, &stride);
+	out = bufpool_alloc_bitmap(size, size, &stride);
+
+	if(!src || !ref || !out) {
+		rc = RC_OUTOFMEM;
+		goto cleanup;
+	}
+
+	autotune_fill(src, stride, size, size);
+	memcpy(ref, src, (size_t)stride * size);
+	memcpy(out, src, (size_t)stride * size);
+
+	rc = filter_apply(src, ref, stride, size, size, filter);
+	if(failed(rc)) goto cleanup;
+
+	*best_ms = -1;
+
+	for(v=0; v<FILTER_VARIANT_COUNT; v++) {
+		for(t=0; t<2; t++) {
+			AutotuneChoice choice = {v, t};
+
+			ms[v][t] = -1;
+
+			/* The first run also warms up the caches and the pool */
+			if(failed(autotune_run(src, out, stride, size, size, filter, &choice))) {
+				continue;
+			}
+
+			for(j=0; j<size; j++) {
+				if(memcmp(ref + (size_t)j * stride, out + (size_t)j * stride, (size_t)size * bytes_per_pixel) != 0) break;
+			}
+
+			if(j < size) {
+				fprintf(stderr, "%s: the %s %s variant differs from filter_apply(), not used.\n", filter->name,
+						filter_variant_name(v), t ? "threaded" : "serial");
+				continue;
+			}
+
+			for(n=0; n<runs; n++) {
+				Uint64 start = SDL_GetPerformanceCounter();
+				autotune_run(src, out, stride, size, size, filter, &choice);
+				times[n] = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+			}
+
+			qsort(times, runs, sizeof(double), autotune_compare_times);
+			ms[v][t] = times[runs / 2];
+
+			if(*best_ms < 0 || ms[v][t] < *best_ms) {
+				*best = choice;
+				*best_ms = ms[v][t];
+			}
+		}
+	}
+
+	if(*best_ms < 0) {
+		rc = RC_FAIL;
+	}
+
+cleanup:
+	bufpool_free(src);
+	bufpool_free(ref);
+	bufpool_free(out);
+
+	return rc;
+}
+
+RETCODE autotune_filter(Filter2D *filter, AutotuneClass cls, int runs)
+{
+	double ms[FILTER_VARIANT_COUNT][2], best_ms;
+	AutotuneChoice best;
+
+	RETCODE rc = autotune_measure(filter, cls, runs, ms, &best, &best_ms);
+	if(failed(rc)) return rc;
+
+	return autotune_set(filter->name, cls, &best, best_ms);
+}
+
+void autotune_forget(const char *name)
+{
+	SDL_AtomicLock(&entries_lock);
+
+	int i = autotune_find(name, 0);
+	if(i >= 0) {
+		memset(entries[i].decided, 0, sizeof(entries[i].decided));
+	}
+
+	SDL_AtomicUnlock(&entries_lock);
+}
+
+RETCODE autotune_lookup(Filter2D *filter, int w, int h, AutotuneChoice *out)
+{
+	AutotuneClass cls = (int64_t)w * h <= AUTOTUNE_SMALL_PIXELS ? AUTOTUNE_SMALL : AUTOTUNE_LARGE;
+	RETCODE rc = RC_FALSE;
+
+	SDL_AtomicLock(&entries_lock);
+
+	int i = autotune_find(filter->name, 0);
+	if(i >= 0 && entries[i].decided[cls]) {
+		*out = entries[i].choice[cls];
+		rc = RC_OK;
+	}
+
+	SDL_AtomicUnlock(&entries_lock);
+
+	if(rc == RC_FALSE) {
+		/* Skipping the zero taps never costs more, and large images are worth splitting */
+		out->variant = FILTER_VARIANT_SPARSE;
+		out->threaded = cls == AUTOTUNE_LARGE;
+	}
+
+	return rc;
+}
+
+void autotune_get(Filter2D *filter, int w, int h, AutotuneChoice *out)
+{
+	AutotuneClass cls = (int64_t)w * h <= AUTOTUNE_SMALL_PIXELS ? AUTOTUNE_SMALL : AUTOTUNE_LARGE;
+
+	if(autotune_lookup(filter, w, h, out) == RC_OK || !tune_on_first_use) {
+		return;
+	}
+
+	/* Tuned once and saved; a thread finding the tuner busy doesn't wait for it */
+	if(SDL_AtomicTryLock(&tuning_lock)) {
+		RETCODE rc = autotune_filter(filter, cls, AUTOTUNE_RUNS);
+
+		/* On a failure the default is kept, so it isn't tried again on every call */
+		if(succeeded(rc)) {
+			autotune_save(cache_file);
+		}else if(failed(autotune_set(filter->name, cls, out, 0))) {
+			/* Nothing can be stored, every call would time the candidates again */
+			tune_on_first_use = 0;
+		}
+
+		SDL_AtomicUnlock(&tuning_lock);
+
+		autotune_lookup(filter, w, h, out);
+	}
+}
+
+RETCODE autotune_apply(void *src, void *dst, int stride, int w, int h, Filter2D *filter)
+{
+	AutotuneChoice choice;
+
+	autotune_get(filter, w, h, &choice);
+
+	return autotune_run(src, dst, stride, w, h, filter, &choice);
+}
+
+int autotune_main(int argc, char **argv)
+{
+	const char *filename = AUTOTUNE_DEFAULT_FILE;
+	const char *only = NULL;
+	double ms[FILTER_VARIANT_COUNT][2], best_ms;
+	AutotuneChoice best;
+	Filter2D *filter;
+	char cpu[192];
+	int i, c, runs = AUTOTUNE_RUNS, failures = 0;
+
+	/* argv[1] is --tune */
+	for(i=2; i<argc; i++) {
+		if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			filename = argv[++i];
+		}else if(strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			only = argv[++i];
+		}else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			runs = atoi(argv[++i]);
+		}else {
+			printf("Usage: \"%s --tune [-o <file>] [-f <filter>[,<filter>...]] [-r <runs>]\"\n", argv[0]);
+			printf("  -o  File of the decisions (default %s), read at startup\n", AUTOTUNE_DEFAULT_FILE);
+			printf("  -r  Timed runs of every variant (default %d)\n", AUTOTUNE_RUNS);
+			return 1;
+		}
+	}
+
+	/* Decisions of the filters not tuned now are kept */
+	autotune_load(filename);
+
+	autotune_cpu_key(cpu, sizeof(cpu));
+	printf("Tuning on %s...\n", cpu);
+	printf("%-14s %-6s %10s %10s %10s %10s   %s\n", "filter", "size", "generic", "generic-mt", "sparse", "sparse-mt", "choice");
+
+	for(i=0; succeeded(filter_find_by_id(i, &filter)); i++) {
+		if(only) {
+			size_t len = strlen(filter->name);
+			const char *p = strstr(only, filter->name);
+
+			if(!p || (p != only && p[-1] != ',') || (p[len] != 0 && p[len] != ',')) continue;
+		}
+
+		for(c=0; c<AUTOTUNE_CLASS_COUNT; c++) {
+			if(failed(autotune_measure(filter, c, runs, ms, &best, &best_ms))) {
+				printf("%-14s %-6s failed\n", filter->name, class_names[c]);
+				failures++;
+				continue;
+			}
+
+			autotune_set(filter->name, c, &best, best_ms);
+
+			printf("%-14s %-6s %7.3f ms %7.3f ms %7.3f ms %7.3f ms   %s %s\n", filter->name, class_names[c],
+					ms[FILTER_VARIANT_GENERIC][0], ms[FILTER_VARIANT_GENERIC][1], ms[FILTER_VARIANT_SPARSE][0], ms[FILTER_VARIANT_SPARSE][1],
+					filter_variant_name(best.variant), best.threaded ? "threaded" : "serial");
+		}
+	}
+
+	if(failed(autotune_save(filename))) {
+		printf("Can't write \"%s\".\n", filename);
+		return 1;
+	}
+
+	printf("Decisions written to \"%s\".\n", filename);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * autotune.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef AUTOTUNE_H_
+#define AUTOTUNE_H_
+
+#include "common.h"
+#include "filters.h"
+
+/* Decisions are read from and written to this file in the working directory */
+#define AUTOTUNE_DEFAULT_FILE	"autotune.txt"
+
+/* Images up to this many pixels use the decisions made on AUTOTUNE_SMALL_SIZE squares */
+#define AUTOTUNE_SMALL_PIXELS	(512 * 512)
+#define AUTOTUNE_SMALL_SIZE		256
+#define AUTOTUNE_LARGE_SIZE		1024
+
+/* Timed runs of every candidate, the median counts */
+#define AUTOTUNE_RUNS			5
+
+/* Entries of the decision table at first, it doubles when full */
+#define AUTOTUNE_INITIAL_ENTRIES	32
+
+typedef enum {
+	AUTOTUNE_SMALL = 0,
+	AUTOTUNE_LARGE,
+	AUTOTUNE_CLASS_COUNT,
+} AutotuneClass;
+
+/* How a convolution matrix is applied to a whole image */
+typedef struct {
+	FilterVariant variant;
+
+	/* Nonzero if the rows are split across the thread pool */
+	int threaded;
+} AutotuneChoice;
+
+/**
+ * Reads the decisions stored by an earlier run. They are ignored (RC_FALSE) if the file
+ * was written on another CPU or by another build. The file also becomes the one where
+ * decisions made on first use are saved.
+ */
+RETCODE autotune_load(const char *filename);
+RETCODE autotune_save(const char *filename);
+
+/**
+ * Nonzero (the default) to time the candidates the first time a matrix is applied to
+ * an image of a class without a decision; otherwise a default choice is used.
+ */
+void autotune_set_first_use(int enable);
+
+/* Times every variant of a matrix on a square of the class and keeps the fastest one */
+RETCODE autotune_filter(Filter2D *filter, AutotuneClass cls, int runs);
+
+/* Drops the decisions of a matrix whose coefficients changed, it's tuned again when needed */
+void autotune_forget(const char *name);
+
+/* Choice for a `w` x `h` image; RC_FALSE and a default choice if it wasn't tuned */
+RETCODE autotune_lookup(Filter2D *filter, int w, int h, AutotuneChoice *out);
+
+/* Like autotune_lookup(), but tunes the matrix now if needed and enabled */
+void autotune_get(Filter2D *filter, int w, int h, AutotuneChoice *out);
+
+/* Applies a matrix to the whole image the fastest way known (same result as filter_apply()) */
+RETCODE autotune_apply(void *src, void *dst, int stride, int w, int h, Filter2D *filter);
+
+/**
+ * Entry point of --tune: tunes every registered matrix for both classes, prints the
+ * timings and writes the decisions. Returns the process exit code.
+ */
+int autotune_main(int argc, char **argv);
+
+#endif /* AUTOTUNE_H_ */
@@ -0,0 +1,883 @@
+/*
+ * batch.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#include <SDL2/SDL.h>
+#include "common.h"
+#include "batch.h"
+#include "imgutils.h"
+#include "filters.h"
+#include "bufpool.h"
+#include "threadpool.h"
+#include "trace.h"
+#include "memtrack.h"
+#include "autotune.h"
+
+typedef struct {
+	char *path;
+	long size;
+} BatchFile;
+
+typedef struct {
+	BatchFile *files;
+	int count, capacity;
+} BatchFileList;
+
+/* State shared by the threads processing a list of files */
+typedef struct {
+	const BatchOptions *opt;
+	BatchFileList *list;
+
+	/* Bitmap memory reserved by the images in flight */
+	SDL_mutex *lock;
+	SDL_cond *cond;
+	size_t in_flight;
+
+	/* Totals for the throughput report (under lock) */
+	int done, failures;
+	uint64_t pixels;
+
+	/* Largest memory peak of a file (with -R) */
+	int64_t peak_bytes;
+
+	/* Files started so far and the thread reading the next ones ahead (under lock) */
+	int started, quit;
+	SDL_cond *prefetch_cond;
+	SDL_Thread *prefetcher;
+} BatchRun;
+
+/* Tiles of one filter applied to a big image */
+typedef struct {
+	uint8_t *src, *dst;
+	int stride, w, h;
+	int cols;
+	const char *name;
+	SDL_atomic_t rc;
+} BatchTiles;
+
+static void batch_print_usage(const char *argv0)
+{
+	const char *fn = strrchr(argv0, '\\');
+	fn = fn ? fn + 1 : argv0;
+
+	printf("Usage: \"%s [-f <filter>[,<filter>...]] [-m <template> [-n <count>]] [-r <w>x<h> | -t <size>] [-o <output> | -d <dir>] [-e <expression> [-b <image>...]] [-T <trace.json> [-P]] [-R] <image>...\"\n", fn);
+	printf("  -f  Filters applied in order, e.g. \"blur3x3,canny\"\n");
+	printf("  -e  Per-pixel expression applied after the filters, e.g. \"clamp((a - b) * 2 + 128)\" (see expr.h)\n");
+	printf("  -b  Image read as b, c and d by the expression (in the order given), the size of the input\n");
+	printf("  -o  Output file, the format is selected by the extension (pgm, qoi)\n");
+	printf("  -d  Output directory when processing several images, directories or patterns (\"images\\*.pgm\")\n");
+	printf("  -x  Format of the files written to the output directory (default pgm, qoi for compressed lossless files)\n");
+	printf("  -M  Memory for the images processed at the same time, in MB (default %d)\n", BATCH_DEFAULT_BUDGET / (1024 * 1024));
+	printf("  -r  Resize the result to <width>x<height>\n");
+	printf("  -t  Make a thumbnail whose larger side is <size> pixels\n");
+	printf("  -k  Resize kernel: box, bilinear, bicubic or lanczos3 (default)\n");
+	printf("  -m  Print the positions where the template image matches the filtered image\n");
+	printf("  -n  Number of reported matches (default 1)\n");
+	printf("  -s  Smallest reported match score, -1..1 (default %.2f)\n", match_default_params.min_score);
+	printf("  -T  Write the time spent loading, filtering and saving as Chrome trace JSON\n");
+	printf("  -P  Add cycles, instructions and cache misses to the spans of the trace\n");
+	printf("  -R  Report the memory peak of every file and the memory used by each subsystem\n");
+}
+
+/* Loads an image into a pooled 32-bit bitmap */
+static RETCODE batch_load_image(const char *filename, uint8_t **out, int *stride, int *w, int *h)
+{
+	IMGReader reader;
+	RETCODE rc;
+
+	rc = image_reader_open(filename, &reader);
+	if(rc == RC_FAIL) {
+		printf("Can't open \"%s\".\n", filename);
+		return RC_FAIL;
+	}
+
+	if(succeeded(rc)) {
+		*out = bufpool_alloc_bitmap(reader.header.w, reader.header.h, stride);
+		rc = *out ? image_reader_load(&reader, *out, *stride) : RC_OUTOFMEM;
+		image_reader_close(&reader);
+	}
+
+	if(failed(rc)) {
+		printf("Can't load \"%s\" (rc=%d).\n", filename, rc);
+		return rc;
+	}
+
+	*w = reader.header.w;
+	*h = reader.header.h;
+
+	return RC_OK;
+}
+
+/* Searches the template in a 32-bit bitmap and prints the best matches */
+static RETCODE batch_match(const BatchOptions *opt, const char *input, const uint8_t *pixels, int stride, int w, int h)
+{
+	uint8_t *tmpl = NULL;
+	MatchResult *results = NULL;
+	RETCODE rc;
+	int i, count, tmpl_stride;
+
+	IMGReader reader;
+	rc = image_reader_open(opt->template_file, &reader);
+	if(failed(rc)) return rc;
+
+	int32_t tw = reader.header.w, th = reader.header.h;
+
+	tmpl = bufpool_alloc_bitmap(tw, th, &tmpl_stride);
+	results = malloc(opt->match_count * sizeof(MatchResult));
+
+	if(!tmpl || !results) {
+		rc = RC_OUTOFMEM;
+		goto cleanup;
+	}
+
+	rc = image_reader_load(&reader, tmpl, tmpl_stride);
+	if(failed(rc)) goto cleanup;
+
+	rc = match_template(pixels, stride, w, h, tmpl, tmpl_stride, tw, th, &opt->match_params, results, opt->match_count, &count);
+	if(failed(rc)) goto cleanup;
+
+	/* Several files are processed at the same time, so their lines are told apart by the name */
+	if(opt->multiple_files) {
+		for(i=0; i<count; i++) {
+			printf("%s: match %d: x=%d y=%d score=%.4f\n", input, i + 1, results[i].x, results[i].y, results[i].score);
+		}
+
+		if(count == 0) {
+			printf("%s: no matches.\n", input);
+		}
+	}else {
+		printf("\n");
+		for(i=0; i<count; i++) {
+			printf("Match %d: x=%d y=%d score=%.4f\n", i + 1, results[i].x, results[i].y, results[i].score);
+		}
+
+		if(count == 0) {
+			printf("No matches.\n");
+		}
+	}
+
+cleanup:
+	image_reader_close(&reader);
+	free(results);
+	bufpool_free(tmpl);
+
+	return rc;
+}
+
+/* Splits a comma separated list of filter names. The names point inside `list` */
+static RETCODE batch_parse_filters(char *list, BatchOptions *opt)
+{
+	char *name = strtok(list, ",");
+
+	while(name) {
+		if(opt->filter_count >= BATCH_MAX_FILTERS) {
+			return RC_INVALIDARG;
+		}
+
+		opt->filters[opt->filter_count++] = name;
+		name = strtok(NULL, ",");
+	}
+
+	return RC_OK;
+}
+
+static void batch_tile_proc(void *arg, int index)
+{
+	BatchTiles *t = arg;
+	SDL_Rect rect;
+
+	rect.x = (index % t->cols) * BATCH_TILE_SIZE;
+	rect.y = (index / t->cols) * BATCH_TILE_SIZE;
+	rect.w = rect.x + BATCH_TILE_SIZE > t->w ? t->w - rect.x : BATCH_TILE_SIZE;
+	rect.h = rect.y + BATCH_TILE_SIZE > t->h ? t->h - rect.y : BATCH_TILE_SIZE;
+
+	RETCODE rc = filter_apply_rect_by_name(t->src, t->dst, t->stride, t->w, t->h, &rect, t->name);
+
+	if(failed(rc)) {
+		SDL_AtomicSet(&t->rc, rc);
+	}
+}
+
+/**
+ * Applies a filter to a bitmap. Local filters on big images are split into tiles, which
+ * are a parallel loop of their own: the threads done with their files help with them.
+ */
+static RETCODE batch_apply_filter(uint8_t *src, uint8_t *dst, int stride, int w, int h, const char *name)
+{
+	if((int64_t)w * h < BATCH_TILE_THRESHOLD || filter_is_local(name) != RC_OK) {
+		return filter_apply_by_name(src, dst, stride, w, h, name);
+	}
+
+	BatchTiles t = {
+		.src = src,
+		.dst = dst,
+		.stride = stride,
+		.w = w,
+		.h = h,
+		.cols = (w + BATCH_TILE_SIZE - 1) / BATCH_TILE_SIZE,
+		.name = name,
+	};
+	SDL_AtomicSet(&t.rc, RC_OK);
+
+	threadpool_parallel_for(t.cols * ((h + BATCH_TILE_SIZE - 1) / BATCH_TILE_SIZE), batch_tile_proc, &t);
+
+	return SDL_AtomicGet(&t.rc);
+}
+
+/* Evaluates the expression with the filtered image as `a` and the images given with -b */
+static RETCODE batch_apply_expr(const BatchOptions *opt, const char *input, const uint8_t *src, uint8_t *dst, int stride, int w, int h)
+{
+	ExprInput inputs[EXPR_MAX_INPUTS];
+	int i;
+
+	inputs[0].pixels = src;
+	inputs[0].stride = stride;
+
+	for(i=0; i<opt->expr_file_count; i++) {
+		if(opt->expr_w[i] != w || opt->expr_h[i] != h) {
+			printf("%s: the image is %dx%d, \"%s\" is %dx%d.\n", input, w, h, opt->expr_files[i], opt->expr_w[i], opt->expr_h[i]);
+			return RC_INVALIDARG;
+		}
+
+		inputs[i + 1].pixels = opt->expr_pixels[i];
+		inputs[i + 1].stride = opt->expr_strides[i];
+	}
+
+	RETCODE rc = expr_apply(opt->expr, inputs, opt->expr_file_count + 1, dst, stride, w, h);
+	if(failed(rc)) {
+		printf("%s: the expression failed (rc=%d).\n", input, rc);
+	}
+
+	return rc;
+}
+
+/* Processes an image file whose header has been read */
+static RETCODE batch_process_reader(const BatchOptions *opt, char *input, IMGReader *reader, char *output)
+{
+	TRACE_SCOPE("file");
+
+	uint8_t *buf[2] = {NULL, NULL};
+	RETCODE rc;
+	int i, stride, cur = 0;
+	int32_t w = reader->header.w, h = reader->header.h;
+
+	/* Two bitmaps are used in ping-pong fashion through the filter chain */
+	for(i=0; i<2; i++) {
+		buf[i] = bufpool_alloc_bitmap(w, h, &stride);
+
+		if(buf[i] == NULL) {
+			rc = RC_OUTOFMEM;
+			goto cleanup;
+		}
+	}
+
+	rc = image_reader_load(reader, buf[0], stride);
+	if(failed(rc)) goto cleanup;
+
+	/* Filters don't touch the alpha component, so initialize it in both bitmaps */
+	memcpy(buf[1], buf[0], (size_t)stride * h);
+
+	for(i=0; i<opt->filter_count; i++) {
+		rc = batch_apply_filter(buf[cur], buf[!cur], stride, w, h, opt->filters[i]);
+		if(failed(rc)) {
+			printf("%s: filter \"%s\" failed (rc=%d).\n", input, opt->filters[i], rc);
+			goto cleanup;
+		}
+
+		cur = !cur;
+	}
+
+	if(opt->expr) {
+		rc = batch_apply_expr(opt, input, buf[cur], buf[!cur], stride, w, h);
+		if(failed(rc)) goto cleanup;
+
+		cur = !cur;
+	}
+
+	if(opt->template_file) {
+		rc = batch_match(opt, input, buf[cur], stride, w, h);
+		if(failed(rc)) {
+			printf("%s: template matching failed (rc=%d).\n", input, rc);
+			goto cleanup;
+		}
+	}
+
+	/* Resize the result, the bitmap which isn't current is replaced by one with the new size */
+	if(opt->resize_w > 0 || opt->thumbnail > 0) {
+		int out_w = opt->resize_w, out_h = opt->resize_h, out_stride;
+
+		if(opt->thumbnail > 0) {
+			resample_fit_size(w, h, opt->thumbnail, &out_w, &out_h);
+		}
+
+		bufpool_free(buf[!cur]);
+		buf[!cur] = bufpool_alloc_bitmap(out_w, out_h, &out_stride);
+
+		if(buf[!cur] == NULL) {
+			rc = RC_OUTOFMEM;
+			goto cleanup;
+		}
+
+		rc = resample(buf[cur], stride, w, h, buf[!cur], out_stride, out_w, out_h, opt->resample_filter);
+		if(failed(rc)) goto cleanup;
+
+		cur = !cur;
+		stride = out_stride;
+		w = out_w;
+		h = out_h;
+	}
+
+	if(output) {
+		rc = image_save_bitmap_to_file(output, image_format_from_filename(output), buf[cur], stride, w, h);
+	}
+
+cleanup:
+	bufpool_free(buf[0]);
+	bufpool_free(buf[1]);
+
+	return rc;
+}
+
+RETCODE batch_process_file(const BatchOptions *opt, char *input, char *output)
+{
+	IMGReader reader;
+
+	RETCODE rc = image_reader_open(input, &reader);
+	if(failed(rc)) return rc;
+
+	rc = batch_process_reader(opt, input, &reader, output);
+	image_reader_close(&reader);
+
+	return rc;
+}
+
+/* Matches a file name against a pattern with * and ? wildcards, ignoring the case */
+static int batch_wildcard_match(const char *pattern, const char *name)
+{
+	if(*pattern == '*') {
+		while(*pattern == '*') pattern++;
+
+		if(!*pattern) {
+			return 1;
+		}
+
+		for(; *name; name++) {
+			if(batch_wildcard_match(pattern, name)) return 1;
+		}
+
+		return 0;
+	}
+
+	if(!*name) {
+		return !*pattern;
+	}
+
+	if(*pattern != '?' && tolower((unsigned char)*pattern) != tolower((unsigned char)*name)) {
+		return 0;
+	}
+
+	return batch_wildcard_match(pattern + 1, name + 1);
+}
+
+static RETCODE batch_add_file(BatchFileList *list, const char *path, long size)
+{
+	if(list->count == list->capacity) {
+		int capacity = list->capacity ? 2 * list->capacity : 64;
+		BatchFile *files = realloc(list->files, capacity * sizeof(BatchFile));
+
+		if(!files) return RC_OUTOFMEM;
+
+		list->files = files;
+		list->capacity = capacity;
+	}
+
+	char *copy = malloc(strlen(path) + 1);
+	if(!copy) return RC_OUTOFMEM;
+
+	strcpy(copy, path);
+	list->files[list->count].path = copy;
+	list->files[list->count].size = size;
+	list->count++;
+
+	return RC_OK;
+}
+
+/**
+ * Adds the files of a command line argument: a file, all the images (by extension) of
+ * a directory, or the files of a directory matching a pattern. The shell of Windows
+ * doesn't expand the patterns, so it is done here.
+ */
+static RETCODE batch_collect_files(const char *arg, BatchFileList *list)
+{
+	struct stat st;
+	char dir[FILENAME_MAX], path[FILENAME_MAX];
+	const char *pattern = NULL;
+	RETCODE rc = RC_OK;
+
+	if(strchr(arg, '*') || strchr(arg, '?')) {
+		const char *slash = strrchr(arg, '/');
+		const char *bslash = strrchr(arg, '\\');
+		if(bslash > slash) slash = bslash;
+
+		if(slash) {
+			snprintf(dir, sizeof(dir), "%.*s", (int)(slash - arg), arg);
+			pattern = slash + 1;
+		}else {
+			strcpy(dir, ".");
+			pattern = arg;
+		}
+	}else {
+		if(stat(arg, &st) != 0) {
+			printf("Can't find \"%s\".\n", arg);
+			return RC_FAIL;
+		}
+
+		if(!S_ISDIR(st.st_mode)) {
+			return batch_add_file(list, arg, (long)st.st_size);
+		}
+
+		snprintf(dir, sizeof(dir), "%s", arg);
+	}
+
+	DIR *d = opendir(dir);
+	if(!d) {
+		printf("Can't open directory \"%s\".\n", dir);
+		return RC_FAIL;
+	}
+
+	struct dirent *e;
+	while(succeeded(rc) && (e = readdir(d)) != NULL) {
+		if(pattern ? !batch_wildcard_match(pattern, e->d_name) : image_format_supported(image_format_from_filename(e->d_name)) != RC_OK) {
+			continue;
+		}
+
+		/* "." and ".." are skipped here as directories */
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+
+		rc = batch_add_file(list, path, (long)st.st_size);
+	}
+
+	closedir(d);
+	return rc;
+}
+
+/* Bigger files first, so the long jobs don't start last and keep the other threads waiting */
+static int batch_compare_files(const void *a, const void *b)
+{
+	long sa = ((const BatchFile*)a)->size, sb = ((const BatchFile*)b)->size;
+
+	return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+/* Name of the result of a file in the output directory: the same name with the output format */
+static void batch_output_name(const BatchOptions *opt, const char *input, char *out, size_t size)
+{
+	const char *name = strrchr(input, '/');
+	const char *bname = strrchr(input, '\\');
+	if(bname > name) name = bname;
+	name = name ? name + 1 : input;
+
+	const char *ext = strrchr(name, '.');
+	int len = ext ? (int)(ext - name) : (int)strlen(name);
+
+	snprintf(out, size, "%s/%.*s.%s", opt->output_dir, len, name, opt->output_format);
+}
+
+/* Estimates the bitmap memory needed for a file: the two ping-pong bitmaps and the resized result */
+static size_t batch_file_memory(const BatchOptions *opt, int w, int h)
+{
+	size_t bytes = 2 * (size_t)bufpool_stride(w) * h;
+
+	if(opt->resize_w > 0 || opt->thumbnail > 0) {
+		int out_w = opt->resize_w, out_h = opt->resize_h;
+
+		if(opt->thumbnail > 0) {
+			resample_fit_size(w, h, opt->thumbnail, &out_w, &out_h);
+		}
+
+		bytes += (size_t)bufpool_stride(out_w) * out_h;
+	}
+
+	return bytes;
+}
+
+/**
+ * Processes one file of the list. Decoding, filtering and encoding of a file are done
+ * by the same thread; a file waits for memory while the images in flight use the
+ * budget (unless it is the only one).
+ */
+static void batch_file_proc(void *arg, int index)
+{
+	BatchRun *run = arg;
+	const BatchOptions *opt = run->opt;
+	char *input = run->list->files[index].path;
+	char output[FILENAME_MAX];
+	IMGReader reader;
+	RETCODE rc;
+
+	/* Lets the prefetcher go on to the files after this one */
+	SDL_LockMutex(run->lock);
+	if(index >= run->started) {
+		run->started = index + 1;
+		SDL_CondSignal(run->prefetch_cond);
+	}
+	SDL_UnlockMutex(run->lock);
+
+	/* The file stays open with the header parsed while waiting for memory */
+	rc = image_reader_open(input, &reader);
+	if(failed(rc)) {
+		printf(rc == RC_FAIL ? "%s: can't open the file.\n" : "%s: unknown image format.\n", input);
+
+		SDL_LockMutex(run->lock);
+		run->failures++;
+		SDL_UnlockMutex(run->lock);
+		return;
+	}
+
+	int32_t w = reader.header.w, h = reader.header.h;
+	size_t bytes = batch_file_memory(opt, w, h);
+
+	SDL_LockMutex(run->lock);
+	while(run->in_flight > 0 && run->in_flight + bytes > opt->memory_budget) {
+		SDL_CondWait(run->cond, run->lock);
+	}
+	run->in_flight += bytes;
+	SDL_UnlockMutex(run->lock);
+
+	if(opt->output_dir) {
+		batch_output_name(opt, input, output, sizeof(output));
+	}
+
+	MemOp memop;
+	Uint32 start = SDL_GetTicks();
+
+	/* Includes the scratch memory of the filters, which the budget doesn't */
+	memtrack_op_begin(&memop, input);
+	rc = batch_process_reader(opt, input, &reader, opt->output_dir ? output : NULL);
+	memtrack_op_end(&memop);
+
+	image_reader_close(&reader);
+
+	if(failed(rc)) {
+		printf("%s: failed (rc=%d)\n", input, rc);
+	}else if(opt->memory_report) {
+		printf("%s: %dx%d in %u ms, memory peak %.1f MB (%.1f MB budgeted)\n", input, w, h, SDL_GetTicks() - start,
+				memop.peak / (1024.0 * 1024.0), bytes / (1024.0 * 1024.0));
+	}else {
+		printf("%s: %dx%d in %u ms\n", input, w, h, SDL_GetTicks() - start);
+	}
+
+	SDL_LockMutex(run->lock);
+	run->in_flight -= bytes;
+
+	if(memop.peak > run->peak_bytes) {
+		run->peak_bytes = memop.peak;
+	}
+
+	if(failed(rc)) {
+		run->failures++;
+	}else {
+		run->done++;
+		run->pixels += (uint64_t)w * h;
+	}
+
+	SDL_CondBroadcast(run->cond);
+	SDL_UnlockMutex(run->lock);
+}
+
+/**
+ * Asks the system to read the files up to BATCH_PREFETCH_FILES past the last one started,
+ * so they are in the page cache by the time they are decoded.
+ */
+static int batch_prefetch_proc(void *arg)
+{
+	BatchRun *run = arg;
+	int next = 0;
+
+	SDL_LockMutex(run->lock);
+
+	while(!run->quit && next < run->list->count) {
+		if(next >= run->started + BATCH_PREFETCH_FILES) {
+			SDL_CondWait(run->prefetch_cond, run->lock);
+			continue;
+		}
+
+		const char *path = run->list->files[next++].path;
+
+		SDL_UnlockMutex(run->lock);
+		image_prefetch(path);
+		SDL_LockMutex(run->lock);
+	}
+
+	SDL_UnlockMutex(run->lock);
+
+	return 0;
+}
+
+/* Processes a list of files in parallel and prints the throughput */
+static RETCODE batch_process_list(const BatchOptions *opt, BatchFileList *list)
+{
+	BatchRun run;
+
+	memset(&run, 0, sizeof(run));
+	run.opt = opt;
+	run.list = list;
+	run.lock = SDL_CreateMutex();
+	run.cond = SDL_CreateCond();
+	run.prefetch_cond = SDL_CreateCond();
+
+	if(!run.lock || !run.cond || !run.prefetch_cond) {
+		if(run.lock) SDL_DestroyMutex(run.lock);
+		if(run.cond) SDL_DestroyCond(run.cond);
+		if(run.prefetch_cond) SDL_DestroyCond(run.prefetch_cond);
+		return RC_OUTOFMEM;
+	}
+
+	qsort(list->files, list->count, sizeof(BatchFile), batch_compare_files);
+
+	/* Timings taken while the pool is busy with other files would be saved as decisions */
+	autotune_set_first_use(0);
+
+	/* Without the thread the files are just read when they're decoded */
+	run.prefetcher = SDL_CreateThread(batch_prefetch_proc, "batch_prefetch", &run);
+
+	printf("Processing %d files on %d threads...\n", list->count, threadpool_get_thread_count());
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	threadpool_parallel_for(list->count, batch_file_proc, &run);
+	double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+	if(run.prefetcher) {
+		SDL_LockMutex(run.lock);
+		run.quit = 1;
+		SDL_CondSignal(run.prefetch_cond);
+		SDL_UnlockMutex(run.lock);
+
+		SDL_WaitThread(run.prefetcher, NULL);
+	}
+
+	if(seconds <= 0) seconds = 1e-6;
+
+	printf("Processed %d images (%d failed) in %.2f s: %.1f images/s, %.1f MPix/s\n",
+			run.done, run.failures, seconds, run.done / seconds, run.pixels / seconds / 1e6);
+
+	if(opt->memory_report) {
+		printf("Largest memory peak of a file: %.1f MB\n", run.peak_bytes / (1024.0 * 1024.0));
+	}
+
+	SDL_DestroyCond(run.prefetch_cond);
+	SDL_DestroyCond(run.cond);
+	SDL_DestroyMutex(run.lock);
+
+	return run.failures ? RC_FAIL : RC_OK;
+}
+
+static void batch_make_dir(const char *dir)
+{
+#ifdef _WIN32
+	mkdir(dir);
+#else
+	mkdir(dir, 0777);
+#endif
+}
+
+int batch_main(int argc, char **argv)
+{
+	BatchOptions opt;
+	BatchFileList list;
+	char **inputs;
+	int i, input_count = 0;
+	RETCODE rc = RC_OK;
+
+	memset(&opt, 0, sizeof(opt));
+	memset(&list, 0, sizeof(list));
+	opt.resample_filter = RESAMPLE_LANCZOS3;
+	opt.match_count = 1;
+	opt.match_params = match_default_params;
+	opt.output_format = "pgm";
+	opt.memory_budget = BATCH_DEFAULT_BUDGET;
+
+	inputs = malloc(argc * sizeof(char*));
+	if(!inputs) return 1;
+
+	for(i=1; i<argc; i++) {
+		if(strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			if(failed(batch_parse_filters(argv[++i], &opt))) {
+				printf("Too many filters (at most %d).\n", BATCH_MAX_FILTERS);
+				rc = RC_INVALIDARG;
+				goto cleanup;
+			}
+		}else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			opt.output = argv[++i];
+		}else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			if(sscanf(argv[++i], "%dx%d", &opt.resize_w, &opt.resize_h) != 2 || opt.resize_w <= 0 || opt.resize_h <= 0) {
+				printf("Invalid size \"%s\".\n", argv[i]);
+				rc = RC_INVALIDARG;
+				goto cleanup;
+			}
+		}else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			opt.thumbnail = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+			if(failed(resample_find_by_name(argv[++i], &opt.resample_filter))) {
+				printf("Unknown resize kernel \"%s\".\n", argv[i]);
+				rc = RC_INVALIDARG;
+				goto cleanup;
+			}
+		}else if(strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			opt.template_file = argv[++i];
+		}else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			opt.match_count = atoi(argv[++i]);
+
+			if(opt.match_count < 1) {
+				printf("Invalid match count \"%s\".\n", argv[i]);
+				rc = RC_INVALIDARG;
+				goto cleanup;
+			}
+		}else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			opt.match_params.min_score = (float)atof(argv[++i]);
+		}else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			opt.output_dir = argv[++i];
+		}else if(strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+			opt.output_format = argv[++i];
+		}else if(strcmp(argv[i], "-M") == 0 && i + 1 < argc) {
+			opt.memory_budget = (size_t)atoi(argv[++i]) * 1024 * 1024;
+		}else if(strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+			opt.trace_file = argv[++i];
+		}else if(strcmp(argv[i], "-P") == 0) {
+			opt.trace_counters = 1;
+		}else if(strcmp(argv[i], "-R") == 0) {
+			opt.memory_report = 1;
+		}else if(strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			expr_free(opt.expr);
+			opt.expr = NULL;
+
+			if(failed(expr_compile(argv[++i], &opt.expr))) {
+				rc = RC_INVALIDARG;
+				goto cleanup;
+			}
+		}else if(strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			if(opt.expr_file_count == EXPR_MAX_INPUTS - 1) {
+				printf("Too many images for the expression (at most %d).\n", EXPR_MAX_INPUTS - 1);
+				rc = RC_INVALIDARG;
+				goto cleanup;
+			}
+
+			opt.expr_files[opt.expr_file_count++] = argv[++i];
+		}else if(argv[i][0] != '-') {
+			inputs[input_count++] = argv[i];
+		}else {
+			batch_print_usage(argv[0]);
+			rc = RC_INVALIDARG;
+			goto cleanup;
+		}
+	}
+
+	/* A single file keeps the output file name, several ones go to the output directory */
+	opt.multiple_files = input_count > 1 || opt.output_dir != NULL;
+
+	if(input_count == 0 || (opt.multiple_files && opt.output) || (!opt.output && !opt.output_dir && !opt.template_file)) {
+		batch_print_usage(argv[0]);
+		rc = RC_INVALIDARG;
+		goto cleanup;
+	}
+
+	/* Checked before the filters run, not when the result is written */
+	if(opt.output && image_format_writable(image_format_from_filename(opt.output)) != RC_OK) {
+		printf("Can't save images as \"%s\".\n", image_format_from_filename(opt.output));
+		rc = RC_INVALIDARG;
+	}
+
+	if(succeeded(rc) && opt.expr && expr_input_count(opt.expr) > opt.expr_file_count + 1) {
+		printf("The expression reads %d images, only %d are given.\n", expr_input_count(opt.expr), opt.expr_file_count + 1);
+		rc = RC_INVALIDARG;
+	}
+
+	for(i=0; i<opt.expr_file_count && succeeded(rc); i++) {
+		rc = batch_load_image(opt.expr_files[i], &opt.expr_pixels[i], &opt.expr_strides[i], &opt.expr_w[i], &opt.expr_h[i]);
+	}
+
+	if(failed(rc)) goto cleanup;
+
+	if(opt.trace_file) {
+		trace_enable(1);
+
+		if(opt.trace_counters && failed(trace_enable_counters(1))) {
+			printf("Tracing without hardware counters: %s.\n", perfcnt_error());
+		}
+	}
+
+	if(!opt.multiple_files) {
+		MemOp memop;
+		Uint32 start = SDL_GetTicks();
+		printf("Processing \"%s\"...", inputs[0]);
+
+		memtrack_op_begin(&memop, inputs[0]);
+		rc = batch_process_file(&opt, inputs[0], opt.output);
+		memtrack_op_end(&memop);
+
+		if(failed(rc)) {
+			printf("failed (rc=%d)\n", rc);
+		}else if(opt.memory_report) {
+			printf("done in %u ms, memory peak %.1f MB\n", SDL_GetTicks() - start, memop.peak / (1024.0 * 1024.0));
+		}else {
+			printf("done in %u ms\n", SDL_GetTicks() - start);
+		}
+	}else {
+		for(i=0; i<input_count && succeeded(rc); i++) {
+			rc = batch_collect_files(inputs[i], &list);
+		}
+
+		if(succeeded(rc) && opt.output_dir) {
+			if(image_format_writable(opt.output_format) != RC_OK) {
+				printf("Can't save images as \"%s\".\n", opt.output_format);
+				rc = RC_INVALIDARG;
+			}else {
+				batch_make_dir(opt.output_dir);
+			}
+		}
+
+		if(succeeded(rc)) {
+			rc = batch_process_list(&opt, &list);
+		}
+
+		for(i=0; i<list.count; i++) {
+			free(list.files[i].path);
+		}
+
+		free(list.files);
+	}
+
+	if(opt.trace_file) {
+		trace_export(opt.trace_file);
+	}
+
+	if(opt.memory_report) {
+		memtrack_print_summary();
+		bufpool_print_stats();
+	}
+
+cleanup:
+	for(i=0; i<opt.expr_file_count; i++) {
+		bufpool_free(opt.expr_pixels[i]);
+	}
+
+	expr_free(opt.expr);
+	free(inputs);
+
+	return failed(rc) ? 1 : 0;
+}
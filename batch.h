@@ -0,0 +1,96 @@
+/*
+ * batch.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <SDL2/SDL.h>
+#include "common.h"
+#include "resample.h"
+#include "match.h"
+#include "expr.h"
+
+/* Maximum number of filters in a chain */
+#define BATCH_MAX_FILTERS	32
+
+/* Images with more pixels are filtered in tiles, so all the threads work on them */
+#define BATCH_TILE_THRESHOLD	(4 * 1024 * 1024)
+#define BATCH_TILE_SIZE			256
+
+/* Memory of the bitmaps being processed at the same time, when no -M option is given */
+#define BATCH_DEFAULT_BUDGET	(1024 * 1024 * 1024)
+
+/* Files of a list read ahead of the last one started */
+#define BATCH_PREFETCH_FILES	8
+
+typedef struct {
+	/* Names of the filters applied in order (Filter2D matrices or operations) */
+	char *filters[BATCH_MAX_FILTERS];
+	int filter_count;
+
+	/* Output file; its extension selects the format */
+	char *output;
+
+	/* Output directory when several files are processed and the format of the files written there */
+	char *output_dir;
+	char *output_format;
+
+	/* Limit of the memory taken by the bitmaps of the images in flight */
+	size_t memory_budget;
+
+	/* Set when several files are processed at once; messages are prefixed with the file name */
+	int multiple_files;
+
+	/* Resize the result to resize_w x resize_h (0 keeps the size) */
+	int resize_w, resize_h;
+
+	/* Resize the result so its larger side is `thumbnail` pixels (0 disables it) */
+	int thumbnail;
+
+	/* Kernel used for resizing */
+	ResampleFilter resample_filter;
+
+	/* Template searched for in the filtered image (NULL disables matching) */
+	char *template_file;
+
+	/* Number of reported matches and their parameters */
+	int match_count;
+	MatchParams match_params;
+
+	/* Chrome trace JSON written at the end (NULL if nothing is traced) */
+	char *trace_file;
+
+	/* Nonzero to add the hardware counters of each span to the trace */
+	int trace_counters;
+
+	/* Nonzero to print the memory peak of each file and a summary per subsystem */
+	int memory_report;
+
+	/* Expression applied after the filters (NULL if none), `a` is the filtered image */
+	ExprProgram *expr;
+
+	/* Images b, c and d of the expression, loaded once and used for every file */
+	char *expr_files[EXPR_MAX_INPUTS - 1];
+	uint8_t *expr_pixels[EXPR_MAX_INPUTS - 1];
+	int expr_strides[EXPR_MAX_INPUTS - 1];
+	int expr_w[EXPR_MAX_INPUTS - 1], expr_h[EXPR_MAX_INPUTS - 1];
+	int expr_file_count;
+} BatchOptions;
+
+/**
+ * Entry point of the windowless mode. Parses the command line, processes the
+ * input image and writes the result. Returns the process exit code.
+ */
+int batch_main(int argc, char **argv);
+
+/**
+ * Loads a file into a CPU bitmap, runs the filter chain on it, matches the template and
+ * saves the result (if output isn't NULL). No renderer is needed.
+ */
+RETCODE batch_process_file(const BatchOptions *opt, char *input, char *output);
+
+#endif /* BATCH_H_ */
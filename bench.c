@@ -0,0 +1,949 @@
+/*
+ * bench.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "common.h"
+#include "bench.h"
+#include "batch.h"
+#include "filters.h"
+#include "histogram.h"
+#include "imgutils.h"
+#include "bufpool.h"
+#include "threadpool.h"
+#include "autotune.h"
+#include "expr.h"
+
+#define bytes_per_pixel 4
+
+/* A measured operation, called once per run */
+typedef RETCODE (*BenchProc)(void *arg);
+
+typedef struct {
+	char name[64];
+	const char *variant;
+	int w, h;
+	int runs;
+
+	double median_ms, p90_ms, min_ms, max_ms;
+	double mpix_s, gb_s;
+
+	/* Memory read and written per pixel, as assumed for gb_s */
+	double pixel_bytes;
+
+	/* Hardware counters of one run (the average of all the runs) */
+	PerfValues counters;
+
+	/* 1 if the result equals the reference, 0 if it doesn't, -1 if it isn't checked */
+	int match;
+} BenchResult;
+
+typedef struct {
+	BenchResult *results;
+	int count;
+	int capacity;
+
+	int mismatches;
+} BenchReport;
+
+/* Filter applied by the reference and the faster variants */
+typedef struct {
+	uint8_t *src, *dst;
+	int stride, w, h;
+
+	const char *name;
+	Filter2D *filter;
+	FilterOp *op;
+
+	int cols;
+	int band_h;
+	SDL_atomic_t rc;
+} BenchFilter;
+
+typedef struct {
+	const uint8_t *pixels;
+	int stride, w, h;
+	Histogram r, g, b;
+} BenchHistogram;
+
+typedef struct {
+	IMGHandler *handler;
+	FILE *f;
+	uint8_t *pixels;
+	int stride, w, h;
+} BenchIO;
+
+/* Returns 1 if `name` is in the comma separated list of cases to run */
+static int bench_selected(const BenchOptions *opt, const char *name)
+{
+	const char *p = opt->only;
+	size_t len = strlen(name);
+
+	if(!p) return 1;
+
+	while(*p) {
+		const char *end = strchr(p, ',');
+		if(!end) end = p + strlen(p);
+
+		if((size_t)(end - p) == len && strncmp(p, name, len) == 0) {
+			return 1;
+		}
+
+		p = *end ? end + 1 : end;
+	}
+
+	return 0;
+}
+
+/* Smooth gradients with noise, so the filters have edges and flat areas to work on */
+static void bench_fill(uint8_t *pixels, int stride, int w, int h)
+{
+	uint32_t seed = 0x9e3779b9;
+	int i, j;
+
+	for(j=0; j<h; j++) {
+		uint8_t *p = pixels + (size_t)j * stride;
+
+		for(i=0; i<w; i++, p += bytes_per_pixel) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+
+			p[0] = 255;
+			p[1] = (uint8_t)(i * 255 / w + (seed & 15));
+			p[2] = (uint8_t)(j * 255 / h + ((seed >> 4) & 15));
+			p[3] = (uint8_t)(((i / 32 + j / 32) & 1) * 160 + ((seed >> 8) & 63));
+		}
+	}
+}
+
+static int bench_equal(const uint8_t *a, const uint8_t *b, int stride, int w, int h)
+{
+	int j;
+
+	for(j=0; j<h; j++) {
+		if(memcmp(a + (size_t)j * stride, b + (size_t)j * stride, (size_t)w * bytes_per_pixel) != 0) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int bench_compare_times(const void *a, const void *b)
+{
+	double ta = *(const double*)a, tb = *(const double*)b;
+
+	return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+/**
+ * Runs `proc` opt->runs times (at least BENCH_MIN_RUNS, fewer once BENCH_TIME_LIMIT is
+ * spent) and fills the timing part of `r`. `bytes` is the memory read and written by
+ * one run.
+ */
+static RETCODE bench_time(const BenchOptions *opt, BenchProc proc, void *arg, double bytes, BenchResult *r)
+{
+	double *times = malloc(opt->runs * sizeof(double));
+	double total = 0;
+	PerfValues start_counters, end_counters;
+	RETCODE rc = RC_OK;
+	int n, c;
+
+	if(!times) return RC_OUTOFMEM;
+
+	/* Counted over all the runs; fails harmlessly when the counters aren't open */
+	perfcnt_read(&opt->counters, &start_counters);
+
+	for(n=0; n<opt->runs; n++) {
+		if(n >= BENCH_MIN_RUNS && total > BENCH_TIME_LIMIT) {
+			break;
+		}
+
+		Uint64 start = SDL_GetPerformanceCounter();
+
+		rc = proc(arg);
+		if(failed(rc)) break;
+
+		times[n] = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+		total += times[n];
+	}
+
+	if(succeeded(rc)) {
+		qsort(times, n, sizeof(double), bench_compare_times);
+
+		int p90 = (n * 9 + 9) / 10 - 1;
+
+		r->runs = n;
+		r->median_ms = (n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2) * 1000.0;
+		r->p90_ms = times[p90] * 1000.0;
+		r->min_ms = times[0] * 1000.0;
+		r->max_ms = times[n - 1] * 1000.0;
+		r->mpix_s = (double)r->w * r->h / (r->median_ms / 1000.0) / 1e6;
+		r->gb_s = bytes / (r->median_ms / 1000.0) / 1e9;
+		r->pixel_bytes = bytes / ((double)r->w * r->h);
+
+		if(succeeded(perfcnt_read(&opt->counters, &end_counters))) {
+			perfcnt_diff(&start_counters, &end_counters, &r->counters);
+
+			for(c=0; c<PERFCNT_COUNT; c++) {
+				r->counters.values[c] /= n;
+			}
+		}
+	}
+
+	free(times);
+	return rc;
+}
+
+/**
+ * Cycles per pixel, instructions per cycle, bytes read from memory per pixel (a line
+ * per last level cache miss) and mispredicted branches per pixel. Returns 0 if the
+ * cycles and instructions weren't counted; the other two are negative if not counted.
+ */
+static int bench_counter_rates(const BenchResult *r, double *cycles_per_pixel, double *ipc, double *llc_bytes_per_pixel, double *branch_misses_per_pixel)
+{
+	const PerfValues *v = &r->counters;
+	double pixels = (double)r->w * r->h;
+	unsigned needed = (1u << PERFCNT_CYCLES) | (1u << PERFCNT_INSTRUCTIONS);
+
+	if((v->valid & needed) != needed || v->values[PERFCNT_CYCLES] == 0) {
+		return 0;
+	}
+
+	*cycles_per_pixel = v->values[PERFCNT_CYCLES] / pixels;
+	*ipc = (double)v->values[PERFCNT_INSTRUCTIONS] / v->values[PERFCNT_CYCLES];
+
+	if(llc_bytes_per_pixel) {
+		*llc_bytes_per_pixel = v->valid & (1u << PERFCNT_LLC_MISSES) ? v->values[PERFCNT_LLC_MISSES] * (double)SDL_GetCPUCacheLineSize() / pixels : -1;
+	}
+
+	if(branch_misses_per_pixel) {
+		*branch_misses_per_pixel = v->valid & (1u << PERFCNT_BRANCH_MISSES) ? v->values[PERFCNT_BRANCH_MISSES] / pixels : -1;
+	}
+
+	return 1;
+}
+
+static RETCODE bench_add(BenchReport *report, const BenchResult *r)
+{
+	if(report->count == report->capacity) {
+		int capacity = report->capacity ? report->capacity * 2 : 64;
+		BenchResult *results = realloc(report->results, capacity * sizeof(BenchResult));
+
+		if(!results) return RC_OUTOFMEM;
+
+		report->results = results;
+		report->capacity = capacity;
+	}
+
+	report->results[report->count++] = *r;
+
+	char counters[48] = "";
+	double cpp, ipc;
+
+	if(bench_counter_rates(r, &cpp, &ipc, NULL, NULL)) {
+		snprintf(counters, sizeof(counters), " %8.2f c/px %5.2f IPC", cpp, ipc);
+	}
+
+	fprintf(stderr, "%-16s %-9s %5dx%-5d %10.3f ms %9.1f MPix/s %7.2f GB/s%s%s\n", r->name, r->variant, r->w, r->h,
+			r->median_ms, r->mpix_s, r->gb_s, counters, r->match == 0 ? "  MISMATCH" : "");
+
+	if(r->match == 0) {
+		report->mismatches++;
+	}
+
+	return RC_OK;
+}
+
+static void bench_init_result(BenchResult *r, const char *name, const char *variant, int w, int h)
+{
+	memset(r, 0, sizeof(BenchResult));
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->variant = variant;
+	r->w = w;
+	r->h = h;
+	r->match = -1;
+}
+
+static RETCODE bench_reference_proc(void *arg)
+{
+	BenchFilter *bf = arg;
+
+	if(bf->filter) {
+		return filter_apply(bf->src, bf->dst, bf->stride, bf->w, bf->h, bf->filter);
+	}
+
+	return bf->op->apply(bf->src, bf->dst, bf->stride, bf->w, bf->h);
+}
+
+static void bench_tile_proc(void *arg, int index)
+{
+	BenchFilter *bf = arg;
+	SDL_Rect rect;
+
+	rect.x = (index % bf->cols) * BATCH_TILE_SIZE;
+	rect.y = (index / bf->cols) * BATCH_TILE_SIZE;
+	rect.w = rect.x + BATCH_TILE_SIZE > bf->w ? bf->w - rect.x : BATCH_TILE_SIZE;
+	rect.h = rect.y + BATCH_TILE_SIZE > bf->h ? bf->h - rect.y : BATCH_TILE_SIZE;
+
+	RETCODE rc = filter_apply_rect_by_name(bf->src, bf->dst, bf->stride, bf->w, bf->h, &rect, bf->name);
+	if(failed(rc)) {
+		SDL_AtomicSet(&bf->rc, rc);
+	}
+}
+
+/* The tiles of the batch mode and the viewer */
+static RETCODE bench_tiles_proc(void *arg)
+{
+	BenchFilter *bf = arg;
+
+	bf->cols = (bf->w + BATCH_TILE_SIZE - 1) / BATCH_TILE_SIZE;
+	SDL_AtomicSet(&bf->rc, RC_OK);
+
+	threadpool_parallel_for(bf->cols * ((bf->h + BATCH_TILE_SIZE - 1) / BATCH_TILE_SIZE), bench_tile_proc, bf);
+
+	return SDL_AtomicGet(&bf->rc);
+}
+
+static void bench_band_proc(void *arg, int band)
+{
+	BenchFilter *bf = arg;
+	SDL_Rect rect = {0, band * bf->band_h, bf->w, bf->band_h};
+
+	if(rect.y + rect.h > bf->h) {
+		rect.h = bf->h - rect.y;
+	}
+
+	RETCODE rc = filter_apply_rect_by_name(bf->src, bf->dst, bf->stride, bf->w, bf->h, &rect, bf->name);
+	if(failed(rc)) {
+		SDL_AtomicSet(&bf->rc, rc);
+	}
+}
+
+/* The row bands of the daemon */
+static RETCODE bench_bands_proc(void *arg)
+{
+	BenchFilter *bf = arg;
+	int bands = threadpool_split_rows(bf->h, &bf->band_h);
+
+	SDL_AtomicSet(&bf->rc, RC_OK);
+	threadpool_parallel_for(bands, bench_band_proc, bf);
+
+	return SDL_AtomicGet(&bf->rc);
+}
+
+/* The sparse matrix kernel on one thread */
+static RETCODE bench_sparse_proc(void *arg)
+{
+	BenchFilter *bf = arg;
+	SDL_Rect rect = {0, 0, bf->w, bf->h};
+
+	return filter_apply_rect_variant(bf->src, bf->dst, bf->stride, bf->w, bf->h, &rect, bf->filter, FILTER_VARIANT_SPARSE);
+}
+
+/* The choice of the autotuner (filter_apply_by_name()) */
+static RETCODE bench_tuned_proc(void *arg)
+{
+	BenchFilter *bf = arg;
+
+	return autotune_apply(bf->src, bf->dst, bf->stride, bf->w, bf->h, bf->filter);
+}
+
+/* Measures the reference of a filter, then every variant checked against its result */
+static RETCODE bench_filter(const BenchOptions *opt, BenchReport *report, BenchFilter *bf, uint8_t *ref, uint8_t *out)
+{
+	static const struct {
+		const char *variant;
+		BenchProc proc;
+
+		/* Only for convolution matrices */
+		int matrix;
+	} variants[] = {
+		{"tiles", bench_tiles_proc, 0},
+		{"bands", bench_bands_proc, 0},
+		{"sparse", bench_sparse_proc, 1},
+		{"tuned", bench_tuned_proc, 1},
+	};
+
+	size_t size = (size_t)bf->stride * bf->h;
+	double bytes = 2.0 * bf->w * bf->h * bytes_per_pixel;
+	BenchResult r;
+	RETCODE rc;
+	int i;
+
+	/* Filters don't write the alpha component */
+	memcpy(ref, bf->src, size);
+	bf->dst = ref;
+
+	bench_init_result(&r, bf->name, "reference", bf->w, bf->h);
+	rc = bench_time(opt, bench_reference_proc, bf, bytes, &r);
+	if(failed(rc)) {
+		fprintf(stderr, "%s failed on %dx%d (rc=%d).\n", bf->name, bf->w, bf->h, rc);
+		return rc;
+	}
+
+	rc = bench_add(report, &r);
+	if(failed(rc)) return rc;
+
+	if(filter_is_local(bf->name) != RC_OK) {
+		return RC_OK;
+	}
+
+	for(i=0; i<sizeof(variants) / sizeof(variants[0]); i++) {
+		if(variants[i].matrix && !bf->filter) {
+			continue;
+		}
+
+		memcpy(out, bf->src, size);
+		bf->dst = out;
+
+		bench_init_result(&r, bf->name, variants[i].variant, bf->w, bf->h);
+		rc = bench_time(opt, variants[i].proc, bf, bytes, &r);
+		if(failed(rc)) {
+			fprintf(stderr, "%s (%s) failed on %dx%d (rc=%d).\n", bf->name, variants[i].variant, bf->w, bf->h, rc);
+			return rc;
+		}
+
+		r.match = bench_equal(ref, out, bf->stride, bf->w, bf->h);
+
+		rc = bench_add(report, &r);
+		if(failed(rc)) return rc;
+	}
+
+	return RC_OK;
+}
+
+/* Expression measured against the same formula written in C */
+#define BENCH_EXPR	"clamp((a - a(1, 0)) * 2 + 128)"
+
+typedef struct {
+	const uint8_t *src;
+	uint8_t *dst;
+	int stride, w, h;
+	ExprProgram *prog;
+} BenchExpr;
+
+static RETCODE bench_expr_reference_proc(void *arg)
+{
+	BenchExpr *be = arg;
+	int i, j, c;
+
+	for(j=0; j<be->h; j++) {
+		const uint8_t *s = be->src + (size_t)j * be->stride;
+		uint8_t *d = be->dst + (size_t)j * be->stride;
+
+		for(i=0; i<be->w; i++) {
+			const uint8_t *right = s + ((i + 1) % be->w) * bytes_per_pixel;
+
+			for(c=1; c<bytes_per_pixel; c++) {
+				int v = (s[i * bytes_per_pixel + c] - right[c]) * 2 + 128;
+				d[i * bytes_per_pixel + c] = v < 0 ? 0 : v > 255 ? 255 : v;
+			}
+		}
+	}
+
+	return RC_OK;
+}
+
+static RETCODE bench_expr_proc(void *arg)
+{
+	BenchExpr *be = arg;
+	ExprInput input = {be->src, be->stride};
+
+	return expr_apply(be->prog, &input, 1, be->dst, be->stride, be->w, be->h);
+}
+
+static RETCODE bench_expr(const BenchOptions *opt, BenchReport *report, const uint8_t *src, uint8_t *ref, uint8_t *out, int stride, int w, int h)
+{
+	BenchExpr be = {src, ref, stride, w, h, NULL};
+	double bytes = 2.0 * w * h * bytes_per_pixel;
+	BenchResult r;
+	RETCODE rc;
+
+	rc = expr_compile(BENCH_EXPR, &be.prog);
+	if(failed(rc)) return rc;
+
+	memcpy(ref, src, (size_t)stride * h);
+	memcpy(out, src, (size_t)stride * h);
+
+	bench_init_result(&r, "expr", "reference", w, h);
+	rc = bench_time(opt, bench_expr_reference_proc, &be, bytes, &r);
+	if(succeeded(rc)) rc = bench_add(report, &r);
+	if(failed(rc)) goto cleanup;
+
+	be.dst = out;
+
+	bench_init_result(&r, "expr", "bytecode", w, h);
+	rc = bench_time(opt, bench_expr_proc, &be, bytes, &r);
+	if(failed(rc)) {
+		fprintf(stderr, "expr failed on %dx%d (rc=%d).\n", w, h, rc);
+		goto cleanup;
+	}
+
+	r.match = bench_equal(ref, out, stride, w, h);
+	rc = bench_add(report, &r);
+
+cleanup:
+	expr_free(be.prog);
+	return rc;
+}
+
+static RETCODE bench_histogram_proc(void *arg)
+{
+	BenchHistogram *bh = arg;
+
+	return histogram_extract_bitmap(bh->pixels, bh->stride, bh->w, bh->h, &bh->r, &bh->g, &bh->b);
+}
+
+static RETCODE bench_histogram(const BenchOptions *opt, BenchReport *report, const uint8_t *pixels, int stride, int w, int h)
+{
+	BenchHistogram bh = {pixels, stride, w, h};
+	int32_t counts[3][256];
+	BenchResult r;
+	int i, j;
+
+	bench_init_result(&r, "histogram", "bitmap", w, h);
+
+	RETCODE rc = bench_time(opt, bench_histogram_proc, &bh, (double)w * h * bytes_per_pixel, &r);
+	if(failed(rc)) return rc;
+
+	/* Plain count of the R, G and B components */
+	memset(counts, 0, sizeof(counts));
+
+	for(j=0; j<h; j++) {
+		const uint8_t *p = pixels + (size_t)j * stride;
+
+		for(i=0; i<w; i++, p += bytes_per_pixel) {
+			counts[0][p[1]]++;
+			counts[1][p[2]]++;
+			counts[2][p[3]]++;
+		}
+	}
+
+	r.match = memcmp(counts[0], bh.r.values, sizeof(counts[0])) == 0 &&
+			memcmp(counts[1], bh.g.values, sizeof(counts[1])) == 0 &&
+			memcmp(counts[2], bh.b.values, sizeof(counts[2])) == 0;
+
+	return bench_add(report, &r);
+}
+
+static RETCODE bench_save_proc(void *arg)
+{
+	BenchIO *io = arg;
+
+	rewind(io->f);
+
+	RETCODE rc = io->handler->image_save(io->f, io->pixels, io->stride, io->w, io->h);
+	fflush(io->f);
+
+	return rc;
+}
+
+static RETCODE bench_load_proc(void *arg)
+{
+	BenchIO *io = arg;
+	IMGReader reader;
+	RETCODE rc;
+
+	rewind(io->f);
+
+	rc = image_reader_attach(io->f, &reader);
+	if(failed(rc)) return rc;
+
+	/* The magic must select the handler that saved the file */
+	if(reader.handler->image_load != io->handler->image_load) {
+		return RC_INVALIDDATA;
+	}
+
+	return image_reader_load(&reader, io->pixels, io->stride);
+}
+
+/* Returns 1 if the files have the same contents */
+static int bench_same_files(FILE *a, FILE *b)
+{
+	char buf_a[4096], buf_b[4096];
+	size_t n;
+
+	rewind(a);
+	rewind(b);
+
+	do {
+		n = fread(buf_a, 1, sizeof(buf_a), a);
+
+		if(fread(buf_b, 1, sizeof(buf_b), b) != n || memcmp(buf_a, buf_b, n) != 0) {
+			return 0;
+		}
+	}while(n > 0);
+
+	return 1;
+}
+
+/**
+ * Measures saving the bitmap and loading it back with a handler. The loaded bitmap
+ * must save to the same file, formats like PGM keep only a part of the pixels.
+ */
+static RETCODE bench_io(const BenchOptions *opt, BenchReport *report, IMGHandler *handler, uint8_t *src, uint8_t *out, int stride, int w, int h)
+{
+	BenchIO io = {handler, tmpfile(), src, stride, w, h};
+	FILE *again = tmpfile();
+	double bytes = (double)w * h * bytes_per_pixel;
+	BenchResult r;
+	RETCODE rc;
+
+	if(!io.f || !again) {
+		rc = RC_FAIL;
+		goto cleanup;
+	}
+
+	if(!handler->image_save) {
+		fprintf(stderr, "%-16s saving isn't implemented, skipped.\n", handler->format_name);
+		rc = RC_OK;
+		goto cleanup;
+	}
+
+	rc = bench_save_proc(&io);
+	if(failed(rc)) goto cleanup;
+
+	bench_init_result(&r, handler->format_name, "save", w, h);
+	rc = bench_time(opt, bench_save_proc, &io, bytes, &r);
+	if(failed(rc)) goto cleanup;
+
+	rc = bench_add(report, &r);
+	if(failed(rc)) goto cleanup;
+
+	io.pixels = out;
+
+	bench_init_result(&r, handler->format_name, "load", w, h);
+	rc = bench_time(opt, bench_load_proc, &io, bytes, &r);
+	if(failed(rc)) goto cleanup;
+
+	rc = handler->image_save(again, out, stride, w, h);
+	if(failed(rc)) goto cleanup;
+
+	fflush(again);
+	r.match = bench_same_files(io.f, again);
+
+	rc = bench_add(report, &r);
+
+cleanup:
+	if(io.f) fclose(io.f);
+	if(again) fclose(again);
+
+	if(failed(rc)) {
+		fprintf(stderr, "%s input/output failed on %dx%d (rc=%d).\n", handler->format_name, w, h, rc);
+	}
+
+	return rc;
+}
+
+/* Runs every selected case on a w x h image */
+static RETCODE bench_size(const BenchOptions *opt, BenchReport *report, int w, int h)
+{
+	uint8_t *src, *ref, *out;
+	int stride, i;
+	RETCODE rc = RC_OK;
+
+	src = bufpool_alloc_bitmap(w, h, &stride);
+	ref = bufpool_alloc_bitmap(w, h, &stride);
+	out = bufpool_alloc_bitmap(w, h, &stride);
+
+	if(!src || !ref || !out) {
+		fprintf(stderr, "Not enough memory for %dx%d images.\n", w, h);
+		rc = RC_OUTOFMEM;
+		goto cleanup;
+	}
+
+	bench_fill(src, stride, w, h);
+
+	BenchFilter bf = {
+		.src = src,
+		.stride = stride,
+		.w = w,
+		.h = h,
+	};
+
+	for(i=0; succeeded(filter_find_by_id(i, &bf.filter)); i++) {
+		bf.name = bf.filter->name;
+		bf.op = NULL;
+
+		if(bench_selected(opt, bf.name)) {
+			rc = bench_filter(opt, report, &bf, ref, out);
+			if(failed(rc)) goto cleanup;
+		}
+	}
+
+	bf.filter = NULL;
+
+	for(i=0; succeeded(filter_op_find_by_id(i, &bf.op)); i++) {
+		bf.name = bf.op->name;
+
+		if(bench_selected(opt, bf.name)) {
+			rc = bench_filter(opt, report, &bf, ref, out);
+			if(failed(rc)) goto cleanup;
+		}
+	}
+
+	if(bench_selected(opt, "expr")) {
+		rc = bench_expr(opt, report, src, ref, out, stride, w, h);
+		if(failed(rc)) goto cleanup;
+	}
+
+	if(bench_selected(opt, "histogram")) {
+		rc = bench_histogram(opt, report, src, stride, w, h);
+		if(failed(rc)) goto cleanup;
+	}
+
+	if((int64_t)w * h <= BENCH_IO_MAX_PIXELS) {
+		IMGHandler *handler;
+
+		for(i=0; succeeded(image_handler_by_id(i, &handler)); i++) {
+			if(bench_selected(opt, handler->format_name)) {
+				rc = bench_io(opt, report, handler, src, out, stride, w, h);
+				if(failed(rc)) goto cleanup;
+			}
+		}
+	}
+
+cleanup:
+	bufpool_free(src);
+	bufpool_free(ref);
+	bufpool_free(out);
+
+	return rc;
+}
+
+static void bench_write_report(FILE *f, const BenchReport *report)
+{
+	double cpp, ipc, llc, branches;
+	int i;
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"threads\": %d,\n", threadpool_get_thread_count());
+#ifdef __SSE2__
+	fprintf(f, "  \"sse2\": true,\n");
+#else
+	fprintf(f, "  \"sse2\": false,\n");
+#endif
+	fprintf(f, "  \"mismatches\": %d,\n", report->mismatches);
+	fprintf(f, "  \"results\": [\n");
+
+	/* One result per line, which is what bench_compare() reads back */
+	for(i=0; i<report->count; i++) {
+		const BenchResult *r = &report->results[i];
+
+		fprintf(f, "    {\"name\": \"%s\", \"variant\": \"%s\", \"w\": %d, \"h\": %d, \"runs\": %d, "
+				"\"median_ms\": %.4f, \"p90_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f, \"mpix_s\": %.2f, \"gb_s\": %.3f",
+				r->name, r->variant, r->w, r->h, r->runs, r->median_ms, r->p90_ms, r->min_ms, r->max_ms, r->mpix_s, r->gb_s);
+		fprintf(f, ", \"bytes_per_pixel\": %.1f", r->pixel_bytes);
+
+		if(bench_counter_rates(r, &cpp, &ipc, &llc, &branches)) {
+			fprintf(f, ", \"cycles_per_pixel\": %.3f, \"ipc\": %.3f", cpp, ipc);
+
+			if(llc >= 0) fprintf(f, ", \"llc_bytes_per_pixel\": %.3f", llc);
+			if(branches >= 0) fprintf(f, ", \"branch_misses_per_pixel\": %.4f", branches);
+		}
+
+		if(r->match >= 0) {
+			fprintf(f, ", \"match\": %s", r->match ? "true" : "false");
+		}
+
+		fprintf(f, "}%s\n", i + 1 < report->count ? "," : "");
+	}
+
+	fprintf(f, "  ]\n}\n");
+}
+
+static int bench_json_string(const char *line, const char *key, char *out, size_t size)
+{
+	char pattern[32];
+	size_t n = 0;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+
+	const char *p = strstr(line, pattern);
+	if(!p) return 0;
+
+	for(p += strlen(pattern); *p && *p != '"' && n + 1 < size; p++) {
+		out[n++] = *p;
+	}
+
+	out[n] = '\0';
+	return 1;
+}
+
+static int bench_json_number(const char *line, const char *key, double *out)
+{
+	char pattern[32];
+
+	snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+
+	const char *p = strstr(line, pattern);
+	if(!p) return 0;
+
+	*out = strtod(p + strlen(pattern), NULL);
+	return 1;
+}
+
+/**
+ * Compares the median times with a report written by an earlier run. Returns the
+ * number of regressions, or -1 if the baseline can't be read.
+ */
+static int bench_compare(const BenchOptions *opt, const BenchReport *report)
+{
+	char line[1024], name[64], variant[16];
+	double w, h, median;
+	int i, compared = 0, regressions = 0;
+
+	FILE *f = fopen(opt->baseline, "r");
+	if(!f) {
+		fprintf(stderr, "Can't open the baseline \"%s\".\n", opt->baseline);
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), f)) {
+		if(!bench_json_string(line, "name", name, sizeof(name)) || !bench_json_string(line, "variant", variant, sizeof(variant)) ||
+				!bench_json_number(line, "w", &w) || !bench_json_number(line, "h", &h) || !bench_json_number(line, "median_ms", &median)) {
+			continue;
+		}
+
+		for(i=0; i<report->count; i++) {
+			const BenchResult *r = &report->results[i];
+
+			if(r->w != (int)w || r->h != (int)h || strcmp(r->name, name) != 0 || strcmp(r->variant, variant) != 0) {
+				continue;
+			}
+
+			compared++;
+
+			if(r->median_ms > median * (1.0 + opt->threshold / 100.0)) {
+				fprintf(stderr, "REGRESSION %s %s %dx%d: %.3f ms -> %.3f ms (%+.1f%%)\n", name, variant, r->w, r->h,
+						median, r->median_ms, (r->median_ms / median - 1.0) * 100.0);
+				regressions++;
+			}
+
+			break;
+		}
+	}
+
+	fclose(f);
+
+	fprintf(stderr, "%d cases compared with \"%s\", %d slower by more than %.0f%%.\n", compared, opt->baseline, regressions, opt->threshold);
+
+	return regressions;
+}
+
+static RETCODE bench_parse_sizes(const char *list, BenchOptions *opt)
+{
+	const char *p = list;
+	char *end;
+
+	opt->size_count = 0;
+
+	while(*p) {
+		long size = strtol(p, &end, 10);
+
+		if(end == p || size <= 0 || size > 16384 || opt->size_count >= BENCH_MAX_SIZES) {
+			return RC_INVALIDARG;
+		}
+
+		opt->sizes[opt->size_count++] = (int)size;
+
+		if(*end == ',') end++;
+		else if(*end) return RC_INVALIDARG;
+
+		p = end;
+	}
+
+	return opt->size_count > 0 ? RC_OK : RC_INVALIDARG;
+}
+
+int bench_main(int argc, char **argv)
+{
+	BenchOptions opt;
+	BenchReport report;
+	RETCODE rc = RC_OK;
+	int i, counters = 0;
+
+	memset(&opt, 0, sizeof(opt));
+	memset(&report, 0, sizeof(report));
+	opt.runs = BENCH_DEFAULT_RUNS;
+	opt.threshold = BENCH_DEFAULT_THRESHOLD;
+	bench_parse_sizes(BENCH_DEFAULT_SIZES, &opt);
+
+	/* argv[1] is --bench */
+	for(i=2; i<argc && succeeded(rc); i++) {
+		if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			rc = bench_parse_sizes(argv[++i], &opt);
+		}else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			opt.runs = atoi(argv[++i]);
+			if(opt.runs <= 0) rc = RC_INVALIDARG;
+		}else if(strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			opt.only = argv[++i];
+		}else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			opt.output = argv[++i];
+		}else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			opt.baseline = argv[++i];
+		}else if(strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			opt.threshold = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-p") == 0) {
+			counters = 1;
+		}else {
+			rc = RC_INVALIDARG;
+		}
+	}
+
+	if(failed(rc)) {
+		printf("Usage: \"%s --bench [-s <size>[,<size>...]] [-r <runs>] [-f <case>[,<case>...]] [-o <report.json>] [-c <baseline.json>] [-t <percent>] [-p]\"\n", argv[0]);
+		printf("  -s  Sizes of the square test images (%s by default, up to 16384)\n", BENCH_DEFAULT_SIZES);
+		printf("  -f  Filters, \"histogram\" or image formats to measure (all by default)\n");
+		printf("  -c  Report the cases more than -t percent (%.0f by default) slower than in the baseline\n", BENCH_DEFAULT_THRESHOLD);
+		printf("  -p  Count cycles, instructions, cache and branch misses per pixel (Linux)\n");
+		return 1;
+	}
+
+	/* The tuned variant uses the stored decisions, tuning now would be timed too */
+	autotune_set_first_use(0);
+
+	/* The pool is started first, the counters only cover the threads existing when opened */
+	if(counters) {
+		threadpool_get_thread_count();
+
+		if(failed(perfcnt_open_process(&opt.counters))) {
+			fprintf(stderr, "Measuring without hardware counters: %s.\n", perfcnt_error());
+		}
+	}
+
+	for(i=0; i<opt.size_count && succeeded(rc); i++) {
+		rc = bench_size(&opt, &report, opt.sizes[i], opt.sizes[i]);
+	}
+
+	/* Images of the largest sizes aren't needed again */
+	bufpool_trim();
+
+	FILE *f = opt.output ? fopen(opt.output, "w") : stdout;
+	if(f) {
+		bench_write_report(f, &report);
+		if(f != stdout) fclose(f);
+	}else {
+		fprintf(stderr, "Can't create \"%s\".\n", opt.output);
+		rc = RC_FAIL;
+	}
+
+	if(report.mismatches > 0) {
+		fprintf(stderr, "%d results differ from the reference.\n", report.mismatches);
+	}
+
+	int regressions = opt.baseline ? bench_compare(&opt, &report) : 0;
+
+	perfcnt_close(&opt.counters);
+	free(report.results);
+
+	return failed(rc) || report.mismatches > 0 || regressions != 0 ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * bench.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include "common.h"
+#include "perfcnt.h"
+
+/* Image sizes (square) measured when no -s option is given */
+#define BENCH_DEFAULT_SIZES		"256,1024,4096"
+#define BENCH_MAX_SIZES			8
+
+/* Runs of every case; a case stops after BENCH_MIN_RUNS once it took BENCH_TIME_LIMIT seconds */
+#define BENCH_DEFAULT_RUNS		7
+#define BENCH_MIN_RUNS			3
+#define BENCH_TIME_LIMIT		2.0
+
+/* Image loading and saving is only measured up to this size, the text formats are slow */
+#define BENCH_IO_MAX_PIXELS		(4096 * 4096)
+
+/* Slowdown of the median time against the baseline (percent) reported as a regression */
+#define BENCH_DEFAULT_THRESHOLD	10.0
+
+typedef struct {
+	int sizes[BENCH_MAX_SIZES];
+	int size_count;
+
+	int runs;
+
+	/* Comma separated names of the cases to run, NULL for all of them */
+	char *only;
+
+	/* JSON report, NULL for stdout */
+	char *output;
+
+	/* Report of an earlier run to compare with, NULL to skip the comparison */
+	char *baseline;
+	double threshold;
+
+	/* Hardware counters of all the threads (-p); none are open if unavailable */
+	PerfCounters counters;
+} BenchOptions;
+
+/**
+ * Entry point of the benchmark (--bench). Every convolution matrix, filter operation,
+ * the histogram and every image handler are measured on synthetic images, the faster
+ * variants are checked against the scalar reference, and the results are written as
+ * JSON, with the cycles, instructions and misses per pixel added by -p. Returns 1 if a
+ * variant differs from the reference or a case got slower than in the baseline.
+ */
+int bench_main(int argc, char **argv);
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,368 @@
+/*
+ * bilateral.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bilateral.h"
+#include "separable.h"
+#include "filters.h"
+#include "threadpool.h"
+#include "memtrack.h"
+
+/* Empty cells around the grid, so the blur kernel never samples outside of it */
+#define GRID_PAD	2
+
+/* Largest sum of the R/G/B components, used as the range key */
+#define KEY_MAX		765
+
+const BilateralParams bilateral_default_params = {
+	.sigma_spatial = 8,
+	.sigma_range = 20,
+	.mode = BILATERAL_GRID,
+};
+
+typedef struct {
+	const uint8_t *src;
+	int src_stride;
+	uint8_t *dst;
+	int dst_stride;
+	int w, h;
+	int bpp;
+
+	/* Number of filtered components (1 for gray, 3 for R/G/B) */
+	int channels;
+	float ss, sr;
+
+	/* Grid dimensions and planes (one per component plus the weight) */
+	int gw, gh, gd;
+	size_t cells;
+	float *grid;
+	float *tmp;
+	int rows_per_task;
+
+	/* Brute force: spatial weights and range weights indexed by the key difference */
+	int radius;
+	float *spatial;
+	float *range;
+
+	int band_h;
+	RETCODE rc;
+} BilateralJob;
+
+/* Range key of a pixel: gray level times 3, so gray and 32-bit bitmaps share the same scale */
+static inline int bilateral_key(const uint8_t *p, int bpp)
+{
+	return bpp == 1 ? p[0] * 3 : p[1] + p[2] + p[3];
+}
+
+/* Component c of a pixel in the same order as the grid planes */
+static inline int bilateral_component(const uint8_t *p, int bpp, int c)
+{
+	return bpp == 1 ? p[0] : p[c + 1];
+}
+
+static inline void bilateral_store(uint8_t *p, int bpp, int c, float v)
+{
+	int x = (int)(v + 0.5f);
+
+	if(x < 0) x = 0;
+	else if(x > 255) x = 255;
+
+	if(bpp == 1) {
+		p[0] = (uint8_t)x;
+	}else {
+		p[c + 1] = (uint8_t)x;
+	}
+}
+
+/**
+ * Accumulates the pixels into the nearest grid cell. Each task owns a range of
+ * grid rows and only splats image rows falling into it, so no locking is needed.
+ */
+static void bilateral_splat_proc(void *arg, int task)
+{
+	BilateralJob *job = arg;
+	int i, j, c;
+	int g0 = task * job->rows_per_task;
+	int g1 = g0 + job->rows_per_task;
+	const float inv_ss = 1.0f / job->ss;
+	const float inv_sr = 1.0f / (3 * job->sr);
+	float *weight = job->grid + job->channels * job->cells;
+
+	for(j=0; j<job->h; j++) {
+		int gy = (int)(j * inv_ss + 0.5f) + GRID_PAD;
+		if(gy < g0 || gy >= g1) continue;
+
+		const uint8_t *p = job->src + (size_t)j * job->src_stride;
+
+		for(i=0; i<job->w; i++, p += job->bpp) {
+			int gx = (int)(i * inv_ss + 0.5f) + GRID_PAD;
+			int gz = (int)(bilateral_key(p, job->bpp) * inv_sr + 0.5f) + GRID_PAD;
+			size_t idx = ((size_t)gz * job->gh + gy) * job->gw + gx;
+
+			for(c=0; c<job->channels; c++) {
+				job->grid[c * job->cells + idx] += bilateral_component(p, job->bpp, c);
+			}
+
+			weight[idx] += 1;
+		}
+	}
+}
+
+/* Blurs all the planes of the grid along x, y and z. The result ends up in job->tmp */
+static RETCODE bilateral_blur_grid(BilateralJob *job)
+{
+	static const float kernel[5] = {1.0f/16, 4.0f/16, 6.0f/16, 4.0f/16, 1.0f/16};
+	const int gw = job->gw, gh = job->gh, gd = job->gd;
+	int c, z;
+	RETCODE rc;
+
+	for(c=0; c<=job->channels; c++) {
+		float *a = job->grid + c * job->cells;
+		float *b = job->tmp + c * job->cells;
+
+		/* Along x: every row of every slice is a line */
+		rc = separable_convolve_lines(a, b, gw, gh * gd, 1, gw, kernel, 2, EDGE_ZERO);
+		if(failed(rc)) return rc;
+
+		/* Along y: columns of a slice are adjacent lines */
+		for(z=0; z<gd; z++) {
+			size_t slice = (size_t)z * gw * gh;
+			rc = separable_convolve_lines(b + slice, a + slice, gh, gw, gw, 1, kernel, 2, EDGE_ZERO);
+			if(failed(rc)) return rc;
+		}
+
+		/* Along z: all (x, y) positions are adjacent lines */
+		rc = separable_convolve_lines(a, b, gd, gw * gh, gw * gh, 1, kernel, 2, EDGE_ZERO);
+		if(failed(rc)) return rc;
+	}
+
+	return RC_OK;
+}
+
+/* Reads the blurred grid back at each pixel's position with trilinear interpolation */
+static void bilateral_slice_proc(void *arg, int band)
+{
+	BilateralJob *job = arg;
+	int i, j, c, k;
+	int y1 = (band + 1) * job->band_h > job->h ? job->h : (band + 1) * job->band_h;
+	const float inv_ss = 1.0f / job->ss;
+	const float inv_sr = 1.0f / (3 * job->sr);
+	const size_t sx = 1, sy = job->gw, sz = (size_t)job->gw * job->gh;
+
+	for(j=band * job->band_h; j<y1; j++) {
+		const uint8_t *p = job->src + (size_t)j * job->src_stride;
+		uint8_t *d = job->dst + (size_t)j * job->dst_stride;
+
+		float fy = j * inv_ss + GRID_PAD;
+		int y0 = (int)fy;
+		float ty = fy - y0;
+
+		for(i=0; i<job->w; i++, p += job->bpp, d += job->bpp) {
+			float fx = i * inv_ss + GRID_PAD;
+			float fz = bilateral_key(p, job->bpp) * inv_sr + GRID_PAD;
+			int x0 = (int)fx, z0 = (int)fz;
+			float tx = fx - x0, tz = fz - z0;
+			size_t base = z0 * sz + y0 * sy + x0 * sx;
+
+			/* Offsets and weights of the 8 surrounding cells */
+			const size_t off[8] = {0, sx, sy, sx + sy, sz, sz + sx, sz + sy, sz + sx + sy};
+			const float wt[8] = {
+				(1 - tx) * (1 - ty) * (1 - tz), tx * (1 - ty) * (1 - tz),
+				(1 - tx) * ty * (1 - tz), tx * ty * (1 - tz),
+				(1 - tx) * (1 - ty) * tz, tx * (1 - ty) * tz,
+				(1 - tx) * ty * tz, tx * ty * tz,
+			};
+
+			const float *weight = job->tmp + job->channels * job->cells + base;
+			float norm = 0;
+
+			for(k=0; k<8; k++) {
+				norm += wt[k] * weight[off[k]];
+			}
+
+			for(c=0; c<job->channels; c++) {
+				if(norm <= 0) {
+					bilateral_store(d, job->bpp, c, bilateral_component(p, job->bpp, c));
+					continue;
+				}
+
+				const float *plane = job->tmp + c * job->cells + base;
+				float v = 0;
+
+				for(k=0; k<8; k++) {
+					v += wt[k] * plane[off[k]];
+				}
+
+				bilateral_store(d, job->bpp, c, v / norm);
+			}
+		}
+	}
+}
+
+static RETCODE bilateral_grid(BilateralJob *job)
+{
+	job->gw = (int)((job->w - 1) / job->ss) + 1 + 2 * GRID_PAD;
+	job->gh = (int)((job->h - 1) / job->ss) + 1 + 2 * GRID_PAD;
+	job->gd = (int)(KEY_MAX / (3 * job->sr)) + 1 + 2 * GRID_PAD;
+	job->cells = (size_t)job->gw * job->gh * job->gd;
+
+	size_t bytes = (job->channels + 1) * job->cells * sizeof(float);
+	job->grid = memtrack_calloc(MEM_FILTER, 1, bytes);
+	job->tmp = memtrack_malloc(MEM_FILTER, bytes);
+
+	if(!job->grid || !job->tmp) {
+		memtrack_free(job->grid);
+		memtrack_free(job->tmp);
+		return RC_OUTOFMEM;
+	}
+
+	int tasks = threadpool_split_rows(job->gh, &job->rows_per_task);
+	threadpool_parallel_for(tasks, bilateral_splat_proc, job);
+
+	RETCODE rc = bilateral_blur_grid(job);
+
+	if(succeeded(rc)) {
+		int bands = threadpool_split_rows(job->h, &job->band_h);
+		threadpool_parallel_for(bands, bilateral_slice_proc, job);
+	}
+
+	memtrack_free(job->grid);
+	memtrack_free(job->tmp);
+	return rc;
+}
+
+/* Reference implementation, evaluates the full bilateral weight of every tap */
+static void bilateral_brute_force_proc(void *arg, int band)
+{
+	BilateralJob *job = arg;
+	int i, j, x, y, c;
+	int y1 = (band + 1) * job->band_h > job->h ? job->h : (band + 1) * job->band_h;
+	const int r = job->radius, bpp = job->bpp;
+
+	for(j=band * job->band_h; j<y1; j++) {
+		for(i=0; i<job->w; i++) {
+			const uint8_t *center = job->src + (size_t)j * job->src_stride + i * bpp;
+			int key = bilateral_key(center, bpp);
+			float acc[3] = {0, 0, 0}, norm = 0;
+
+			for(y=-r; y<=r; y++) {
+				if(j + y < 0 || j + y >= job->h) continue;
+
+				const uint8_t *line = job->src + (size_t)(j + y) * job->src_stride;
+				const float *spatial = job->spatial + (y + r) * (2 * r + 1) + r;
+
+				for(x=-r; x<=r; x++) {
+					if(i + x < 0 || i + x >= job->w) continue;
+
+					const uint8_t *p = line + (i + x) * bpp;
+					float wt = spatial[x] * job->range[abs(bilateral_key(p, bpp) - key)];
+
+					for(c=0; c<job->channels; c++) {
+						acc[c] += wt * bilateral_component(p, bpp, c);
+					}
+
+					norm += wt;
+				}
+			}
+
+			uint8_t *d = job->dst + (size_t)j * job->dst_stride + i * bpp;
+			for(c=0; c<job->channels; c++) {
+				bilateral_store(d, bpp, c, acc[c] / norm);
+			}
+		}
+	}
+}
+
+static RETCODE bilateral_brute_force(BilateralJob *job)
+{
+	int i, x, y;
+
+	job->radius = (int)ceilf(3 * job->ss);
+	int n = 2 * job->radius + 1;
+
+	job->spatial = memtrack_malloc(MEM_FILTER, n * n * sizeof(float));
+	job->range = memtrack_malloc(MEM_FILTER, (KEY_MAX + 1) * sizeof(float));
+
+	if(!job->spatial || !job->range) {
+		memtrack_free(job->spatial);
+		memtrack_free(job->range);
+		return RC_OUTOFMEM;
+	}
+
+	for(y=0; y<n; y++) {
+		for(x=0; x<n; x++) {
+			float dx = x - job->radius, dy = y - job->radius;
+			job->spatial[y * n + x] = expf(-(dx * dx + dy * dy) / (2 * job->ss * job->ss));
+		}
+	}
+
+	/* The key is three times the gray level */
+	for(i=0; i<=KEY_MAX; i++) {
+		float d = i / 3.0f;
+		job->range[i] = expf(-(d * d) / (2 * job->sr * job->sr));
+	}
+
+	int bands = threadpool_split_rows(job->h, &job->band_h);
+	threadpool_parallel_for(bands, bilateral_brute_force_proc, job);
+
+	memtrack_free(job->spatial);
+	memtrack_free(job->range);
+	return RC_OK;
+}
+
+RETCODE bilateral_filter(const void *src, int src_stride, void *dst, int dst_stride, int w, int h,
+		int bytes_per_pixel, const BilateralParams *params)
+{
+	if(!params) {
+		params = &bilateral_default_params;
+	}
+
+	if(!src || !dst || src == dst || w <= 0 || h <= 0) {
+		return RC_INVALIDARG;
+	}
+
+	if(bytes_per_pixel != 1 && bytes_per_pixel != 4) {
+		return RC_INVALIDARG;
+	}
+
+	if(params->sigma_spatial < 1 || params->sigma_range <= 0) {
+		return RC_INVALIDARG;
+	}
+
+	BilateralJob job = {
+		.src = src,
+		.src_stride = src_stride,
+		.dst = dst,
+		.dst_stride = dst_stride,
+		.w = w,
+		.h = h,
+		.bpp = bytes_per_pixel,
+		.channels = bytes_per_pixel == 1 ? 1 : 3,
+		.ss = params->sigma_spatial,
+		.sr = params->sigma_range,
+		.rc = RC_OK,
+	};
+
+	if(params->mode == BILATERAL_BRUTE_FORCE) {
+		return bilateral_brute_force(&job);
+	}
+
+	return bilateral_grid(&job);
+}
+
+RETCODE bilateral_apply(void *src, void *dst, int stride, int w, int h)
+{
+	return bilateral_filter(src, stride, dst, stride, w, h, 4, NULL);
+}
+
+FilterOp bilateral_op = {
+	.name = "bilateral",
+	.apply = bilateral_apply,
+};
@@ -0,0 +1,47 @@
+/*
+ * bilateral.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef BILATERAL_H_
+#define BILATERAL_H_
+
+#include <stdint.h>
+#include "common.h"
+
+typedef enum {
+	/* Downsampled 3D bilateral grid, cost almost independent of the spatial sigma */
+	BILATERAL_GRID = 0,
+
+	/* Exact evaluation over the whole window, used as reference for the grid */
+	BILATERAL_BRUTE_FORCE,
+} BilateralMode;
+
+typedef struct {
+	/* Standard deviation of the spatial Gaussian, in pixels */
+	float sigma_spatial;
+
+	/* Standard deviation of the range Gaussian, in gray levels */
+	float sigma_range;
+
+	BilateralMode mode;
+} BilateralParams;
+
+/* Parameters used when NULL is passed to bilateral_filter() */
+extern const BilateralParams bilateral_default_params;
+
+/**
+ * Edge-preserving smoothing of an 8-bit gray (bytes_per_pixel = 1) or a 32-bit
+ * bitmap (bytes_per_pixel = 4). For 32-bit bitmaps the R/G/B components are
+ * filtered with weights taken from the gray level, so colors don't bleed across
+ * edges, and alpha is left untouched.
+ */
+RETCODE bilateral_filter(const void *src, int src_stride, void *dst, int dst_stride, int w, int h,
+		int bytes_per_pixel, const BilateralParams *params);
+
+/* Bilateral grid on a 32-bit bitmap with the default parameters */
+RETCODE bilateral_apply(void *src, void *dst, int stride, int w, int h);
+
+#endif /* BILATERAL_H_ */
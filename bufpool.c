@@ -0,0 +1,257 @@
+/*
+ * bufpool.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "bufpool.h"
+#include "memtrack.h"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#define bytes_per_pixel 4
+
+/* Smallest size class */
+#define BUFPOOL_MIN_CLASS	4096
+
+/* Two classes per power of two, up to 2^63 */
+#define BUFPOOL_CLASS_COUNT	128
+
+/* Mapped buffers are rounded to huge pages */
+#define BUFPOOL_HUGE_PAGE	(2 * 1024 * 1024)
+
+/* Kept in front of every buffer, within the alignment padding */
+typedef struct BufPoolBlock {
+	/* Start of the system allocation */
+	void *base;
+
+	/* Usable size (the size of the class) and the length of the mapping, 0 if malloc'ed */
+	size_t size;
+	size_t mapped;
+
+	int cls;
+
+	/* Next buffer in the free list */
+	struct BufPoolBlock *next;
+} BufPoolBlock;
+
+static SDL_SpinLock pool_lock;
+static BufPoolBlock *free_lists[BUFPOOL_CLASS_COUNT];
+static size_t cached_bytes, used_bytes, peak_bytes;
+static uint64_t allocs, reuses, releases;
+
+static inline BufPoolBlock *bufpool_block(void *p)
+{
+	return (BufPoolBlock*)((uint8_t*)p - BUFPOOL_ALIGNMENT);
+}
+
+/* Rounds a size up to its class and returns the index of the class */
+static int bufpool_class(size_t size, size_t *class_size)
+{
+	int k = 12;
+
+	if(size < BUFPOOL_MIN_CLASS) {
+		size = BUFPOOL_MIN_CLASS;
+	}
+
+	while(((size_t)1 << k) < size) {
+		k++;
+	}
+
+	/* 1.5 * 2^(k-1) if it's enough */
+	size_t half = (size_t)3 << (k - 2);
+
+	if(size <= half && half >= BUFPOOL_MIN_CLASS) {
+		*class_size = half;
+		return 2 * k - 1;
+	}
+
+	*class_size = (size_t)1 << k;
+	return 2 * k;
+}
+
+/* Gets a new buffer of a class from the system */
+static void *bufpool_system_alloc(size_t size, int cls)
+{
+	BufPoolBlock *b;
+	uint8_t *p;
+
+#ifdef __linux__
+	if(size >= BUFPOOL_HUGE_THRESHOLD) {
+		size_t length = (size + BUFPOOL_ALIGNMENT + BUFPOOL_HUGE_PAGE - 1) & ~(size_t)(BUFPOOL_HUGE_PAGE - 1);
+		void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if(base != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+			/* Only a hint, transparent huge pages may be disabled */
+			madvise(base, length, MADV_HUGEPAGE);
+#endif
+			p = (uint8_t*)base + BUFPOOL_ALIGNMENT;
+			b = bufpool_block(p);
+			b->base = base;
+			b->size = size;
+			b->mapped = length;
+			b->cls = cls;
+
+			return p;
+		}
+	}
+#endif
+
+	void *base = malloc(size + 2 * BUFPOOL_ALIGNMENT);
+	if(!base) return NULL;
+
+	p = (uint8_t*)(((uintptr_t)base + 2 * BUFPOOL_ALIGNMENT - 1) & ~(uintptr_t)(BUFPOOL_ALIGNMENT - 1));
+	b = bufpool_block(p);
+	b->base = base;
+	b->size = size;
+	b->mapped = 0;
+	b->cls = cls;
+
+	return p;
+}
+
+static void bufpool_system_free(BufPoolBlock *b)
+{
+#ifdef __linux__
+	if(b->mapped) {
+		munmap(b->base, b->mapped);
+		return;
+	}
+#endif
+
+	free(b->base);
+}
+
+void *bufpool_alloc(size_t size)
+{
+	size_t class_size;
+	int cls = bufpool_class(size, &class_size);
+	void *p = NULL;
+
+	SDL_AtomicLock(&pool_lock);
+
+	BufPoolBlock *b = free_lists[cls];
+	if(b) {
+		free_lists[cls] = b->next;
+		cached_bytes -= b->size;
+		reuses++;
+		p = (uint8_t*)b + BUFPOOL_ALIGNMENT;
+	}
+
+	allocs++;
+	used_bytes += class_size;
+	if(used_bytes > peak_bytes) peak_bytes = used_bytes;
+
+	SDL_AtomicUnlock(&pool_lock);
+
+	if(!p) {
+		p = bufpool_system_alloc(class_size, cls);
+
+		if(!p) {
+			SDL_AtomicLock(&pool_lock);
+			used_bytes -= class_size;
+			SDL_AtomicUnlock(&pool_lock);
+
+			return NULL;
+		}
+	}
+
+	memtrack_add(MEM_IMAGES, (int64_t)class_size);
+
+	return p;
+}
+
+void bufpool_free(void *p)
+{
+	if(!p) {
+		return;
+	}
+
+	BufPoolBlock *b = bufpool_block(p);
+
+	memtrack_add(MEM_IMAGES, -(int64_t)b->size);
+
+	SDL_AtomicLock(&pool_lock);
+
+	used_bytes -= b->size;
+
+	if(cached_bytes + b->size <= BUFPOOL_MAX_CACHED) {
+		b->next = free_lists[b->cls];
+		free_lists[b->cls] = b;
+		cached_bytes += b->size;
+		b = NULL;
+	}else {
+		releases++;
+	}
+
+	SDL_AtomicUnlock(&pool_lock);
+
+	if(b) {
+		bufpool_system_free(b);
+	}
+}
+
+int bufpool_stride(int w)
+{
+	int stride = (w * bytes_per_pixel + BUFPOOL_ALIGNMENT - 1) & ~(BUFPOOL_ALIGNMENT - 1);
+
+	/* Rows 4 KB apart map to the same cache sets, so column-wise passes would thrash */
+	if(stride % 4096 == 0) {
+		stride += BUFPOOL_ALIGNMENT;
+	}
+
+	return stride;
+}
+
+void *bufpool_alloc_bitmap(int w, int h, int *stride)
+{
+	if(w <= 0 || h <= 0) {
+		return NULL;
+	}
+
+	*stride = bufpool_stride(w);
+	return bufpool_alloc((size_t)*stride * h);
+}
+
+void bufpool_trim(void)
+{
+	int i;
+
+	SDL_AtomicLock(&pool_lock);
+
+	for(i=0; i<BUFPOOL_CLASS_COUNT; i++) {
+		BufPoolBlock *b = free_lists[i];
+		free_lists[i] = NULL;
+
+		while(b) {
+			BufPoolBlock *next = b->next;
+
+			releases++;
+			bufpool_system_free(b);
+			b = next;
+		}
+	}
+
+	cached_bytes = 0;
+
+	SDL_AtomicUnlock(&pool_lock);
+}
+
+void bufpool_print_stats(void)
+{
+	SDL_AtomicLock(&pool_lock);
+
+	printf("Buffer pool: %llu allocations, %llu reused (%.1f%%), %llu released, peak %.1f MB in use, %.1f MB cached\n",
+			(unsigned long long)allocs, (unsigned long long)reuses, allocs ? 100.0 * reuses / allocs : 0.0,
+			(unsigned long long)releases, peak_bytes / (1024.0 * 1024.0), cached_bytes / (1024.0 * 1024.0));
+
+	SDL_AtomicUnlock(&pool_lock);
+}
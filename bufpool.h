@@ -0,0 +1,49 @@
+/*
+ * bufpool.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef BUFPOOL_H_
+#define BUFPOOL_H_
+
+#include <stddef.h>
+#include "common.h"
+
+/* Alignment of the returned buffers and of the bitmap rows (a cache line, enough for any SIMD load) */
+#define BUFPOOL_ALIGNMENT	64
+
+/* Memory kept in the free lists; released buffers above it go back to the system */
+#define BUFPOOL_MAX_CACHED	(256 * 1024 * 1024)
+
+/* Buffers at least this large are mapped directly and backed by huge pages where possible (Linux) */
+#define BUFPOOL_HUGE_THRESHOLD	(32 * 1024 * 1024)
+
+/**
+ * Returns a buffer of at least `size` bytes aligned to BUFPOOL_ALIGNMENT, or NULL.
+ * Sizes are rounded up to size classes (powers of two and 1.5 times powers of two),
+ * so buffers released with bufpool_free() are reused by later loads and filter runs.
+ * The content is undefined. Thread safe.
+ */
+void *bufpool_alloc(size_t size);
+
+/* Returns a buffer to its free list (or to the system when the pool is full). NULL is ignored */
+void bufpool_free(void *p);
+
+/**
+ * Row size in bytes of a 32-bit bitmap `w` pixels wide: rounded up to BUFPOOL_ALIGNMENT,
+ * and padded by one more line when it is a multiple of 4 KB, so vertically adjacent
+ * pixels don't fall into the same cache set.
+ */
+int bufpool_stride(int w);
+
+/* Allocates a 32-bit bitmap with a padded stride, returned in *stride */
+void *bufpool_alloc_bitmap(int w, int h, int *stride);
+
+/* Releases all cached buffers */
+void bufpool_trim(void);
+
+void bufpool_print_stats(void);
+
+#endif /* BUFPOOL_H_ */
@@ -3,8 +3,41 @@ cd Release
 gcc -O3 -Wall -c -fmessage-length=0 -o filters.o "..\\filters.c" 
 gcc -O3 -Wall -c -fmessage-length=0 -o imgutils_bmp.o "..\\imgutils_bmp.c" 
 gcc -O3 -Wall -c -fmessage-length=0 -o imgutils_pgm.o "..\\imgutils_pgm.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o imgutils_qoi.o "..\\imgutils_qoi.c" 
 gcc -O3 -Wall -c -fmessage-length=0 -o histogram.o "..\\histogram.c" 
 gcc -O3 -Wall -c -fmessage-length=0 -o imgutils.o "..\\imgutils.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o threadpool.o "..\\threadpool.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o bufpool.o "..\\bufpool.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o gradient.o "..\\gradient.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o separable.o "..\\separable.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o canny.o "..\\canny.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o bilateral.o "..\\bilateral.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o resample.o "..\\resample.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o fft.o "..\\fft.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o match.o "..\\match.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o pyramid.o "..\\pyramid.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o tiletex.o "..\\tiletex.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o filterjob.o "..\\filterjob.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o filtercache.o "..\\filtercache.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o history.o "..\\history.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o batch.o "..\\batch.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o stream.o "..\\stream.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o filterd.o "..\\filterd.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o filterd_client.o "..\\filterd_client.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o trace.o "..\\trace.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o perfcnt.o "..\\perfcnt.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o memtrack.o "..\\memtrack.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o autotune.o "..\\autotune.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o kernels.o "..\\kernels.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o expr.o "..\\expr.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o hudfont.o "..\\hudfont.c" 
+gcc -O3 -Wall -c -fmessage-length=0 -o bench.o "..\\bench.c" 
 gcc -O3 -Wall -c -fmessage-length=0 -o main.o "..\\main.c" 
-gcc -o CourseWork_DIP.exe filters.o histogram.o imgutils.o imgutils_bmp.o imgutils_pgm.o main.o -lmingw32 -lSDL2main -lSDL2 
+gcc -o CourseWork_DIP.exe filters.o histogram.o imgutils.o imgutils_bmp.o imgutils_pgm.o imgutils_qoi.o threadpool.o bufpool.o gradient.o separable.o canny.o bilateral.o resample.o fft.o match.o pyramid.o tiletex.o filterjob.o filtercache.o history.o batch.o stream.o filterd.o filterd_client.o bench.o trace.o perfcnt.o memtrack.o autotune.o kernels.o expr.o hudfont.o main.o -lmingw32 -lSDL2main -lSDL2 
+
+# "build.sh bench" also measures the filters and checks them against the reference;
+# BENCH_BASELINE=<report.json> flags the cases which got slower
+if [ "$1" == "bench" ]; then
+	./CourseWork_DIP.exe --bench -o bench.json ${BENCH_BASELINE:+-c "$BENCH_BASELINE"}
+fi
 cd ..
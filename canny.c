@@ -0,0 +1,369 @@
+/*
+ * canny.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <string.h>
+#include <math.h>
+#include "canny.h"
+#include "gradient.h"
+#include "separable.h"
+#include "histogram.h"
+#include "filters.h"
+#include "threadpool.h"
+#include "memtrack.h"
+
+#define bytes_per_pixel 4
+
+/* Largest normalized Sobel magnitude of an 8-bit image: 255 * sqrt(2) */
+#define CANNY_MAX_MAGNITUDE	361.0f
+
+const CannyParams canny_default_params = {
+	.sigma = 1.4f,
+	.low_threshold = 0,
+	.high_threshold = 0,
+	.high_percentile = 0.8f,
+	.low_ratio = 0.4f,
+};
+
+typedef struct {
+	const uint8_t *src;
+	int stride;
+	int w, h;
+
+	/* Gray level, later reused for the suppressed magnitude */
+	float *plane;
+	float *mag;
+	uint8_t *dir;
+
+	/* Suppressed magnitude quantized for the histogram */
+	uint8_t *quantized;
+
+	/* Union-find forest of the edge candidates (-1 for non-candidates) */
+	int32_t *parent;
+	uint8_t *strong;
+
+	float low, high;
+
+	uint8_t *edges;
+	int edges_stride;
+
+	int band_h;
+} CannyJob;
+
+static void canny_luma_proc(void *arg, int band)
+{
+	CannyJob *job = arg;
+	int i, j;
+	int y1 = (band + 1) * job->band_h > job->h ? job->h : (band + 1) * job->band_h;
+	const float third = 1.0f / 3;
+
+	for(j=band * job->band_h; j<y1; j++) {
+		const uint8_t *p = job->src + (size_t)j * job->stride;
+		float *out = job->plane + (size_t)j * job->w;
+
+		for(i=0; i<job->w; i++, p += bytes_per_pixel) {
+			out[i] = (float)(p[1] + p[2] + p[3]) * third;
+		}
+	}
+}
+
+/* Keeps only the pixels which are local maxima along the gradient direction */
+static void canny_nms_proc(void *arg, int band)
+{
+	CannyJob *job = arg;
+	int i, j;
+	const int w = job->w, h = job->h;
+	int y1 = (band + 1) * job->band_h > h ? h : (band + 1) * job->band_h;
+	const float q_scale = 255.0f / CANNY_MAX_MAGNITUDE;
+
+	/* Offsets of the two neighbours along the gradient for each direction sector */
+	const int dx[4] = {1, 1, 0, 1};
+	const int dy[4] = {0, 1, 1, -1};
+
+	for(j=band * job->band_h; j<y1; j++) {
+		const float *m = job->mag + (size_t)j * w;
+		const uint8_t *d = job->dir + (size_t)j * w;
+		float *out = job->plane + (size_t)j * w;
+		uint8_t *q = job->quantized + (size_t)j * w;
+
+		for(i=0; i<w; i++) {
+			float v = m[i];
+
+			/* Border pixels are never edges */
+			if(i == 0 || j == 0 || i == w - 1 || j == h - 1 || v == 0) {
+				out[i] = 0;
+				q[i] = 0;
+				continue;
+			}
+
+			int s = d[i];
+			float n1 = m[i + dx[s] + dy[s] * w];
+			float n2 = m[i - dx[s] - dy[s] * w];
+
+			/* Strict comparison on one side so plateaus keep one pixel */
+			if(v > n1 && v >= n2) {
+				float t = v * q_scale;
+				out[i] = v;
+				q[i] = t > 255 ? 255 : (uint8_t)t;
+			}else {
+				out[i] = 0;
+				q[i] = 0;
+			}
+		}
+	}
+}
+
+static inline int32_t canny_find(int32_t *parent, int32_t x)
+{
+	while(parent[x] != x) {
+		/* Path halving */
+		parent[x] = parent[parent[x]];
+		x = parent[x];
+	}
+
+	return x;
+}
+
+static inline void canny_union(CannyJob *job, int32_t a, int32_t b)
+{
+	a = canny_find(job->parent, a);
+	b = canny_find(job->parent, b);
+
+	if(a == b) return;
+
+	/* The root with the lower index wins, so the forest doesn't depend on the order of the unions */
+	if(a < b) {
+		int32_t t = a;
+		a = b;
+		b = t;
+	}
+
+	job->parent[a] = b;
+	job->strong[b] |= job->strong[a];
+}
+
+/* Links the candidate at (i, j) with the candidates on the previous row */
+static inline void canny_link_previous_row(CannyJob *job, int i, int j)
+{
+	const int w = job->w;
+	int32_t p = j * w + i;
+
+	if(job->parent[p - w] >= 0) canny_union(job, p, p - w);
+	if(i > 0 && job->parent[p - w - 1] >= 0) canny_union(job, p, p - w - 1);
+	if(i < w - 1 && job->parent[p - w + 1] >= 0) canny_union(job, p, p - w + 1);
+}
+
+/* Labels the connected candidates inside one band. Only pixels of the band are touched */
+static void canny_label_proc(void *arg, int band)
+{
+	CannyJob *job = arg;
+	int i, j;
+	const int w = job->w;
+	int y0 = band * job->band_h;
+	int y1 = y0 + job->band_h > job->h ? job->h : y0 + job->band_h;
+
+	for(j=y0; j<y1; j++) {
+		for(i=0; i<w; i++) {
+			int32_t p = j * w + i;
+			float v = job->plane[p];
+
+			if(v < job->low || v == 0) {
+				job->parent[p] = -1;
+				continue;
+			}
+
+			job->parent[p] = p;
+			job->strong[p] = v >= job->high;
+
+			if(i > 0 && job->parent[p - 1] >= 0) {
+				canny_union(job, p, p - 1);
+			}
+
+			if(j > y0) {
+				canny_link_previous_row(job, i, j);
+			}
+		}
+	}
+}
+
+/* Marks the candidates connected to a strong edge */
+static void canny_output_proc(void *arg, int band)
+{
+	CannyJob *job = arg;
+	int i, j;
+	const int w = job->w;
+	int y1 = (band + 1) * job->band_h > job->h ? job->h : (band + 1) * job->band_h;
+
+	for(j=band * job->band_h; j<y1; j++) {
+		uint8_t *out = job->edges + (size_t)j * job->edges_stride;
+
+		for(i=0; i<w; i++) {
+			int32_t x = job->parent[j * w + i];
+
+			if(x < 0) {
+				out[i] = 0;
+				continue;
+			}
+
+			/* Read-only walk to the root, other threads may be walking the same path */
+			while(job->parent[x] != x) {
+				x = job->parent[x];
+			}
+
+			out[i] = job->strong[x] ? 255 : 0;
+		}
+	}
+}
+
+static RETCODE canny_thresholds(CannyJob *job, const CannyParams *params)
+{
+	Histogram hist;
+
+	if(params->high_threshold > 0) {
+		job->high = params->high_threshold;
+		job->low = params->low_threshold;
+		return RC_OK;
+	}
+
+	histogram_extract_plane(job->quantized, job->w, job->w, job->h, &hist);
+
+	/* Suppressed pixels aren't edge candidates */
+	hist.values[0] = 0;
+
+	int32_t bin = histogram_percentile(&hist, params->high_percentile);
+	job->high = (bin + 1) * CANNY_MAX_MAGNITUDE / 255;
+	job->low = job->high * params->low_ratio;
+
+	return RC_OK;
+}
+
+RETCODE canny_detect(void *src, int stride, int w, int h, const CannyParams *params, uint8_t *edges, int edges_stride)
+{
+	RETCODE rc = RC_OK;
+	int b;
+
+	if(!src || !edges || w < 3 || h < 3) {
+		return RC_INVALIDARG;
+	}
+
+	if(!params) {
+		params = &canny_default_params;
+	}
+
+	size_t count = (size_t)w * h;
+	if(count > INT32_MAX) {
+		return RC_INVALIDARG;
+	}
+
+	CannyJob job = {
+		.src = src,
+		.stride = stride,
+		.w = w,
+		.h = h,
+		.edges = edges,
+		.edges_stride = edges_stride,
+	};
+
+	float *blurred = memtrack_malloc(MEM_FILTER, count * sizeof(float));
+	job.plane = memtrack_malloc(MEM_FILTER, count * sizeof(float));
+	job.mag = memtrack_malloc(MEM_FILTER, count * sizeof(float));
+	job.dir = memtrack_malloc(MEM_FILTER, count);
+	job.quantized = memtrack_malloc(MEM_FILTER, count);
+	job.parent = memtrack_malloc(MEM_FILTER, count * sizeof(int32_t));
+	job.strong = memtrack_malloc(MEM_FILTER, count);
+
+	if(!blurred || !job.plane || !job.mag || !job.dir || !job.quantized || !job.parent || !job.strong) {
+		rc = RC_OUTOFMEM;
+		goto cleanup;
+	}
+
+	int bands = threadpool_split_rows(h, &job.band_h);
+
+	/* Stage 1: gray level and Gaussian smoothing */
+	threadpool_parallel_for(bands, canny_luma_proc, &job);
+
+	if(params->sigma > 0) {
+		rc = separable_gaussian_blur(job.plane, blurred, w, w, h, params->sigma, EDGE_CLAMP);
+		if(failed(rc)) goto cleanup;
+	}else {
+		memcpy(blurred, job.plane, count * sizeof(float));
+	}
+
+	/* Stage 2: Sobel gradients with quantized directions */
+	GradientParams gp = {
+		.op = GRADIENT_SOBEL,
+		.mag_format = GRADIENT_FMT_F32,
+		.orient_format = GRADIENT_FMT_U8,
+		.fast_magnitude = 0,
+		.scale = 0,
+	};
+
+	rc = gradient_compute_plane(blurred, w * sizeof(float), w, h, &gp, job.mag, w * sizeof(float), job.dir, w);
+	if(failed(rc)) goto cleanup;
+
+	/* Stage 3: non-maximum suppression */
+	threadpool_parallel_for(bands, canny_nms_proc, &job);
+
+	/* Stage 4: hysteresis. Label each band on its own, stitch the bands and mark the edges */
+	canny_thresholds(&job, params);
+	threadpool_parallel_for(bands, canny_label_proc, &job);
+
+	for(b=1; b<bands; b++) {
+		int i, j = b * job.band_h;
+
+		for(i=0; i<w; i++) {
+			if(job.parent[j * w + i] >= 0) {
+				canny_link_previous_row(&job, i, j);
+			}
+		}
+	}
+
+	threadpool_parallel_for(bands, canny_output_proc, &job);
+
+cleanup:
+	memtrack_free(blurred);
+	memtrack_free(job.plane);
+	memtrack_free(job.mag);
+	memtrack_free(job.dir);
+	memtrack_free(job.quantized);
+	memtrack_free(job.parent);
+	memtrack_free(job.strong);
+
+	return rc;
+}
+
+RETCODE canny_apply(void *src, void *dst, int stride, int w, int h)
+{
+	int i, j;
+	RETCODE rc;
+
+	uint8_t *edges = memtrack_malloc(MEM_FILTER, (size_t)w * h);
+	if(!edges) {
+		return RC_OUTOFMEM;
+	}
+
+	rc = canny_detect(src, stride, w, h, NULL, edges, w);
+
+	if(succeeded(rc)) {
+		for(j=0; j<h; j++) {
+			uint8_t *d = (uint8_t*)dst + (size_t)j * stride;
+			const uint8_t *e = edges + (size_t)j * w;
+
+			for(i=0; i<w; i++, d += bytes_per_pixel) {
+				d[1] = d[2] = d[3] = e[i];
+			}
+		}
+	}
+
+	memtrack_free(edges);
+	return rc;
+}
+
+FilterOp canny_op = {
+	.name = "canny",
+	.apply = canny_apply,
+};
@@ -0,0 +1,46 @@
+/*
+ * canny.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef CANNY_H_
+#define CANNY_H_
+
+#include <stdint.h>
+#include "common.h"
+
+typedef struct {
+	/* Standard deviation of the Gaussian smoothing, 0 disables it */
+	float sigma;
+
+	/**
+	 * Hysteresis thresholds on the gradient magnitude (0..360 for 8-bit input).
+	 * When high_threshold is 0 both thresholds are derived from the histogram
+	 * of the suppressed gradient magnitude.
+	 */
+	float low_threshold;
+	float high_threshold;
+
+	/* Automatic thresholds: percentile of the edge candidates which are not strong edges */
+	float high_percentile;
+
+	/* Automatic thresholds: low threshold as a fraction of the high threshold */
+	float low_ratio;
+} CannyParams;
+
+/* Parameters used when NULL is passed to canny_detect() */
+extern const CannyParams canny_default_params;
+
+/**
+ * Detects edges on a 32-bit bitmap using the Canny algorithm: Gaussian smoothing,
+ * Sobel gradients, non-maximum suppression and hysteresis thresholding.
+ * The output is an 8-bit plane where edge pixels are 255 and the rest are 0.
+ */
+RETCODE canny_detect(void *src, int stride, int w, int h, const CannyParams *params, uint8_t *edges, int edges_stride);
+
+/* Writes the Canny edge map of src as a 32-bit bitmap, using the default parameters */
+RETCODE canny_apply(void *src, void *dst, int stride, int w, int h);
+
+#endif /* CANNY_H_ */
@@ -0,0 +1,832 @@
+/*
+ * expr.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <SDL2/SDL.h>
+#include "expr.h"
+#include "threadpool.h"
+#include "memtrack.h"
+#include "trace.h"
+
+#define bytes_per_pixel 4
+
+/* Colour components of a pixel (bytes 1..3, the alpha one isn't computed) */
+#define EXPR_COMPONENTS 3
+
+/* A register holds the EXPR_LANES values of each component one after the other */
+#define EXPR_VALUES (EXPR_LANES * EXPR_COMPONENTS)
+
+/* Pixels are loaded and stored as words, this is where byte `i` of a pixel is in one */
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+#define EXPR_BYTE_SHIFT(i) ((i) * 8)
+#else
+#define EXPR_BYTE_SHIFT(i) (24 - (i) * 8)
+#endif
+
+typedef enum {
+	/* dst = component of input `a` at (dx, dy) */
+	EXPR_OP_LOAD = 0,
+	EXPR_OP_X,
+	EXPR_OP_Y,
+
+	/* Unary */
+	EXPR_OP_NEG,
+	EXPR_OP_NOT,
+	EXPR_OP_ABS,
+	EXPR_OP_SQRT,
+	EXPR_OP_FLOOR,
+
+	/* Binary */
+	EXPR_OP_ADD,
+	EXPR_OP_SUB,
+	EXPR_OP_MUL,
+	EXPR_OP_DIV,
+	EXPR_OP_MIN,
+	EXPR_OP_MAX,
+	EXPR_OP_POW,
+	EXPR_OP_LT,
+	EXPR_OP_LE,
+	EXPR_OP_GT,
+	EXPR_OP_GE,
+	EXPR_OP_EQ,
+	EXPR_OP_NE,
+	EXPR_OP_AND,
+	EXPR_OP_OR,
+
+	/* Ternary */
+	EXPR_OP_SEL,
+	EXPR_OP_CLAMP,
+	EXPR_OP_MIX,
+} ExprOp;
+
+typedef struct {
+	uint8_t op;
+	uint8_t dst, a, b, c;
+
+	/* Operands of EXPR_OP_LOAD; channel is the byte in the pixel, 0 for the component being computed */
+	int8_t dx, dy;
+	uint8_t channel;
+} ExprInsn;
+
+typedef enum {
+	EXPR_CONST_VALUE = 0,
+	EXPR_CONST_WIDTH,
+	EXPR_CONST_HEIGHT,
+} ExprConstKind;
+
+/* Register filled before the code runs */
+typedef struct {
+	uint8_t reg;
+	uint8_t kind;
+	float value;
+} ExprConst;
+
+struct ExprProgram {
+	ExprInsn code[EXPR_MAX_CODE];
+	int code_count;
+
+	ExprConst consts[EXPR_MAX_REGS];
+	int const_count;
+
+	int result;
+
+	int input_count;
+};
+
+typedef enum {
+	EXPR_REG_FREE = 0,
+	EXPR_REG_TEMP,
+	EXPR_REG_CONST,
+} ExprRegState;
+
+typedef struct {
+	const char *source;
+	const char *p;
+	ExprProgram *prog;
+
+	uint8_t regs[EXPR_MAX_REGS];
+	int temp_top, const_bottom;
+	int failed;
+} ExprParser;
+
+typedef struct {
+	const char *name;
+	ExprOp op;
+	int args;
+} ExprFunction;
+
+static const ExprFunction expr_functions[] = {
+	{"min", EXPR_OP_MIN, 2},
+	{"max", EXPR_OP_MAX, 2},
+	{"pow", EXPR_OP_POW, 2},
+	{"abs", EXPR_OP_ABS, 1},
+	{"sqrt", EXPR_OP_SQRT, 1},
+	{"floor", EXPR_OP_FLOOR, 1},
+	{"mix", EXPR_OP_MIX, 3},
+	{"clamp", EXPR_OP_CLAMP, 3},
+};
+
+/* Rows of the destination split across the thread pool */
+typedef struct {
+	const ExprProgram *prog;
+	const ExprInput *inputs;
+	uint8_t *dst;
+	int stride, w, h;
+	int band_h;
+} ExprBands;
+
+static int expr_operand_count(ExprOp op)
+{
+	if(op <= EXPR_OP_Y) return 0;
+	if(op <= EXPR_OP_FLOOR) return 1;
+	if(op <= EXPR_OP_OR) return 2;
+
+	return 3;
+}
+
+/* One lane of an instruction, used to fold the operations on constants */
+static float expr_scalar(ExprOp op, float a, float b, float c)
+{
+	switch(op) {
+	case EXPR_OP_NEG:	return -a;
+	case EXPR_OP_NOT:	return a == 0;
+	case EXPR_OP_ABS:	return fabsf(a);
+	case EXPR_OP_SQRT:	return sqrtf(a);
+	case EXPR_OP_FLOOR:	return floorf(a);
+	case EXPR_OP_ADD:	return a + b;
+	case EXPR_OP_SUB:	return a - b;
+	case EXPR_OP_MUL:	return a * b;
+	case EXPR_OP_DIV:	return a / b;
+	case EXPR_OP_MIN:	return a < b ? a : b;
+	case EXPR_OP_MAX:	return a > b ? a : b;
+	case EXPR_OP_POW:	return powf(a, b);
+	case EXPR_OP_LT:	return a < b;
+	case EXPR_OP_LE:	return a <= b;
+	case EXPR_OP_GT:	return a > b;
+	case EXPR_OP_GE:	return a >= b;
+	case EXPR_OP_EQ:	return a == b;
+	case EXPR_OP_NE:	return a != b;
+	case EXPR_OP_AND:	return (a != 0) & (b != 0);
+	case EXPR_OP_OR:	return (a != 0) | (b != 0);
+	case EXPR_OP_SEL:	return a != 0 ? b : c;
+	case EXPR_OP_CLAMP:	a = a > c ? c : a; return a < b ? b : a;
+	case EXPR_OP_MIX:	return a + (b - a) * c;
+	default:			return 0;
+	}
+}
+
+static int expr_error(ExprParser *ps, const char *message)
+{
+	if(!ps->failed) {
+		fprintf(stderr, "%s\n%*s^ %s\n", ps->source, (int)(ps->p - ps->source), "", message);
+		ps->failed = 1;
+	}
+
+	return -1;
+}
+
+/**
+ * Temporaries are taken from the bottom of the register file and reused once their
+ * value is consumed. Constants are filled only before the code runs, so they are taken
+ * from the top, above every register an instruction writes.
+ */
+static int expr_alloc(ExprParser *ps, ExprRegState state)
+{
+	int i;
+
+	if(state == EXPR_REG_CONST) {
+		if(ps->const_bottom <= ps->temp_top) {
+			return expr_error(ps, "the expression is too complex");
+		}
+
+		ps->regs[--ps->const_bottom] = EXPR_REG_CONST;
+		return ps->const_bottom;
+	}
+
+	for(i=0; i<ps->const_bottom; i++) {
+		if(ps->regs[i] != EXPR_REG_FREE) continue;
+
+		ps->regs[i] = state;
+		if(i >= ps->temp_top) ps->temp_top = i + 1;
+
+		return i;
+	}
+
+	return expr_error(ps, "the expression is too complex");
+}
+
+static void expr_release(ExprParser *ps, int reg)
+{
+	if(reg >= 0 && ps->regs[reg] == EXPR_REG_TEMP) {
+		ps->regs[reg] = EXPR_REG_FREE;
+	}
+}
+
+/* Register holding a constant, shared by the equal ones */
+static int expr_const(ExprParser *ps, ExprConstKind kind, float value)
+{
+	ExprProgram *prog = ps->prog;
+	int i;
+
+	for(i=0; i<prog->const_count; i++) {
+		if(prog->consts[i].kind == kind && (kind != EXPR_CONST_VALUE || prog->consts[i].value == value)) {
+			return prog->consts[i].reg;
+		}
+	}
+
+	int reg = expr_alloc(ps, EXPR_REG_CONST);
+	if(reg < 0) return -1;
+
+	prog->consts[prog->const_count].reg = reg;
+	prog->consts[prog->const_count].kind = kind;
+	prog->consts[prog->const_count].value = value;
+	prog->const_count++;
+
+	return reg;
+}
+
+static int expr_const_value(ExprParser *ps, int reg, float *out)
+{
+	int i;
+
+	for(i=0; i<ps->prog->const_count; i++) {
+		if(ps->prog->consts[i].reg == reg) {
+			*out = ps->prog->consts[i].value;
+			return ps->prog->consts[i].kind == EXPR_CONST_VALUE;
+		}
+	}
+
+	return 0;
+}
+
+/* Appends an instruction; operations on constants are computed here instead */
+static int expr_emit(ExprParser *ps, ExprOp op, int a, int b, int c)
+{
+	const int count = expr_operand_count(op);
+	float va = 0, vb = 0, vc = 0;
+
+	if(ps->failed || (count > 0 && a < 0) || (count > 1 && b < 0) || (count > 2 && c < 0)) {
+		return -1;
+	}
+
+	if(count > 0 && expr_const_value(ps, a, &va) && (count < 2 || expr_const_value(ps, b, &vb)) &&
+			(count < 3 || expr_const_value(ps, c, &vc))) {
+		return expr_const(ps, EXPR_CONST_VALUE, expr_scalar(op, va, vb, vc));
+	}
+
+	if(ps->prog->code_count == EXPR_MAX_CODE) {
+		return expr_error(ps, "the expression is too long");
+	}
+
+	/* Taken while the operands are held, so the result never overlaps them (see expr_exec()) */
+	int dst = expr_alloc(ps, EXPR_REG_TEMP);
+	if(dst < 0) return -1;
+
+	if(count > 0) expr_release(ps, a);
+	if(count > 1) expr_release(ps, b);
+	if(count > 2) expr_release(ps, c);
+
+	ExprInsn *insn = &ps->prog->code[ps->prog->code_count++];
+	memset(insn, 0, sizeof(ExprInsn));
+	insn->op = op;
+	insn->dst = dst;
+	insn->a = count > 0 ? a : 0;
+	insn->b = count > 1 ? b : 0;
+	insn->c = count > 2 ? c : 0;
+
+	return dst;
+}
+
+static void expr_skip(ExprParser *ps)
+{
+	while(isspace((unsigned char)*ps->p)) ps->p++;
+}
+
+static int expr_accept(ExprParser *ps, const char *token)
+{
+	size_t len = strlen(token);
+
+	expr_skip(ps);
+
+	if(strncmp(ps->p, token, len) != 0) {
+		return 0;
+	}
+
+	ps->p += len;
+	return 1;
+}
+
+static int expr_expect(ExprParser *ps, const char *token)
+{
+	char message[32];
+
+	if(expr_accept(ps, token)) {
+		return 1;
+	}
+
+	snprintf(message, sizeof(message), "expected '%s'", token);
+	expr_error(ps, message);
+	return 0;
+}
+
+static int expr_parse_cond(ExprParser *ps);
+
+/* Offset of a neighbour, a constant integer */
+static int expr_parse_offset(ExprParser *ps, int8_t *out)
+{
+	char *end;
+
+	expr_skip(ps);
+
+	long v = strtol(ps->p, &end, 10);
+	if(end == ps->p) {
+		expr_error(ps, "expected an integer offset");
+		return 0;
+	}
+
+	if(v < -EXPR_MAX_RADIUS || v > EXPR_MAX_RADIUS) {
+		expr_error(ps, "the offset is too large");
+		return 0;
+	}
+
+	ps->p = end;
+	*out = (int8_t)v;
+
+	return 1;
+}
+
+/* a, a(dx, dy), a.r or a(dx, dy).r */
+static int expr_parse_input(ExprParser *ps, int input)
+{
+	ExprInsn load;
+
+	memset(&load, 0, sizeof(load));
+	load.op = EXPR_OP_LOAD;
+	load.a = input;
+
+	if(expr_accept(ps, "(")) {
+		if(!expr_parse_offset(ps, &load.dx) || !expr_expect(ps, ",") || !expr_parse_offset(ps, &load.dy) || !expr_expect(ps, ")")) {
+			return -1;
+		}
+	}
+
+	if(expr_accept(ps, ".")) {
+		expr_skip(ps);
+
+		/* Bytes of the components in an RGBA8888 pixel */
+		switch(*ps->p) {
+		case 'r': load.channel = 3; break;
+		case 'g': load.channel = 2; break;
+		case 'b': load.channel = 1; break;
+		default: return expr_error(ps, "expected r, g or b");
+		}
+
+		ps->p++;
+	}
+
+	if(ps->prog->code_count == EXPR_MAX_CODE) {
+		return expr_error(ps, "the expression is too long");
+	}
+
+	int dst = expr_alloc(ps, EXPR_REG_TEMP);
+	if(dst < 0) return -1;
+
+	load.dst = dst;
+	ps->prog->code[ps->prog->code_count++] = load;
+
+	if(input + 1 > ps->prog->input_count) ps->prog->input_count = input + 1;
+
+	return dst;
+}
+
+static int expr_parse_call(ExprParser *ps, const char *start, int len)
+{
+	int args[3] = {-1, -1, -1};
+	int i, count = 0;
+
+	for(i=0; i<(int)(sizeof(expr_functions) / sizeof(expr_functions[0])); i++) {
+		if((int)strlen(expr_functions[i].name) == len && strncmp(expr_functions[i].name, start, len) == 0) break;
+	}
+
+	if(i == sizeof(expr_functions) / sizeof(expr_functions[0])) {
+		ps->p = start;
+		return expr_error(ps, "unknown name");
+	}
+
+	const ExprFunction *f = &expr_functions[i];
+
+	if(!expr_expect(ps, "(")) return -1;
+
+	do {
+		if(count == 3) {
+			return expr_error(ps, "too many arguments");
+		}
+
+		args[count++] = expr_parse_cond(ps);
+		if(args[count - 1] < 0) return -1;
+	}while(expr_accept(ps, ","));
+
+	if(!expr_expect(ps, ")")) return -1;
+
+	/* clamp(v) clamps to the range of a component */
+	if(f->op == EXPR_OP_CLAMP && count == 1) {
+		args[1] = expr_const(ps, EXPR_CONST_VALUE, 0);
+		args[2] = expr_const(ps, EXPR_CONST_VALUE, 255);
+		count = 3;
+	}
+
+	if(count != f->args) {
+		return expr_error(ps, "wrong number of arguments");
+	}
+
+	return expr_emit(ps, f->op, args[0], args[1], args[2]);
+}
+
+static int expr_parse_primary(ExprParser *ps)
+{
+	expr_skip(ps);
+
+	const char *start = ps->p;
+
+	if(isdigit((unsigned char)*ps->p) || *ps->p == '.') {
+		char *end;
+		float v = strtof(ps->p, &end);
+
+		if(end == ps->p) {
+			return expr_error(ps, "expected a number");
+		}
+
+		ps->p = end;
+		return expr_const(ps, EXPR_CONST_VALUE, v);
+	}
+
+	if(expr_accept(ps, "(")) {
+		int reg = expr_parse_cond(ps);
+
+		if(reg < 0 || !expr_expect(ps, ")")) return -1;
+		return reg;
+	}
+
+	if(!isalpha((unsigned char)*ps->p)) {
+		return expr_error(ps, *ps->p ? "unexpected character" : "unexpected end of the expression");
+	}
+
+	while(isalnum((unsigned char)*ps->p) || *ps->p == '_') ps->p++;
+
+	int len = (int)(ps->p - start);
+
+	if(len == 1) {
+		switch(*start) {
+		case 'a': case 'b': case 'c': case 'd':
+			return expr_parse_input(ps, *start - 'a');
+		case 'x':
+			return expr_emit(ps, EXPR_OP_X, -1, -1, -1);
+		case 'y':
+			return expr_emit(ps, EXPR_OP_Y, -1, -1, -1);
+		case 'w':
+			return expr_const(ps, EXPR_CONST_WIDTH, 0);
+		case 'h':
+			return expr_const(ps, EXPR_CONST_HEIGHT, 0);
+		}
+	}
+
+	return expr_parse_call(ps, start, len);
+}
+
+static int expr_parse_unary(ExprParser *ps)
+{
+	expr_skip(ps);
+
+	if(*ps->p == '!' && ps->p[1] != '=') {
+		ps->p++;
+		return expr_emit(ps, EXPR_OP_NOT, expr_parse_unary(ps), -1, -1);
+	}
+
+	if(expr_accept(ps, "-")) {
+		return expr_emit(ps, EXPR_OP_NEG, expr_parse_unary(ps), -1, -1);
+	}
+
+	if(expr_accept(ps, "+")) {
+		return expr_parse_unary(ps);
+	}
+
+	return expr_parse_primary(ps);
+}
+
+static int expr_parse_mul(ExprParser *ps)
+{
+	int reg = expr_parse_unary(ps);
+
+	while(reg >= 0) {
+		if(expr_accept(ps, "*")) {
+			reg = expr_emit(ps, EXPR_OP_MUL, reg, expr_parse_unary(ps), -1);
+		}else if(expr_accept(ps, "/")) {
+			reg = expr_emit(ps, EXPR_OP_DIV, reg, expr_parse_unary(ps), -1);
+		}else {
+			break;
+		}
+	}
+
+	return reg;
+}
+
+static int expr_parse_add(ExprParser *ps)
+{
+	int reg = expr_parse_mul(ps);
+
+	while(reg >= 0) {
+		if(expr_accept(ps, "+")) {
+			reg = expr_emit(ps, EXPR_OP_ADD, reg, expr_parse_mul(ps), -1);
+		}else if(expr_accept(ps, "-")) {
+			reg = expr_emit(ps, EXPR_OP_SUB, reg, expr_parse_mul(ps), -1);
+		}else {
+			break;
+		}
+	}
+
+	return reg;
+}
+
+static int expr_parse_cmp(ExprParser *ps)
+{
+	/* The two character operators are tried first */
+	static const struct {
+		const char *token;
+		ExprOp op;
+	} ops[] = {{"<=", EXPR_OP_LE}, {">=", EXPR_OP_GE}, {"==", EXPR_OP_EQ}, {"!=", EXPR_OP_NE}, {"<", EXPR_OP_LT}, {">", EXPR_OP_GT}};
+	int i;
+
+	int reg = expr_parse_add(ps);
+	if(reg < 0) return -1;
+
+	for(i=0; i<(int)(sizeof(ops) / sizeof(ops[0])); i++) {
+		if(expr_accept(ps, ops[i].token)) {
+			return expr_emit(ps, ops[i].op, reg, expr_parse_add(ps), -1);
+		}
+	}
+
+	return reg;
+}
+
+static int expr_parse_and(ExprParser *ps)
+{
+	int reg = expr_parse_cmp(ps);
+
+	while(reg >= 0 && expr_accept(ps, "&&")) {
+		reg = expr_emit(ps, EXPR_OP_AND, reg, expr_parse_cmp(ps), -1);
+	}
+
+	return reg;
+}
+
+static int expr_parse_or(ExprParser *ps)
+{
+	int reg = expr_parse_and(ps);
+
+	while(reg >= 0 && expr_accept(ps, "||")) {
+		reg = expr_emit(ps, EXPR_OP_OR, reg, expr_parse_and(ps), -1);
+	}
+
+	return reg;
+}
+
+/* Both branches are computed and selected per lane */
+static int expr_parse_cond(ExprParser *ps)
+{
+	int cond = expr_parse_or(ps);
+
+	if(cond < 0 || !expr_accept(ps, "?")) {
+		return cond;
+	}
+
+	int t = expr_parse_cond(ps);
+	if(t < 0 || !expr_expect(ps, ":")) return -1;
+
+	return expr_emit(ps, EXPR_OP_SEL, cond, t, expr_parse_cond(ps));
+}
+
+RETCODE expr_compile(const char *source, ExprProgram **out)
+{
+	ExprParser ps;
+
+	ExprProgram *prog = memtrack_calloc(MEM_FILTER, 1, sizeof(ExprProgram));
+	if(!prog) return RC_OUTOFMEM;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.source = source;
+	ps.p = source;
+	ps.prog = prog;
+	ps.const_bottom = EXPR_MAX_REGS;
+
+	prog->result = expr_parse_cond(&ps);
+
+	expr_skip(&ps);
+	if(prog->result >= 0 && *ps.p) {
+		expr_error(&ps, "unexpected character");
+	}
+
+	if(ps.failed) {
+		memtrack_free(prog);
+		return RC_INVALIDDATA;
+	}
+
+	*out = prog;
+	return RC_OK;
+}
+
+void expr_free(ExprProgram *prog)
+{
+	memtrack_free(prog);
+}
+
+int expr_input_count(const ExprProgram *prog)
+{
+	return prog->input_count;
+}
+
+static inline int expr_wrap(int v, int n)
+{
+	return v >= 0 && v < n ? v : (v % n + n) % n;
+}
+
+/**
+ * Components of `n` pixels from x0 on, every component gets its own byte or all of them
+ * `channel`. The pixels past the n-th repeat it.
+ */
+static void expr_load(float *d, const ExprInput *in, const ExprInsn *insn, int x0, int n, int y, int w, int h)
+{
+	const uint8_t *line = in->pixels + (size_t)expr_wrap(y + insn->dy, h) * in->stride;
+	const int x = x0 + insn->dx;
+	int i, k;
+
+	if(n == EXPR_LANES && x >= 0 && x + EXPR_LANES <= w) {
+		const uint32_t *px = (const uint32_t*)line + x;
+
+		if(!insn->channel) {
+			for(i=0; i<EXPR_LANES; i++) {
+				d[i] = (float)((px[i] >> EXPR_BYTE_SHIFT(1)) & 0xff);
+				d[EXPR_LANES + i] = (float)((px[i] >> EXPR_BYTE_SHIFT(2)) & 0xff);
+				d[2 * EXPR_LANES + i] = (float)((px[i] >> EXPR_BYTE_SHIFT(3)) & 0xff);
+			}
+		}else {
+			const int shift = EXPR_BYTE_SHIFT(insn->channel);
+
+			for(i=0; i<EXPR_LANES; i++) {
+				d[i] = d[EXPR_LANES + i] = d[2 * EXPR_LANES + i] = (float)((px[i] >> shift) & 0xff);
+			}
+		}
+
+		return;
+	}
+
+	for(i=0; i<EXPR_LANES; i++) {
+		const uint8_t *p = line + expr_wrap(x + (i < n ? i : n - 1), w) * bytes_per_pixel;
+
+		for(k=0; k<EXPR_COMPONENTS; k++) {
+			d[k * EXPR_LANES + i] = p[insn->channel ? insn->channel : k + 1];
+		}
+	}
+}
+
+/**
+ * One instruction other than a load. expr_emit() never gives the result a register the
+ * instruction reads, so the fixed-length loops over the values don't have to expect
+ * overlaps and the compiler turns them into vector instructions.
+ */
+static inline void expr_exec(ExprOp op, float *restrict d, const float *restrict a, const float *restrict s, const float *restrict c, int x0, int y)
+{
+	int l;
+
+	switch(op) {
+	case EXPR_OP_X:		for(l=0; l<EXPR_VALUES; l++) d[l] = (float)(x0 + l % EXPR_LANES); break;
+	case EXPR_OP_Y:		for(l=0; l<EXPR_VALUES; l++) d[l] = (float)y; break;
+	case EXPR_OP_NEG:	for(l=0; l<EXPR_VALUES; l++) d[l] = -a[l]; break;
+	case EXPR_OP_NOT:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] == 0; break;
+	case EXPR_OP_ABS:	for(l=0; l<EXPR_VALUES; l++) d[l] = fabsf(a[l]); break;
+	case EXPR_OP_SQRT:	for(l=0; l<EXPR_VALUES; l++) d[l] = sqrtf(a[l]); break;
+	case EXPR_OP_FLOOR:	for(l=0; l<EXPR_VALUES; l++) d[l] = floorf(a[l]); break;
+	case EXPR_OP_ADD:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] + s[l]; break;
+	case EXPR_OP_SUB:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] - s[l]; break;
+	case EXPR_OP_MUL:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] * s[l]; break;
+	case EXPR_OP_DIV:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] / s[l]; break;
+	case EXPR_OP_MIN:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] < s[l] ? a[l] : s[l]; break;
+	case EXPR_OP_MAX:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] > s[l] ? a[l] : s[l]; break;
+	case EXPR_OP_POW:	for(l=0; l<EXPR_VALUES; l++) d[l] = powf(a[l], s[l]); break;
+	case EXPR_OP_LT:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] < s[l]; break;
+	case EXPR_OP_LE:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] <= s[l]; break;
+	case EXPR_OP_GT:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] > s[l]; break;
+	case EXPR_OP_GE:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] >= s[l]; break;
+	case EXPR_OP_EQ:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] == s[l]; break;
+	case EXPR_OP_NE:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] != s[l]; break;
+	case EXPR_OP_AND:	for(l=0; l<EXPR_VALUES; l++) d[l] = (a[l] != 0) & (s[l] != 0); break;
+	case EXPR_OP_OR:	for(l=0; l<EXPR_VALUES; l++) d[l] = (a[l] != 0) | (s[l] != 0); break;
+	case EXPR_OP_SEL:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] != 0 ? s[l] : c[l]; break;
+	case EXPR_OP_CLAMP:
+		for(l=0; l<EXPR_VALUES; l++) {
+			float v = a[l] > c[l] ? c[l] : a[l];
+			d[l] = v < s[l] ? s[l] : v;
+		}
+		break;
+	case EXPR_OP_MIX:	for(l=0; l<EXPR_VALUES; l++) d[l] = a[l] + (s[l] - a[l]) * c[l]; break;
+	default:			break;
+	}
+}
+
+/* Runs the code on EXPR_LANES pixels */
+static void expr_run(const ExprProgram *prog, float regs[][EXPR_VALUES], const ExprBands *b, int x0, int n, int y)
+{
+	int i;
+
+	for(i=0; i<prog->code_count; i++) {
+		const ExprInsn *insn = &prog->code[i];
+
+		if(insn->op == EXPR_OP_LOAD) {
+			expr_load(regs[insn->dst], &b->inputs[insn->a], insn, x0, n, y, b->w, b->h);
+		}else {
+			expr_exec(insn->op, regs[insn->dst], regs[insn->a], regs[insn->b], regs[insn->c], x0, y);
+		}
+	}
+}
+
+static void expr_band_proc(void *arg, int band)
+{
+	ExprBands *b = arg;
+	const ExprProgram *prog = b->prog;
+	float regs[EXPR_MAX_REGS][EXPR_VALUES] __attribute__((aligned(64)));
+	float out[EXPR_VALUES];
+	int i, j, l, x0;
+
+	int y0 = band * b->band_h;
+	int y1 = y0 + b->band_h > b->h ? b->h : y0 + b->band_h;
+
+	for(i=0; i<prog->const_count; i++) {
+		const ExprConst *k = &prog->consts[i];
+		float v = k->kind == EXPR_CONST_WIDTH ? b->w : k->kind == EXPR_CONST_HEIGHT ? b->h : k->value;
+
+		for(l=0; l<EXPR_VALUES; l++) {
+			regs[k->reg][l] = v;
+		}
+	}
+
+	for(j=y0; j<y1; j++) {
+		uint32_t *d_line = (uint32_t*)(b->dst + (size_t)j * b->stride);
+
+		for(x0=0; x0<b->w; x0+=EXPR_LANES) {
+			int n = b->w - x0 < EXPR_LANES ? b->w - x0 : EXPR_LANES;
+			uint32_t *d = d_line + x0;
+
+			expr_run(prog, regs, b, x0, n, j);
+
+			const float *r = regs[prog->result];
+
+			/* Saturated; NaN fails the lower bound's comparison, so it becomes 0 */
+			for(l=0; l<EXPR_VALUES; l++) {
+				float v = r[l] > 0 ? r[l] : 0;
+				out[l] = v < 255 ? v : 255;
+			}
+
+			/* Rounded here, the compiler doesn't vectorize it with the saturation; alpha (byte 0) is kept */
+			for(i=0; i<n; i++) {
+				d[i] = (d[i] & 0xffu << EXPR_BYTE_SHIFT(0)) |
+						(uint32_t)(int)(out[i] + 0.5f) << EXPR_BYTE_SHIFT(1) |
+						(uint32_t)(int)(out[EXPR_LANES + i] + 0.5f) << EXPR_BYTE_SHIFT(2) |
+						(uint32_t)(int)(out[2 * EXPR_LANES + i] + 0.5f) << EXPR_BYTE_SHIFT(3);
+			}
+		}
+	}
+}
+
+RETCODE expr_apply(const ExprProgram *prog, const ExprInput *inputs, int count, void *dst, int stride, int w, int h)
+{
+	TRACE_SCOPE("expr");
+
+	int i;
+
+	if(!prog || !dst || w <= 0 || h <= 0 || count < prog->input_count) {
+		return RC_INVALIDARG;
+	}
+
+	for(i=0; i<prog->input_count; i++) {
+		if(!inputs[i].pixels || inputs[i].pixels == dst) return RC_INVALIDARG;
+	}
+
+	ExprBands b = {
+		.prog = prog,
+		.inputs = inputs,
+		.dst = dst,
+		.stride = stride,
+		.w = w,
+		.h = h,
+	};
+
+	int bands = threadpool_split_rows(h, &b.band_h);
+	return threadpool_parallel_for(bands, expr_band_proc, &b);
+}
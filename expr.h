@@ -0,0 +1,66 @@
+/*
+ * expr.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef EXPR_H_
+#define EXPR_H_
+
+#include <stdint.h>
+#include "common.h"
+
+/**
+ * Per-pixel expressions over one or more 32-bit bitmaps of the same size, e.g.
+ * "clamp((a - b) * 2 + 128)" or "a > 128 ? 255 : 0". The expression is evaluated for
+ * the R, G and B components separately (alpha isn't touched) and the result is
+ * clamped to 0..255 and rounded.
+ *
+ *   a, b, c, d         the component of the pixel in the 1st..4th input
+ *   a(dx, dy)          the component of a neighbour (integer offsets, wrapped at the edges)
+ *   a.r, a(1, 0).g     a given component instead of the one being computed
+ *   x, y, w, h         coordinates of the pixel and size of the bitmap
+ *   + - * / < <= > >= == != && || ! ?:  like in C, comparisons give 0 or 1
+ *   min max abs sqrt floor pow mix(p, q, t) clamp(v) clamp(v, lo, hi)
+ *
+ * Expressions are compiled to a register bytecode whose every instruction works on
+ * EXPR_LANES pixels, and the rows are split across the thread pool.
+ */
+
+/* Pixels processed by one instruction */
+#define EXPR_LANES			16
+
+#define EXPR_MAX_INPUTS		4
+#define EXPR_MAX_REGS		64
+#define EXPR_MAX_CODE		512
+
+/* Largest neighbour offset */
+#define EXPR_MAX_RADIUS		16
+
+typedef struct ExprProgram ExprProgram;
+
+/* One input bitmap, all of them have the size passed to expr_apply() */
+typedef struct {
+	const uint8_t *pixels;
+	int stride;
+} ExprInput;
+
+/**
+ * Parses and compiles an expression. On a syntax error RC_INVALIDDATA is returned and
+ * the expression is printed to stderr with the position and the reason.
+ */
+RETCODE expr_compile(const char *source, ExprProgram **out);
+void expr_free(ExprProgram *prog);
+
+/* Number of inputs the expression reads (1 + the last input letter used) */
+int expr_input_count(const ExprProgram *prog);
+
+/**
+ * Evaluates the expression for every pixel of dst, which must not be one of the inputs
+ * (the neighbours of a pixel are read after it's written). `count` inputs are given,
+ * at least expr_input_count().
+ */
+RETCODE expr_apply(const ExprProgram *prog, const ExprInput *inputs, int count, void *dst, int stride, int w, int h);
+
+#endif /* EXPR_H_ */
@@ -0,0 +1,243 @@
+/*
+ * fft.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <string.h>
+#include <math.h>
+#include "fft.h"
+#include "threadpool.h"
+#include "memtrack.h"
+
+/* Columns gathered together by the column pass of fft_2d() */
+#define FFT_COLUMN_BLOCK	8
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef struct {
+	int n;
+
+	/* exp(-2*pi*i*k/n) for k in [0..n/2) */
+	Complex *twiddle;
+} FFTPlan;
+
+typedef struct {
+	Complex *data;
+	int w, h;
+	int inverse;
+
+	FFTPlan *row_plan, *col_plan;
+
+	int band_h;
+	RETCODE rc;
+} FFTJob;
+
+int fft_size(int n)
+{
+	int size = 1;
+
+	while(size < n) {
+		size <<= 1;
+	}
+
+	return size;
+}
+
+static RETCODE fft_plan_init(FFTPlan *plan, int n)
+{
+	int k;
+
+	if(n < 1 || (n & (n - 1)) != 0) {
+		return RC_INVALIDARG;
+	}
+
+	plan->n = n;
+	plan->twiddle = memtrack_malloc(MEM_FILTER, (n / 2 + 1) * sizeof(Complex));
+
+	if(!plan->twiddle) {
+		return RC_OUTOFMEM;
+	}
+
+	for(k=0; k<n/2; k++) {
+		double a = -2.0 * M_PI * k / n;
+
+		plan->twiddle[k].re = (float)cos(a);
+		plan->twiddle[k].im = (float)sin(a);
+	}
+
+	return RC_OK;
+}
+
+static void fft_plan_free(FFTPlan *plan)
+{
+	memtrack_free(plan->twiddle);
+	plan->twiddle = NULL;
+}
+
+/* Iterative decimation-in-time transform, not scaled */
+static void fft_transform(const FFTPlan *plan, Complex *x, int inverse)
+{
+	const int n = plan->n;
+	int i, j, len, k;
+
+	/* Bit-reversal permutation */
+	for(i=1, j=0; i<n; i++) {
+		int bit = n >> 1;
+
+		for(; j & bit; bit >>= 1) {
+			j ^= bit;
+		}
+		j ^= bit;
+
+		if(i < j) {
+			Complex t = x[i];
+			x[i] = x[j];
+			x[j] = t;
+		}
+	}
+
+	/* Butterflies, the twiddles of a stage of length len are n/len apart */
+	for(len=2; len<=n; len<<=1) {
+		const int half = len >> 1;
+		const int step = n / len;
+
+		for(i=0; i<n; i+=len) {
+			Complex *a = x + i;
+			Complex *b = x + i + half;
+
+			for(k=0; k<half; k++) {
+				const Complex w = plan->twiddle[k * step];
+				const float wi = inverse ? -w.im : w.im;
+
+				float tr = b[k].re * w.re - b[k].im * wi;
+				float ti = b[k].re * wi + b[k].im * w.re;
+
+				b[k].re = a[k].re - tr;
+				b[k].im = a[k].im - ti;
+				a[k].re += tr;
+				a[k].im += ti;
+			}
+		}
+	}
+}
+
+RETCODE fft_1d(Complex *data, int n, int inverse)
+{
+	FFTPlan plan;
+	RETCODE rc;
+	int i;
+
+	if(!data) {
+		return RC_INVALIDARG;
+	}
+
+	rc = fft_plan_init(&plan, n);
+	if(failed(rc)) return rc;
+
+	fft_transform(&plan, data, inverse);
+
+	if(inverse) {
+		const float scale = 1.0f / n;
+
+		for(i=0; i<n; i++) {
+			data[i].re *= scale;
+			data[i].im *= scale;
+		}
+	}
+
+	fft_plan_free(&plan);
+	return RC_OK;
+}
+
+static void fft_rows_proc(void *arg, int band)
+{
+	FFTJob *job = arg;
+	int j;
+	int y1 = (band + 1) * job->band_h > job->h ? job->h : (band + 1) * job->band_h;
+
+	for(j=band * job->band_h; j<y1; j++) {
+		fft_transform(job->row_plan, job->data + (size_t)j * job->w, job->inverse);
+	}
+}
+
+/* Transforms a block of columns, gathered into contiguous lines so the butterflies stay in cache */
+static void fft_columns_proc(void *arg, int block)
+{
+	FFTJob *job = arg;
+	int i, j, c;
+	const int x0 = block * FFT_COLUMN_BLOCK;
+	const int cols = job->w - x0 < FFT_COLUMN_BLOCK ? job->w - x0 : FFT_COLUMN_BLOCK;
+	const float scale = job->inverse ? 1.0f / ((float)job->w * job->h) : 1.0f;
+
+	Complex *lines = memtrack_malloc(MEM_FILTER, (size_t)FFT_COLUMN_BLOCK * job->h * sizeof(Complex));
+	if(!lines) {
+		job->rc = RC_OUTOFMEM;
+		return;
+	}
+
+	for(j=0; j<job->h; j++) {
+		const Complex *row = job->data + (size_t)j * job->w + x0;
+
+		for(c=0; c<cols; c++) {
+			lines[(size_t)c * job->h + j] = row[c];
+		}
+	}
+
+	for(c=0; c<cols; c++) {
+		fft_transform(job->col_plan, lines + (size_t)c * job->h, job->inverse);
+	}
+
+	for(j=0; j<job->h; j++) {
+		Complex *row = job->data + (size_t)j * job->w + x0;
+
+		for(c=0, i=j; c<cols; c++, i+=job->h) {
+			row[c].re = lines[i].re * scale;
+			row[c].im = lines[i].im * scale;
+		}
+	}
+
+	memtrack_free(lines);
+}
+
+RETCODE fft_2d(Complex *data, int w, int h, int inverse)
+{
+	FFTPlan row_plan = {0}, col_plan = {0};
+	RETCODE rc;
+
+	if(!data) {
+		return RC_INVALIDARG;
+	}
+
+	rc = fft_plan_init(&row_plan, w);
+	if(failed(rc)) goto cleanup;
+
+	rc = fft_plan_init(&col_plan, h);
+	if(failed(rc)) goto cleanup;
+
+	FFTJob job = {
+		.data = data,
+		.w = w,
+		.h = h,
+		.inverse = inverse,
+		.row_plan = &row_plan,
+		.col_plan = &col_plan,
+		.rc = RC_OK,
+	};
+
+	int bands = threadpool_split_rows(h, &job.band_h);
+	threadpool_parallel_for(bands, fft_rows_proc, &job);
+	threadpool_parallel_for((w + FFT_COLUMN_BLOCK - 1) / FFT_COLUMN_BLOCK, fft_columns_proc, &job);
+
+	rc = job.rc;
+
+cleanup:
+	fft_plan_free(&row_plan);
+	fft_plan_free(&col_plan);
+
+	return rc;
+}
@@ -0,0 +1,35 @@
+/*
+ * fft.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef FFT_H_
+#define FFT_H_
+
+#include <stdint.h>
+#include "common.h"
+
+typedef struct {
+	float re, im;
+} Complex;
+
+/* Smallest power of two which is not less than n */
+int fft_size(int n);
+
+/**
+ * In-place radix-2 FFT of n complex samples (n must be a power of two).
+ * The inverse transform is scaled by 1/n, so a forward and an inverse
+ * transform return the original samples.
+ */
+RETCODE fft_1d(Complex *data, int n, int inverse);
+
+/**
+ * In-place 2D FFT of a w x h row-major array (both sizes must be powers of two).
+ * Rows and then columns are transformed in parallel. The inverse transform
+ * is scaled by 1/(w*h).
+ */
+RETCODE fft_2d(Complex *data, int w, int h, int inverse);
+
+#endif /* FFT_H_ */
@@ -0,0 +1,156 @@
+/*
+ * filtercache.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+#include "filtercache.h"
+#include "memtrack.h"
+
+#define FNV_OFFSET_BASIS	0xcbf29ce484222325ULL
+#define FNV_PRIME			0x100000001b3ULL
+
+uint64_t filtercache_hash(const void *data, size_t size, uint64_t seed)
+{
+	const uint8_t *p = data;
+	uint64_t h = FNV_OFFSET_BASIS ^ seed;
+	size_t i;
+
+	for(i=0; i<size; i++) {
+		h ^= p[i];
+		h *= FNV_PRIME;
+	}
+
+	return h;
+}
+
+void filtercache_init(FilterCache *cache, size_t budget)
+{
+	memset(cache, 0, sizeof(FilterCache));
+	cache->budget = budget ? budget : FILTERCACHE_DEFAULT_BUDGET;
+}
+
+static void filtercache_unlink(FilterCache *cache, FilterCacheEntry *e)
+{
+	if(e->prev) e->prev->next = e->next; else cache->head = e->next;
+	if(e->next) e->next->prev = e->prev; else cache->tail = e->prev;
+
+	e->prev = e->next = NULL;
+}
+
+static void filtercache_push_front(FilterCache *cache, FilterCacheEntry *e)
+{
+	e->prev = NULL;
+	e->next = cache->head;
+
+	if(cache->head) cache->head->prev = e; else cache->tail = e;
+	cache->head = e;
+}
+
+static void filtercache_remove(FilterCache *cache, FilterCacheEntry *e)
+{
+	filtercache_unlink(cache, e);
+
+	cache->bytes -= e->bytes;
+	cache->count--;
+
+	filterjob_free_result(e->result);
+	memtrack_free(e);
+}
+
+void filtercache_clear(FilterCache *cache)
+{
+	while(cache->head) {
+		filtercache_remove(cache, cache->head);
+	}
+}
+
+static FilterCacheEntry *filtercache_find(FilterCache *cache, uint64_t source_id, const char *filter, uint64_t params)
+{
+	FilterCacheEntry *e;
+
+	/* A session holds a handful of entries, so a linear search is enough */
+	for(e=cache->head; e; e=e->next) {
+		if(e->source_id == source_id && e->params == params && strcmp(e->filter, filter) == 0) {
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+const FilterJobResult *filtercache_lookup(FilterCache *cache, uint64_t source_id, const char *filter, uint64_t params)
+{
+	FilterCacheEntry *e = filtercache_find(cache, source_id, filter, params);
+
+	if(!e) {
+		cache->misses++;
+		return NULL;
+	}
+
+	cache->hits++;
+
+	filtercache_unlink(cache, e);
+	filtercache_push_front(cache, e);
+
+	return e->result;
+}
+
+RETCODE filtercache_insert(FilterCache *cache, uint64_t source_id, const char *filter, uint64_t params, FilterJobResult *result)
+{
+	FilterCacheEntry *e;
+
+	if(!filter || !result) {
+		return RC_INVALIDARG;
+	}
+
+	size_t bytes = sizeof(FilterCacheEntry) + sizeof(FilterJobResult) + (size_t)result->stride * result->h;
+
+	if(bytes > cache->budget) {
+		filterjob_free_result(result);
+		return RC_FALSE;
+	}
+
+	/* Replace an entry with the same key */
+	e = filtercache_find(cache, source_id, filter, params);
+	if(e) {
+		filtercache_remove(cache, e);
+	}
+
+	while(cache->bytes + bytes > cache->budget && cache->tail) {
+		filtercache_remove(cache, cache->tail);
+		cache->evictions++;
+	}
+
+	e = memtrack_calloc(MEM_CACHE, 1, sizeof(FilterCacheEntry));
+	if(!e) {
+		filterjob_free_result(result);
+		return RC_OUTOFMEM;
+	}
+
+	e->source_id = source_id;
+	strncpy(e->filter, filter, FILTERJOB_MAX_NAME - 1);
+	e->params = params;
+	e->result = result;
+	e->bytes = bytes;
+
+	filtercache_push_front(cache, e);
+	cache->bytes += bytes;
+	cache->count++;
+
+	return RC_OK;
+}
+
+void filtercache_print_stats(const FilterCache *cache)
+{
+	uint64_t lookups = cache->hits + cache->misses;
+
+	printf("Filter cache: %llu hits, %llu misses (%.0f%% hit rate), %llu evictions, %d entries in %.1f of %.1f MB.\n",
+			(unsigned long long)cache->hits, (unsigned long long)cache->misses,
+			lookups ? 100.0 * cache->hits / lookups : 0.0, (unsigned long long)cache->evictions,
+			cache->count, cache->bytes / 1048576.0, cache->budget / 1048576.0);
+}
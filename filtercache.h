@@ -0,0 +1,68 @@
+/*
+ * filtercache.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef FILTERCACHE_H_
+#define FILTERCACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "common.h"
+#include "filterjob.h"
+
+/* Memory used for cached results when 0 is passed to filtercache_init() */
+#define FILTERCACHE_DEFAULT_BUDGET	(256 * 1024 * 1024)
+
+typedef struct FilterCacheEntry {
+	/* Key: source image, filter name and hash of the filter parameters */
+	uint64_t source_id;
+	char filter[FILTERJOB_MAX_NAME];
+	uint64_t params;
+
+	/* Filtered bitmap with its histograms */
+	FilterJobResult *result;
+	size_t bytes;
+
+	/* Neighbours in the recency list */
+	struct FilterCacheEntry *prev, *next;
+} FilterCacheEntry;
+
+typedef struct {
+	/* Most recently used entry first */
+	FilterCacheEntry *head, *tail;
+	int count;
+
+	/* Memory held by the entries and its limit */
+	size_t bytes;
+	size_t budget;
+
+	uint64_t hits, misses, evictions;
+} FilterCache;
+
+/* 64-bit FNV-1a hash, used to build source identities and parameter hashes */
+uint64_t filtercache_hash(const void *data, size_t size, uint64_t seed);
+
+void filtercache_init(FilterCache *cache, size_t budget);
+
+/* Frees all entries. The statistics are kept */
+void filtercache_clear(FilterCache *cache);
+
+/**
+ * Returns the cached result for the key (and marks it as the most recently used)
+ * or NULL. The result stays owned by the cache and is valid until the next insert or clear.
+ */
+const FilterJobResult *filtercache_lookup(FilterCache *cache, uint64_t source_id, const char *filter, uint64_t params);
+
+/**
+ * Stores a result under the key, taking its ownership. The least recently used entries
+ * are evicted until the budget is met. Returns RC_FALSE (and frees the result) if it
+ * alone exceeds the budget.
+ */
+RETCODE filtercache_insert(FilterCache *cache, uint64_t source_id, const char *filter, uint64_t params, FilterJobResult *result);
+
+void filtercache_print_stats(const FilterCache *cache);
+
+#endif /* FILTERCACHE_H_ */
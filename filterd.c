@@ -0,0 +1,503 @@
+/*
+ * filterd.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+/* memfd_create(), accept4() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "common.h"
+#include "filterd.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "filters.h"
+#include "kernels.h"
+#include "autotune.h"
+#include "filtercache.h"
+#include "bufpool.h"
+#include "threadpool.h"
+
+#define bytes_per_pixel 4
+
+/* A step of a plan: either a convolution matrix or an operation */
+typedef struct {
+	Filter2D *filter;
+	FilterOp *op;
+} FilterdStep;
+
+/* Filter chain with the filters already looked up */
+typedef struct {
+	uint64_t key;
+	char chain[FILTERD_MAX_CHAIN];
+
+	/* Registry generation of the lookups, they are repeated after the kernels are reloaded */
+	int generation;
+
+	FilterdStep steps[FILTERD_MAX_CHAIN / 2];
+	int count;
+} FilterdPlan;
+
+/* Segment mapped by a connection, kept while the client sends the same one */
+typedef struct {
+	dev_t dev;
+	ino_t ino;
+	uint8_t *base;
+	size_t size;
+} FilterdMapping;
+
+typedef struct {
+	int sock;
+
+	/* Source and output segments of the last job */
+	FilterdMapping maps[2];
+} FilterdConnection;
+
+/* Band of a convolution applied in parallel */
+typedef struct {
+	uint8_t *src, *dst;
+	int stride, w, h;
+	int band_h;
+	Filter2D *filter;
+} FilterdBands;
+
+static SDL_mutex *plan_lock;
+static FilterdPlan plans[FILTERD_PLAN_CACHE];
+static int plan_next;
+static uint64_t plan_hits, plan_misses;
+
+static SDL_atomic_t jobs_served;
+static volatile sig_atomic_t quit_requested;
+
+static void filterd_signal(int sig)
+{
+	quit_requested = 1;
+}
+
+/* Looks up the filters of a chain once, later jobs with the same chain take them from the cache */
+static RETCODE filterd_get_plan(const char *chain, FilterdPlan *out)
+{
+	char names[FILTERD_MAX_CHAIN];
+	char *name, *save = NULL;
+	int i;
+
+	uint64_t key = filtercache_hash(chain, strlen(chain), 0);
+	int generation = filter_get_generation();
+
+	SDL_LockMutex(plan_lock);
+
+	for(i=0; i<FILTERD_PLAN_CACHE; i++) {
+		if(plans[i].key == key && plans[i].generation == generation && strcmp(plans[i].chain, chain) == 0) {
+			*out = plans[i];
+			plan_hits++;
+			SDL_UnlockMutex(plan_lock);
+			return RC_OK;
+		}
+	}
+
+	plan_misses++;
+	SDL_UnlockMutex(plan_lock);
+
+	memset(out, 0, sizeof(FilterdPlan));
+	out->key = key;
+	out->generation = generation;
+	strcpy(out->chain, chain);
+	strcpy(names, chain);
+
+	/* Connections parse their chains at the same time, so strtok() can't be used */
+	for(name = strtok_r(names, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+		FilterdStep *step = &out->steps[out->count];
+
+		if(failed(filter_find_by_name(name, &step->filter)) && failed(filter_op_find_by_name(name, &step->op))) {
+			return RC_INVALIDARG;
+		}
+
+		out->count++;
+	}
+
+	SDL_LockMutex(plan_lock);
+	plans[plan_next] = *out;
+	plan_next = (plan_next + 1) % FILTERD_PLAN_CACHE;
+	SDL_UnlockMutex(plan_lock);
+
+	return RC_OK;
+}
+
+static void filterd_band_proc(void *arg, int index)
+{
+	FilterdBands *b = arg;
+	SDL_Rect rect = {0, index * b->band_h, b->w, b->band_h};
+
+	if(rect.y + rect.h > b->h) {
+		rect.h = b->h - rect.y;
+	}
+
+	filter_apply_rect(b->src, b->dst, b->stride, b->w, b->h, &rect, b->filter);
+}
+
+static RETCODE filterd_apply_step(const FilterdStep *step, uint8_t *src, uint8_t *dst, int stride, int w, int h)
+{
+	if(step->op) {
+		return step->op->apply(src, dst, stride, w, h);
+	}
+
+	/* Convolutions are single threaded, so they are split in bands of rows */
+	FilterdBands b = {
+		.src = src,
+		.dst = dst,
+		.stride = stride,
+		.w = w,
+		.h = h,
+		.filter = step->filter,
+	};
+
+	int count = threadpool_split_rows(h, &b.band_h);
+	return threadpool_parallel_for(count, filterd_band_proc, &b);
+}
+
+static void filterd_copy_rows(uint8_t *dst, const uint8_t *src, int stride, int w, int h)
+{
+	int j;
+
+	for(j=0; j<h; j++) {
+		memcpy(dst + (size_t)j * stride, src + (size_t)j * stride, (size_t)w * bytes_per_pixel);
+	}
+}
+
+/**
+ * Runs a plan. The steps ping-pong between the output and a pooled scratch bitmap;
+ * in place the source is first copied to the scratch bitmap, since a filter can't
+ * write over its input.
+ */
+static RETCODE filterd_run_plan(const FilterdPlan *plan, uint8_t *src, uint8_t *out, int stride, int w, int h)
+{
+	RETCODE rc = RC_OK;
+	int i;
+
+	if(plan->count == 0) {
+		if(out != src) filterd_copy_rows(out, src, stride, w, h);
+		return RC_OK;
+	}
+
+	uint8_t *scratch = bufpool_alloc((size_t)stride * h);
+	if(!scratch) return RC_OUTOFMEM;
+
+	/* Filters don't touch the alpha component, so both bitmaps start as the source */
+	filterd_copy_rows(scratch, src, stride, w, h);
+	if(out != src) filterd_copy_rows(out, src, stride, w, h);
+
+	uint8_t *cur = out == src ? scratch : src;
+	uint8_t *next = out;
+
+	for(i=0; i<plan->count && succeeded(rc); i++) {
+		rc = filterd_apply_step(&plan->steps[i], cur, next, stride, w, h);
+
+		cur = next;
+		next = cur == out ? scratch : out;
+	}
+
+	if(succeeded(rc) && cur != out) {
+		filterd_copy_rows(out, cur, stride, w, h);
+	}
+
+	bufpool_free(scratch);
+	return rc;
+}
+
+/* Maps a received segment, reusing the previous mapping when the client sends the same one again */
+static uint8_t *filterd_map(FilterdMapping *m, int fd, size_t *size)
+{
+	struct stat st;
+
+	if(fstat(fd, &st) != 0) {
+		return NULL;
+	}
+
+	/* A segment the client could still shrink would raise SIGBUS here in the middle of a job */
+	int seals = fcntl(fd, F_GET_SEALS);
+	if(seals < 0 || !(seals & F_SEAL_SHRINK)) {
+		return NULL;
+	}
+
+	if(m->base && m->dev == st.st_dev && m->ino == st.st_ino && m->size == (size_t)st.st_size) {
+		*size = m->size;
+		return m->base;
+	}
+
+	if(m->base) {
+		munmap(m->base, m->size);
+		m->base = NULL;
+	}
+
+	if(st.st_size <= 0) {
+		return NULL;
+	}
+
+	void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(base == MAP_FAILED) {
+		return NULL;
+	}
+
+	m->dev = st.st_dev;
+	m->ino = st.st_ino;
+	m->base = base;
+	m->size = st.st_size;
+
+	*size = m->size;
+	return base;
+}
+
+/* Checks that a bitmap of the request fits in its segment */
+static int filterd_fits(const FilterdRequest *req, size_t size)
+{
+	if(req->offset > size || req->offset % bytes_per_pixel != 0) {
+		return 0;
+	}
+
+	return (uint64_t)req->stride * (req->h - 1) + (uint64_t)req->w * bytes_per_pixel <= size - req->offset;
+}
+
+static RETCODE filterd_handle(FilterdConnection *c, FilterdRequest *req, int *fds, int fd_count)
+{
+	uint8_t *src, *out;
+	size_t src_size, out_size;
+	FilterdPlan plan;
+
+	int separate = (req->flags & FILTERD_SEPARATE_OUTPUT) != 0;
+
+	if(req->magic != FILTERD_MAGIC || req->version != FILTERD_VERSION || fd_count != 1 + separate) {
+		return RC_INVALIDARG;
+	}
+
+	if(req->w <= 0 || req->h <= 0 || req->stride < req->w * bytes_per_pixel || req->stride % bytes_per_pixel != 0) {
+		return RC_INVALIDARG;
+	}
+
+	req->filters[FILTERD_MAX_CHAIN - 1] = '\0';
+
+	RETCODE rc = filterd_get_plan(req->filters, &plan);
+	if(failed(rc)) return rc;
+
+	src = filterd_map(&c->maps[0], fds[0], &src_size);
+	if(!src || !filterd_fits(req, src_size)) {
+		return RC_INVALIDARG;
+	}
+
+	src += req->offset;
+	out = src;
+
+	if(separate) {
+		out = filterd_map(&c->maps[1], fds[1], &out_size);
+		if(!out || !filterd_fits(req, out_size)) {
+			return RC_INVALIDARG;
+		}
+
+		/* A filter can't write over its input, the same segment twice is an in-place job */
+		if(c->maps[0].dev == c->maps[1].dev && c->maps[0].ino == c->maps[1].ino) {
+			return RC_INVALIDARG;
+		}
+
+		out += req->offset;
+	}
+
+	return filterd_run_plan(&plan, src, out, req->stride, req->w, req->h);
+}
+
+/* Serves the jobs of one client until it disconnects */
+static int filterd_connection_proc(void *arg)
+{
+	FilterdConnection *c = arg;
+	FilterdRequest req;
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	int i;
+
+	for(;;) {
+		struct iovec iov = {&req, sizeof(req)};
+		struct msghdr msg;
+		int fds[2], fd_count = 0;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		ssize_t n = recvmsg(c->sock, &msg, MSG_CMSG_CLOEXEC);
+		if(n <= 0) {
+			break;
+		}
+
+		struct cmsghdr *cmsg;
+		for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+				int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+				for(i=0; i<count; i++) {
+					int fd;
+					memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+
+					if(fd_count < 2) fds[fd_count++] = fd; else close(fd);
+				}
+			}
+		}
+
+		Uint64 start = SDL_GetPerformanceCounter();
+		FilterdReply reply;
+
+		if(n != sizeof(req) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+			reply.rc = RC_INVALIDARG;
+		}else {
+			reply.rc = filterd_handle(c, &req, fds, fd_count);
+		}
+
+		/* The mappings stay valid without the descriptors */
+		for(i=0; i<fd_count; i++) {
+			close(fds[i]);
+		}
+
+		reply.elapsed_us = (uint32_t)((SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency());
+		SDL_AtomicAdd(&jobs_served, 1);
+
+		if(send(c->sock, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply)) {
+			break;
+		}
+	}
+
+	for(i=0; i<2; i++) {
+		if(c->maps[i].base) munmap(c->maps[i].base, c->maps[i].size);
+	}
+
+	close(c->sock);
+	free(c);
+
+	return 0;
+}
+
+int filterd_main(int argc, char **argv)
+{
+	const char *path = argc > 2 ? argv[2] : FILTERD_DEFAULT_SOCKET;
+	struct sockaddr_un addr;
+	struct sigaction sa;
+
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		printf("Socket path \"%s\" is too long.\n", path);
+		return 1;
+	}
+
+	plan_lock = SDL_CreateMutex();
+	if(!plan_lock) return 1;
+
+	/* Connections run at the same time, matrices are tuned with --tune instead of on first use */
+	autotune_set_first_use(0);
+
+	int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(listener < 0) {
+		printf("Failed to create the socket (%s).\n", strerror(errno));
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	/* A socket left by a daemon which didn't exit cleanly */
+	unlink(path);
+
+	/* Only the user running the daemon may connect */
+	mode_t mask = umask(0077);
+	int bound = bind(listener, (struct sockaddr*)&addr, sizeof(addr));
+	umask(mask);
+
+	if(bound != 0 || listen(listener, 64) != 0) {
+		printf("Failed to listen on \"%s\" (%s).\n", path, strerror(errno));
+		close(listener);
+		return 1;
+	}
+
+	/* Any thread may get the signal, so the listener polls the flag instead of relying on EINTR */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = filterd_signal;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	/* Start the pool now, so the first job doesn't wait for the threads */
+	printf("Listening on \"%s\" with %d filter threads.\n", path, threadpool_get_thread_count());
+	fflush(stdout);
+
+	while(!quit_requested) {
+		struct pollfd pfd = {listener, POLLIN, 0};
+
+		int ready = poll(&pfd, 1, 250);
+
+		/* Connections look the kernels up again when they change, jobs in progress keep the old ones */
+		kernels_poll();
+
+		if(ready <= 0) {
+			continue;
+		}
+
+		int sock = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+
+		if(sock < 0) {
+			if(errno == EINTR || errno == ECONNABORTED) continue;
+
+			printf("accept() failed (%s).\n", strerror(errno));
+			break;
+		}
+
+		FilterdConnection *c = calloc(1, sizeof(FilterdConnection));
+		if(!c) {
+			close(sock);
+			continue;
+		}
+
+		c->sock = sock;
+
+		SDL_Thread *thread = SDL_CreateThread(filterd_connection_proc, "filterd_connection", c);
+		if(!thread) {
+			free(c);
+			close(sock);
+			continue;
+		}
+
+		SDL_DetachThread(thread);
+	}
+
+	/* Connections still open end with the process */
+	close(listener);
+	unlink(path);
+
+	printf("Served %d jobs, filter plans: %llu hits, %llu misses.\n", SDL_AtomicGet(&jobs_served),
+			(unsigned long long)plan_hits, (unsigned long long)plan_misses);
+
+	SDL_DestroyMutex(plan_lock);
+	return 0;
+}
+
+#else
+
+int filterd_main(int argc, char **argv)
+{
+	printf("The filtering daemon needs UNIX domain sockets and memfd (Linux).\n");
+	return 1;
+}
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * filterd.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef FILTERD_H_
+#define FILTERD_H_
+
+#include <stdint.h>
+#include "common.h"
+
+/* Socket used when none is given on the command line */
+#define FILTERD_DEFAULT_SOCKET	"/tmp/filterd.sock"
+
+#define FILTERD_MAGIC		0x64746c66	/* "fltd" */
+#define FILTERD_VERSION		1
+
+/* Longest filter chain ("blur3x3,canny") of a request */
+#define FILTERD_MAX_CHAIN	256
+
+/* Chains whose filters are resolved and kept by the daemon */
+#define FILTERD_PLAN_CACHE	32
+
+/* The result is written to a second segment instead of over the source */
+#define FILTERD_SEPARATE_OUTPUT	0x1
+
+/**
+ * Job descriptor sent as one packet over the socket. The descriptor of the shared
+ * memory segment with the source bitmap (and of the output segment if
+ * FILTERD_SEPARATE_OUTPUT is set) travels with it as SCM_RIGHTS ancillary data.
+ * Both bitmaps are 32-bit (RGBA8888) with the same stride.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+
+	int32_t w, h;
+	int32_t stride;
+
+	/* Byte offset of the bitmap in its segment */
+	uint64_t offset;
+
+	/* Comma separated filter names, NUL terminated */
+	char filters[FILTERD_MAX_CHAIN];
+} FilterdRequest;
+
+typedef struct {
+	RETCODE rc;
+
+	/* Time the daemon spent on the job */
+	uint32_t elapsed_us;
+} FilterdReply;
+
+/**
+ * Entry point of the daemon (--daemon [socket]). It listens on a UNIX domain socket and
+ * serves every connection on its own thread, while the filters share the warm thread
+ * pool. Returns the process exit code.
+ */
+int filterd_main(int argc, char **argv);
+
+#endif /* FILTERD_H_ */
@@ -0,0 +1,424 @@
+/*
+ * filterd_client.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+/* memfd_create(), accept4() */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "common.h"
+#include "filterd_client.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "filters.h"
+#include "bufpool.h"
+#include "threadpool.h"
+
+#define bytes_per_pixel 4
+
+/* Work and results of one thread of the load generator */
+typedef struct {
+	const char *path;
+	const char *filters;
+	int w, h;
+	int jobs;
+	int separate;
+	int seed;
+
+	/* Round-trip time of every job */
+	uint32_t *latency_us;
+	int done;
+	int mismatches;
+	RETCODE rc;
+} FilterdLoadClient;
+
+RETCODE filterd_connect(const char *path, int *sock)
+{
+	struct sockaddr_un addr;
+
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		return RC_INVALIDARG;
+	}
+
+	int s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if(s < 0) return RC_FAIL;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if(connect(s, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		close(s);
+		return RC_FAIL;
+	}
+
+	*sock = s;
+	return RC_OK;
+}
+
+void filterd_disconnect(int sock)
+{
+	if(sock >= 0) {
+		close(sock);
+	}
+}
+
+RETCODE filterd_image_create(FilterdImage *img, int w, int h)
+{
+	memset(img, 0, sizeof(FilterdImage));
+	img->fd = -1;
+
+	if(w <= 0 || h <= 0) {
+		return RC_INVALIDARG;
+	}
+
+	img->w = w;
+	img->h = h;
+	img->stride = bufpool_stride(w);
+	img->size = (size_t)img->stride * h;
+
+	img->fd = memfd_create("filterd_image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(img->fd < 0) {
+		return RC_FAIL;
+	}
+
+	if(ftruncate(img->fd, img->size) != 0) {
+		filterd_image_destroy(img);
+		return RC_OUTOFMEM;
+	}
+
+	/* The daemon only maps segments whose size can't change under it */
+	if(fcntl(img->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0) {
+		filterd_image_destroy(img);
+		return RC_FAIL;
+	}
+
+	void *p = mmap(NULL, img->size, PROT_READ | PROT_WRITE, MAP_SHARED, img->fd, 0);
+	if(p == MAP_FAILED) {
+		filterd_image_destroy(img);
+		return RC_OUTOFMEM;
+	}
+
+	img->pixels = p;
+	return RC_OK;
+}
+
+void filterd_image_destroy(FilterdImage *img)
+{
+	if(img->pixels) munmap(img->pixels, img->size);
+	if(img->fd >= 0) close(img->fd);
+
+	img->pixels = NULL;
+	img->fd = -1;
+}
+
+RETCODE filterd_submit(int sock, const FilterdImage *src, const FilterdImage *dst, const char *filters, uint32_t *elapsed_us)
+{
+	FilterdRequest req;
+	FilterdReply reply;
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	int fds[2] = {src->fd, dst ? dst->fd : -1};
+	int fd_count = dst ? 2 : 1;
+
+	if(strlen(filters) >= FILTERD_MAX_CHAIN || (dst && (dst->w != src->w || dst->h != src->h || dst->stride != src->stride))) {
+		return RC_INVALIDARG;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.magic = FILTERD_MAGIC;
+	req.version = FILTERD_VERSION;
+	req.flags = dst ? FILTERD_SEPARATE_OUTPUT : 0;
+	req.w = src->w;
+	req.h = src->h;
+	req.stride = src->stride;
+	strcpy(req.filters, filters);
+
+	struct iovec iov = {&req, sizeof(req)};
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
+
+	/* The segments travel as descriptors, the pixels are never copied through the socket */
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, fd_count * sizeof(int));
+
+	if(sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(req)) {
+		return RC_FAIL;
+	}
+
+	if(recv(sock, &reply, sizeof(reply), 0) != sizeof(reply)) {
+		return RC_FAIL;
+	}
+
+	if(elapsed_us) {
+		*elapsed_us = reply.elapsed_us;
+	}
+
+	return reply.rc;
+}
+
+/* Filters a copy of the image in this process, like the daemon does */
+static RETCODE filterd_local_chain(const FilterdImage *img, const char *filters, uint8_t **out)
+{
+	char names[FILTERD_MAX_CHAIN];
+	char *name, *save = NULL;
+	size_t size = (size_t)img->stride * img->h;
+	RETCODE rc = RC_OK;
+
+	uint8_t *buf[2] = {bufpool_alloc(size), bufpool_alloc(size)};
+	int cur = 0;
+
+	if(!buf[0] || !buf[1]) {
+		bufpool_free(buf[0]);
+		bufpool_free(buf[1]);
+		return RC_OUTOFMEM;
+	}
+
+	memcpy(buf[0], img->pixels, size);
+	memcpy(buf[1], img->pixels, size);
+	strcpy(names, filters);
+
+	for(name = strtok_r(names, ",", &save); name && succeeded(rc); name = strtok_r(NULL, ",", &save)) {
+		rc = filter_apply_by_name(buf[cur], buf[!cur], img->stride, img->w, img->h, name);
+		cur = !cur;
+	}
+
+	bufpool_free(buf[!cur]);
+	*out = buf[cur];
+
+	return rc;
+}
+
+static int filterd_load_client_proc(void *arg)
+{
+	FilterdLoadClient *lc = arg;
+	FilterdImage src, dst;
+	uint8_t *expected = NULL;
+	int sock = -1, i, j;
+
+	memset(&dst, 0, sizeof(dst));
+	dst.fd = -1;
+
+	lc->rc = filterd_image_create(&src, lc->w, lc->h);
+	if(succeeded(lc->rc) && lc->separate) lc->rc = filterd_image_create(&dst, lc->w, lc->h);
+	if(succeeded(lc->rc)) lc->rc = filterd_connect(lc->path, &sock);
+	if(failed(lc->rc)) goto cleanup;
+
+	/* Some texture, different for every client */
+	for(j=0; j<lc->h; j++) {
+		uint8_t *p = src.pixels + (size_t)j * src.stride;
+
+		for(i=0; i<lc->w; i++, p += bytes_per_pixel) {
+			p[0] = 255;
+			p[1] = (uint8_t)(i * 3 + j + lc->seed);
+			p[2] = (uint8_t)((i ^ j) + lc->seed * 7);
+			p[3] = (uint8_t)(i * j / 16 + lc->seed);
+		}
+	}
+
+	lc->rc = filterd_local_chain(&src, lc->filters, &expected);
+	if(failed(lc->rc)) goto cleanup;
+
+	for(i=0; i<lc->jobs; i++) {
+		Uint64 start = SDL_GetPerformanceCounter();
+
+		lc->rc = filterd_submit(sock, &src, lc->separate ? &dst : NULL, lc->filters, NULL);
+		if(failed(lc->rc)) goto cleanup;
+
+		lc->latency_us[lc->done++] = (uint32_t)((SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency());
+
+		/* The first result must match filtering in this process; in place the next jobs filter it again */
+		if(i == 0) {
+			const FilterdImage *result = lc->separate ? &dst : &src;
+
+			for(j=0; j<lc->h; j++) {
+				if(memcmp(result->pixels + (size_t)j * result->stride, expected + (size_t)j * result->stride, (size_t)lc->w * bytes_per_pixel) != 0) {
+					lc->mismatches++;
+				}
+			}
+		}
+	}
+
+cleanup:
+	bufpool_free(expected);
+	filterd_disconnect(sock);
+	filterd_image_destroy(&src);
+	filterd_image_destroy(&dst);
+
+	return 0;
+}
+
+static int filterd_compare_latency(const void *a, const void *b)
+{
+	uint32_t la = *(const uint32_t*)a, lb = *(const uint32_t*)b;
+
+	return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+int filterd_load_main(int argc, char **argv)
+{
+	const char *path = FILTERD_DEFAULT_SOCKET;
+	const char *filters = "blur3x3";
+	int clients = 4, jobs = 100, w = 640, h = 480, separate = 0;
+	int i, j, total = 0, mismatches = 0;
+	RETCODE rc = RC_OK;
+
+	/* argv[1] is --filterd-load */
+	for(i=2; i<argc; i++) {
+		if(strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+			path = argv[++i];
+		}else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			clients = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			jobs = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			if(sscanf(argv[++i], "%dx%d", &w, &h) != 2) w = 0;
+		}else if(strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			filters = argv[++i];
+		}else if(strcmp(argv[i], "-x") == 0) {
+			separate = 1;
+		}else {
+			clients = 0;
+			break;
+		}
+	}
+
+	if(clients <= 0 || jobs <= 0 || w <= 0 || h <= 0) {
+		printf("Usage: \"%s --filterd-load [-S <socket>] [-c <clients>] [-n <jobs per client>] [-s <w>x<h>] [-f <filter>[,<filter>...]] [-x]\"\n", argv[0]);
+		printf("  -x  Write the results to a second segment instead of in place\n");
+		return 1;
+	}
+
+	FilterdLoadClient *lc = calloc(clients, sizeof(FilterdLoadClient));
+	SDL_Thread **threads = calloc(clients, sizeof(SDL_Thread*));
+	uint32_t *latency = malloc((size_t)clients * jobs * sizeof(uint32_t));
+
+	if(!lc || !threads || !latency) {
+		free(lc);
+		free(threads);
+		free(latency);
+		return 1;
+	}
+
+	printf("%d clients submitting %d jobs each (%dx%d, \"%s\") to \"%s\"...\n", clients, jobs, w, h, filters, path);
+
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	for(i=0; i<clients; i++) {
+		lc[i].path = path;
+		lc[i].filters = filters;
+		lc[i].w = w;
+		lc[i].h = h;
+		lc[i].jobs = jobs;
+		lc[i].separate = separate;
+		lc[i].seed = i;
+		lc[i].latency_us = latency + (size_t)i * jobs;
+
+		threads[i] = SDL_CreateThread(filterd_load_client_proc, "filterd_load", &lc[i]);
+	}
+
+	for(i=0; i<clients; i++) {
+		if(threads[i]) {
+			SDL_WaitThread(threads[i], NULL);
+		}else {
+			lc[i].rc = RC_FAIL;
+		}
+	}
+
+	double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+	/* Gather the latencies of all the clients */
+	for(i=0; i<clients; i++) {
+		for(j=0; j<lc[i].done; j++) {
+			latency[total++] = lc[i].latency_us[j];
+		}
+
+		mismatches += lc[i].mismatches;
+
+		if(failed(lc[i].rc)) {
+			printf("Client %d failed after %d jobs (rc=%d).\n", i, lc[i].done, lc[i].rc);
+			rc = lc[i].rc;
+		}
+	}
+
+	if(total > 0) {
+		double sum = 0;
+
+		for(i=0; i<total; i++) {
+			sum += latency[i];
+		}
+
+		qsort(latency, total, sizeof(uint32_t), filterd_compare_latency);
+
+		printf("%d jobs in %.2f s: %.1f jobs/s, %.1f MPix/s\n", total, seconds, total / seconds, (double)total * w * h / seconds / 1e6);
+		printf("Latency: %.2f ms average, %.2f ms median, %.2f ms 99th percentile, %.2f ms max\n",
+				sum / total / 1000.0, latency[total / 2] / 1000.0, latency[(int)(total * 0.99)] / 1000.0, latency[total - 1] / 1000.0);
+	}
+
+	if(mismatches > 0) {
+		printf("%d rows differ from filtering in this process.\n", mismatches);
+		rc = RC_FAIL;
+	}
+
+	free(lc);
+	free(threads);
+	free(latency);
+
+	return failed(rc) ? 1 : 0;
+}
+
+#else
+
+RETCODE filterd_connect(const char *path, int *sock)
+{
+	return RC_NOTIMPL;
+}
+
+void filterd_disconnect(int sock)
+{
+}
+
+RETCODE filterd_image_create(FilterdImage *img, int w, int h)
+{
+	return RC_NOTIMPL;
+}
+
+void filterd_image_destroy(FilterdImage *img)
+{
+}
+
+RETCODE filterd_submit(int sock, const FilterdImage *src, const FilterdImage *dst, const char *filters, uint32_t *elapsed_us)
+{
+	return RC_NOTIMPL;
+}
+
+int filterd_load_main(int argc, char **argv)
+{
+	printf("The filtering daemon needs UNIX domain sockets and memfd (Linux).\n");
+	return 1;
+}
+
+#endif
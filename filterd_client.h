@@ -0,0 +1,47 @@
+/*
+ * filterd_client.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef FILTERD_CLIENT_H_
+#define FILTERD_CLIENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+#include "filterd.h"
+
+/* 32-bit bitmap in a shared memory segment which can be passed to the daemon */
+typedef struct {
+	int fd;
+	uint8_t *pixels;
+	size_t size;
+	int w, h, stride;
+} FilterdImage;
+
+/* Connects to the daemon listening on `path`; *sock receives the connection */
+RETCODE filterd_connect(const char *path, int *sock);
+void filterd_disconnect(int sock);
+
+/* Creates a bitmap in a new shared memory segment (memfd), with a padded stride */
+RETCODE filterd_image_create(FilterdImage *img, int w, int h);
+void filterd_image_destroy(FilterdImage *img);
+
+/**
+ * Runs a filter chain on `src` in the daemon and waits for it. The result replaces the
+ * source if dst is NULL, otherwise it is written to dst, which must have the size and
+ * stride of src. Returns the result code of the job; the daemon's time is stored in
+ * *elapsed_us if it isn't NULL.
+ */
+RETCODE filterd_submit(int sock, const FilterdImage *src, const FilterdImage *dst, const char *filters, uint32_t *elapsed_us);
+
+/**
+ * Load generator (--filterd-load): several client threads submit jobs to a running
+ * daemon, check the first result of each against filtering in this process, and
+ * print the throughput and latency. Returns the process exit code.
+ */
+int filterd_load_main(int argc, char **argv);
+
+#endif /* FILTERD_CLIENT_H_ */
@@ -0,0 +1,554 @@
+/*
+ * filterjob.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <string.h>
+#include "filterjob.h"
+#include "filters.h"
+#include "threadpool.h"
+#include "bufpool.h"
+
+#define bytes_per_pixel 4
+
+/* Most tiles filtered in parallel before the viewport is looked at again */
+#define FILTERJOB_MAX_BATCH	64
+
+typedef struct {
+	FilterWorker *worker;
+	const char *name;
+	uint32_t generation;
+
+	/* Full-resolution destination shared by the tiles */
+	uint8_t *assembled;
+
+	int tiles[FILTERJOB_MAX_BATCH];
+	FilterJobResult *results[FILTERJOB_MAX_BATCH];
+} FilterJobBatch;
+
+void filterjob_free_result(FilterJobResult *result)
+{
+	if(result) {
+		bufpool_free(result->pixels);
+		free(result);
+	}
+}
+
+/* Allocates a result; its rows are `stride` bytes apart (a padded stride if 0) */
+static FilterJobResult *filterjob_alloc_result(const char *name, uint32_t generation, FilterJobKind kind, int w, int h, int stride, int alloc_pixels)
+{
+	FilterJobResult *r = calloc(1, sizeof(FilterJobResult));
+	if(!r) return NULL;
+
+	r->generation = generation;
+	r->kind = kind;
+	strcpy(r->filter, name);
+	r->w = w;
+	r->h = h;
+	r->stride = stride ? stride : bufpool_stride(w);
+	r->rect.w = w;
+	r->rect.h = h;
+
+	if(alloc_pixels) {
+		r->pixels = bufpool_alloc((size_t)r->stride * h);
+
+		if(!r->pixels) {
+			free(r);
+			return NULL;
+		}
+	}
+
+	return r;
+}
+
+/* Filters a whole copy of `src` */
+static FilterJobResult *filterjob_run(const uint8_t *src, int stride, int w, int h, const char *name, uint32_t generation, FilterJobKind kind)
+{
+	int j;
+
+	/* Filters take one stride for both bitmaps */
+	FilterJobResult *r = filterjob_alloc_result(name, generation, kind, w, h, stride, 1);
+	if(!r) return NULL;
+
+	/* Filters don't touch the alpha component, so start from the source */
+	for(j=0; j<h; j++) {
+		memcpy(r->pixels + (size_t)j * r->stride, src + (size_t)j * stride, (size_t)w * bytes_per_pixel);
+	}
+
+	r->rc = filter_apply_by_name((void*)src, r->pixels, r->stride, w, h, name);
+
+	if(succeeded(r->rc)) {
+		histogram_extract_bitmap(r->pixels, r->stride, w, h, &r->histograms[0], &r->histograms[1], &r->histograms[2]);
+	}
+
+	return r;
+}
+
+static inline int filterjob_superseded(FilterWorker *worker, uint32_t generation)
+{
+	return generation != (uint32_t)SDL_AtomicGet(&worker->generation);
+}
+
+static void filterjob_notify(FilterWorker *worker)
+{
+	SDL_Event event;
+
+	memset(&event, 0, sizeof(event));
+	event.type = worker->event_type;
+	SDL_PushEvent(&event);
+}
+
+/* Queues a result for the UI thread, unless a newer request has superseded it */
+static void filterjob_publish(FilterWorker *worker, FilterJobResult *r)
+{
+	SDL_LockMutex(worker->lock);
+
+	if(filterjob_superseded(worker, r->generation)) {
+		filterjob_free_result(r);
+		r = NULL;
+	}else {
+		if(worker->results_tail) worker->results_tail->next = r; else worker->results = r;
+		worker->results_tail = r;
+	}
+
+	SDL_UnlockMutex(worker->lock);
+
+	if(r) {
+		filterjob_notify(worker);
+	}
+}
+
+/* Drops the queued results, the lock must be held */
+static void filterjob_drop_results(FilterWorker *worker)
+{
+	while(worker->results) {
+		FilterJobResult *r = worker->results;
+
+		worker->results = r->next;
+		filterjob_free_result(r);
+	}
+
+	worker->results_tail = NULL;
+}
+
+void filterjob_tile_rect(const FilterWorker *worker, int index, SDL_Rect *rect)
+{
+	rect->x = (index % worker->tile_cols) * FILTERJOB_TILE_SIZE;
+	rect->y = (index / worker->tile_cols) * FILTERJOB_TILE_SIZE;
+	rect->w = rect->x + FILTERJOB_TILE_SIZE > worker->w ? worker->w - rect->x : FILTERJOB_TILE_SIZE;
+	rect->h = rect->y + FILTERJOB_TILE_SIZE > worker->h ? worker->h - rect->y : FILTERJOB_TILE_SIZE;
+}
+
+/**
+ * Picks the pending tiles closest to the viewport (0 inside it, 1 next to it and
+ * the distance in tiles for the rest). Returns their number.
+ */
+static int filterjob_next_tiles(FilterWorker *worker, int *tiles, int max)
+{
+	int i, j, k, count = 0;
+	int priority[FILTERJOB_MAX_BATCH];
+
+	SDL_LockMutex(worker->lock);
+	SDL_Rect v = worker->viewport;
+	SDL_UnlockMutex(worker->lock);
+
+	/* Viewport in tile units */
+	int c0 = v.x / FILTERJOB_TILE_SIZE, c1 = (v.x + v.w - 1) / FILTERJOB_TILE_SIZE;
+	int r0 = v.y / FILTERJOB_TILE_SIZE, r1 = (v.y + v.h - 1) / FILTERJOB_TILE_SIZE;
+
+	for(j=0; j<worker->tile_rows; j++) {
+		int dy = j < r0 ? r0 - j : j > r1 ? j - r1 : 0;
+
+		for(i=0; i<worker->tile_cols; i++) {
+			int index = j * worker->tile_cols + i;
+			int dx = i < c0 ? c0 - i : i > c1 ? i - c1 : 0;
+			int p = dx > dy ? dx : dy;
+
+			if(worker->tile_done[index] || (count == max && p >= priority[count - 1])) {
+				continue;
+			}
+
+			if(count < max) {
+				count++;
+			}
+
+			for(k=count - 1; k>0 && priority[k - 1] > p; k--) {
+				priority[k] = priority[k - 1];
+				tiles[k] = tiles[k - 1];
+			}
+
+			priority[k] = p;
+			tiles[k] = index;
+		}
+	}
+
+	return count;
+}
+
+static void filterjob_tile_proc(void *arg, int index)
+{
+	FilterJobBatch *batch = arg;
+	FilterWorker *worker = batch->worker;
+	SDL_Rect rect;
+	int j;
+
+	filterjob_tile_rect(worker, batch->tiles[index], &rect);
+
+	FilterJobResult *r = filterjob_alloc_result(batch->name, batch->generation, FILTERJOB_TILE, rect.w, rect.h, 0, 1);
+	batch->results[index] = r;
+
+	if(!r) return;
+
+	r->rect = rect;
+	r->rc = filter_apply_rect_by_name(worker->pixels, batch->assembled, worker->stride, worker->w, worker->h, &rect, batch->name);
+
+	for(j=0; j<rect.h; j++) {
+		memcpy(r->pixels + (size_t)j * r->stride, batch->assembled + (size_t)(rect.y + j) * worker->stride + rect.x * bytes_per_pixel, (size_t)rect.w * bytes_per_pixel);
+	}
+}
+
+/* Filters the image tile by tile and finally hands over the assembled image */
+static void filterjob_run_tiles(FilterWorker *worker, const char *name, uint32_t generation)
+{
+	FilterJobBatch batch = {
+		.worker = worker,
+		.name = name,
+		.generation = generation,
+	};
+
+	int i, count, failures = 0;
+	int max = threadpool_get_thread_count();
+	size_t size = (size_t)worker->stride * worker->h;
+
+	if(max > FILTERJOB_MAX_BATCH) max = FILTERJOB_MAX_BATCH;
+
+	batch.assembled = bufpool_alloc(size);
+	if(!batch.assembled) return;
+
+	memcpy(batch.assembled, worker->pixels, size);
+	memset(worker->tile_done, 0, worker->tile_cols * worker->tile_rows);
+
+	while((count = filterjob_next_tiles(worker, batch.tiles, max)) > 0) {
+		/* A key press between two batches drops the rest of the work */
+		if(filterjob_superseded(worker, generation)) {
+			bufpool_free(batch.assembled);
+			return;
+		}
+
+		threadpool_parallel_for(count, filterjob_tile_proc, &batch);
+
+		for(i=0; i<count; i++) {
+			worker->tile_done[batch.tiles[i]] = 1;
+
+			if(!batch.results[i]) {
+				failures++;
+				continue;
+			}
+
+			if(failed(batch.results[i]->rc)) {
+				failures++;
+			}
+
+			filterjob_publish(worker, batch.results[i]);
+		}
+	}
+
+	FilterJobResult *r = filterjob_alloc_result(name, generation, FILTERJOB_ASSEMBLED, worker->w, worker->h, worker->stride, 0);
+
+	if(!r || failures) {
+		free(r);
+		bufpool_free(batch.assembled);
+		return;
+	}
+
+	r->pixels = batch.assembled;
+	histogram_extract_bitmap(r->pixels, r->stride, r->w, r->h, &r->histograms[0], &r->histograms[1], &r->histograms[2]);
+
+	filterjob_publish(worker, r);
+}
+
+/* Filters a pyramid level of the source and publishes it as a preview */
+static void filterjob_run_level(FilterWorker *worker, int level, const char *name, uint32_t generation)
+{
+	PyramidLevel l;
+
+	if(failed(pyramid_get_level(&worker->pyramid, level, &l))) {
+		return;
+	}
+
+	FilterJobResult *r = filterjob_run(l.pixels, l.stride, l.w, l.h, name, generation, FILTERJOB_PREVIEW);
+	if(!r) return;
+
+	r->rect.w = worker->w;
+	r->rect.h = worker->h;
+
+	filterjob_publish(worker, r);
+}
+
+static int filterjob_thread_proc(void *arg)
+{
+	FilterWorker *worker = arg;
+	char name[FILTERJOB_MAX_NAME];
+
+	for(;;) {
+		SDL_LockMutex(worker->lock);
+
+		while(!worker->has_pending && !worker->has_staged && !worker->quit) {
+			SDL_CondWait(worker->cond, worker->lock);
+		}
+
+		if(worker->quit) {
+			SDL_UnlockMutex(worker->lock);
+			break;
+		}
+
+		/* The source is only read by this thread, so it's replaced between requests */
+		int swapped = worker->has_staged;
+
+		if(swapped) {
+			uint8_t *old = worker->pixels;
+
+			worker->pixels = worker->staged;
+			worker->staged = old;
+			worker->has_staged = 0;
+
+			/* The viewer reads the serial and the levels under the pyramid's lock */
+			pyramid_lock(&worker->pyramid);
+			pyramid_set_base(&worker->pyramid, worker->pixels, worker->stride, worker->w, worker->h);
+			SDL_AtomicAdd(&worker->source_serial, 1);
+			pyramid_unlock(&worker->pyramid);
+		}
+
+		if(!worker->has_pending) {
+			SDL_UnlockMutex(worker->lock);
+
+			/* The original view is drawn from the pyramid */
+			filterjob_notify(worker);
+			continue;
+		}
+
+		strcpy(name, worker->pending);
+		worker->has_pending = 0;
+		uint32_t generation = (uint32_t)SDL_AtomicGet(&worker->generation);
+
+		SDL_UnlockMutex(worker->lock);
+
+		if(swapped) {
+			filterjob_notify(worker);
+		}
+
+		/**
+		 * A filter can't be interrupted, so superseded requests are dropped between the stages:
+		 * a small pyramid level first, then the level on screen and finally the full image.
+		 */
+		if(worker->is_large) {
+			SDL_LockMutex(worker->lock);
+			int display_level = worker->display_level;
+			SDL_UnlockMutex(worker->lock);
+
+			int preview_level = pyramid_level_for_size(&worker->pyramid, FILTERJOB_PREVIEW_SIZE);
+
+			filterjob_run_level(worker, preview_level, name, generation);
+
+			if(display_level > 0 && display_level < preview_level && !filterjob_superseded(worker, generation)) {
+				filterjob_run_level(worker, display_level, name, generation);
+			}
+		}
+
+		if(filterjob_superseded(worker, generation)) {
+			/* Nothing to do */
+		}else if(worker->tile_done && filter_is_local(name) == RC_OK) {
+			filterjob_run_tiles(worker, name, generation);
+		}else {
+			FilterJobResult *r = filterjob_run(worker->pixels, worker->stride, worker->w, worker->h, name, generation, FILTERJOB_FULL);
+			if(r) filterjob_publish(worker, r);
+		}
+	}
+
+	return 0;
+}
+
+RETCODE filterjob_create(const void *pixels, int stride, int w, int h, Uint32 event_type, FilterWorker **out)
+{
+	int j;
+	RETCODE rc = RC_OK;
+
+	if(!pixels || !out || w <= 0 || h <= 0) {
+		return RC_INVALIDARG;
+	}
+
+	FilterWorker *worker = calloc(1, sizeof(FilterWorker));
+	if(!worker) return RC_OUTOFMEM;
+
+	worker->w = w;
+	worker->h = h;
+	worker->event_type = event_type;
+	worker->pixels = bufpool_alloc_bitmap(w, h, &worker->stride);
+	worker->staged = bufpool_alloc_bitmap(w, h, &worker->stride);
+	worker->lock = SDL_CreateMutex();
+	worker->cond = SDL_CreateCond();
+
+	/* The whole image is visible until told otherwise */
+	worker->viewport.w = w;
+	worker->viewport.h = h;
+
+	if(!worker->pixels || !worker->staged || !worker->lock || !worker->cond) {
+		rc = RC_OUTOFMEM;
+		goto fail;
+	}
+
+	for(j=0; j<h; j++) {
+		memcpy(worker->pixels + (size_t)j * worker->stride, (const uint8_t*)pixels + (size_t)j * stride, w * bytes_per_pixel);
+	}
+
+	/* The pyramid is shared with the viewer, which draws zoomed-out images from it */
+	rc = pyramid_init(&worker->pyramid, PYRAMID_GAUSSIAN);
+	if(failed(rc)) goto fail;
+
+	pyramid_set_base(&worker->pyramid, worker->pixels, worker->stride, w, h);
+
+	/* Images at most twice the preview size are filtered quickly enough without previews and tiles */
+	if(w > 2 * FILTERJOB_PREVIEW_SIZE || h > 2 * FILTERJOB_PREVIEW_SIZE) {
+		worker->is_large = 1;
+		worker->tile_cols = (w + FILTERJOB_TILE_SIZE - 1) / FILTERJOB_TILE_SIZE;
+		worker->tile_rows = (h + FILTERJOB_TILE_SIZE - 1) / FILTERJOB_TILE_SIZE;
+		worker->tile_done = calloc(worker->tile_cols * worker->tile_rows, 1);
+
+		if(!worker->tile_done) {
+			rc = RC_OUTOFMEM;
+			goto fail;
+		}
+	}
+
+	worker->thread = SDL_CreateThread(filterjob_thread_proc, "filterjob", worker);
+	if(!worker->thread) {
+		rc = RC_FAIL;
+		goto fail;
+	}
+
+	*out = worker;
+	return RC_OK;
+
+fail:
+	filterjob_destroy(&worker);
+	return rc;
+}
+
+void filterjob_destroy(FilterWorker **worker)
+{
+	FilterWorker *w = *worker;
+
+	if(!w) {
+		return;
+	}
+
+	if(w->thread) {
+		SDL_LockMutex(w->lock);
+		w->quit = 1;
+		SDL_AtomicAdd(&w->generation, 1);
+		SDL_CondSignal(w->cond);
+		SDL_UnlockMutex(w->lock);
+
+		SDL_WaitThread(w->thread, NULL);
+	}
+
+	filterjob_drop_results(w);
+
+	if(w->lock) SDL_DestroyMutex(w->lock);
+	if(w->cond) SDL_DestroyCond(w->cond);
+
+	bufpool_free(w->pixels);
+	bufpool_free(w->staged);
+	pyramid_free(&w->pyramid);
+	free(w->tile_done);
+	free(w);
+
+	*worker = NULL;
+}
+
+uint32_t filterjob_submit(FilterWorker *worker, const char *filter_name)
+{
+	SDL_LockMutex(worker->lock);
+
+	strncpy(worker->pending, filter_name, FILTERJOB_MAX_NAME - 1);
+	worker->pending[FILTERJOB_MAX_NAME - 1] = 0;
+	worker->has_pending = 1;
+
+	uint32_t generation = (uint32_t)SDL_AtomicAdd(&worker->generation, 1) + 1;
+
+	/* The results of the previous request are stale now */
+	filterjob_drop_results(worker);
+
+	SDL_CondSignal(worker->cond);
+	SDL_UnlockMutex(worker->lock);
+
+	return generation;
+}
+
+void filterjob_cancel(FilterWorker *worker)
+{
+	SDL_LockMutex(worker->lock);
+
+	worker->has_pending = 0;
+	SDL_AtomicAdd(&worker->generation, 1);
+	filterjob_drop_results(worker);
+
+	SDL_UnlockMutex(worker->lock);
+}
+
+RETCODE filterjob_set_source(FilterWorker *worker, const void *pixels, int stride)
+{
+	int j;
+
+	SDL_LockMutex(worker->lock);
+
+	/* Supersede the request in progress, which keeps reading the old source until it stops */
+	worker->has_pending = 0;
+	SDL_AtomicAdd(&worker->generation, 1);
+	filterjob_drop_results(worker);
+
+	/* The staged copy isn't read by the thread before it's swapped in */
+	for(j=0; j<worker->h; j++) {
+		memcpy(worker->staged + (size_t)j * worker->stride, (const uint8_t*)pixels + (size_t)j * stride, worker->w * bytes_per_pixel);
+	}
+
+	worker->has_staged = 1;
+	SDL_CondSignal(worker->cond);
+
+	SDL_UnlockMutex(worker->lock);
+
+	return RC_OK;
+}
+
+void filterjob_set_viewport(FilterWorker *worker, const SDL_Rect *visible, int level)
+{
+	if(visible->w <= 0 || visible->h <= 0) {
+		return;
+	}
+
+	SDL_LockMutex(worker->lock);
+	worker->viewport = *visible;
+	worker->display_level = level;
+	SDL_UnlockMutex(worker->lock);
+}
+
+RETCODE filterjob_take_result(FilterWorker *worker, FilterJobResult **out)
+{
+	SDL_LockMutex(worker->lock);
+
+	*out = worker->results;
+
+	if(*out) {
+		worker->results = (*out)->next;
+		if(!worker->results) worker->results_tail = NULL;
+
+		(*out)->next = NULL;
+	}
+
+	SDL_UnlockMutex(worker->lock);
+
+	return *out ? RC_OK : RC_FALSE;
+}
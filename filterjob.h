@@ -0,0 +1,157 @@
+/*
+ * filterjob.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef FILTERJOB_H_
+#define FILTERJOB_H_
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "common.h"
+#include "histogram.h"
+#include "pyramid.h"
+
+/* Largest side of the pyramid level filtered as a quick preview before the full image */
+#define FILTERJOB_PREVIEW_SIZE	512
+
+/* Longest filter name accepted by filterjob_submit() */
+#define FILTERJOB_MAX_NAME	64
+
+/* Side of the tiles in which local filters process large images */
+#define FILTERJOB_TILE_SIZE	256
+
+typedef enum {
+	/* The whole image at a coarser pyramid level (rect is still in full-resolution pixels) */
+	FILTERJOB_PREVIEW = 0,
+
+	/* The whole image at full resolution */
+	FILTERJOB_FULL,
+
+	/* One tile (rect) at full resolution */
+	FILTERJOB_TILE,
+
+	/* The whole image assembled from the tiles delivered before, only needed for caching */
+	FILTERJOB_ASSEMBLED,
+} FilterJobKind;
+
+typedef struct FilterJobResult {
+	/* Request which produced the result */
+	uint32_t generation;
+
+	FilterJobKind kind;
+
+	/* Area of the full-resolution image covered by the result */
+	SDL_Rect rect;
+
+	/* Filter which produced the result */
+	char filter[FILTERJOB_MAX_NAME];
+
+	RETCODE rc;
+
+	/* 32-bit bitmap (from the buffer pool) and the histograms of its R/G/B components */
+	uint8_t *pixels;
+	int stride;
+	int w, h;
+
+	/* Histograms of the whole image (not set for tiles) */
+	Histogram histograms[3];
+
+	struct FilterJobResult *next;
+} FilterJobResult;
+
+typedef struct {
+	SDL_Thread *thread;
+	SDL_mutex *lock;
+	SDL_cond *cond;
+
+	/* CPU copy of the source image (with a padded stride) and its pyramid, whose coarser levels are filtered as previews */
+	uint8_t *pixels;
+	int stride;
+	int w, h;
+	Pyramid pyramid;
+
+	/* Images large enough to get previews and tiles */
+	int is_large;
+
+	/* Latest request. Results of older generations are dropped */
+	char pending[FILTERJOB_MAX_NAME];
+	int has_pending;
+	SDL_atomic_t generation;
+
+	/* Copy of the next source, swapped with `pixels` by the thread before it takes a request */
+	uint8_t *staged;
+	int has_staged;
+
+	/* Incremented by the thread whenever it swaps in a new source */
+	SDL_atomic_t source_serial;
+
+	/* Results which aren't taken by the UI thread yet, oldest first */
+	FilterJobResult *results, *results_tail;
+
+	/**
+	 * Tiles of large images (tile_done is NULL for small ones). Local filters are
+	 * applied tile by tile, starting with the tiles in the viewport.
+	 */
+	int tile_cols, tile_rows;
+	uint8_t *tile_done;
+	SDL_Rect viewport;
+
+	/* Pyramid level drawn by the viewer, it is filtered right after the quick preview */
+	int display_level;
+
+	/* SDL event pushed when a result is ready */
+	Uint32 event_type;
+
+	int quit;
+} FilterWorker;
+
+/**
+ * Starts a background worker which filters copies of the given 32-bit bitmap,
+ * so the UI thread never waits for a filter. An event of `event_type` is pushed
+ * whenever a result can be taken with filterjob_take_result().
+ */
+RETCODE filterjob_create(const void *pixels, int stride, int w, int h, Uint32 event_type, FilterWorker **out);
+
+/* Stops the worker (waiting for the filter in progress) and frees it */
+void filterjob_destroy(FilterWorker **worker);
+
+/**
+ * Requests a filter (matrix or operation name). The request supersedes the one in
+ * progress: its remaining stages are skipped and its results are never returned.
+ * Returns the generation of the request.
+ */
+uint32_t filterjob_submit(FilterWorker *worker, const char *filter_name);
+
+/* Supersedes the request in progress without starting a new one */
+void filterjob_cancel(FilterWorker *worker);
+
+/**
+ * Replaces the source image (of the same size) with a copy of the given bitmap, so
+ * the next filters are applied to it. The request in progress is superseded; the copy
+ * is swapped in when the thread is done with it, without the caller waiting, and an
+ * event is pushed then (source_serial changes).
+ */
+RETCODE filterjob_set_source(FilterWorker *worker, const void *pixels, int stride);
+
+/**
+ * Sets the visible area of the image and the pyramid level it is drawn from.
+ * Tiles inside the area are filtered first, then the tiles around it and
+ * finally the rest of the image.
+ */
+void filterjob_set_viewport(FilterWorker *worker, const SDL_Rect *visible, int level);
+
+/* Area of the image covered by a tile */
+void filterjob_tile_rect(const FilterWorker *worker, int index, SDL_Rect *rect);
+
+/**
+ * Takes the oldest pending result of the latest request. Returns RC_FALSE if there
+ * is none. The result must be freed with filterjob_free_result().
+ */
+RETCODE filterjob_take_result(FilterWorker *worker, FilterJobResult **out);
+
+void filterjob_free_result(FilterJobResult *result);
+
+#endif /* FILTERJOB_H_ */
@@ -8,14 +8,83 @@
 #include <malloc.h>
 #include <string.h>
 #include "filters.h"
+#include "trace.h"
+#include "memtrack.h"
+#include "autotune.h"
 
 #define CLAMP(x, a, b) if(x < a) x = a; else if (x > b) x = b;
 #define bytes_per_pixel 4
 
-Filter2D *filter_list;
-int filter_count;
+/* Most nonzero taps applied by the sparse variant, matrices with more use the generic one */
+#define FILTER_MAX_TAPS 225
+
+/* Open addressing table from names to ids, at least twice as large as the names */
+typedef struct {
+	const char *name;
+	int id;
+} FilterSlot;
+
+typedef struct {
+	FilterSlot *slots;
+	int size;
+} FilterIndex;
+
+/* Registered matrices, the id of a matrix is its index. Guarded by filter_lock */
+static Filter2D **filter_list;
+static int filter_count;
+static FilterIndex filter_index;
+static int filter_generation;
+static SDL_SpinLock filter_lock;
+
+/* Copies of the built-in matrices and of the ones loaded from kernel files */
+static Filter2D **filter_builtins;
+static int filter_builtin_count, filter_builtin_capacity;
+static Filter2D **filter_loaded;
+static int filter_loaded_count;
+
+/* Replaced matrices, other threads may still be applying them */
+static Filter2D **filter_retired;
+static int filter_retired_count, filter_retired_capacity;
+
+static FilterOp *filter_op_list;
+static int filter_op_count;
+static FilterIndex filter_op_index;
+
+static const char *filter_edge_names[FILTER_EDGE_COUNT] = {"wrap", "clamp", "mirror"};
+
+/* Coordinate of the pixel read for `v` on an axis of `n` pixels */
+static inline int filter_edge_coord(int v, int n, FilterEdge edge)
+{
+	if(v >= 0 && v < n) {
+		return v;
+	}
+
+	if(edge == FILTER_EDGE_CLAMP) {
+		return v < 0 ? 0 : n - 1;
+	}
+
+	if(edge == FILTER_EDGE_MIRROR) {
+		int period = 2 * (n - 1);
+
+		if(period == 0) return 0;
+
+		v %= period;
+		if(v < 0) v += period;
+
+		return v < n ? v : period - v;
+	}
+
+	return (v % n + n) % n;
+}
 
 RETCODE filter_apply(void *src, void *dst, int stride, int w, int h, Filter2D *filter)
+{
+	SDL_Rect rect = {0, 0, w, h};
+
+	return filter_apply_rect(src, dst, stride, w, h, &rect, filter);
+}
+
+RETCODE filter_apply_rect(void *src, void *dst, int stride, int w, int h, const SDL_Rect *rect, Filter2D *filter)
 {
 	int i, j, x, y;
 
@@ -28,20 +97,20 @@ RETCODE filter_apply(void *src, void *dst, int stride, int w, int h, Filter2D *f
 	int filter_hw = filter->w / 2;
 	int filter_hh = filter->h / 2;
 
-	for(j=0; j<h; j++) {
+	for(j=rect->y; j<rect->y + rect->h; j++) {
 		uint8_t *d_line = dst + stride * j;
 
-		for(i=0; i<w; i++) {
+		for(i=rect->x; i<rect->x + rect->w; i++) {
 			int32_t product[bytes_per_pixel] = {0, 0, 0, 1};
 
 			/* Apply the convulation matrix and store the result in product[] */
 			for(y=-filter_hh; y<=filter_hh; y++) {
-				/* Calculate source pixel's scanline, by wrapping the overbound indices */
-				uint8_t *fy_src = src + (((j + y) + h) % h) * stride;
+				/* Calculate source pixel's scanline, the overbound indices are handled by the edge mode */
+				uint8_t *fy_src = src + filter_edge_coord(j + y, h, filter->edge) * stride;
 
 				for(x=-filter_hw; x<=filter_hw; x++) {
 					/* Calculate source pixel's address */
-					uint8_t *fx_src = fy_src + (((x + i) + w) % w) * bytes_per_pixel;
+					uint8_t *fx_src = fy_src + filter_edge_coord(x + i, w, filter->edge) * bytes_per_pixel;
 
 					int filter_x = x + filter_hw;
 					int filter_y = y + filter_hh;
@@ -54,10 +123,10 @@ RETCODE filter_apply(void *src, void *dst, int stride, int w, int h, Filter2D *f
 				}
 			}
 
-			/* Divide the product by the common divisor */
-			product[0] /= filter->divisor;
-			product[1] /= filter->divisor;
-			product[2] /= filter->divisor;
+			/* Divide the product by the common divisor and add the offset */
+			product[0] = product[0] / filter->divisor + filter->offset;
+			product[1] = product[1] / filter->divisor + filter->offset;
+			product[2] = product[2] / filter->divisor + filter->offset;
 
 			CLAMP(product[0], 0, 255);
 			CLAMP(product[1], 0, 255);
@@ -77,43 +146,609 @@ RETCODE filter_apply(void *src, void *dst, int stride, int w, int h, Filter2D *f
 	return RC_OK;
 }
 
-RETCODE filter_find_by_name(const char *name, Filter2D **out)
+/**
+ * Applies only the nonzero taps of the plan, in the order filter_apply_rect() adds them,
+ * so the sums are rounded the same way. Away from the edges the taps are fixed offsets
+ * from the pixel and the edge mode isn't needed.
+ */
+static RETCODE filter_apply_rect_sparse(void *src, void *dst, int stride, int w, int h, const SDL_Rect *rect, Filter2D *filter)
 {
-	int i;
+	int offsets[FILTER_MAX_TAPS];
+	const FilterPlan *plan;
+	int i, j, t;
+	RETCODE rc;
+
+	rc = filter_get_plan(filter, &plan);
+	if(failed(rc)) return rc;
+
+	if(plan->taps > FILTER_MAX_TAPS) {
+		return filter_apply_rect(src, dst, stride, w, h, rect, filter);
+	}
+
+	int filter_hw = filter->w / 2;
+	int filter_hh = filter->h / 2;
+
+	for(t=0; t<plan->taps; t++) {
+		offsets[t] = plan->dy[t] * stride + plan->dx[t] * bytes_per_pixel;
+	}
+
+	for(j=rect->y; j<rect->y + rect->h; j++) {
+		uint8_t *d_line = (uint8_t*)dst + stride * j;
+		int inner_row = j >= filter_hh && j < h - filter_hh;
+
+		for(i=rect->x; i<rect->x + rect->w; i++) {
+			int32_t product[bytes_per_pixel] = {0, 0, 0, 1};
+
+			if(inner_row && i >= filter_hw && i < w - filter_hw) {
+				const uint8_t *center = (const uint8_t*)src + (size_t)j * stride + i * bytes_per_pixel;
+
+				for(t=0; t<plan->taps; t++) {
+					const uint8_t *s_pixel = center + offsets[t];
+
+					product[0] += s_pixel[1] * plan->weights[t];
+					product[1] += s_pixel[2] * plan->weights[t];
+					product[2] += s_pixel[3] * plan->weights[t];
+				}
+			}else {
+				for(t=0; t<plan->taps; t++) {
+					const uint8_t *s_pixel = (const uint8_t*)src + filter_edge_coord(j + plan->dy[t], h, filter->edge) * stride +
+							filter_edge_coord(i + plan->dx[t], w, filter->edge) * bytes_per_pixel;
+
+					product[0] += s_pixel[1] * plan->weights[t];
+					product[1] += s_pixel[2] * plan->weights[t];
+					product[2] += s_pixel[3] * plan->weights[t];
+				}
+			}
+
+			product[0] = product[0] / filter->divisor + filter->offset;
+			product[1] = product[1] / filter->divisor + filter->offset;
+			product[2] = product[2] / filter->divisor + filter->offset;
+
+			CLAMP(product[0], 0, 255);
+			CLAMP(product[1], 0, 255);
+			CLAMP(product[2], 0, 255);
+
+			uint8_t *d_pixel = d_line + i * bytes_per_pixel;
+			d_pixel[1] = (uint8_t)product[0];
+			d_pixel[2] = (uint8_t)product[1];
+			d_pixel[3] = (uint8_t)product[2];
+		}
+	}
 
-	for(i=0; i<filter_count; i++) {
-		if(strcmp(filter_list[i].name, name) != 0)
-			continue;
+	return RC_OK;
+}
+
+RETCODE filter_apply_rect_variant(void *src, void *dst, int stride, int w, int h, const SDL_Rect *rect, Filter2D *filter, FilterVariant variant)
+{
+	if(variant == FILTER_VARIANT_SPARSE) {
+		return filter_apply_rect_sparse(src, dst, stride, w, h, rect, filter);
+	}
+
+	return filter_apply_rect(src, dst, stride, w, h, rect, filter);
+}
+
+const char *filter_variant_name(FilterVariant variant)
+{
+	return variant == FILTER_VARIANT_SPARSE ? "sparse" : "generic";
+}
 
-		*out = &filter_list[i];
+const char *filter_edge_name(FilterEdge edge)
+{
+	return edge >= 0 && edge < FILTER_EDGE_COUNT ? filter_edge_names[edge] : "unknown";
+}
+
+RETCODE filter_get_plan(Filter2D *filter, const FilterPlan **out)
+{
+	int x, y, taps = 0;
+
+	FilterPlan *plan = SDL_AtomicGetPtr((void**)&filter->plan);
+	if(plan) {
+		*out = plan;
 		return RC_OK;
 	}
 
-	return RC_FAIL;
+	if(filter->w <= 0 || filter->h <= 0 || filter->w % 2 == 0 || filter->h % 2 == 0 || filter->divisor == 0) {
+		return RC_INVALIDARG;
+	}
+
+	const int count = filter->w * filter->h;
+
+	/* The tap arrays follow the plan in the same block */
+	plan = memtrack_malloc(MEM_FILTER, sizeof(FilterPlan) + (size_t)count * (2 * sizeof(int) + sizeof(float)));
+	if(!plan) return RC_OUTOFMEM;
+
+	plan->weights = (float*)(plan + 1);
+	plan->dx = (int*)(plan->weights + count);
+	plan->dy = plan->dx + count;
+
+	int filter_hw = filter->w / 2;
+	int filter_hh = filter->h / 2;
+
+	for(y=-filter_hh; y<=filter_hh; y++) {
+		for(x=-filter_hw; x<=filter_hw; x++) {
+			float weight = filter->matrix[(y + filter_hh) * filter->w + x + filter_hw];
+
+			if(weight == 0) continue;
+
+			plan->dx[taps] = x;
+			plan->dy[taps] = y;
+			plan->weights[taps] = weight;
+			taps++;
+		}
+	}
+
+	plan->taps = taps;
+
+	/* Another thread may have compiled it meanwhile, then its plan is used */
+	if(!SDL_AtomicCASPtr((void**)&filter->plan, NULL, plan)) {
+		memtrack_free(plan);
+		plan = SDL_AtomicGetPtr((void**)&filter->plan);
+	}
+
+	*out = plan;
+	return RC_OK;
+}
+
+static uint32_t filter_hash_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while(*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* Builds a new index of the names, the old one is freed on success */
+static RETCODE filter_index_build(FilterIndex *index, const char **names, int count)
+{
+	int i, size = 16;
+
+	while(size < count * 2) size *= 2;
+
+	FilterSlot *slots = memtrack_calloc(MEM_FILTER, size, sizeof(FilterSlot));
+	if(!slots) return RC_OUTOFMEM;
+
+	for(i=0; i<count; i++) {
+		uint32_t k = filter_hash_name(names[i]) & (size - 1);
+
+		/* The first of equal names wins, like it did in a linear search */
+		while(slots[k].name && strcmp(slots[k].name, names[i]) != 0) {
+			k = (k + 1) & (size - 1);
+		}
+
+		if(!slots[k].name) {
+			slots[k].name = names[i];
+			slots[k].id = i;
+		}
+	}
+
+	memtrack_free(index->slots);
+	index->slots = slots;
+	index->size = size;
+
+	return RC_OK;
+}
+
+static int filter_index_find(const FilterIndex *index, const char *name)
+{
+	if(!index->size) {
+		return -1;
+	}
+
+	uint32_t k = filter_hash_name(name) & (index->size - 1);
+
+	for(; index->slots[k].name; k = (k + 1) & (index->size - 1)) {
+		if(strcmp(index->slots[k].name, name) == 0) return index->slots[k].id;
+	}
+
+	return -1;
+}
+
+/* Grows an array of matrices to hold at least `count` */
+static RETCODE filter_reserve(Filter2D ***list, int *capacity, int count)
+{
+	int new_capacity = *capacity ? *capacity : 16;
+
+	while(new_capacity < count) new_capacity *= 2;
+
+	if(new_capacity != *capacity) {
+		Filter2D **p = memtrack_realloc(MEM_FILTER, *list, new_capacity * sizeof(Filter2D*));
+
+		if(!p) return RC_OUTOFMEM;
+
+		*list = p;
+		*capacity = new_capacity;
+	}
+
+	return RC_OK;
+}
+
+static RETCODE filter_push(Filter2D ***list, int *count, int *capacity, Filter2D *filter)
+{
+	RETCODE rc = filter_reserve(list, capacity, *count + 1);
+
+	if(succeeded(rc)) {
+		(*list)[(*count)++] = filter;
+	}
+
+	return rc;
+}
+
+/* Copies a matrix into a single block (without the plan) */
+static Filter2D *filter_copy(const Filter2D *src)
+{
+	const size_t count = (size_t)src->w * src->h;
+	const size_t name_len = strlen(src->name) + 1;
+
+	Filter2D *f = memtrack_malloc(MEM_FILTER, sizeof(Filter2D) + count * sizeof(float) + name_len);
+	if(!f) return NULL;
+
+	*f = *src;
+	f->matrix = (float*)(f + 1);
+	f->name = (char*)(f->matrix + count);
+	f->plan = NULL;
+
+	memcpy(f->matrix, src->matrix, count * sizeof(float));
+	memcpy(f->name, src->name, name_len);
+
+	return f;
+}
+
+static void filter_destroy(Filter2D *f)
+{
+	if(f) {
+		memtrack_free(f->plan);
+		memtrack_free(f);
+	}
+}
+
+static int filter_same(const Filter2D *a, const Filter2D *b)
+{
+	return strcmp(a->name, b->name) == 0 && a->w == b->w && a->h == b->h && a->divisor == b->divisor &&
+			a->offset == b->offset && a->edge == b->edge && memcmp(a->matrix, b->matrix, (size_t)a->w * a->h * sizeof(float)) == 0;
+}
+
+static int filter_find_in(Filter2D *const *list, int count, const char *name)
+{
+	int i;
+
+	for(i=0; i<count; i++) {
+		if(strcmp(list[i]->name, name) == 0) return i;
+	}
+
+	return -1;
+}
+
+static int filter_contains(Filter2D *const *list, int count, const Filter2D *filter)
+{
+	int i;
+
+	for(i=0; i<count; i++) {
+		if(list[i] == filter) return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Only one thread may call it at a time (the one polling the kernel files); the lookups
+ * from other threads only wait for the lists to be swapped.
+ */
+RETCODE filter_set_loaded(const Filter2D *filters, int count)
+{
+	Filter2D **loaded = NULL, **list = NULL, **changed = NULL;
+	int loaded_count = 0, loaded_capacity = 0;
+	int list_count = 0, list_capacity = 0;
+	int changed_count = 0, changed_capacity = 0, removed_count = 0;
+	const char **names = NULL;
+	FilterIndex index = {NULL, 0};
+	int swapped = 0;
+	RETCODE rc = RC_OK;
+	int i, j;
+
+	for(i=0; i<count; i++) {
+		if(filter_find_in(loaded, loaded_count, filters[i].name) >= 0) {
+			rc = RC_INVALIDARG;
+			goto cleanup;
+		}
+
+		/* A matrix which didn't change keeps its object, with the plan and the tuning */
+		j = filter_find_in(filter_loaded, filter_loaded_count, filters[i].name);
+
+		Filter2D *f = j >= 0 && filter_same(filter_loaded[j], &filters[i]) ? filter_loaded[j] : filter_copy(&filters[i]);
+		if(!f) {
+			rc = RC_OUTOFMEM;
+			goto cleanup;
+		}
+
+		rc = filter_push(&loaded, &loaded_count, &loaded_capacity, f);
+		if(failed(rc)) {
+			if(j < 0 || f != filter_loaded[j]) filter_destroy(f);
+			goto cleanup;
+		}
+	}
+
+	/* Loaded matrices take the place of the built-in ones with their names */
+	for(i=0; i<filter_builtin_count && succeeded(rc); i++) {
+		j = filter_find_in(loaded, loaded_count, filter_builtins[i]->name);
+		rc = filter_push(&list, &list_count, &list_capacity, j >= 0 ? loaded[j] : filter_builtins[i]);
+	}
+
+	for(i=0; i<loaded_count && succeeded(rc); i++) {
+		if(filter_find_in(filter_builtins, filter_builtin_count, loaded[i]->name) < 0) {
+			rc = filter_push(&list, &list_count, &list_capacity, loaded[i]);
+		}
+	}
+
+	/* New matrices and the ones they replaced lose their tuning */
+	for(i=0; i<loaded_count && succeeded(rc); i++) {
+		if(!filter_contains(filter_loaded, filter_loaded_count, loaded[i])) {
+			rc = filter_push(&changed, &changed_count, &changed_capacity, loaded[i]);
+		}
+	}
+
+	for(i=0; i<filter_loaded_count && succeeded(rc); i++) {
+		if(!filter_contains(loaded, loaded_count, filter_loaded[i])) {
+			rc = filter_push(&changed, &changed_count, &changed_capacity, filter_loaded[i]);
+			removed_count++;
+		}
+	}
+
+	/* Nothing may fail after the swap */
+	if(succeeded(rc)) {
+		rc = filter_reserve(&filter_retired, &filter_retired_capacity, filter_retired_count + removed_count);
+	}
+
+	if(succeeded(rc)) {
+		names = memtrack_malloc(MEM_FILTER, (list_count + 1) * sizeof(char*));
+		if(!names) rc = RC_OUTOFMEM;
+	}
+
+	if(failed(rc)) goto cleanup;
+
+	for(i=0; i<list_count; i++) {
+		names[i] = list[i]->name;
+	}
+
+	rc = filter_index_build(&index, names, list_count);
+	if(failed(rc)) goto cleanup;
+
+	SDL_AtomicLock(&filter_lock);
+
+	Filter2D **old_list = filter_list;
+	FilterIndex old_index = filter_index;
+
+	filter_list = list;
+	filter_count = list_count;
+	filter_index = index;
+	filter_generation++;
+
+	SDL_AtomicUnlock(&filter_lock);
+
+	list = old_list;
+	index = old_index;
+	swapped = 1;
+
+	/* Other threads may still be applying the removed matrices, they are freed on exit */
+	for(i=0; i<filter_loaded_count; i++) {
+		if(!filter_contains(loaded, loaded_count, filter_loaded[i])) {
+			filter_retired[filter_retired_count++] = filter_loaded[i];
+		}
+	}
+
+	Filter2D **old_loaded = filter_loaded;
+	filter_loaded = loaded;
+	filter_loaded_count = loaded_count;
+	loaded = old_loaded;
+
+	for(i=0; i<changed_count; i++) {
+		autotune_forget(changed[i]->name);
+	}
+
+cleanup:
+	/* Copies made for a failed update */
+	for(i=0; !swapped && i<loaded_count; i++) {
+		if(!filter_contains(filter_loaded, filter_loaded_count, loaded[i])) filter_destroy(loaded[i]);
+	}
+
+	memtrack_free(loaded);
+	memtrack_free(list);
+	memtrack_free(changed);
+	memtrack_free(names);
+	memtrack_free(index.slots);
+
+	return rc;
+}
+
+int filter_get_generation(void)
+{
+	SDL_AtomicLock(&filter_lock);
+	int generation = filter_generation;
+	SDL_AtomicUnlock(&filter_lock);
+
+	return generation;
+}
+
+RETCODE filter_find_by_name(const char *name, Filter2D **out)
+{
+	SDL_AtomicLock(&filter_lock);
+
+	int id = filter_index_find(&filter_index, name);
+	if(id >= 0) *out = filter_list[id];
+
+	SDL_AtomicUnlock(&filter_lock);
+
+	return id >= 0 ? RC_OK : RC_FAIL;
 }
 
 RETCODE filter_find_by_id(const int id, Filter2D **out)
 {
-	if(id < 0 || id >= filter_count) {
+	RETCODE rc = RC_FAIL;
+
+	SDL_AtomicLock(&filter_lock);
+
+	if(id >= 0 && id < filter_count) {
+		*out = filter_list[id];
+		rc = RC_OK;
+	}
+
+	SDL_AtomicUnlock(&filter_lock);
+
+	return rc;
+}
+
+RETCODE filter_op_find_by_id(const int id, FilterOp **out)
+{
+	if(id < 0 || id >= filter_op_count) {
 		return RC_FAIL;
 	}
 
-	*out = &filter_list[id];
+	*out = &filter_op_list[id];
 	return RC_OK;
 }
 
-RETCODE filter_apply_to_texture(SDL_Texture *src, SDL_Texture *dst, const char *filter_name)
+RETCODE filter_op_find_by_name(const char *name, FilterOp **out)
 {
+	int id = filter_index_find(&filter_op_index, name);
+
+	if(id < 0) {
+		return RC_FAIL;
+	}
+
+	*out = &filter_op_list[id];
+	return RC_OK;
+}
+
+RETCODE filter_apply_by_name(void *src, void *dst, int stride, int w, int h, const char *filter_name)
+{
+	TRACE_SCOPE("filter");
+
 	RETCODE rc;
-	Filter2D *filter;
+	Filter2D *filter = NULL;
+	FilterOp *op = NULL;
 
-	/* Find the filter */
+	/* Find the filter. If there isn't a matrix with this name, look for an operation */
 	rc = filter_find_by_name(filter_name, &filter);
-	if(failed(rc)) return rc;
+	if(failed(rc)) {
+		rc = filter_op_find_by_name(filter_name, &op);
+		if(failed(rc)) return rc;
+	}
 
-	if(!src || !dst || !filter) {
+	if(!src || !dst) {
 		return RC_INVALIDARG;
 	}
+
+	/* The variant measured fastest on this machine, filter_apply() stays the reference */
+	if(filter) {
+		return autotune_apply(src, dst, stride, w, h, filter);
+	}
+
+	return op->apply(src, dst, stride, w, h);
+}
+
+RETCODE filter_is_local(const char *filter_name)
+{
+	Filter2D *filter;
+	FilterOp *op;
+
+	/* Convolution matrices only need their own extent around each pixel */
+	if(succeeded(filter_find_by_name(filter_name, &filter))) {
+		return RC_OK;
+	}
+
+	if(succeeded(filter_op_find_by_name(filter_name, &op)) && op->is_local) {
+		return RC_OK;
+	}
+
+	return RC_FALSE;
+}
+
+/* Applies a local operation to a copy of the tile with an apron around it (wrapped at the edges) */
+static RETCODE filter_op_apply_rect(void *src, void *dst, int stride, int w, int h, const SDL_Rect *rect, FilterOp *op)
+{
+	int i, j;
+	const int cw = rect->w + 2 * op->apron;
+	const int ch = rect->h + 2 * op->apron;
+	const int crop_stride = cw * bytes_per_pixel;
+
+	uint8_t *crop_src = memtrack_malloc(MEM_FILTER, (size_t)crop_stride * ch);
+	uint8_t *crop_dst = memtrack_malloc(MEM_FILTER, (size_t)crop_stride * ch);
+	RETCODE rc;
+
+	if(!crop_src || !crop_dst) {
+		rc = RC_OUTOFMEM;
+		goto cleanup;
+	}
+
+	for(j=0; j<ch; j++) {
+		const uint8_t *s_line = (uint8_t*)src + (size_t)(((rect->y - op->apron + j) % h + h) % h) * stride;
+		uint32_t *c_line = (uint32_t*)(crop_src + (size_t)j * crop_stride);
+
+		for(i=0; i<cw; i++) {
+			c_line[i] = ((const uint32_t*)s_line)[((rect->x - op->apron + i) % w + w) % w];
+		}
+	}
+
+	/* Operations don't touch the alpha component */
+	memcpy(crop_dst, crop_src, (size_t)crop_stride * ch);
+
+	rc = op->apply(crop_src, crop_dst, crop_stride, cw, ch);
+	if(failed(rc)) goto cleanup;
+
+	for(j=0; j<rect->h; j++) {
+		memcpy((uint8_t*)dst + (size_t)(rect->y + j) * stride + rect->x * bytes_per_pixel,
+				crop_dst + (size_t)(op->apron + j) * crop_stride + op->apron * bytes_per_pixel, rect->w * bytes_per_pixel);
+	}
+
+cleanup:
+	memtrack_free(crop_src);
+	memtrack_free(crop_dst);
+
+	return rc;
+}
+
+RETCODE filter_apply_rect_by_name(void *src, void *dst, int stride, int w, int h, const SDL_Rect *rect, const char *filter_name)
+{
+	TRACE_SCOPE("filter_tile");
+
+	Filter2D *filter = NULL;
+	FilterOp *op = NULL;
+
+	if(!src || !dst || !rect || rect->x < 0 || rect->y < 0 || rect->w <= 0 || rect->h <= 0 ||
+			rect->x + rect->w > w || rect->y + rect->h > h) {
+		return RC_INVALIDARG;
+	}
+
+	/* Tiles are already spread over the threads, only the kernel is chosen (never tuned from here) */
+	if(succeeded(filter_find_by_name(filter_name, &filter))) {
+		AutotuneChoice choice;
+
+		autotune_lookup(filter, w, h, &choice);
+		return filter_apply_rect_variant(src, dst, stride, w, h, rect, filter, choice.variant);
+	}
+
+	if(failed(filter_op_find_by_name(filter_name, &op))) {
+		return RC_FAIL;
+	}
+
+	if(!op->is_local) {
+		return RC_NOTIMPL;
+	}
+
+	return filter_op_apply_rect(src, dst, stride, w, h, rect, op);
+}
+
+RETCODE filter_apply_to_texture(SDL_Texture *src, SDL_Texture *dst, const char *filter_name)
+{
+	RETCODE rc;
+
+	if(!src || !dst) {
+		return RC_INVALIDARG;
+	}
+
 	void *src_pixels, *dst_pixels;
 	int src_stride, dst_stride;
 
@@ -133,7 +768,7 @@ RETCODE filter_apply_to_texture(SDL_Texture *src, SDL_Texture *dst, const char *
 		goto unlock;
 	}
 
-	rc = filter_apply(src_pixels, dst_pixels, src_stride, width, height, filter);
+	rc = filter_apply_by_name(src_pixels, dst_pixels, src_stride, width, height, filter_name);
 
 unlock:
 	SDL_UnlockTexture(src);
@@ -146,7 +781,8 @@ RETCODE copy_texture(SDL_Texture *src, SDL_Texture *dst)
 {
 	void *src_pixels, *dst_pixels;
 	int src_stride, dst_stride;
-	RETCODE rc;
+	RETCODE rc = RC_OK;
+	int j;
 
 	if(SDL_LockTexture(src, NULL, &src_pixels, &src_stride) != 0) {
 		return RC_FAIL;
@@ -165,10 +801,14 @@ RETCODE copy_texture(SDL_Texture *src, SDL_Texture *dst)
 	}
 
 	if(format != SDL_PIXELFORMAT_RGBA8888) {
-		return RC_INVALIDARG;
+		rc = RC_INVALIDARG;
+		goto unlock;
 	}
 
-	memcpy(dst_pixels, src_pixels, height * width * 4);
+	/* The pitch of a locked texture may be larger than its width */
+	for(j=0; j<height; j++) {
+		memcpy((uint8_t*)dst_pixels + (size_t)j * dst_stride, (const uint8_t*)src_pixels + (size_t)j * src_stride, (size_t)width * 4);
+	}
 
 unlock:
 	SDL_UnlockTexture(src);
@@ -320,21 +960,61 @@ static const Filter2D sobel_v33 = {
 
 void __attribute__((constructor)) filter_init()
 {
-	filter_list = calloc(10, sizeof(Filter2D));
-	filter_count = 0;
+	static const Filter2D *builtins[] = {&blur33, &blur55, &blur77, &gausblur33, &edge33, &sharpen33, &emboss33, &sobel_h33, &sobel_v33};
+	const char *op_names[10];
+	int i;
+
+	/* The built-in matrices are copied like the loaded ones, so they can keep a plan */
+	for(i=0; i<(int)(sizeof(builtins) / sizeof(builtins[0])); i++) {
+		Filter2D *f = filter_copy(builtins[i]);
+
+		if(!f || failed(filter_push(&filter_builtins, &filter_builtin_count, &filter_builtin_capacity, f))) {
+			filter_destroy(f);
+			break;
+		}
+	}
 
-	filter_list[filter_count++] = blur33;
-	filter_list[filter_count++] = blur55;
-	filter_list[filter_count++] = blur77;
-	filter_list[filter_count++] = gausblur33;
-	filter_list[filter_count++] = edge33;
-	filter_list[filter_count++] = sharpen33;
-	filter_list[filter_count++] = emboss33;
-	filter_list[filter_count++] = sobel_h33;
-	filter_list[filter_count++] = sobel_v33;
+	filter_set_loaded(NULL, 0);
+
+	filter_op_list = memtrack_calloc(MEM_FILTER, 10, sizeof(FilterOp));
+	filter_op_count = 0;
+
+	/* Register gradient operators */
+	extern FilterOp gradient_sobel_op;
+	extern FilterOp gradient_scharr_op;
+	extern FilterOp gradient_prewitt_op;
+	filter_op_list[filter_op_count++] = gradient_sobel_op;
+	filter_op_list[filter_op_count++] = gradient_scharr_op;
+	filter_op_list[filter_op_count++] = gradient_prewitt_op;
+
+	/* Register edge detectors */
+	extern FilterOp canny_op;
+	filter_op_list[filter_op_count++] = canny_op;
+
+	/* Register edge-preserving smoothing */
+	extern FilterOp bilateral_op;
+	filter_op_list[filter_op_count++] = bilateral_op;
+
+	for(i=0; i<filter_op_count; i++) {
+		op_names[i] = filter_op_list[i].name;
+	}
+
+	filter_index_build(&filter_op_index, op_names, filter_op_count);
 }
 
 void __attribute__((destructor)) filter_uninit()
 {
-	free(filter_list);
+	int i;
+
+	for(i=0; i<filter_builtin_count; i++) filter_destroy(filter_builtins[i]);
+	for(i=0; i<filter_loaded_count; i++) filter_destroy(filter_loaded[i]);
+	for(i=0; i<filter_retired_count; i++) filter_destroy(filter_retired[i]);
+
+	memtrack_free(filter_builtins);
+	memtrack_free(filter_loaded);
+	memtrack_free(filter_retired);
+	memtrack_free(filter_list);
+	memtrack_free(filter_index.slots);
+	memtrack_free(filter_op_list);
+	memtrack_free(filter_op_index.slots);
 }
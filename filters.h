@@ -12,6 +12,27 @@
 #include <SDL2/SDL.h>
 #include "common.h"
 
+/* How a convolution matrix reads the pixels outside the bitmap */
+typedef enum {
+	/* From the opposite edge (the default) */
+	FILTER_EDGE_WRAP = 0,
+
+	/* The nearest edge pixel is repeated */
+	FILTER_EDGE_CLAMP,
+
+	/* Reflected at the edge pixel, which isn't repeated */
+	FILTER_EDGE_MIRROR,
+
+	FILTER_EDGE_COUNT,
+} FilterEdge;
+
+/* Nonzero taps of a matrix in the order they are added, compiled on first use */
+typedef struct FilterPlan {
+	int taps;
+	int *dx, *dy;
+	float *weights;
+} FilterPlan;
+
 typedef struct {
 	/* Name of the filter */
 	char *name;
@@ -23,13 +44,86 @@ typedef struct {
 	/* Common divisor */
 	float divisor;
 
+	/* Added to the components after the division */
+	float offset;
+
+	FilterEdge edge;
+
 	/* Convolution matrix */
 	float *matrix;
+
+	/* Set by filter_get_plan(), registered matrices are never changed after it */
+	FilterPlan *plan;
 } Filter2D;
 
+/* Routine of a filter which isn't expressed as a convolution matrix */
+typedef RETCODE (*FilterProc)(void *src, void *dst, int stride, int w, int h);
+
+typedef struct {
+	/* Name of the operation */
+	char *name;
+
+	/* Processes the whole 32-bit bitmap from src into dst */
+	FilterProc apply;
+
+	/**
+	 * Set if an output pixel depends only on the source pixels at most `apron` pixels
+	 * away, so the operation can be applied to tiles of the bitmap. Operations which
+	 * look at the whole image (e.g. automatic thresholds) leave it 0.
+	 */
+	int is_local;
+	int apron;
+} FilterOp;
+
+/* Implementations of a convolution matrix, all giving the same result as filter_apply() */
+typedef enum {
+	/* Every tap with wrapped coordinates (the reference) */
+	FILTER_VARIANT_GENERIC = 0,
+
+	/* Only the nonzero taps, and the coordinates are wrapped only near the edges */
+	FILTER_VARIANT_SPARSE,
+
+	FILTER_VARIANT_COUNT,
+} FilterVariant;
+
+/**
+ * Registered matrices are never freed before the process exits, so a pointer returned
+ * by filter_find_by_name() or filter_find_by_id() stays valid even after the matrix is
+ * replaced by filter_set_loaded().
+ */
 RETCODE filter_find_by_name(const char *name, Filter2D **out);
 RETCODE filter_find_by_id(const int id, Filter2D **out);
+
+/**
+ * Replaces the matrices loaded from kernel files with `count` new ones (copied). A loaded
+ * matrix with the name of a built-in one takes its place (and id), the others follow
+ * the built-in ones. Matrices which didn't change are kept, so their plans and tuning too.
+ */
+RETCODE filter_set_loaded(const Filter2D *filters, int count);
+
+/* Incremented whenever the registered matrices change, so lookups kept elsewhere can be dropped */
+int filter_get_generation(void);
+
+/* Compiles the plan of a matrix the first time it's needed */
+RETCODE filter_get_plan(Filter2D *filter, const FilterPlan **out);
+
+const char *filter_edge_name(FilterEdge edge);
+RETCODE filter_op_find_by_id(const int id, FilterOp **out);
+RETCODE filter_op_find_by_name(const char *name, FilterOp **out);
 RETCODE filter_apply(void *src, void *dst, int stride, int w, int h, Filter2D *filter);
+RETCODE filter_apply_rect(void *src, void *dst, int stride, int w, int h, const SDL_Rect *rect, Filter2D *filter);
+RETCODE filter_apply_rect_variant(void *src, void *dst, int stride, int w, int h, const SDL_Rect *rect, Filter2D *filter, FilterVariant variant);
+const char *filter_variant_name(FilterVariant variant);
+RETCODE filter_apply_by_name(void *src, void *dst, int stride, int w, int h, const char *filter_name);
+
+/* Returns RC_OK if the filter can be applied to a part of the bitmap, RC_FALSE if it needs the whole one */
+RETCODE filter_is_local(const char *filter_name);
+
+/**
+ * Filters only the pixels inside `rect`, reading their neighbours from the whole
+ * bitmap, so the result matches the same area of filter_apply_by_name().
+ */
+RETCODE filter_apply_rect_by_name(void *src, void *dst, int stride, int w, int h, const SDL_Rect *rect, const char *filter_name);
 RETCODE filter_apply_to_texture(SDL_Texture *src, SDL_Texture *dst, const char *filter_name);
 RETCODE copy_texture(SDL_Texture *src, SDL_Texture *dst);
 
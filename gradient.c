@@ -0,0 +1,400 @@
+/*
+ * gradient.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <string.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "gradient.h"
+#include "filters.h"
+#include "threadpool.h"
+#include "memtrack.h"
+
+#define bytes_per_pixel 4
+
+/* Private output format used by gradient_apply(): gray magnitude written to the R/G/B components */
+#define GRADIENT_FMT_GRAY32	100
+
+/* tan(22.5) and tan(67.5) used for quantizing the orientation into sectors */
+#define TAN_22_5	0.41421356f
+#define TAN_67_5	2.41421356f
+
+typedef struct {
+	/* Source is either 32-bit bitmap or a float plane */
+	const uint8_t *src;
+	int stride;
+	int is_plane;
+	int w, h;
+
+	/* Smoothing weights applied perpendicular to the derivative */
+	float s[3];
+	float scale;
+	int fast_magnitude;
+	int mag_format;
+	int orient_format;
+
+	uint8_t *mag;
+	int mag_stride;
+	uint8_t *orient;
+	int orient_stride;
+
+	int band_h;
+	RETCODE rc;
+} GradientJob;
+
+/* Loads source row y (wrapped) into out[1..w] and pads out[0] and out[w+1] by wrapping */
+static void gradient_fetch_row(const GradientJob *job, int y, float *out)
+{
+	int i;
+
+	y = (y + job->h) % job->h;
+	const uint8_t *line = job->src + (size_t)y * job->stride;
+
+	if(job->is_plane) {
+		memcpy(out + 1, line, job->w * sizeof(float));
+	}else {
+		const float third = 1.0f / 3;
+
+		for(i=0; i<job->w; i++) {
+			const uint8_t *p = line + i * bytes_per_pixel;
+			out[i + 1] = (float)(p[1] + p[2] + p[3]) * third;
+		}
+	}
+
+	out[0] = out[job->w];
+	out[job->w + 1] = out[1];
+}
+
+/* Computes gx/gy for one row out of three consecutive padded source rows */
+static void gradient_derivatives(const GradientJob *job, const float *r0, const float *r1, const float *r2,
+		float *v, float *d, float *gx, float *gy)
+{
+	int i, n = job->w + 2;
+	const float s0 = job->s[0], s1 = job->s[1], s2 = job->s[2];
+
+	/* Vertical smoothing (for gx) and vertical difference (for gy) */
+	for(i=0; i<n; i++) {
+		v[i] = s0 * r0[i] + s1 * r1[i] + s2 * r2[i];
+		d[i] = r2[i] - r0[i];
+	}
+
+	/* Horizontal difference (for gx) and horizontal smoothing (for gy) */
+	for(i=0; i<job->w; i++) {
+		gx[i] = v[i + 2] - v[i];
+		gy[i] = s0 * d[i] + s1 * d[i + 1] + s2 * d[i + 2];
+	}
+}
+
+static inline float gradient_magnitude(float gx, float gy, int fast)
+{
+	return fast ? fabsf(gx) + fabsf(gy) : sqrtf(gx * gx + gy * gy);
+}
+
+/* Writes the magnitude of one row in the requested format */
+static void gradient_store_magnitude(const GradientJob *job, const float *gx, const float *gy, uint8_t *out)
+{
+	int i = 0;
+	const int w = job->w;
+	const float scale = job->scale;
+
+#ifdef __SSE2__
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	const __m128 vscale = _mm_set1_ps(scale);
+	const __m128 u8_max = _mm_set1_ps(255.0f);
+	const __m128 u16_max = _mm_set1_ps(65535.0f);
+	const __m128i u16_bias = _mm_set1_epi32(32768);
+	const __m128i u16_flip = _mm_set1_epi16((short)0x8000);
+
+	for(; i + 4 <= w; i += 4) {
+		__m128 x = _mm_loadu_ps(gx + i);
+		__m128 y = _mm_loadu_ps(gy + i);
+		__m128 m;
+
+		if(job->fast_magnitude) {
+			m = _mm_add_ps(_mm_andnot_ps(sign_mask, x), _mm_andnot_ps(sign_mask, y));
+		}else {
+			m = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+		}
+
+		m = _mm_mul_ps(m, vscale);
+
+		switch(job->mag_format) {
+		case GRADIENT_FMT_F32:
+			_mm_storeu_ps((float*)out + i, m);
+			break;
+
+		case GRADIENT_FMT_U16: {
+			__m128i q = _mm_sub_epi32(_mm_cvtps_epi32(_mm_min_ps(m, u16_max)), u16_bias);
+			q = _mm_xor_si128(_mm_packs_epi32(q, q), u16_flip);
+			_mm_storel_epi64((__m128i*)((uint16_t*)out + i), q);
+			break;
+		}
+
+		case GRADIENT_FMT_U8: {
+			__m128i q = _mm_cvtps_epi32(_mm_min_ps(m, u8_max));
+			q = _mm_packus_epi16(_mm_packs_epi32(q, q), q);
+			int32_t packed = _mm_cvtsi128_si32(q);
+			memcpy(out + i, &packed, 4);
+			break;
+		}
+
+		case GRADIENT_FMT_GRAY32: {
+			/* Replicate each magnitude byte into the R/G/B components, keeping alpha untouched */
+			__m128i q = _mm_cvtps_epi32(_mm_min_ps(m, u8_max));
+			uint8_t *p = out + i * bytes_per_pixel;
+			int k;
+
+			for(k=0; k<4; k++, p += bytes_per_pixel) {
+				uint8_t b = (uint8_t)_mm_cvtsi128_si32(q);
+				p[1] = p[2] = p[3] = b;
+				q = _mm_srli_si128(q, 4);
+			}
+			break;
+		}
+		}
+	}
+#endif
+
+	/* Scalar path (and the tail of the vector path) */
+	for(; i<w; i++) {
+		float m = gradient_magnitude(gx[i], gy[i], job->fast_magnitude) * scale;
+
+		switch(job->mag_format) {
+		case GRADIENT_FMT_F32:
+			((float*)out)[i] = m;
+			break;
+
+		case GRADIENT_FMT_U16:
+			((uint16_t*)out)[i] = (uint16_t)lrintf(m > 65535.0f ? 65535.0f : m);
+			break;
+
+		case GRADIENT_FMT_U8:
+			out[i] = (uint8_t)lrintf(m > 255.0f ? 255.0f : m);
+			break;
+
+		case GRADIENT_FMT_GRAY32: {
+			uint8_t *p = out + i * bytes_per_pixel;
+			p[1] = p[2] = p[3] = (uint8_t)lrintf(m > 255.0f ? 255.0f : m);
+			break;
+		}
+		}
+	}
+}
+
+static void gradient_store_orientation(const GradientJob *job, const float *gx, const float *gy, uint8_t *out)
+{
+	int i;
+
+	if(job->orient_format == GRADIENT_FMT_F32) {
+		for(i=0; i<job->w; i++) {
+			((float*)out)[i] = atan2f(gy[i], gx[i]);
+		}
+
+		return;
+	}
+
+	/* Quantize the direction in four sectors */
+	for(i=0; i<job->w; i++) {
+		float ax = fabsf(gx[i]), ay = fabsf(gy[i]);
+		uint8_t sector;
+
+		if(ay <= ax * TAN_22_5) {
+			sector = 0;
+		}else if(ay >= ax * TAN_67_5) {
+			sector = 2;
+		}else {
+			sector = (gx[i] > 0) == (gy[i] > 0) ? 1 : 3;
+		}
+
+		if(job->orient_format == GRADIENT_FMT_U16) {
+			((uint16_t*)out)[i] = sector;
+		}else {
+			out[i] = sector;
+		}
+	}
+}
+
+static void gradient_band_proc(void *arg, int band)
+{
+	GradientJob *job = arg;
+	int j, n = job->w + 2;
+	int y0 = band * job->band_h;
+	int y1 = y0 + job->band_h > job->h ? job->h : y0 + job->band_h;
+
+	float *scratch = memtrack_malloc(MEM_FILTER, 7 * n * sizeof(float));
+	if(!scratch) {
+		job->rc = RC_OUTOFMEM;
+		return;
+	}
+
+	float *rows[3] = {scratch, scratch + n, scratch + 2 * n};
+	float *v = scratch + 3 * n, *d = scratch + 4 * n;
+	float *gx = scratch + 5 * n, *gy = scratch + 6 * n;
+
+	gradient_fetch_row(job, y0 - 1, rows[0]);
+	gradient_fetch_row(job, y0, rows[1]);
+
+	for(j=y0; j<y1; j++) {
+		gradient_fetch_row(job, j + 1, rows[2]);
+		gradient_derivatives(job, rows[0], rows[1], rows[2], v, d, gx, gy);
+
+		if(job->mag) {
+			gradient_store_magnitude(job, gx, gy, job->mag + (size_t)j * job->mag_stride);
+		}
+
+		if(job->orient) {
+			gradient_store_orientation(job, gx, gy, job->orient + (size_t)j * job->orient_stride);
+		}
+
+		/* Rotate the row window */
+		float *t = rows[0];
+		rows[0] = rows[1];
+		rows[1] = rows[2];
+		rows[2] = t;
+	}
+
+	memtrack_free(scratch);
+}
+
+static RETCODE gradient_run(GradientJob *job, const GradientParams *params)
+{
+	/* Perpendicular smoothing weights and their sum for each operator */
+	static const float weights[3][4] = {
+		{1, 2, 1, 4},		/* Sobel */
+		{3, 10, 3, 16},		/* Scharr */
+		{1, 1, 1, 3},		/* Prewitt */
+	};
+
+	if(!job->src || job->w <= 0 || job->h <= 0 || !params) {
+		return RC_INVALIDARG;
+	}
+
+	if(params->op < GRADIENT_SOBEL || params->op > GRADIENT_PREWITT) {
+		return RC_INVALIDARG;
+	}
+
+	if(!job->mag && !job->orient) {
+		return RC_INVALIDARG;
+	}
+
+	job->s[0] = weights[params->op][0];
+	job->s[1] = weights[params->op][1];
+	job->s[2] = weights[params->op][2];
+	job->scale = params->scale != 0 ? params->scale : 1.0f / weights[params->op][3];
+	job->fast_magnitude = params->fast_magnitude;
+	job->orient_format = job->orient ? params->orient_format : GRADIENT_FMT_NONE;
+	job->rc = RC_OK;
+
+	if(!job->mag) {
+		job->mag_format = GRADIENT_FMT_NONE;
+	}
+
+	int bands = threadpool_split_rows(job->h, &job->band_h);
+	threadpool_parallel_for(bands, gradient_band_proc, job);
+
+	return job->rc;
+}
+
+RETCODE gradient_compute(void *src, int stride, int w, int h, const GradientParams *params,
+		void *mag, int mag_stride, void *orient, int orient_stride)
+{
+	GradientJob job = {
+		.src = src,
+		.stride = stride,
+		.is_plane = 0,
+		.w = w,
+		.h = h,
+		.mag = mag,
+		.mag_stride = mag_stride,
+		.mag_format = params ? params->mag_format : GRADIENT_FMT_NONE,
+		.orient = orient,
+		.orient_stride = orient_stride,
+	};
+
+	return gradient_run(&job, params);
+}
+
+RETCODE gradient_compute_plane(const float *src, int stride, int w, int h, const GradientParams *params,
+		void *mag, int mag_stride, void *orient, int orient_stride)
+{
+	GradientJob job = {
+		.src = (const uint8_t*)src,
+		.stride = stride,
+		.is_plane = 1,
+		.w = w,
+		.h = h,
+		.mag = mag,
+		.mag_stride = mag_stride,
+		.mag_format = params ? params->mag_format : GRADIENT_FMT_NONE,
+		.orient = orient,
+		.orient_stride = orient_stride,
+	};
+
+	return gradient_run(&job, params);
+}
+
+RETCODE gradient_apply(void *src, void *dst, int stride, int w, int h, GradientOperator op)
+{
+	GradientParams params = {
+		.op = op,
+		.mag_format = GRADIENT_FMT_U8,
+		.orient_format = GRADIENT_FMT_NONE,
+		.fast_magnitude = 0,
+		.scale = 0,
+	};
+
+	GradientJob job = {
+		.src = src,
+		.stride = stride,
+		.is_plane = 0,
+		.w = w,
+		.h = h,
+		.mag = dst,
+		.mag_stride = stride,
+		.mag_format = GRADIENT_FMT_GRAY32,
+	};
+
+	return gradient_run(&job, &params);
+}
+
+static RETCODE gradient_sobel_apply(void *src, void *dst, int stride, int w, int h)
+{
+	return gradient_apply(src, dst, stride, w, h, GRADIENT_SOBEL);
+}
+
+static RETCODE gradient_scharr_apply(void *src, void *dst, int stride, int w, int h)
+{
+	return gradient_apply(src, dst, stride, w, h, GRADIENT_SCHARR);
+}
+
+static RETCODE gradient_prewitt_apply(void *src, void *dst, int stride, int w, int h)
+{
+	return gradient_apply(src, dst, stride, w, h, GRADIENT_PREWITT);
+}
+
+FilterOp gradient_sobel_op = {
+	.name = "gradient_sobel",
+	.apply = gradient_sobel_apply,
+	.is_local = 1,
+	.apron = 1,
+};
+
+FilterOp gradient_scharr_op = {
+	.name = "gradient_scharr",
+	.apply = gradient_scharr_apply,
+	.is_local = 1,
+	.apron = 1,
+};
+
+FilterOp gradient_prewitt_op = {
+	.name = "gradient_prewitt",
+	.apply = gradient_prewitt_apply,
+	.is_local = 1,
+	.apron = 1,
+};
@@ -0,0 +1,69 @@
+/*
+ * gradient.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef GRADIENT_H_
+#define GRADIENT_H_
+
+#include <stdint.h>
+#include "common.h"
+
+typedef enum {
+	GRADIENT_SOBEL = 0,
+	GRADIENT_SCHARR,
+	GRADIENT_PREWITT,
+} GradientOperator;
+
+typedef enum {
+	GRADIENT_FMT_NONE = 0,
+	GRADIENT_FMT_U8,
+	GRADIENT_FMT_U16,
+	GRADIENT_FMT_F32,
+} GradientFormat;
+
+typedef struct {
+	/* Which pair of derivative kernels to use */
+	GradientOperator op;
+
+	/* Format of the magnitude output */
+	GradientFormat mag_format;
+
+	/**
+	 * Format of the orientation output. F32 stores the angle in radians [-pi..pi],
+	 * U8 stores the direction sector 0..3 (0, 45, 90 and 135 degrees), which is
+	 * what non-maximum suppression needs.
+	 */
+	GradientFormat orient_format;
+
+	/* Approximate the magnitude with |gx|+|gy| instead of sqrt(gx^2 + gy^2) */
+	int fast_magnitude;
+
+	/**
+	 * Multiplier applied to the magnitude before it is stored. When zero, the
+	 * derivatives are normalized by the kernel's weight, so a step edge of
+	 * height 255 produces a magnitude of 255.
+	 */
+	float scale;
+} GradientParams;
+
+/**
+ * Computes both derivatives of a 32-bit bitmap in one pass and writes the
+ * gradient magnitude (and optionally the orientation) to separate planes.
+ * The gray level of a pixel is the average of its R/G/B components and edge
+ * pixels are handled through wrapping, same as filter_apply().
+ * `orient` may be NULL if the orientation is not needed.
+ */
+RETCODE gradient_compute(void *src, int stride, int w, int h, const GradientParams *params,
+		void *mag, int mag_stride, void *orient, int orient_stride);
+
+/* Same as gradient_compute(), but the source is a single channel float plane (stride is in bytes) */
+RETCODE gradient_compute_plane(const float *src, int stride, int w, int h, const GradientParams *params,
+		void *mag, int mag_stride, void *orient, int orient_stride);
+
+/* Writes the Sobel/Scharr/Prewitt gradient magnitude of src as a gray 32-bit bitmap */
+RETCODE gradient_apply(void *src, void *dst, int stride, int w, int h, GradientOperator op);
+
+#endif /* GRADIENT_H_ */
@@ -8,11 +8,13 @@
 #include <string.h>
 #include "histogram.h"
 #include "common.h"
+#include "trace.h"
 
 RETCODE histogram_extract(SDL_Texture *src, Histogram *r, Histogram *g, Histogram *b)
 {
 	uint32_t format;
 	int acc, w, h;
+	RETCODE rc;
 
 	if(SDL_QueryTexture(src, &format, &acc, &w, &h) != 0) {
 		return RC_FAIL;
@@ -29,23 +31,36 @@ RETCODE histogram_extract(SDL_Texture *src, Histogram *r, Histogram *g, Histogra
 		return RC_FAIL;
 	}
 
+	rc = histogram_extract_bitmap(pixels, stride, w, h, r, g, b);
+
+	SDL_UnlockTexture(src);
+	return rc;
+}
+
+RETCODE histogram_extract_bitmap(const uint8_t *pixels, int stride, int w, int h, Histogram *r, Histogram *g, Histogram *b)
+{
+	TRACE_SCOPE("histogram");
+
 	int i, j;
-	memset((void*)r->values, 0, 256);
-	memset((void*)g->values, 0, 256);
-	memset((void*)b->values, 0, 256);
+
+	if(!pixels || !r || !g || !b) {
+		return RC_INVALIDARG;
+	}
+
+	memset((void*)r->values, 0, sizeof(r->values));
+	memset((void*)g->values, 0, sizeof(g->values));
+	memset((void*)b->values, 0, sizeof(b->values));
 
 	for(j=0; j<h; j++) {
-		uint8_t *pix = pixels + j * stride;
+		const uint8_t *pix = pixels + j * stride;
 
-		for(i=0; i<w; i++) {
+		for(i=0; i<w; i++, pix += 4) {
 			r->values[pix[1]]++;
 			g->values[pix[2]]++;
 			b->values[pix[3]]++;
 		}
 	}
 
-	SDL_UnlockTexture(src);
-
 	/* Evaluate effective range and average */
 	histogram_evaluate_statistics(r);
 	histogram_evaluate_statistics(g);
@@ -54,6 +69,28 @@ RETCODE histogram_extract(SDL_Texture *src, Histogram *r, Histogram *g, Histogra
 	return RC_OK;
 }
 
+RETCODE histogram_extract_plane(const uint8_t *plane, int stride, int w, int h, Histogram *out)
+{
+	int i, j;
+
+	if(!plane || !out) {
+		return RC_INVALIDARG;
+	}
+
+	memset((void*)out->values, 0, sizeof(out->values));
+
+	for(j=0; j<h; j++) {
+		const uint8_t *pix = plane + j * stride;
+
+		for(i=0; i<w; i++) {
+			out->values[pix[i]]++;
+		}
+	}
+
+	histogram_evaluate_statistics(out);
+	return RC_OK;
+}
+
 RETCODE histogram_evaluate_statistics(Histogram *h)
 {
 	int i;
@@ -85,6 +122,31 @@ RETCODE histogram_evaluate_statistics(Histogram *h)
 		h->avg += h->values[i];
 	}
 
+	h->val_count = h->avg;
 	h->avg /= 256;
 	return RC_OK;
 }
+
+int32_t histogram_percentile(const Histogram *h, float p)
+{
+	int i;
+	int64_t total = 0, acc = 0;
+
+	for(i=0; i<256; i++) {
+		total += h->values[i];
+	}
+
+	if(total == 0) {
+		return 0;
+	}
+
+	for(i=0; i<256; i++) {
+		acc += h->values[i];
+
+		if(acc >= (int64_t)(p * total)) {
+			return i;
+		}
+	}
+
+	return 255;
+}
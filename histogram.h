@@ -30,6 +30,14 @@ typedef struct {
 } Histogram;
 
 RETCODE histogram_extract(SDL_Texture *src, Histogram *r, Histogram *g, Histogram *b);
+RETCODE histogram_extract_bitmap(const uint8_t *pixels, int stride, int w, int h, Histogram *r, Histogram *g, Histogram *b);
+RETCODE histogram_extract_plane(const uint8_t *plane, int stride, int w, int h, Histogram *out);
 RETCODE histogram_evaluate_statistics(Histogram *h);
 
+/**
+ * Returns the smallest value v for which at least `p` (0..1) of the measured
+ * values are less than or equal to v.
+ */
+int32_t histogram_percentile(const Histogram *h, float p);
+
 #endif /* HISTOGRAM_H_ */
@@ -0,0 +1,422 @@
+/*
+ * history.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <string.h>
+#include "history.h"
+#include "bufpool.h"
+#include "trace.h"
+#include "memtrack.h"
+
+#define bytes_per_pixel 4
+
+/* Every slot of the spill file holds a whole tile */
+#define HISTORY_SLOT_SIZE	((int64_t)HISTORY_TILE_SIZE * HISTORY_TILE_SIZE * bytes_per_pixel)
+
+/* Seeks to a slot of the spill file, which grows past 2 GB; long is 32 bits on Windows */
+static int history_seek_slot(FILE *f, int slot)
+{
+	int64_t offset = slot * HISTORY_SLOT_SIZE;
+
+#ifdef _WIN32
+	return _fseeki64(f, offset, SEEK_SET);
+#else
+	return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+/* Area of the image covered by a tile */
+static void history_tile_rect(const History *h, int index, int *x, int *y, int *tw, int *th)
+{
+	*x = (index % h->cols) * HISTORY_TILE_SIZE;
+	*y = (index / h->cols) * HISTORY_TILE_SIZE;
+	*tw = h->w - *x < HISTORY_TILE_SIZE ? h->w - *x : HISTORY_TILE_SIZE;
+	*th = h->h - *y < HISTORY_TILE_SIZE ? h->h - *y : HISTORY_TILE_SIZE;
+}
+
+/* Copies a tile out of a bitmap, its rows are stored packed */
+static HistoryTile *history_tile_new(History *h, int index, const uint8_t *src, int stride)
+{
+	int x, y, tw, th, j;
+
+	history_tile_rect(h, index, &x, &y, &tw, &th);
+
+	HistoryTile *t = memtrack_calloc(MEM_CACHE, 1, sizeof(HistoryTile));
+	if(!t) return NULL;
+
+	t->pixels = bufpool_alloc((size_t)tw * th * bytes_per_pixel);
+	if(!t->pixels) {
+		memtrack_free(t);
+		return NULL;
+	}
+
+	for(j=0; j<th; j++) {
+		memcpy(t->pixels + (size_t)j * tw * bytes_per_pixel, src + (size_t)(y + j) * stride + (size_t)x * bytes_per_pixel, (size_t)tw * bytes_per_pixel);
+	}
+
+	t->refs = 1;
+	t->slot = -1;
+	h->bytes += (size_t)tw * th * bytes_per_pixel;
+	h->tiles_stored++;
+
+	return t;
+}
+
+static void history_tile_release(History *h, HistoryTile *t, int index)
+{
+	int x, y, tw, th;
+
+	if(!t || --t->refs > 0) {
+		return;
+	}
+
+	if(t->pixels) {
+		history_tile_rect(h, index, &x, &y, &tw, &th);
+		h->bytes -= (size_t)tw * th * bytes_per_pixel;
+		bufpool_free(t->pixels);
+	}
+
+	/* The slot can hold another tile now */
+	if(t->slot >= 0) {
+		if(h->free_count == h->free_capacity) {
+			int capacity = h->free_capacity ? 2 * h->free_capacity : 64;
+			int *slots = memtrack_realloc(MEM_CACHE, h->free_slots, capacity * sizeof(int));
+
+			if(slots) {
+				h->free_slots = slots;
+				h->free_capacity = capacity;
+			}
+		}
+
+		if(h->free_count < h->free_capacity) {
+			h->free_slots[h->free_count++] = t->slot;
+		}
+	}
+
+	memtrack_free(t);
+}
+
+/* Returns the packed pixels of a tile, reading a spilled one into the scratch buffer */
+static const uint8_t *history_tile_pixels(History *h, HistoryTile *t, int index)
+{
+	int x, y, tw, th;
+
+	if(t->pixels) {
+		return t->pixels;
+	}
+
+	history_tile_rect(h, index, &x, &y, &tw, &th);
+
+	if(history_seek_slot(h->spill, t->slot) != 0 ||
+			fread(h->scratch, (size_t)tw * th * bytes_per_pixel, 1, h->spill) != 1) {
+		return NULL;
+	}
+
+	h->tiles_reloaded++;
+	return h->scratch;
+}
+
+/* Writes a tile to the spill file and frees its pixels */
+static RETCODE history_tile_spill(History *h, HistoryTile *t, int index)
+{
+	int x, y, tw, th;
+
+	if(!h->spill) {
+		h->spill = tmpfile();
+		if(!h->spill) return RC_FAIL;
+	}
+
+	history_tile_rect(h, index, &x, &y, &tw, &th);
+
+	if(t->slot < 0) {
+		t->slot = h->free_count > 0 ? h->free_slots[--h->free_count] : h->spill_slots++;
+	}
+
+	if(history_seek_slot(h->spill, t->slot) != 0 ||
+			fwrite(t->pixels, (size_t)tw * th * bytes_per_pixel, 1, h->spill) != 1) {
+		return RC_FAIL;
+	}
+
+	bufpool_free(t->pixels);
+	t->pixels = NULL;
+
+	h->bytes -= (size_t)tw * th * bytes_per_pixel;
+	h->tiles_spilled++;
+
+	return RC_OK;
+}
+
+/* Spills the tiles of a snapshot until the budget is met. Pinned tiles are skipped unless `force` is set */
+static RETCODE history_spill_snapshot(History *h, HistorySnapshot *s, int force)
+{
+	int i;
+
+	for(i=0; i<h->cols * h->rows && h->bytes > h->budget; i++) {
+		HistoryTile *t = s->tiles[i];
+
+		if(t->pixels && (force || !t->pinned)) {
+			RETCODE rc = history_tile_spill(h, t, i);
+			if(failed(rc)) return rc;
+		}
+	}
+
+	return RC_OK;
+}
+
+/**
+ * Spills tiles, starting with the snapshots farthest from the current one,
+ * until the resident tiles fit the budget.
+ */
+static RETCODE history_enforce_budget(History *h)
+{
+	RETCODE rc = RC_OK;
+	int i, d;
+
+	if(h->bytes <= h->budget || h->count == 0) {
+		return RC_OK;
+	}
+
+	HistorySnapshot *current = h->steps[h->current];
+
+	for(i=0; i<h->cols * h->rows; i++) {
+		current->tiles[i]->pinned = 1;
+	}
+
+	for(d=h->count - 1; d>0 && h->bytes > h->budget && succeeded(rc); d--) {
+		if(h->current - d >= 0) {
+			rc = history_spill_snapshot(h, h->steps[h->current - d], 0);
+		}
+
+		if(succeeded(rc) && h->current + d < h->count) {
+			rc = history_spill_snapshot(h, h->steps[h->current + d], 0);
+		}
+	}
+
+	/* The current image alone exceeds the budget */
+	if(succeeded(rc)) {
+		rc = history_spill_snapshot(h, current, 1);
+	}
+
+	for(i=0; i<h->cols * h->rows; i++) {
+		current->tiles[i]->pinned = 0;
+	}
+
+	return rc;
+}
+
+static void history_free_snapshot(History *h, HistorySnapshot *s)
+{
+	int i;
+
+	if(!s) {
+		return;
+	}
+
+	for(i=0; s->tiles && i<h->cols * h->rows; i++) {
+		history_tile_release(h, s->tiles[i], i);
+	}
+
+	memtrack_free(s->tiles);
+	memtrack_free(s);
+}
+
+RETCODE history_init(History *h, int w, int height, size_t budget)
+{
+	if(w <= 0 || height <= 0) {
+		return RC_INVALIDARG;
+	}
+
+	memset(h, 0, sizeof(History));
+
+	h->w = w;
+	h->h = height;
+	h->cols = (w + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE;
+	h->rows = (height + HISTORY_TILE_SIZE - 1) / HISTORY_TILE_SIZE;
+	h->budget = budget ? budget : HISTORY_DEFAULT_BUDGET;
+
+	h->scratch = memtrack_malloc(MEM_CACHE, HISTORY_SLOT_SIZE);
+	if(!h->scratch) return RC_OUTOFMEM;
+
+	return RC_OK;
+}
+
+void history_free(History *h)
+{
+	int i;
+
+	for(i=0; i<h->count; i++) {
+		history_free_snapshot(h, h->steps[i]);
+		h->steps[i] = NULL;
+	}
+
+	if(h->spill) {
+		fclose(h->spill);
+	}
+
+	memtrack_free(h->free_slots);
+	memtrack_free(h->scratch);
+
+	memset(h, 0, sizeof(History));
+}
+
+/* Checks if a region of a bitmap equals the packed pixels of a tile */
+static int history_tile_equals(const History *h, int index, const uint8_t *tile, const uint8_t *src, int stride)
+{
+	int x, y, tw, th, j;
+
+	history_tile_rect(h, index, &x, &y, &tw, &th);
+
+	for(j=0; j<th; j++) {
+		if(memcmp(tile + (size_t)j * tw * bytes_per_pixel, src + (size_t)(y + j) * stride + (size_t)x * bytes_per_pixel, (size_t)tw * bytes_per_pixel) != 0) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+RETCODE history_push(History *h, const void *pixels, int stride, const char *label)
+{
+	TRACE_SCOPE("history_push");
+
+	int i;
+	int n = h->cols * h->rows;
+
+	HistorySnapshot *s = memtrack_calloc(MEM_CACHE, 1, sizeof(HistorySnapshot));
+	if(!s) return RC_OUTOFMEM;
+
+	s->tiles = memtrack_calloc(MEM_CACHE, n, sizeof(HistoryTile*));
+	if(!s->tiles) {
+		memtrack_free(s);
+		return RC_OUTOFMEM;
+	}
+
+	HistorySnapshot *prev = h->count ? h->steps[h->current] : NULL;
+
+	for(i=0; i<n; i++) {
+		/* Filters often leave parts of the image as they were, those tiles are shared */
+		if(prev) {
+			const uint8_t *tile = history_tile_pixels(h, prev->tiles[i], i);
+
+			if(tile && history_tile_equals(h, i, tile, pixels, stride)) {
+				s->tiles[i] = prev->tiles[i];
+				s->tiles[i]->refs++;
+				h->tiles_shared++;
+				continue;
+			}
+		}
+
+		s->tiles[i] = history_tile_new(h, i, pixels, stride);
+
+		if(!s->tiles[i]) {
+			history_free_snapshot(h, s);
+			return RC_OUTOFMEM;
+		}
+	}
+
+	strncpy(s->label, label ? label : "", HISTORY_MAX_LABEL - 1);
+	s->id = ++h->next_id;
+
+	/* The snapshots which could be redone are lost */
+	for(i=h->current + 1; i<h->count; i++) {
+		history_free_snapshot(h, h->steps[i]);
+		h->steps[i] = NULL;
+	}
+
+	if(h->count) {
+		h->count = h->current + 1;
+	}
+
+	/* Drop the oldest snapshot after the first one to make room, so the first can always be restored */
+	if(h->count == HISTORY_MAX_STEPS) {
+		history_free_snapshot(h, h->steps[1]);
+		memmove(&h->steps[1], &h->steps[2], (HISTORY_MAX_STEPS - 2) * sizeof(HistorySnapshot*));
+		h->count--;
+	}
+
+	h->steps[h->count] = s;
+	h->current = h->count++;
+
+	/* A failed spill leaves the tiles in memory, the history is still valid */
+	if(failed(history_enforce_budget(h))) {
+		printf("Can't spill the undo history to a temporary file, it is kept in memory.\n");
+	}
+
+	return RC_OK;
+}
+
+RETCODE history_jump(History *h, int step)
+{
+	if(step < 0 || step >= h->count) {
+		return RC_INVALIDARG;
+	}
+
+	h->current = step;
+	return RC_OK;
+}
+
+RETCODE history_undo(History *h)
+{
+	if(h->current == 0) {
+		return RC_FALSE;
+	}
+
+	return history_jump(h, h->current - 1);
+}
+
+RETCODE history_redo(History *h)
+{
+	if(h->current + 1 >= h->count) {
+		return RC_FALSE;
+	}
+
+	return history_jump(h, h->current + 1);
+}
+
+RETCODE history_get(History *h, void *pixels, int stride)
+{
+	TRACE_SCOPE("history_get");
+
+	int i, j, x, y, tw, th;
+
+	if(h->count == 0) {
+		return RC_FAIL;
+	}
+
+	HistorySnapshot *s = h->steps[h->current];
+
+	for(i=0; i<h->cols * h->rows; i++) {
+		const uint8_t *tile = history_tile_pixels(h, s->tiles[i], i);
+		if(!tile) return RC_FAIL;
+
+		history_tile_rect(h, i, &x, &y, &tw, &th);
+
+		for(j=0; j<th; j++) {
+			memcpy((uint8_t*)pixels + (size_t)(y + j) * stride + (size_t)x * bytes_per_pixel, tile + (size_t)j * tw * bytes_per_pixel, (size_t)tw * bytes_per_pixel);
+		}
+	}
+
+	return RC_OK;
+}
+
+uint32_t history_current_id(const History *h)
+{
+	return h->count ? h->steps[h->current]->id : 0;
+}
+
+const char *history_current_label(const History *h)
+{
+	return h->count ? h->steps[h->current]->label : "";
+}
+
+void history_print_stats(const History *h)
+{
+	printf("Undo history: %d steps, %llu tiles stored, %llu shared, %llu spilled, %llu read back, %.1f of %.1f MB in memory.\n",
+			h->count, (unsigned long long)h->tiles_stored, (unsigned long long)h->tiles_shared,
+			(unsigned long long)h->tiles_spilled, (unsigned long long)h->tiles_reloaded,
+			h->bytes / 1048576.0, h->budget / 1048576.0);
+}
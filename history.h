@@ -0,0 +1,108 @@
+/*
+ * history.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "common.h"
+
+/* Side of the tiles which are shared between the snapshots */
+#define HISTORY_TILE_SIZE	256
+
+/* Most snapshots kept; the oldest ones after the first are dropped first */
+#define HISTORY_MAX_STEPS	64
+
+/* Memory held by tiles when 0 is passed to history_init(), the rest is spilled to a temporary file */
+#define HISTORY_DEFAULT_BUDGET	(256 * 1024 * 1024)
+
+/* Longest label of a snapshot */
+#define HISTORY_MAX_LABEL	64
+
+typedef struct {
+	/* Number of snapshots using the tile */
+	int refs;
+
+	/* Pixels in memory (NULL if spilled) and the slot in the spill file (-1 if none) */
+	uint8_t *pixels;
+	int slot;
+
+	/* Set while the tile belongs to the current snapshot, which is never spilled first */
+	int pinned;
+} HistoryTile;
+
+typedef struct {
+	/* Grid of tiles, which may be shared with other snapshots */
+	HistoryTile **tiles;
+
+	/* Unique identity of the snapshot and the operation which produced it */
+	uint32_t id;
+	char label[HISTORY_MAX_LABEL];
+} HistorySnapshot;
+
+typedef struct {
+	/* Size of the image and its tile grid */
+	int w, h;
+	int cols, rows;
+
+	/* Snapshots, oldest first. Those after `current` can be redone */
+	HistorySnapshot *steps[HISTORY_MAX_STEPS];
+	int count;
+	int current;
+	uint32_t next_id;
+
+	/* Memory held by resident tiles and its limit */
+	size_t bytes;
+	size_t budget;
+
+	/* Temporary file with spilled tiles, in fixed-size slots, and the slots free for reuse */
+	FILE *spill;
+	int spill_slots;
+	int *free_slots;
+	int free_count, free_capacity;
+
+	/* Tile-sized buffer for comparing spilled tiles */
+	uint8_t *scratch;
+
+	/* Statistics */
+	uint64_t tiles_shared, tiles_stored, tiles_spilled, tiles_reloaded;
+} History;
+
+/* Prepares an empty history of w x h images. budget is in bytes (0 selects the default) */
+RETCODE history_init(History *h, int w, int height, size_t budget);
+
+/* Frees the snapshots and closes the spill file */
+void history_free(History *h);
+
+/**
+ * Adds a 32-bit bitmap as the new current snapshot, dropping the snapshots which
+ * could be redone. Tiles equal to the ones of the previous current snapshot are
+ * shared with it instead of being copied.
+ */
+RETCODE history_push(History *h, const void *pixels, int stride, const char *label);
+
+/* Steps back or forward. Return RC_FALSE if there is no snapshot in that direction */
+RETCODE history_undo(History *h);
+RETCODE history_redo(History *h);
+
+/* Makes a snapshot the current one (0 is the first one pushed, which is never dropped) */
+RETCODE history_jump(History *h, int step);
+
+/* Copies the current snapshot into a 32-bit bitmap, reading spilled tiles back as needed */
+RETCODE history_get(History *h, void *pixels, int stride);
+
+/* Identity of the current snapshot, 0 if there is none */
+uint32_t history_current_id(const History *h);
+
+/* Label of the current snapshot */
+const char *history_current_label(const History *h);
+
+void history_print_stats(const History *h);
+
+#endif /* HISTORY_H_ */
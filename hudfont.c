@@ -0,0 +1,108 @@
+/*
+ * hudfont.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <string.h>
+#include <ctype.h>
+#include "hudfont.h"
+
+/* Rows of the glyphs from the top, bit 4 is the leftmost pixel */
+static const uint8_t hudfont_glyphs[96][7] = {
+	['0' - ' '] = {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E},
+	['1' - ' '] = {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+	['2' - ' '] = {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F},
+	['3' - ' '] = {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},
+	['4' - ' '] = {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02},
+	['5' - ' '] = {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},
+	['6' - ' '] = {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E},
+	['7' - ' '] = {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+	['8' - ' '] = {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E},
+	['9' - ' '] = {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},
+
+	['A' - ' '] = {0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},
+	['B' - ' '] = {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E},
+	['C' - ' '] = {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E},
+	['D' - ' '] = {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C},
+	['E' - ' '] = {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F},
+	['F' - ' '] = {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},
+	['G' - ' '] = {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F},
+	['H' - ' '] = {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},
+	['I' - ' '] = {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E},
+	['J' - ' '] = {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C},
+	['K' - ' '] = {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},
+	['L' - ' '] = {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},
+	['M' - ' '] = {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11},
+	['N' - ' '] = {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},
+	['O' - ' '] = {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},
+	['P' - ' '] = {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10},
+	['Q' - ' '] = {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D},
+	['R' - ' '] = {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},
+	['S' - ' '] = {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E},
+	['T' - ' '] = {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+	['U' - ' '] = {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},
+	['V' - ' '] = {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04},
+	['W' - ' '] = {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A},
+	['X' - ' '] = {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},
+	['Y' - ' '] = {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04},
+	['Z' - ' '] = {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F},
+
+	['.' - ' '] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C},
+	[',' - ' '] = {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08},
+	[':' - ' '] = {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00},
+	['%' - ' '] = {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03},
+	['/' - ' '] = {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00},
+	['-' - ' '] = {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00},
+	['_' - ' '] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F},
+	['=' - ' '] = {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00},
+	['(' - ' '] = {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02},
+	[')' - ' '] = {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08},
+	['[' - ' '] = {0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E},
+	[']' - ' '] = {0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E},
+};
+
+void hudfont_draw(SDL_Renderer *renderer, int x, int y, int scale, const char *text)
+{
+	SDL_Rect rects[256];
+	int n = 0, row, bit;
+
+	for(; *text; text++, x += HUDFONT_CELL_W * scale) {
+		int c = toupper((unsigned char)*text);
+
+		if(c < ' ' || c > '~') {
+			continue;
+		}
+
+		const uint8_t *glyph = hudfont_glyphs[c - ' '];
+
+		for(row=0; row<7; row++) {
+			/* Runs of lit pixels in a row become one rectangle */
+			for(bit=4; bit>=0; bit--) {
+				if(!(glyph[row] & (1 << bit))) continue;
+
+				int run = 1;
+				while(bit - run >= 0 && (glyph[row] & (1 << (bit - run)))) run++;
+
+				SDL_Rect r = {x + (4 - bit) * scale, y + row * scale, run * scale, scale};
+				rects[n++] = r;
+				bit -= run - 1;
+
+				if(n == sizeof(rects) / sizeof(rects[0])) {
+					SDL_RenderFillRects(renderer, rects, n);
+					n = 0;
+				}
+			}
+		}
+	}
+
+	if(n > 0) {
+		SDL_RenderFillRects(renderer, rects, n);
+	}
+}
+
+int hudfont_width(const char *text, int scale)
+{
+	return (int)strlen(text) * HUDFONT_CELL_W * scale;
+}
@@ -0,0 +1,27 @@
+/*
+ * hudfont.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef HUDFONT_H_
+#define HUDFONT_H_
+
+#include <SDL2/SDL.h>
+
+/* Character cell at scale 1: a 5x7 glyph with a pixel of spacing */
+#define HUDFONT_CELL_W	6
+#define HUDFONT_CELL_H	8
+
+/**
+ * Draws `text` with the current draw color of the renderer, the top left corner at
+ * (x, y) and every font pixel `scale` pixels wide. Lowercase letters are drawn as
+ * capitals; characters without a glyph are left blank.
+ */
+void hudfont_draw(SDL_Renderer *renderer, int x, int y, int scale, const char *text);
+
+/* Width of `text` in pixels */
+int hudfont_width(const char *text, int scale);
+
+#endif /* HUDFONT_H_ */
@@ -8,98 +8,338 @@
 #include <stdio.h>
 #include <string.h>
 #include <malloc.h>
+#ifdef __linux__
+#include <fcntl.h>
+#endif
 
 #include "common.h"
 #include "imgutils.h"
+#include "trace.h"
+#include "memtrack.h"
 
 static IMGHandler *img_handler_arr;
 static int img_handler_len;
 
+/* Handlers by the first byte of their magic, chained through img_handler_next (-1 ends) */
+static int img_magic_first[256];
+static int *img_handler_next;
+
+static void imgutils_register(const IMGHandler *handler)
+{
+	int id = img_handler_len++;
+	uint8_t first = (uint8_t)handler->magic[0];
+
+	img_handler_arr[id] = *handler;
+	img_handler_next[id] = img_magic_first[first];
+	img_magic_first[first] = id;
+}
+
 void __attribute__((constructor)) imgutils_init(void)
 {
-	img_handler_arr = malloc(100 * sizeof(IMGHandler));
+	int i;
+
+	img_handler_arr = memtrack_malloc(MEM_CODEC, 100 * sizeof(IMGHandler));
+	img_handler_next = memtrack_malloc(MEM_CODEC, 100 * sizeof(int));
 	img_handler_len = 0;
 
+	for(i=0; i<256; i++) {
+		img_magic_first[i] = -1;
+	}
+
 	/* Register PGM image handler */
 	extern IMGHandler imgutils_pgm_handler;
-	img_handler_arr[img_handler_len++] = imgutils_pgm_handler;
+	imgutils_register(&imgutils_pgm_handler);
 
 	/* Register BMP handler */
 	extern IMGHandler imgutils_bmp_handler;
-	img_handler_arr[img_handler_len++] = imgutils_bmp_handler;
+	imgutils_register(&imgutils_bmp_handler);
+
+	/* Register QOI handler */
+	extern IMGHandler imgutils_qoi_handler;
+	imgutils_register(&imgutils_qoi_handler);
 }
 
 void __attribute__((destructor)) imgutils_finalize(void)
 {
-	free(img_handler_arr);
+	memtrack_free(img_handler_arr);
+	memtrack_free(img_handler_next);
 }
 
-RETCODE image_get_info(FILE *f, int32_t *format, int32_t *w, int32_t *h)
+/* Handler of a file starting with `head`, NULL if no magic matches */
+static IMGHandler *image_find_handler(const uint8_t *head, int len)
 {
-	int i;
-	RETCODE rc;
+	int id;
 
-	for(i=0; i<img_handler_len; i++) {
-		rc = img_handler_arr[i].image_test(f, format, w, h);
-		if(succeeded(rc)) return rc;
+	if(len <= 0) {
+		return NULL;
 	}
 
-	return RC_FAIL;
+	for(id=img_magic_first[head[0]]; id>=0; id=img_handler_next[id]) {
+		IMGHandler *handler = &img_handler_arr[id];
+
+		if(handler->magic_len <= len && memcmp(head, handler->magic, handler->magic_len) == 0) {
+			return handler;
+		}
+	}
+
+	return NULL;
 }
 
-RETCODE image_load(FILE *f, SDL_Texture *target)
+RETCODE image_reader_attach(FILE *f, IMGReader *r)
 {
-	int i;
+	uint8_t head[IMG_HEAD_SIZE];
+	long pos = ftell(f);
 	RETCODE rc;
 
-	for(i=0; i<img_handler_len; i++) {
-		/* Try if the current handler is able to handle this image file */
-		rc = img_handler_arr[i].image_test(f, NULL, NULL, NULL);
+	memset(r, 0, sizeof(*r));
 
-		if(succeeded(rc)) {
-			/* Since the handler has accepted the file, now try to load it */
-			rc = img_handler_arr[i].image_load(f, target);
-			if(failed(rc)) continue;
+	/* The first block is read once, the handler parses the header from memory */
+	int len = (int)fread(head, 1, sizeof(head), f);
 
-			return rc;
-		}
+	r->handler = image_find_handler(head, len);
+	if(!r->handler) {
+		return RC_INVALIDDATA;
 	}
 
-	return RC_FAIL;
+	rc = r->handler->image_parse(head, len, &r->header);
+	if(failed(rc)) return rc;
+
+	if(r->header.w <= 0 || r->header.h <= 0) {
+		return RC_INVALIDDATA;
+	}
+
+	/* Usually within the stdio buffer already filled */
+	if(fseek(f, pos + r->header.data_offset, SEEK_SET) != 0) {
+		return RC_FAIL;
+	}
+
+	r->f = f;
+	return RC_OK;
 }
 
-RETCODE image_load_from_file(char *filename, SDL_Texture *target)
+RETCODE image_reader_open(const char *filename, IMGReader *r)
 {
-	FILE *f;
+	RETCODE rc;
 
-	f = fopen(filename, "r");
+	/* Text formats are read in binary mode too, their parsers skip '\r' as whitespace */
+	FILE *f = fopen(filename, "rb");
 	if(!f) {
 		/* Failed to open file */
+		memset(r, 0, sizeof(*r));
 		return RC_FAIL;
 	}
 
-	RETCODE rc = image_load(f, target);
+	setvbuf(f, NULL, _IOFBF, IMG_READ_BUFFER);
+
+#ifdef __linux__
+	posix_fadvise(fileno(f), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	rc = image_reader_attach(f, r);
+	if(failed(rc)) {
+		fclose(f);
+		r->f = NULL;
+		return rc;
+	}
+
+	r->owns_file = 1;
+	return RC_OK;
+}
+
+RETCODE image_reader_load(IMGReader *r, void *pixels, int stride)
+{
+	TRACE_SCOPE("load");
+
+	if(!r->f) {
+		return RC_INVALIDARG;
+	}
+
+	return r->handler->image_load(r->f, &r->header, pixels, stride, r->header.w, r->header.h);
+}
+
+void image_reader_close(IMGReader *r)
+{
+	if(r->f && r->owns_file) {
+		fclose(r->f);
+	}
+
+	r->f = NULL;
+}
+
+RETCODE image_prefetch(const char *filename)
+{
+	FILE *f = fopen(filename, "rb");
+	if(!f) {
+		return RC_FAIL;
+	}
+
+#ifdef __linux__
+	/* Starts reading the whole file in the background */
+	posix_fadvise(fileno(f), 0, 0, POSIX_FADV_WILLNEED);
+#else
+	char buf[IMG_HEAD_SIZE];
+
+	/* No hint to give, read the file through so it's in the cache */
+	while(fread(buf, 1, sizeof(buf), f) == sizeof(buf));
+#endif
+
 	fclose(f);
+	return RC_OK;
+}
+
+/* Returns the extension of a file name, which is used as format name (pgm if there is none) */
+const char *image_format_from_filename(const char *filename)
+{
+	const char *ext = strrchr(filename, '.');
+
+	if(!ext || strchr(ext, '/') || strchr(ext, '\\')) {
+		return "pgm";
+	}
+
+	return ext + 1;
+}
+
+RETCODE image_format_supported(const char *format_name)
+{
+	int i;
+
+	for(i=0; i<img_handler_len; i++) {
+		if(stricmp(format_name, img_handler_arr[i].format_name) == 0)
+			return RC_OK;
+	}
+
+	return RC_FALSE;
+}
+
+RETCODE image_format_writable(const char *format_name)
+{
+	int i;
+
+	for(i=0; i<img_handler_len; i++) {
+		if(stricmp(format_name, img_handler_arr[i].format_name) == 0)
+			return img_handler_arr[i].image_save ? RC_OK : RC_FALSE;
+	}
+
+	return RC_FALSE;
+}
+
+RETCODE image_handler_by_id(int id, IMGHandler **out)
+{
+	if(id < 0 || id >= img_handler_len) {
+		return RC_FAIL;
+	}
+
+	*out = &img_handler_arr[id];
+	return RC_OK;
+}
+
+RETCODE image_load(IMGReader *r, SDL_Texture *target)
+{
+	uint32_t format;
+	int access, w, h;
+	void *pixels;
+	int stride;
+
+	if(SDL_QueryTexture(target, &format, &access, &w, &h) != 0) {
+		return RC_FAIL;
+	}
+
+	if(format != SDL_PIXELFORMAT_RGBA8888) {
+		return RC_INVALIDARG;
+	}
+
+	/* Make sure the texture has same size as the image in the file */
+	if(w != r->header.w || h != r->header.h) {
+		return RC_INVALIDARG;
+	}
+
+	if(SDL_LockTexture(target, NULL, &pixels, &stride) != 0) {
+		printf("SDL_LockTexture failed (%s).\n", SDL_GetError());
+		return RC_FAIL;
+	}
+
+	RETCODE rc = image_reader_load(r, pixels, stride);
+	SDL_UnlockTexture(target);
 
 	return rc;
 }
 
-RETCODE image_save(FILE *f, char *format_name, SDL_Texture *source)
+RETCODE image_load_from_file(char *filename, SDL_Texture *target)
+{
+	IMGReader r;
+
+	RETCODE rc = image_reader_open(filename, &r);
+	if(failed(rc)) return rc;
+
+	rc = image_load(&r, target);
+	image_reader_close(&r);
+
+	return rc;
+}
+
+RETCODE image_save_bitmap(FILE *f, const char *format_name, const void *pixels, int stride, int w, int h)
 {
+	TRACE_SCOPE("save");
+
 	int i;
 
 	for(i=0; i<img_handler_len; i++) {
 		if(stricmp(format_name, img_handler_arr[i].format_name) != 0)
 			continue;
 
-		return img_handler_arr[i].image_save(f, source);
+		if(!img_handler_arr[i].image_save)
+			return RC_NOTIMPL;
+
+		return img_handler_arr[i].image_save(f, pixels, stride, w, h);
 	}
 
 	/* Format not found */
 	return RC_FAIL;
 }
 
+RETCODE image_save(FILE *f, char *format_name, SDL_Texture *source)
+{
+	uint32_t format;
+	int access, w, h;
+	void *pixels;
+	int stride;
+
+	if(SDL_QueryTexture(source, &format, &access, &w, &h) != 0) {
+		return RC_FAIL;
+	}
+
+	if(SDL_LockTexture(source, NULL, &pixels, &stride) != 0) {
+		return RC_FAIL;
+	}
+
+	RETCODE rc = image_save_bitmap(f, format_name, pixels, stride, w, h);
+	SDL_UnlockTexture(source);
+
+	return rc;
+}
+
 RETCODE image_save_to_file(char *fn, char *format_name, SDL_Texture *source)
+{
+	uint32_t format;
+	int access, w, h;
+	void *pixels;
+	int stride;
+
+	if(SDL_QueryTexture(source, &format, &access, &w, &h) != 0) {
+		return RC_FAIL;
+	}
+
+	if(SDL_LockTexture(source, NULL, &pixels, &stride) != 0) {
+		return RC_FAIL;
+	}
+
+	RETCODE rc = image_save_bitmap_to_file(fn, format_name, pixels, stride, w, h);
+	SDL_UnlockTexture(source);
+
+	return rc;
+}
+
+RETCODE image_save_bitmap_to_file(const char *fn, const char *format_name, const void *pixels, int stride, int w, int h)
 {
 	int i;
 	char *fm = "w";
@@ -121,7 +361,7 @@ RETCODE image_save_to_file(char *fn, char *format_name, SDL_Texture *source)
 		return RC_FAIL;
 	}
 
-	RETCODE rc = image_save(f, format_name, source);
+	RETCODE rc = image_save_bitmap(f, format_name, pixels, stride, w, h);
 	fclose(f);
 
 	return rc;
@@ -11,34 +11,107 @@
 #include <SDL2/SDL.h>
 #include "common.h"
 
+/* Bytes read from the start of a file to tell the format and parse the header */
+#define IMG_HEAD_SIZE		4096
+
+/* Size of the stdio buffer of files being loaded */
+#define IMG_READ_BUFFER		(64 * 1024)
+
+/* Longest signature a handler can be told by */
+#define IMG_MAX_MAGIC		8
+
+/* Header of an image file, parsed once from the first block */
+typedef struct {
+	int32_t format;
+	int32_t w, h;
+
+	/* Offset of the pixel data from the start of the file */
+	long data_offset;
+
+	/* Meaning depends on the format: the maximum value of PGM, the bits per pixel of BMP */
+	int32_t depth;
+
+	/* Nonzero if the rows are stored from the bottom up */
+	int bottom_up;
+} IMGHeader;
+
 typedef struct {
 	char *format_name;
 
 	/* If the format is binary or text */
 	int	is_bin;
 
+	/* Bytes the files start with, handlers are looked up by them */
+	const char *magic;
+	int magic_len;
+
 	/**
-	 * Function for testing a image if it's handled by this current image handler.
-	 * This function is responsible not to modify the FILE position pointer.
+	 * Function for parsing the header of an image from the first `len` bytes of the file
+	 * (up to IMG_HEAD_SIZE, starting with the magic). RC_INVALIDDATA if the header isn't
+	 * valid or doesn't fit in them.
 	 */
-	RETCODE (*image_test)(FILE *f, int *format, int *w, int *h);
+	RETCODE (*image_parse)(const uint8_t *head, int len, IMGHeader *out);
 
 	/**
-	 * Function for loading a image from FILE and uploads it to already existing SDL texture.
-	 * If the source pixel format doesn't match with the texture format, the function will try to convert the image.
+	 * Function for loading a image from FILE into an already allocated 32-bit bitmap (RGBA8888).
+	 * The FILE is positioned at the pixel data of the parsed header, the bitmap has the size
+	 * from it; other pixel formats are converted.
 	 */
-	RETCODE (*image_load)(FILE *f, SDL_Texture *target);
+	RETCODE (*image_load)(FILE *f, const IMGHeader *hdr, void *pixels, int stride, int w, int h);
 
 	/**
-	 * Function for saving contents of a SDL texture into a file.
+	 * Function for saving contents of a 32-bit bitmap into a file, NULL for formats that
+	 * are only read.
 	 */
-	RETCODE (*image_save)(FILE *f, SDL_Texture *source);
+	RETCODE (*image_save)(FILE *f, const void *pixels, int stride, int w, int h);
 } IMGHandler;
 
-RETCODE image_get_info(FILE *f, int32_t *format, int32_t *w, int32_t *h);
-RETCODE image_load(FILE *f, SDL_Texture *target);
+/* An image file being loaded, whose header has been parsed */
+typedef struct {
+	FILE *f;
+	IMGHandler *handler;
+	IMGHeader header;
+
+	/* Nonzero if the FILE was opened by image_reader_open() */
+	int owns_file;
+} IMGReader;
+
+/**
+ * Opens an image file and parses its header with the handler its first bytes select.
+ * RC_FAIL if the file can't be opened, RC_INVALIDDATA if the format isn't known or the
+ * header isn't valid; nothing has to be closed then.
+ */
+RETCODE image_reader_open(const char *filename, IMGReader *r);
+
+/* Like image_reader_open() on a FILE opened in binary mode, from its current position */
+RETCODE image_reader_attach(FILE *f, IMGReader *r);
+
+/* Loads the pixels into a 32-bit bitmap of the size in the header */
+RETCODE image_reader_load(IMGReader *r, void *pixels, int stride);
+void image_reader_close(IMGReader *r);
+
+/**
+ * Tells the system a file will be read soon, so it's read ahead into the page cache
+ * while earlier files are being decoded. May block on the disk, call it off the threads
+ * doing the work.
+ */
+RETCODE image_prefetch(const char *filename);
+
+RETCODE image_load(IMGReader *r, SDL_Texture *target);
 RETCODE image_load_from_file(char *filename, SDL_Texture *target);
 RETCODE image_save(FILE *f, char *format_name, SDL_Texture *source);
+RETCODE image_save_bitmap(FILE *f, const char *format_name, const void *pixels, int stride, int w, int h);
 RETCODE image_save_to_file(char *fn, char *format_name, SDL_Texture *source);
+RETCODE image_save_bitmap_to_file(const char *fn, const char *format_name, const void *pixels, int stride, int w, int h);
+const char *image_format_from_filename(const char *filename);
+
+/* Returns RC_OK if a handler for the format (a file extension) is registered, RC_FALSE otherwise */
+RETCODE image_format_supported(const char *format_name);
+
+/* Returns RC_OK if images can be saved in the format, RC_FALSE if it's unknown or only read */
+RETCODE image_format_writable(const char *format_name);
+
+/* Returns the handler registered at position `id`, RC_FAIL past the last one */
+RETCODE image_handler_by_id(int id, IMGHandler **out);
 
 #endif /* IMGUTILS_H_ */
@@ -8,10 +8,13 @@
 #include <SDL2/SDL.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <malloc.h>
 #include "common.h"
 #include "imgutils.h"
+#include "memtrack.h"
 
 typedef struct {
   uint8_t Magic[2];
@@ -35,118 +38,74 @@ typedef struct {
 	uint32_t biClrImportant;
 } __attribute__((aligned(1),packed)) BitmapInfoHeader;
 
-RETCODE bmp_test(FILE *f, int *format, int *w, int *h)
+RETCODE bmp_parse(const uint8_t *head, int len, IMGHeader *out)
 {
-	int pos = ftell(f);
-	RETCODE rc = RC_OK;
 	BitmapFileHeader bmfh;
 	BitmapInfoHeader bmih;
 
-	/* Read bitmap file header */
-	if(fread(&bmfh, sizeof(bmfh), 1, f) != 1) {
-		rc = RC_INVALIDDATA;
-		goto end;
-	}
-
-	if(bmfh.Magic[0] != 'B' || bmfh.Magic[1] != 'M') {
-		rc = RC_INVALIDDATA;
-		goto end;
+	if(len < (int)(sizeof(bmfh) + sizeof(bmih))) {
+		return RC_INVALIDDATA;
 	}
 
-	fseek(f, pos + 14, SEEK_SET);
+	/* Bitmap file header, then the info header */
+	memcpy(&bmfh, head, sizeof(bmfh));
+	memcpy(&bmih, head + 14, sizeof(bmih));
 
-	/* Read bitmap info header */
-	if(fread(&bmih, sizeof(bmih), 1, f) != 1) {
-		rc = RC_INVALIDDATA;
-		goto end;
+	if(bmfh.Magic[0] != 'B' || bmfh.Magic[1] != 'M') {
+		return RC_INVALIDDATA;
 	}
 
 	if(bmih.biSize != sizeof(bmih)) {
 		/* Uncommon bitmap type */
-		rc = RC_INVALIDDATA;
-		goto end;
+		return RC_INVALIDDATA;
 	}
 
 	/* We'll handle only 24 and 32 bpp */
 	if(bmih.biBitCount!=24 && bmih.biBitCount!=32) {
-		rc = RC_INVALIDDATA;
-		goto end;
+		return RC_INVALIDDATA;
 	}
 
 	/* We don't support RLE and other compressions */
 	if(bmih.biCompression != 0) {
-		rc = RC_INVALIDDATA;
-		goto end;
+		return RC_INVALIDDATA;
 	}
 
-	if(w) *w = bmih.biWidth;
-	if(h) *h = bmih.biHeight;
-	if(format) *format = SDL_PIXELFORMAT_RGBA8888;
-
-end:
-	/* Return stream to original position */
-	fseek(f, pos, SEEK_SET);
+	/* A negative height means the rows are stored from the top down */
+	out->w = bmih.biWidth;
+	out->h = abs(bmih.biHeight);
+	out->bottom_up = bmih.biHeight > 0;
+	out->depth = bmih.biBitCount;
+	out->data_offset = bmfh.bfOffBits;
+	out->format = SDL_PIXELFORMAT_RGBA8888;
 
-	return rc;
+	return RC_OK;
 }
 
-RETCODE bmp_load(FILE *f, SDL_Texture *target)
+RETCODE bmp_load(FILE *f, const IMGHeader *hdr, void *pixels, int stride, int w, int h)
 {
-	BitmapFileHeader bmfh;
-	BitmapInfoHeader bmih;
-	int pos = ftell(f);
-
-	/* Read bitmap file header */
-	if(fread(&bmfh, sizeof(bmfh), 1, f) != 1) {
-		return RC_INVALIDDATA;
+	/* Make sure the bitmap has same size as the image in the file */
+	if(w != hdr->w || h != hdr->h) {
+		return RC_INVALIDARG;
 	}
 
-	if(bmfh.Magic[0] != 'B' || bmfh.Magic[1] != 'M') {
-		return RC_INVALIDDATA;
-	}
+	uint8_t *dst = pixels;
+	int32_t dst_stride = stride, src_stride = (hdr->depth * w + 31) / 32 * 4;
 
-	fseek(f, pos + 14, SEEK_SET);
+	int i, j;
+	uint8_t *temp = memtrack_malloc(MEM_CODEC, src_stride);
 
-	/* Read bitmap info header */
-	if(fread(&bmih, sizeof(bmih), 1, f) != 1) {
-		return RC_INVALIDDATA;
-	}
-
-	if(bmih.biSize != sizeof(bmih)) {
-		/* Uncommon bitmap type */
-		return RC_INVALIDDATA;
-	}
-
-	/* We'll handle only 24 and 32 bpp */
-	if(bmih.biBitCount!=24 && bmih.biBitCount!=32) {
-		return RC_INVALIDDATA;
-	}
-
-	//fseek(f, pos + bmfh.bfOffBits, SEEK_SET);
-
-	uint8_t *dst;
-	int32_t dst_stride, src_stride = (bmih.biBitCount * bmih.biWidth + 31) / 32 * 4;
-
-	/* Lock texture */
-	if(SDL_LockTexture(target, NULL, (void**)&dst, &dst_stride) != 0) {
-		return RC_FAIL;
-	}
-
-	int i, j, height = abs(bmih.biHeight);
-	uint8_t *temp = malloc(src_stride);
-
-	for(j=0; j<height; j++) {
-		uint8_t *dst_line = dst + ((bmih.biHeight-1) - j) * dst_stride;
+	for(j=0; j<h; j++) {
+		uint8_t *dst_line = dst + (hdr->bottom_up ? h - 1 - j : j) * dst_stride;
 		uint8_t *t = temp;
 
 		if(fread(temp, src_stride, 1, f) != 1) {
-			goto unlock;
+			goto end;
 		}
 
-		for(i=0; i<bmih.biWidth; i++) {
-			switch(bmih.biBitCount) {
+		for(i=0; i<w; i++) {
+			switch(hdr->depth) {
 			case 24:
-				dst_line[0] = 1;
+				dst_line[0] = 255;
 				dst_line[1] = t[0];
 				dst_line[2] = t[1];
 				dst_line[3] = t[2];
@@ -165,22 +124,17 @@ RETCODE bmp_load(FILE *f, SDL_Texture *target)
 		}
 	}
 
-unlock:
-	SDL_UnlockTexture(target);
-	free(temp);
+end:
+	memtrack_free(temp);
 
 	return RC_OK;
 }
 
-RETCODE bmp_save(FILE *f, SDL_Texture *source)
-{
-	return RC_NOTIMPL;
-}
-
 IMGHandler imgutils_bmp_handler = {
 	.format_name = "bmp",
 	.is_bin = 1,
-	.image_test = bmp_test,
+	.magic = "BM",
+	.magic_len = 2,
+	.image_parse = bmp_parse,
 	.image_load = bmp_load,
-	.image_save = bmp_save,
 };
@@ -7,103 +7,78 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include "common.h"
 #include "imgutils.h"
 
-RETCODE pgm_test(FILE *f, int *format, int *w, int *h)
+/* Reads the next number of the header, skipping whitespace and comments; -1 if there's none */
+static int pgm_header_number(const uint8_t *head, int len, int *pos)
 {
-	char identifier[1024];
-	char description[1024];
-
-	long int pos = ftell(f);
-	int width, height;
-	RETCODE rc = RC_OK;
-
-	/* Read identifier */
-	fscanf(f, "%2s\n", identifier);
-	if(strcmp(identifier, "P2") != 0) {
-		/* Invalid identifier */
-		rc = RC_INVALIDDATA;
-		goto end;
-	}
+	int p = *pos, value = 0;
+
+	for(;;) {
+		while(p < len && isspace(head[p])) p++;
 
-	/* Read description */
-	fgets(description, 1024, f);
-	if(description[0] != '#') {
-		/* Description should start with '#' */
-		rc = RC_INVALIDDATA;
-		goto end;
+		if(p >= len || head[p] != '#') break;
+
+		/* Comment until the end of the line */
+		while(p < len && head[p] != '\n') p++;
 	}
 
-	/* Read dimensions */
-	if (fscanf(f, "%1024d %d", &width, &height) <= 0) {
-		rc = RC_INVALIDDATA;
-		goto end;
+	if(p >= len || !isdigit(head[p])) {
+		return -1;
 	}
 
-	if(w) *w = width;
-	if(h) *h = height;
-	if(format) *format = SDL_PIXELFORMAT_RGBA8888;
+	while(p < len && isdigit(head[p])) {
+		if(value > 100000000) return -1;
 
-end:
-	fseek(f, pos, SEEK_SET);
+		value = value * 10 + (head[p++] - '0');
+	}
 
-	/* Seems like a valid file */
-	return rc;
+	/* The number must end within the block, it could go on after it */
+	if(p >= len) {
+		return -1;
+	}
+
+	*pos = p;
+	return value;
 }
 
-RETCODE pgm_load(FILE *f, SDL_Texture *target)
+RETCODE pgm_parse(const uint8_t *head, int len, IMGHeader *out)
 {
-	char identifier[1024];
-	char description[1024];
-	int32_t width, height;
-	int32_t maxval;
-
-	/* Read identifier */
-	fscanf(f, "%s\n", identifier);
-	if(strcmp(identifier, "P2") != 0) {
-		/* Invalid identifier */
-		return RC_INVALIDDATA;
-	}
+	int pos = 2;
 
-	/* Read description */
-	fgets(description, 1024, f);
-	if(description[0] != '#') {
-		/* Description should start with '#' */
+	/* Identifier, followed by whitespace */
+	if(len < 3 || head[0] != 'P' || head[1] != '2' || !isspace(head[2])) {
 		return RC_INVALIDDATA;
 	}
 
-	/* Read dimensions */
-	if (fscanf(f, "%d %d", &width, &height) <= 0) {
-		return RC_INVALIDDATA;
-	}
+	/* Dimensions and the maximum value of grey, comments may come between them */
+	out->w = pgm_header_number(head, len, &pos);
+	out->h = pgm_header_number(head, len, &pos);
+	out->depth = pgm_header_number(head, len, &pos);
 
-	/* Read maximum value of grey */
-	if (fscanf(f, "%d", &maxval) <= 0) {
+	if(out->w <= 0 || out->h <= 0 || out->depth <= 0) {
 		return RC_INVALIDDATA;
 	}
 
-	/* Make sure texture has same size and format as the image in the file */
-	uint32_t format;
-	int access, w, h;
+	out->format = SDL_PIXELFORMAT_RGBA8888;
+	out->data_offset = pos;
+	out->bottom_up = 0;
 
-	if (SDL_QueryTexture(target, &format, &access, &w, &h) != 0) {
-		return RC_FAIL;
-	}
-
-	if(w!=width || h!=height || format!=SDL_PIXELFORMAT_RGBA8888) {
-		return RC_INVALIDARG;
-	}
+	return RC_OK;
+}
 
-	/* Lock texture data and update it's content according to the content in the file */
-	uint8_t *pix_data;
-	int stride;
+RETCODE pgm_load(FILE *f, const IMGHeader *hdr, void *pixels, int stride, int w, int h)
+{
+	int32_t maxval = hdr->depth;
 
-	if (SDL_LockTexture(target, NULL, (void**)&pix_data, &stride) != 0) {
-		printf("SDL_LockTexture failed (%s).\n", SDL_GetError());
-		return RC_FAIL;
+	/* Make sure the bitmap has same size as the image in the file */
+	if(w != hdr->w || h != hdr->h) {
+		return RC_INVALIDARG;
 	}
 
+	uint8_t *pix_data = pixels;
 	int i, j, value;
 
 	/* Load pixel data from file */
@@ -126,21 +101,11 @@ RETCODE pgm_load(FILE *f, SDL_Texture *target)
 		}
 	}
 
-	/* Unlock texture */
-	SDL_UnlockTexture(target);
-
 	return RC_OK;
 }
 
-RETCODE pgm_save(FILE *f, SDL_Texture *source)
+RETCODE pgm_save(FILE *f, const void *pixels, int stride, int w, int h)
 {
-	uint32_t format;
-	int acc, w, h;
-
-	if(SDL_QueryTexture(source, &format, &acc, &w, &h) != 0) {
-		return RC_FAIL;
-	}
-
 	/* Write signature */
 	fprintf(f, "P2\n");
 
@@ -150,18 +115,11 @@ RETCODE pgm_save(FILE *f, SDL_Texture *source)
 	/* Write dimentions and max value */
 	fprintf(f, "%d %d\n%d\n", w, h, 255);
 
-	uint8_t *pixels;
-	int32_t stride;
-
-	if(SDL_LockTexture(source, NULL, (void**)&pixels, &stride) != 0) {
-		return RC_FAIL;
-	}
-
 	int32_t i, j;
 
 	/* Write values */
 	for(j=0; j<h; j++) {
-		uint8_t *line = pixels + stride * j;
+		const uint8_t *line = (const uint8_t*)pixels + stride * j;
 
 		for(i=0; i<w; i++) {
 			line++;
@@ -176,9 +134,6 @@ RETCODE pgm_save(FILE *f, SDL_Texture *source)
 		fprintf(f, "\n");
 	}
 
-	/* Unlock */
-	SDL_UnlockTexture(source);
-
 	return RC_OK;
 }
 
@@ -186,7 +141,9 @@ RETCODE pgm_save(FILE *f, SDL_Texture *source)
 IMGHandler imgutils_pgm_handler = {
 	.format_name = "pgm",
 	.is_bin = 0,
-	.image_test = pgm_test,
+	.magic = "P2",
+	.magic_len = 2,
+	.image_parse = pgm_parse,
 	.image_load = pgm_load,
 	.image_save = pgm_save,
 };
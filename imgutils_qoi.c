@@ -0,0 +1,312 @@
+/*
+ * imgutils_qoi.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "common.h"
+#include "imgutils.h"
+#include "memtrack.h"
+
+/**
+ * The "Quite OK Image" format: a 14-byte header and a stream of chunks, each coding a
+ * pixel as a run of the previous one, an index into the 64 pixels seen last (by a hash),
+ * a small difference from the previous pixel or the full value. It's lossless and
+ * encodes and decodes in a single pass, with no tables to build.
+ */
+
+#define QOI_OP_INDEX	0x00
+#define QOI_OP_DIFF		0x40
+#define QOI_OP_LUMA		0x80
+#define QOI_OP_RUN		0xc0
+#define QOI_OP_RGB		0xfe
+#define QOI_OP_RGBA		0xff
+#define QOI_MASK_2		0xc0
+
+#define QOI_HEADER_SIZE	14
+
+/* The spec limits images to 400 million pixels */
+#define QOI_PIXELS_MAX	400000000
+
+/* Longest run of a chunk, 63 and 64 would clash with QOI_OP_RGB and QOI_OP_RGBA */
+#define QOI_RUN_MAX		62
+
+/* Longest chunk (QOI_OP_RGBA) */
+#define QOI_CHUNK_MAX	5
+
+/* Chunks are read and written through a buffer of this size */
+#define QOI_BUFFER_SIZE	(64 * 1024)
+
+static const uint8_t qoi_padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+/* A pixel with the components in the order of the bitmap, copied and compared as a word */
+typedef union {
+	struct {
+		uint8_t a, b, g, r;
+	} c;
+
+	uint32_t v;
+} QOIPixel;
+
+static inline int qoi_hash(QOIPixel px)
+{
+	return (px.c.r * 3 + px.c.g * 5 + px.c.b * 7 + px.c.a * 11) & 63;
+}
+
+static inline uint32_t qoi_read_32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void qoi_write_32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+RETCODE qoi_parse(const uint8_t *head, int len, IMGHeader *out)
+{
+	if(len < QOI_HEADER_SIZE || memcmp(head, "qoif", 4) != 0) {
+		return RC_INVALIDDATA;
+	}
+
+	uint32_t w = qoi_read_32(head + 4), h = qoi_read_32(head + 8);
+	int channels = head[12], colorspace = head[13];
+
+	if(w == 0 || h == 0 || h >= QOI_PIXELS_MAX / w) {
+		return RC_INVALIDDATA;
+	}
+
+	if((channels != 3 && channels != 4) || colorspace > 1) {
+		return RC_INVALIDDATA;
+	}
+
+	out->w = (int32_t)w;
+	out->h = (int32_t)h;
+	out->depth = channels * 8;
+	out->bottom_up = 0;
+	out->data_offset = QOI_HEADER_SIZE;
+	out->format = SDL_PIXELFORMAT_RGBA8888;
+
+	return RC_OK;
+}
+
+RETCODE qoi_load(FILE *f, const IMGHeader *hdr, void *pixels, int stride, int w, int h)
+{
+	QOIPixel index[64], px = {.c = {255, 0, 0, 0}};
+	int i, j, run = 0;
+	size_t pos = 0, len = 0;
+	RETCODE rc = RC_OK;
+
+	/* Make sure the bitmap has same size as the image in the file */
+	if(w != hdr->w || h != hdr->h) {
+		return RC_INVALIDARG;
+	}
+
+	uint8_t *buf = memtrack_malloc(MEM_CODEC, QOI_BUFFER_SIZE);
+	if(!buf) {
+		return RC_OUTOFMEM;
+	}
+
+	memset(index, 0, sizeof(index));
+
+	for(j=0; j<h; j++) {
+		uint8_t *dst = (uint8_t*)pixels + (size_t)stride * j;
+
+		for(i=0; i<w; i++, dst += 4) {
+			if(run > 0) {
+				run--;
+			}else {
+				/* Keep a whole chunk in the buffer */
+				if(len - pos < QOI_CHUNK_MAX) {
+					memmove(buf, buf + pos, len - pos);
+					len -= pos;
+					pos = 0;
+					len += fread(buf + len, 1, QOI_BUFFER_SIZE - len, f);
+
+					if(len == 0) {
+						/* The file ends before the last pixel */
+						rc = RC_INVALIDDATA;
+						goto end;
+					}
+				}
+
+				int b1 = buf[pos++];
+
+				if(b1 == QOI_OP_RGB) {
+					px.c.r = buf[pos];
+					px.c.g = buf[pos + 1];
+					px.c.b = buf[pos + 2];
+					pos += 3;
+				}else if(b1 == QOI_OP_RGBA) {
+					px.c.r = buf[pos];
+					px.c.g = buf[pos + 1];
+					px.c.b = buf[pos + 2];
+					px.c.a = buf[pos + 3];
+					pos += 4;
+				}else if((b1 & QOI_MASK_2) == QOI_OP_INDEX) {
+					px = index[b1];
+				}else if((b1 & QOI_MASK_2) == QOI_OP_DIFF) {
+					px.c.r += ((b1 >> 4) & 3) - 2;
+					px.c.g += ((b1 >> 2) & 3) - 2;
+					px.c.b += (b1 & 3) - 2;
+				}else if((b1 & QOI_MASK_2) == QOI_OP_LUMA) {
+					int b2 = buf[pos++];
+					int vg = (b1 & 0x3f) - 32;
+
+					px.c.r += vg - 8 + ((b2 >> 4) & 0x0f);
+					px.c.g += vg;
+					px.c.b += vg - 8 + (b2 & 0x0f);
+				}else {
+					run = b1 & 0x3f;
+				}
+
+				/* A truncated chunk read past the data */
+				if(pos > len) {
+					rc = RC_INVALIDDATA;
+					goto end;
+				}
+
+				index[qoi_hash(px)] = px;
+			}
+
+			memcpy(dst, &px, 4);
+		}
+	}
+
+end:
+	memtrack_free(buf);
+
+	return rc;
+}
+
+RETCODE qoi_save(FILE *f, const void *pixels, int stride, int w, int h)
+{
+	QOIPixel index[64], px, prev = {.c = {255, 0, 0, 0}};
+	int i, j, run = 0, opaque = 1;
+	size_t len = 0;
+	RETCODE rc = RC_OK;
+
+	if(w <= 0 || h <= 0 || h >= QOI_PIXELS_MAX / w) {
+		return RC_INVALIDARG;
+	}
+
+	uint8_t *buf = memtrack_malloc(MEM_CODEC, QOI_BUFFER_SIZE);
+	if(!buf) {
+		return RC_OUTOFMEM;
+	}
+
+	/* Opaque images are stored as RGB, which covers the PGM and 24-bit BMP loaders (both set alpha to 255) */
+	for(j=0; j<h && opaque; j++) {
+		const uint8_t *src = (const uint8_t*)pixels + (size_t)stride * j;
+
+		for(i=0; i<w; i++) {
+			opaque &= src[i * 4] == 255;
+		}
+	}
+
+	memcpy(buf, "qoif", 4);
+	qoi_write_32(buf + 4, (uint32_t)w);
+	qoi_write_32(buf + 8, (uint32_t)h);
+	buf[12] = opaque ? 3 : 4;
+	buf[13] = 0;
+	len = QOI_HEADER_SIZE;
+
+	memset(index, 0, sizeof(index));
+
+	for(j=0; j<h; j++) {
+		const uint8_t *src = (const uint8_t*)pixels + (size_t)stride * j;
+
+		for(i=0; i<w; i++, src += 4) {
+			memcpy(&px, src, 4);
+
+			if(px.v == prev.v) {
+				run++;
+
+				/* Runs continue across rows, the last pixel ends them */
+				if(run == QOI_RUN_MAX || (i == w - 1 && j == h - 1)) {
+					buf[len++] = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+			}else {
+				if(run > 0) {
+					buf[len++] = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+
+				int hash = qoi_hash(px);
+
+				if(index[hash].v == px.v) {
+					buf[len++] = QOI_OP_INDEX | hash;
+				}else {
+					index[hash] = px;
+
+					if(px.c.a == prev.c.a) {
+						/* Differences wrap around like the components */
+						int8_t vr = (int8_t)(px.c.r - prev.c.r);
+						int8_t vg = (int8_t)(px.c.g - prev.c.g);
+						int8_t vb = (int8_t)(px.c.b - prev.c.b);
+						int8_t vg_r = vr - vg;
+						int8_t vg_b = vb - vg;
+
+						if(vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+							buf[len++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+						}else if(vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+							buf[len++] = QOI_OP_LUMA | (vg + 32);
+							buf[len++] = (vg_r + 8) << 4 | (vg_b + 8);
+						}else {
+							buf[len++] = QOI_OP_RGB;
+							buf[len++] = px.c.r;
+							buf[len++] = px.c.g;
+							buf[len++] = px.c.b;
+						}
+					}else {
+						buf[len++] = QOI_OP_RGBA;
+						buf[len++] = px.c.r;
+						buf[len++] = px.c.g;
+						buf[len++] = px.c.b;
+						buf[len++] = px.c.a;
+					}
+				}
+			}
+
+			prev = px;
+
+			/* Room for the two chunks a pixel can write */
+			if(len > QOI_BUFFER_SIZE - 2 * QOI_CHUNK_MAX) {
+				if(fwrite(buf, 1, len, f) != len) {
+					rc = RC_FAIL;
+					goto end;
+				}
+
+				len = 0;
+			}
+		}
+	}
+
+	if(fwrite(buf, 1, len, f) != len || fwrite(qoi_padding, 1, sizeof(qoi_padding), f) != sizeof(qoi_padding)) {
+		rc = RC_FAIL;
+	}
+
+end:
+	memtrack_free(buf);
+
+	return rc;
+}
+
+IMGHandler imgutils_qoi_handler = {
+	.format_name = "qoi",
+	.is_bin = 1,
+	.magic = "qoif",
+	.magic_len = 4,
+	.image_parse = qoi_parse,
+	.image_load = qoi_load,
+	.image_save = qoi_save,
+};
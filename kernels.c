@@ -0,0 +1,493 @@
+/*
+ * kernels.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <SDL2/SDL.h>
+#include "kernels.h"
+#include "filtercache.h"
+#include "memtrack.h"
+
+/* Definitions read from the files, each owns its name and matrix */
+typedef struct {
+	Filter2D *filters;
+	int count, capacity;
+} KernelList;
+
+/* File being parsed and the definition in progress */
+typedef struct {
+	const char *filename;
+	int line;
+
+	Filter2D *cur;
+	int filled;
+	int has_divisor;
+} KernelParser;
+
+static char kernels_path[1024];
+static uint64_t kernels_signature;
+static Uint32 kernels_checked;
+
+static void kernels_free_list(KernelList *list)
+{
+	int i;
+
+	for(i=0; i<list->count; i++) {
+		memtrack_free(list->filters[i].name);
+		memtrack_free(list->filters[i].matrix);
+	}
+
+	memtrack_free(list->filters);
+	memset(list, 0, sizeof(KernelList));
+}
+
+static RETCODE kernels_error(const KernelParser *p, const char *message, const char *token)
+{
+	fprintf(stderr, "%s:%d: %s%s%s%s\n", p->filename, p->line, message, token ? " \"" : "", token ? token : "", token ? "\"" : "");
+	return RC_INVALIDDATA;
+}
+
+/* The divisor defaults to the sum of the coefficients, so blurs keep the brightness */
+static void kernels_finish(KernelParser *p)
+{
+	int i;
+
+	if(p->cur && !p->has_divisor) {
+		float sum = 0;
+
+		for(i=0; i<p->cur->w * p->cur->h; i++) {
+			sum += p->cur->matrix[i];
+		}
+
+		p->cur->divisor = sum != 0 ? sum : 1;
+	}
+
+	p->cur = NULL;
+}
+
+static RETCODE kernels_begin(KernelParser *p, KernelList *list, const char *name, const char *size)
+{
+	FilterOp *op;
+	int w, h, i;
+	char end;
+
+	if(!name || !size) {
+		return kernels_error(p, "expected \"kernel <name> <w>x<h>\"", NULL);
+	}
+
+	if(strlen(name) >= KERNELS_MAX_NAME) {
+		return kernels_error(p, "name too long", name);
+	}
+
+	for(i=0; name[i]; i++) {
+		if(!isalnum((unsigned char)name[i]) && name[i] != '_') {
+			return kernels_error(p, "names may only contain letters, digits and '_':", name);
+		}
+	}
+
+	if(succeeded(filter_op_find_by_name(name, &op))) {
+		return kernels_error(p, "name of a filter operation", name);
+	}
+
+	if(sscanf(size, "%dx%d%c", &w, &h, &end) != 2 || w < 1 || h < 1 || w > KERNELS_MAX_SIZE || h > KERNELS_MAX_SIZE || w % 2 == 0 || h % 2 == 0) {
+		return kernels_error(p, "the size must be odd and at most 15x15:", size);
+	}
+
+	/* A later definition replaces an earlier one with the same name */
+	for(i=0; i<list->count; i++) {
+		if(strcmp(list->filters[i].name, name) == 0) {
+			fprintf(stderr, "%s:%d: \"%s\" is defined again, the last definition is used.\n", p->filename, p->line, name);
+
+			memtrack_free(list->filters[i].name);
+			memtrack_free(list->filters[i].matrix);
+			memmove(&list->filters[i], &list->filters[i + 1], (list->count - i - 1) * sizeof(Filter2D));
+			list->count--;
+			break;
+		}
+	}
+
+	if(list->count == list->capacity) {
+		int capacity = list->capacity ? list->capacity * 2 : 16;
+		Filter2D *filters = memtrack_realloc(MEM_FILTER, list->filters, capacity * sizeof(Filter2D));
+
+		if(!filters) return RC_OUTOFMEM;
+
+		list->filters = filters;
+		list->capacity = capacity;
+	}
+
+	Filter2D *f = &list->filters[list->count];
+	memset(f, 0, sizeof(Filter2D));
+
+	f->w = w;
+	f->h = h;
+	f->divisor = 1;
+	f->edge = FILTER_EDGE_WRAP;
+	f->name = memtrack_malloc(MEM_FILTER, strlen(name) + 1);
+	f->matrix = memtrack_calloc(MEM_FILTER, (size_t)w * h, sizeof(float));
+
+	if(!f->name || !f->matrix) {
+		memtrack_free(f->name);
+		memtrack_free(f->matrix);
+		return RC_OUTOFMEM;
+	}
+
+	strcpy(f->name, name);
+	list->count++;
+
+	p->cur = f;
+	p->filled = 0;
+	p->has_divisor = 0;
+
+	return RC_OK;
+}
+
+static RETCODE kernels_parse_number(const KernelParser *p, const char *token, float *out)
+{
+	char *end;
+
+	*out = strtof(token, &end);
+
+	if(end == token || *end || !isfinite(*out)) {
+		return kernels_error(p, "not a number:", token);
+	}
+
+	return RC_OK;
+}
+
+/* Attribute of the definition in progress, before its coefficients */
+static RETCODE kernels_attribute(KernelParser *p, const char *key, const char *value)
+{
+	RETCODE rc;
+	int i;
+
+	if(!p->cur) {
+		return kernels_error(p, "expected \"kernel\" before", key);
+	}
+
+	if(p->filled > 0) {
+		return kernels_error(p, "attributes must come before the coefficients:", key);
+	}
+
+	if(!value) {
+		return kernels_error(p, "missing value of", key);
+	}
+
+	if(strcmp(key, "divisor") == 0) {
+		if(strcmp(value, "auto") == 0) {
+			p->has_divisor = 0;
+			return RC_OK;
+		}
+
+		rc = kernels_parse_number(p, value, &p->cur->divisor);
+		if(failed(rc)) return rc;
+
+		if(p->cur->divisor == 0) {
+			return kernels_error(p, "the divisor can't be 0", NULL);
+		}
+
+		p->has_divisor = 1;
+		return RC_OK;
+	}
+
+	if(strcmp(key, "offset") == 0) {
+		return kernels_parse_number(p, value, &p->cur->offset);
+	}
+
+	if(strcmp(key, "edge") == 0) {
+		for(i=0; i<FILTER_EDGE_COUNT; i++) {
+			if(strcmp(value, filter_edge_name(i)) == 0) {
+				p->cur->edge = i;
+				return RC_OK;
+			}
+		}
+
+		return kernels_error(p, "the edge mode is one of wrap, clamp and mirror, not", value);
+	}
+
+	return kernels_error(p, "unknown keyword", key);
+}
+
+static RETCODE kernels_parse_file(const char *filename, KernelList *list)
+{
+	KernelParser p = {filename, 0, NULL, 0, 0};
+	char line[1024];
+	RETCODE rc = RC_OK;
+
+	FILE *f = fopen(filename, "r");
+	if(!f) {
+		fprintf(stderr, "Can't open \"%s\".\n", filename);
+		return RC_FAIL;
+	}
+
+	while(succeeded(rc) && fgets(line, sizeof(line), f)) {
+		char *save = NULL;
+		char *comment = strchr(line, '#');
+
+		p.line++;
+
+		if(comment) *comment = 0;
+
+		char *token = strtok_r(line, " \t\r\n", &save);
+		if(!token) continue;
+
+		/* Numbers start with a digit, a sign or a point, keywords with a letter */
+		if(isalpha((unsigned char)token[0])) {
+			char *value = strtok_r(NULL, " \t\r\n", &save);
+			char *extra = NULL;
+
+			if(strcmp(token, "kernel") == 0) {
+				if(p.cur && p.filled < p.cur->w * p.cur->h) {
+					rc = kernels_error(&p, "coefficients missing before the next kernel", NULL);
+					break;
+				}
+
+				kernels_finish(&p);
+				rc = kernels_begin(&p, list, value, value ? strtok_r(NULL, " \t\r\n", &save) : NULL);
+			}else {
+				rc = kernels_attribute(&p, token, value);
+			}
+
+			if(succeeded(rc) && (extra = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+				rc = kernels_error(&p, "unexpected", extra);
+			}
+
+			continue;
+		}
+
+		for(; token && succeeded(rc); token = strtok_r(NULL, " \t\r\n", &save)) {
+			if(!p.cur || p.filled == p.cur->w * p.cur->h) {
+				rc = kernels_error(&p, p.cur ? "too many coefficients:" : "expected \"kernel\" before", token);
+				break;
+			}
+
+			rc = kernels_parse_number(&p, token, &p.cur->matrix[p.filled]);
+			p.filled++;
+		}
+	}
+
+	if(succeeded(rc) && ferror(f)) {
+		fprintf(stderr, "Can't read \"%s\".\n", filename);
+		rc = RC_FAIL;
+	}
+
+	if(succeeded(rc) && p.cur && p.filled < p.cur->w * p.cur->h) {
+		rc = kernels_error(&p, "the file ends before the last coefficients", NULL);
+	}
+
+	kernels_finish(&p);
+	fclose(f);
+
+	return rc;
+}
+
+static int kernels_is_kernel_file(const char *name)
+{
+	size_t len = strlen(name), ext = strlen(KERNELS_FILE_EXT);
+
+	return len > ext && strcmp(name + len - ext, KERNELS_FILE_EXT) == 0;
+}
+
+static int kernels_compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Names of the *.kern files of a directory in order; the caller frees the array and the names */
+static RETCODE kernels_list_dir(const char *dir, char ***out, int *count)
+{
+	char **names = NULL;
+	int n = 0, capacity = 0;
+	struct dirent *e;
+
+	DIR *d = opendir(dir);
+	if(!d) return RC_FAIL;
+
+	while((e = readdir(d)) != NULL) {
+		if(!kernels_is_kernel_file(e->d_name)) {
+			continue;
+		}
+
+		if(n == capacity) {
+			capacity = capacity ? capacity * 2 : 16;
+			char **p = memtrack_realloc(MEM_FILTER, names, capacity * sizeof(char*));
+
+			if(!p) break;
+			names = p;
+		}
+
+		names[n] = memtrack_malloc(MEM_FILTER, strlen(e->d_name) + 1);
+		if(!names[n]) break;
+
+		strcpy(names[n++], e->d_name);
+	}
+
+	closedir(d);
+
+	if(n > 1) qsort(names, n, sizeof(char*), kernels_compare_names);
+
+	*out = names;
+	*count = n;
+
+	return RC_OK;
+}
+
+static void kernels_free_names(char **names, int count)
+{
+	int i;
+
+	for(i=0; i<count; i++) {
+		memtrack_free(names[i]);
+	}
+
+	memtrack_free(names);
+}
+
+static uint64_t kernels_stat_hash(const struct stat *st, uint64_t seed)
+{
+	int64_t stamp[3] = {(int64_t)st->st_size, (int64_t)st->st_mtime, 0};
+
+#ifdef __linux__
+	/* Edits within the same second are noticed too */
+	stamp[2] = st->st_mtim.tv_nsec;
+#endif
+
+	return filtercache_hash(stamp, sizeof(stamp), seed);
+}
+
+/* Changes when a kernel file is added, removed or written; 0 if there's nothing at the path */
+static uint64_t kernels_get_signature(const char *path)
+{
+	char filename[2048];
+	struct stat st;
+	char **names;
+	int i, count;
+
+	if(stat(path, &st) != 0) {
+		return 0;
+	}
+
+	if(!S_ISDIR(st.st_mode)) {
+		return kernels_stat_hash(&st, 1);
+	}
+
+	uint64_t hash = 2;
+
+	if(failed(kernels_list_dir(path, &names, &count))) {
+		return hash;
+	}
+
+	for(i=0; i<count; i++) {
+		snprintf(filename, sizeof(filename), "%s/%s", path, names[i]);
+
+		hash = filtercache_hash(names[i], strlen(names[i]), hash);
+		if(stat(filename, &st) == 0) hash = kernels_stat_hash(&st, hash);
+	}
+
+	kernels_free_names(names, count);
+	return hash;
+}
+
+/* Parses everything at the path and hands the kernels to the registry */
+static RETCODE kernels_reload(int *count)
+{
+	KernelList list = {NULL, 0, 0};
+	char filename[2048];
+	struct stat st;
+	RETCODE rc = RC_OK;
+	char **names;
+	int i, n;
+
+	*count = 0;
+
+	if(stat(kernels_path, &st) != 0) {
+		filter_set_loaded(NULL, 0);
+		return RC_FALSE;
+	}
+
+	if(S_ISDIR(st.st_mode)) {
+		rc = kernels_list_dir(kernels_path, &names, &n);
+
+		if(succeeded(rc)) {
+			for(i=0; i<n && succeeded(rc); i++) {
+				snprintf(filename, sizeof(filename), "%s/%s", kernels_path, names[i]);
+				rc = kernels_parse_file(filename, &list);
+			}
+
+			kernels_free_names(names, n);
+		}
+	}else {
+		rc = kernels_parse_file(kernels_path, &list);
+	}
+
+	if(succeeded(rc)) {
+		rc = filter_set_loaded(list.filters, list.count);
+		*count = list.count;
+	}
+
+	kernels_free_list(&list);
+	return rc;
+}
+
+RETCODE kernels_load(const char *path)
+{
+	RETCODE rc;
+	int count;
+
+	snprintf(kernels_path, sizeof(kernels_path), "%s", path);
+	kernels_signature = kernels_get_signature(kernels_path);
+	kernels_checked = SDL_GetTicks();
+
+	rc = kernels_reload(&count);
+
+	if(rc == RC_OK) {
+		fprintf(stderr, "Loaded %d kernels from \"%s\".\n", count, kernels_path);
+	}else if(failed(rc)) {
+		fprintf(stderr, "The kernels in \"%s\" aren't loaded (rc=%d).\n", kernels_path, rc);
+	}
+
+	return rc;
+}
+
+RETCODE kernels_poll(void)
+{
+	RETCODE rc;
+	int count;
+
+	if(!kernels_path[0] || SDL_GetTicks() - kernels_checked < KERNELS_POLL_MS) {
+		return RC_FALSE;
+	}
+
+	kernels_checked = SDL_GetTicks();
+
+	uint64_t signature = kernels_get_signature(kernels_path);
+	if(signature == kernels_signature) {
+		return RC_FALSE;
+	}
+
+	/* A file saved halfway fails to parse, the rest of it changes the signature again */
+	kernels_signature = signature;
+
+	rc = kernels_reload(&count);
+	if(failed(rc)) {
+		fprintf(stderr, "The kernels in \"%s\" aren't reloaded, the previous ones stay in use.\n", kernels_path);
+		return RC_FALSE;
+	}
+
+	fprintf(stderr, "Reloaded %d kernels from \"%s\".\n", count, kernels_path);
+	return RC_OK;
+}
+
+int kernels_watching(void)
+{
+	return kernels_path[0] && kernels_signature != 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * kernels.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef KERNELS_H_
+#define KERNELS_H_
+
+#include "common.h"
+#include "filters.h"
+
+/**
+ * Kernel definitions are read from this file, or from the *.kern files (in name order)
+ * if it's a directory, in the working directory. A definition looks like
+ *
+ *   # Comment
+ *   kernel sharpen5x5 5x5
+ *   divisor 1
+ *   offset 0
+ *   edge clamp
+ *    0  0 -1  0  0
+ *    ...
+ *
+ * The attributes are optional and come before the coefficients, which follow in rows;
+ * the definition ends with the last of the w*h coefficients. The divisor defaults to
+ * the sum of the coefficients (1 if it's 0), the offset to 0 and the edge mode to wrap.
+ */
+#define KERNELS_DEFAULT_PATH	"kernels"
+#define KERNELS_FILE_EXT		".kern"
+
+/* Names are limited to letters, digits and '_' */
+#define KERNELS_MAX_NAME		32
+#define KERNELS_MAX_SIZE		15
+
+/* The files are checked for changes at most this often */
+#define KERNELS_POLL_MS			500
+
+/**
+ * Loads the kernels of a file or directory into the filter registry (filter_set_loaded()),
+ * replacing the ones loaded before, and remembers the path for kernels_poll(). RC_FALSE
+ * if there's nothing at the path. On an error in a definition it's printed with the file
+ * and line, and the kernels loaded before stay in use.
+ */
+RETCODE kernels_load(const char *path);
+
+/**
+ * Loads the kernels again if a file at the path of kernels_load() was added, changed or
+ * removed since, checking at most every KERNELS_POLL_MS. RC_OK if the registry changed,
+ * RC_FALSE if it didn't need to.
+ */
+RETCODE kernels_poll(void);
+
+/* Nonzero if there was a file or directory at the path when it was last checked */
+int kernels_watching(void);
+
+#endif /* KERNELS_H_ */
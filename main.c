@@ -14,6 +14,22 @@
 #include "imgutils.h"
 #include "filters.h"
 #include "histogram.h"
+#include "batch.h"
+#include "filterjob.h"
+#include "filtercache.h"
+#include "pyramid.h"
+#include "tiletex.h"
+#include "history.h"
+#include "bufpool.h"
+#include "stream.h"
+#include "filterd.h"
+#include "filterd_client.h"
+#include "bench.h"
+#include "trace.h"
+#include "hudfont.h"
+#include "memtrack.h"
+#include "autotune.h"
+#include "kernels.h"
 
 /* Zoom will be performed in 10 ticks (1/6 second) */
 #define ZOOM_SPEED	10
@@ -22,12 +38,60 @@ typedef struct {
 	SDL_Window *wnd;
 	SDL_Renderer *renderer;
 
-	SDL_Texture *orig_image;
-	SDL_Texture *filtered_image;
+	/* Size of the loaded image */
+	int image_w, image_h;
 
-	/* If a filter is applied, then filtered_image will be displayed instead of orig_image */
+	/**
+	 * 32-bit bitmap shown as filtered (the original image until a filter is applied).
+	 * Results of the worker are copied into it and it is drawn through tiled textures,
+	 * so images larger than the biggest texture of the renderer can be shown.
+	 * The rows are aligned and padded (see bufpool_stride()).
+	 */
+	uint8_t *filtered;
+	int filtered_stride;
+
+	/* If a filter is applied, then the filtered bitmap will be displayed instead of the original */
 	int8_t is_filter_applied;
 
+	/* Filters run on a background worker, which pushes worker_event when a result is ready */
+	FilterWorker *worker;
+	Uint32 worker_event;
+
+	/* Low-resolution result shown (stretched) until the full one arrives */
+	SDL_Texture *preview_image;
+	int show_preview;
+
+	/* Tiles of the filtered bitmap already holding the result shown over the preview (NULL for small images) */
+	uint8_t *tile_valid;
+
+	/* Offset of the view from the image center (in image pixels) and the visible area told to the worker */
+	SDL_Point pan;
+	SDL_Rect viewport;
+
+	/**
+	 * Zoomed-out images are drawn from pyramid levels instead of minifying the full image,
+	 * each level through its own tiled texture. The original image uses the pyramid of the
+	 * worker; the base of filtered_pyramid is the filtered bitmap.
+	 */
+	Pyramid filtered_pyramid;
+	TiledTexture orig_levels[PYRAMID_MAX_LEVELS];
+	TiledTexture filtered_levels[PYRAMID_MAX_LEVELS];
+	int display_level;
+
+	/* Full-resolution results of this session, keyed by the identity of the loaded image and the history step */
+	FilterCache cache;
+	uint64_t source_id;
+
+	/**
+	 * Filters are applied cumulatively: each result becomes a snapshot of the undo history.
+	 * worker_state is the snapshot the worker holds as its source (and the original view shows).
+	 */
+	History history;
+	uint32_t worker_state;
+
+	/* source_serial of the worker the original view was last drawn with */
+	int orig_serial;
+
 	/* Size of the renderable area of the window */
 	SDL_Point renderer_size;
 
@@ -42,8 +106,26 @@ typedef struct {
 	/* Flag signifying if the histograms are shown */
 	int show_histograms;
 
+	/**
+	 * The histograms are drawn once into this texture (with premultiplied alpha)
+	 * and redrawn only when they change. NULL if the renderer has no render targets.
+	 */
+	SDL_Texture *histogram_overlay;
+	int histograms_changed;
+
+	/* The screen is redrawn only when something has changed or an animation runs */
+	int needs_redraw;
+
 	/* Show both images (original and filtered) */
 	int dual_view;
+
+	/* Spans are recorded while tracing (until trace.json is written) or the HUD is shown */
+	int tracing;
+	int show_hud;
+
+	/* The HUD sums the spans since the last key press, and shows the time of the last frame */
+	Uint64 operation_start;
+	double frame_ms;
 } SDLContext;
 
 /* Quadratic easing creates smoother animation */
@@ -55,22 +137,110 @@ float quadratic_easing(float t, float b, float c, float d)
 	return -c/2 * (t*(t-2) - 1) + b;
 }
 
+/* Destroys the tiled textures of pyramid levels */
+void destroy_level_textures(TiledTexture *levels)
+{
+	int i;
+
+	for(i=0; i<PYRAMID_MAX_LEVELS; i++) {
+		tiletex_free(&levels[i]);
+	}
+}
+
+/* Part of the filtered bitmap (NULL for all of it) has changed */
+void filtered_changed(SDLContext *ctx, const SDL_Rect *rect)
+{
+	int i;
+
+	/* The full-resolution tiles upload only the changed part, the coarser levels are rebuilt lazily */
+	tiletex_invalidate(&ctx->filtered_levels[0], rect);
+	pyramid_invalidate(&ctx->filtered_pyramid);
+
+	for(i=1; i<PYRAMID_MAX_LEVELS; i++) {
+		tiletex_invalidate(&ctx->filtered_levels[i], NULL);
+	}
+}
+
+/* Copies a 32-bit bitmap into an area of the filtered bitmap */
+void paste_filtered(SDLContext *ctx, const uint8_t *pixels, int stride, const SDL_Rect *rect)
+{
+	int j;
+
+	for(j=0; j<rect->h; j++) {
+		memcpy(ctx->filtered + (size_t)(rect->y + j) * ctx->filtered_stride + rect->x * 4, pixels + (size_t)j * stride, (size_t)rect->w * 4);
+	}
+
+	filtered_changed(ctx, rect);
+}
+
+/**
+ * Draws a pyramid level through its tiled texture, building the level on first use.
+ * The base is drawn if the level can't be built.
+ */
+RETCODE draw_level(Pyramid *p, TiledTexture *levels, int level, const SDL_Rect *target_rect)
+{
+	PyramidLevel l;
+	RETCODE rc;
+
+	if(failed(pyramid_get_level(p, level, &l))) {
+		level = 0;
+
+		rc = pyramid_get_level(p, level, &l);
+		if(failed(rc)) return rc;
+	}
+
+	TiledTexture *t = &levels[level];
+
+	/* Levels are reallocated when the base changes its size */
+	if(t->pixels != l.pixels || t->w != l.w || t->h != l.h) {
+		rc = tiletex_set_source(t, l.pixels, l.stride, l.w, l.h);
+		if(failed(rc)) return rc;
+	}
+
+	return tiletex_draw(t, NULL, target_rect);
+}
+
 /**
  * Destroys the textures in the application's context, if they are
  * allocated at all.
  */
 RETCODE sdl_ctx_dispose_textures(SDLContext *ctx)
 {
-	if(ctx->orig_image != NULL) {
-		SDL_DestroyTexture(ctx->orig_image);
-		ctx->orig_image = NULL;
+	/* The tiled textures and the pyramids use the bitmaps freed here */
+	destroy_level_textures(ctx->filtered_levels);
+	destroy_level_textures(ctx->orig_levels);
+	pyramid_set_base(&ctx->filtered_pyramid, NULL, 0, 0, 0);
+
+	/* The worker holds copies of the image, so it goes together with the textures */
+	filterjob_destroy(&ctx->worker);
+
+	if(ctx->preview_image != NULL) {
+		memtrack_texture_destroyed(MEM_TEXTURES, ctx->preview_image);
+		SDL_DestroyTexture(ctx->preview_image);
+		ctx->preview_image = NULL;
 	}
 
-	if(ctx->filtered_image != NULL) {
-		SDL_DestroyTexture(ctx->filtered_image);
-		ctx->filtered_image = NULL;
+	ctx->show_preview = 0;
+
+	free(ctx->tile_valid);
+	ctx->tile_valid = NULL;
+
+	if(ctx->histogram_overlay != NULL) {
+		memtrack_texture_destroyed(MEM_HISTOGRAM, ctx->histogram_overlay);
+		SDL_DestroyTexture(ctx->histogram_overlay);
+		ctx->histogram_overlay = NULL;
 	}
 
+	if(ctx->history.count > 0) {
+		history_print_stats(&ctx->history);
+	}
+
+	history_free(&ctx->history);
+
+	bufpool_free(ctx->filtered);
+	ctx->filtered = NULL;
+	ctx->image_w = ctx->image_h = 0;
+
 	return RC_OK;
 }
 
@@ -89,6 +259,13 @@ RETCODE sdl_ctx_dispose(SDLContext **ctx)
 	/* Dispose textures */
 	sdl_ctx_dispose_textures(c);
 
+	filtercache_print_stats(&c->cache);
+	filtercache_clear(&c->cache);
+	pyramid_free(&c->filtered_pyramid);
+
+	bufpool_print_stats();
+	bufpool_trim();
+
 	/* Destroy renderer */
 	if(c->renderer != NULL) {
 		SDL_DestroyRenderer(c->renderer);
@@ -112,6 +289,7 @@ RETCODE sdl_ctx_dispose(SDLContext **ctx)
 RETCODE sdl_ctx_init(SDLContext **ctx, SDL_Rect wnd_rect, SDL_Point tex_size)
 {
 	SDLContext *c = *ctx;
+	int i;
 
 	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "best");
 
@@ -144,11 +322,26 @@ RETCODE sdl_ctx_init(SDLContext **ctx, SDL_Rect wnd_rect, SDL_Point tex_size)
 	}
 
 	SDL_GetRendererOutputSize(c->renderer, &c->renderer_size.x, &c->renderer_size.y);
+
+	for(i=0; i<PYRAMID_MAX_LEVELS; i++) {
+		if(failed(tiletex_init(&c->orig_levels[i], c->renderer)) || failed(tiletex_init(&c->filtered_levels[i], c->renderer))) {
+			goto fail;
+		}
+	}
+
 	c->zoom_factor = 1;
 	c->zoom_animation_progress = 0;
 	c->zoom_animation_amount = 0;
 	c->show_histograms = 1;
+	c->histograms_changed = 1;
+	c->needs_redraw = 1;
 	c->dual_view = 0;
+	c->worker_event = SDL_RegisterEvents(1);
+	filtercache_init(&c->cache, 0);
+
+	if(failed(pyramid_init(&c->filtered_pyramid, PYRAMID_GAUSSIAN))) {
+		goto fail;
+	}
 
 	/* Success */
 	*ctx = c;
@@ -162,65 +355,66 @@ fail:
 
 RETCODE sdl_ctx_alloc_textures(SDLContext *ctx, char *image_filename)
 {
-	/* Get file extension */
-	char *ext, *fm = "r";
+	/* The format is told by the first bytes, the header is parsed once */
+	IMGReader reader;
+	RETCODE rc = image_reader_open(image_filename, &reader);
+	if(failed(rc)) return rc;
 
-	if((ext = strrchr(image_filename, '.')) != NULL) {
-		ext++;
+	/* Destroy old textures, if any */
+	sdl_ctx_dispose_textures(ctx);
 
-		/* BMP files should be opened as binary */
-		if(stricmp(ext, "bmp") == 0) {
-			fm = "rb";
-		}
+	int32_t w = reader.header.w, h = reader.header.h;
 
-		/* Other (PGM) files should be opened as text files */
+	/* The image is kept in memory and uploaded tile by tile, since it may not fit a single texture */
+	ctx->filtered = bufpool_alloc_bitmap(w, h, &ctx->filtered_stride);
+	if(!ctx->filtered) {
+		rc = RC_OUTOFMEM;
+		goto fail;
 	}
 
-	FILE *f = fopen(image_filename, fm);
-	if(!f) return RC_FAIL;
+	ctx->image_w = w;
+	ctx->image_h = h;
 
-	/* Destroy old textures, if any */
-	sdl_ctx_dispose_textures(ctx);
+	/* Load image from file */
+	rc = image_reader_load(&reader, ctx->filtered, ctx->filtered_stride);
+	if(failed(rc)) goto fail;
 
-	int32_t fmt, w, h;
-	RETCODE rc = image_get_info(f, &fmt, &w, &h);
-	if(failed(rc)) return rc;
+	/* Close the image file handle */
+	image_reader_close(&reader);
 
-	/* Create texture for original image */
-	if(ctx) {
-		/* Since SDL doesn't support 8bit single channel format, we will convert gray-scale image to RGB32 */
-		ctx->orig_image = SDL_CreateTexture(ctx->renderer, fmt, SDL_TEXTUREACCESS_STREAMING, w, h);
+	/* Start the filter worker with a copy of the original image */
+	rc = filterjob_create(ctx->filtered, ctx->filtered_stride, w, h, ctx->worker_event, &ctx->worker);
+	if(failed(rc)) return rc;
 
-		/* Check result */
-		if (ctx->orig_image == NULL){
-			goto fail;
-		}
+	if(ctx->worker->tile_done) {
+		ctx->tile_valid = calloc(ctx->worker->tile_cols * ctx->worker->tile_rows, 1);
+		if(!ctx->tile_valid) return RC_OUTOFMEM;
 	}
 
-	/* Load image from file */
-	rc = image_load(f, ctx->orig_image);
+	/* Until a filter is applied, the original image is shown as filtered */
+	rc = pyramid_set_base(&ctx->filtered_pyramid, ctx->filtered, ctx->filtered_stride, w, h);
 	if(failed(rc)) return rc;
 
-	/* Create texture for the filtered image */
-	if(ctx) {
-		/* Since SDL doesn't support 8bit single channel format, we will convert gray-scale image to RGB32 */
-		ctx->filtered_image = SDL_CreateTexture(ctx->renderer, fmt, SDL_TEXTUREACCESS_STREAMING, w, h);
+	rc = tiletex_set_source(&ctx->filtered_levels[0], ctx->filtered, ctx->filtered_stride, w, h);
+	if(failed(rc)) return rc;
 
-		/* Check result */
-		if (ctx->filtered_image == NULL){
-			goto fail;
-		}
-	}
+	/* The file name and size identify the image in the filter cache */
+	ctx->source_id = filtercache_hash(image_filename, strlen(image_filename), ((uint64_t)w << 32) | (uint32_t)h);
 
-	/* Close the image file handle */
-	fclose(f);
+	/* The loaded image is the first step of the history */
+	rc = history_init(&ctx->history, w, h, 0);
+	if(failed(rc)) return rc;
 
-	/* Success */
-	return RC_OK;
+	rc = history_push(&ctx->history, ctx->filtered, ctx->filtered_stride, "original");
+	if(failed(rc)) return rc;
+
+	ctx->worker_state = history_current_id(&ctx->history);
+
+	return rc;
 
 fail:
-	fclose(f);
-	return RC_FAIL;
+	image_reader_close(&reader);
+	return rc;
 }
 
 RETCODE draw_histogram(SDLContext *ctx, SDL_Rect bounds_rect, SDL_Color clr, Histogram *h)
@@ -242,15 +436,20 @@ RETCODE draw_histogram(SDLContext *ctx, SDL_Rect bounds_rect, SDL_Color clr, His
 	SDL_SetRenderDrawColor(ctx->renderer, clr.r, clr.g, clr.b, 128);
 	int bar_width = inner_rect.w / 128;
 
+	/* All bars are submitted in a single call */
+	SDL_Rect bar_rects[128];
+
 	int i;
 	for(i=0; i<128; i++) {
 		int v = (h->values[i*2] + h->values[i*2+1]) / 2;
 		int bar_height = inner_rect.h * v / h->maxval;
 
 		SDL_Rect bar_rect = {inner_rect.x + i * bar_width, inner_rect.y + inner_rect.h - bar_height, bar_width, bar_height};
-		SDL_RenderFillRect(ctx->renderer, &bar_rect);
+		bar_rects[i] = bar_rect;
 	}
 
+	SDL_RenderFillRects(ctx->renderer, bar_rects, 128);
+
 	/* Draw range */
 	SDL_SetRenderDrawColor(ctx->renderer, 0, 0, 0, 64);
 
@@ -263,9 +462,223 @@ RETCODE draw_histogram(SDLContext *ctx, SDL_Rect bounds_rect, SDL_Color clr, His
 	return RC_OK;
 }
 
+/* Draws the R/G/B histograms side by side inside hist_rect */
+void draw_histograms(SDLContext *ctx, SDL_Rect hist_rect)
+{
+	int hist_w = hist_rect.w / 3 - 10;
+
+	/* Draw red histogram */
+	SDL_Rect tmp_rect = {hist_rect.x + 5, hist_rect.y, hist_w, hist_rect.h};
+	SDL_Color tmp_color = {255, 0, 0, 1};
+	draw_histogram(ctx, tmp_rect, tmp_color, &ctx->histograms[0]);
+
+	/* Draw green histogram */
+	SDL_Rect tmp_rect2 = {hist_rect.x + 10 + hist_w, hist_rect.y, hist_w, hist_rect.h};
+	SDL_Color tmp_color2 = {0, 255, 0, 1};
+	draw_histogram(ctx, tmp_rect2, tmp_color2, &ctx->histograms[1]);
+
+	/* Draw blue histogram */
+	SDL_Rect tmp_rect3 = {hist_rect.x + 15 + hist_w * 2, hist_rect.y, hist_w, hist_rect.h};
+	SDL_Color tmp_color3 = {0, 0, 255, 1};
+	draw_histogram(ctx, tmp_rect3, tmp_color3, &ctx->histograms[2]);
+}
+
+/**
+ * Redraws the histograms into their overlay texture if they have changed since the
+ * last time (or the texture doesn't match the size). Returns RC_FAIL if the renderer
+ * can't render to textures, so the caller draws the histograms directly.
+ */
+RETCODE update_histogram_overlay(SDLContext *ctx, int w, int h)
+{
+	int tex_w, tex_h;
+
+	if(!SDL_RenderTargetSupported(ctx->renderer)) {
+		return RC_FAIL;
+	}
+
+	if(ctx->histogram_overlay && (SDL_QueryTexture(ctx->histogram_overlay, NULL, NULL, &tex_w, &tex_h) != 0 || tex_w != w || tex_h != h)) {
+		memtrack_texture_destroyed(MEM_HISTOGRAM, ctx->histogram_overlay);
+		SDL_DestroyTexture(ctx->histogram_overlay);
+		ctx->histogram_overlay = NULL;
+	}
+
+	if(!ctx->histogram_overlay) {
+		ctx->histogram_overlay = SDL_CreateTexture(ctx->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, w, h);
+
+		if(!ctx->histogram_overlay) {
+			return RC_FAIL;
+		}
+
+		memtrack_texture_created(MEM_HISTOGRAM, ctx->histogram_overlay);
+
+		/**
+		 * Blending the bars onto a transparent texture leaves premultiplied colors in it,
+		 * so the texture is composed with (ONE, ONE_MINUS_SRC_ALPHA) to look the same as
+		 * drawing the bars directly on the screen.
+		 */
+		SDL_BlendMode premultiplied = SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+				SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+
+		if(SDL_SetTextureBlendMode(ctx->histogram_overlay, premultiplied) != 0) {
+			memtrack_texture_destroyed(MEM_HISTOGRAM, ctx->histogram_overlay);
+			SDL_DestroyTexture(ctx->histogram_overlay);
+			ctx->histogram_overlay = NULL;
+			return RC_FAIL;
+		}
+
+		ctx->histograms_changed = 1;
+	}
+
+	if(!ctx->histograms_changed) {
+		return RC_OK;
+	}
+
+	if(SDL_SetRenderTarget(ctx->renderer, ctx->histogram_overlay) != 0) {
+		return RC_FAIL;
+	}
+
+	SDL_SetRenderDrawBlendMode(ctx->renderer, SDL_BLENDMODE_NONE);
+	SDL_SetRenderDrawColor(ctx->renderer, 0, 0, 0, 0);
+	SDL_RenderClear(ctx->renderer);
+
+	SDL_Rect hist_rect = {0, 0, w, h};
+	draw_histograms(ctx, hist_rect);
+
+	SDL_SetRenderTarget(ctx->renderer, NULL);
+	ctx->histograms_changed = 0;
+
+	return RC_OK;
+}
+
+/* Replaces the shown histograms, their overlay is redrawn on the next frame */
+void set_histograms(SDLContext *ctx, const Histogram *histograms)
+{
+	memcpy(ctx->histograms, histograms, sizeof(ctx->histograms));
+	ctx->histograms_changed = 1;
+}
+
+/* Draws the filtered image, or the preview with the tiles which are already filtered on top of it */
+void draw_filtered(SDLContext *ctx, const SDL_Rect *target_rect, float zoom)
+{
+	int i, j;
+
+	if(!ctx->show_preview) {
+		draw_level(&ctx->filtered_pyramid, ctx->filtered_levels, ctx->display_level, target_rect);
+		return;
+	}
+
+	/* The preview is stretched over the area of the full image */
+	SDL_RenderCopy(ctx->renderer, ctx->preview_image, NULL, target_rect);
+
+	if(!ctx->tile_valid) {
+		return;
+	}
+
+	/* Only the visible tiles are looked at */
+	int c0 = ctx->viewport.x / FILTERJOB_TILE_SIZE, c1 = (ctx->viewport.x + ctx->viewport.w - 1) / FILTERJOB_TILE_SIZE;
+	int r0 = ctx->viewport.y / FILTERJOB_TILE_SIZE, r1 = (ctx->viewport.y + ctx->viewport.h - 1) / FILTERJOB_TILE_SIZE;
+
+	for(j=r0; j<=r1 && j<ctx->worker->tile_rows; j++) {
+		for(i=c0; i<=c1 && i<ctx->worker->tile_cols; i++) {
+			int index = j * ctx->worker->tile_cols + i;
+			SDL_Rect src_rect;
+
+			if(!ctx->tile_valid[index]) {
+				continue;
+			}
+
+			filterjob_tile_rect(ctx->worker, index, &src_rect);
+
+			/* Round both edges, so neighbouring tiles don't leave gaps */
+			int x0 = target_rect->x + (int)(src_rect.x * zoom);
+			int y0 = target_rect->y + (int)(src_rect.y * zoom);
+			int x1 = target_rect->x + (int)((src_rect.x + src_rect.w) * zoom);
+			int y1 = target_rect->y + (int)((src_rect.y + src_rect.h) * zoom);
+			SDL_Rect dst_rect = {x0, y0, x1 - x0, y1 - y0};
+
+			tiletex_draw(&ctx->filtered_levels[0], &src_rect, &dst_rect);
+		}
+	}
+}
+
+/* Tells the worker which part of the image is visible, so it filters those tiles first */
+void update_viewport(SDLContext *ctx, const SDL_Rect *target_rect, float zoom)
+{
+	int w = ctx->image_w, h = ctx->image_h;
+
+	int x0 = (int)(-target_rect->x / zoom);
+	int y0 = (int)(-target_rect->y / zoom);
+	int x1 = (int)((ctx->renderer_size.x - target_rect->x) / zoom) + 1;
+	int y1 = (int)((ctx->renderer_size.y - target_rect->y) / zoom) + 1;
+
+	if(x0 < 0) x0 = 0;
+	if(y0 < 0) y0 = 0;
+	if(x1 > w) x1 = w;
+	if(y1 > h) y1 = h;
+
+	SDL_Rect v = {x0, y0, x1 - x0, y1 - y0};
+
+	int level = pyramid_level_for_scale(&ctx->worker->pyramid, zoom);
+
+	if(v.w > 0 && v.h > 0 && (memcmp(&v, &ctx->viewport, sizeof(v)) != 0 || level != ctx->display_level)) {
+		ctx->viewport = v;
+		ctx->display_level = level;
+		filterjob_set_viewport(ctx->worker, &v, level);
+	}
+}
+
+/* Draws the time of the last frame and of each kind of span since the last key press */
+void draw_hud(SDLContext *ctx)
+{
+	const int scale = 2, padding = 8, line_h = (HUDFONT_CELL_H + 2) * scale;
+	TraceSummary summary;
+	char line[64];
+	int i;
+
+	trace_summarize(ctx->operation_start, &summary);
+
+	/* With the hardware counters each line also shows instructions per cycle */
+	int w = hudfont_width(trace_counters_enabled ? "filter_tile    1234x 123456.7 ms IPC 1.23" : "filter_tile    1234x 123456.7 ms", scale) + 2 * padding;
+	SDL_Rect box = {ctx->renderer_size.x - w - 10, 10, w, (summary.count + 2) * line_h + 2 * padding};
+	int x = box.x + padding, y = box.y + padding;
+
+	SDL_SetRenderDrawBlendMode(ctx->renderer, SDL_BLENDMODE_BLEND);
+	SDL_SetRenderDrawColor(ctx->renderer, 0, 0, 0, 176);
+	SDL_RenderFillRect(ctx->renderer, &box);
+
+	SDL_SetRenderDrawColor(ctx->renderer, 255, 255, 255, 255);
+	snprintf(line, sizeof(line), "Last frame %.2f ms", ctx->frame_ms);
+	hudfont_draw(ctx->renderer, x, y, scale, line);
+	y += line_h;
+
+	hudfont_draw(ctx->renderer, x, y, scale, summary.count ? "Since the last key:" : "Nothing since the last key");
+	y += line_h;
+
+	for(i=0; i<summary.count; i++, y += line_h) {
+		const TraceSummaryEntry *e = &summary.entries[i];
+
+		/* The bar shows the share of the largest total */
+		SDL_Rect bar = {x, y - scale, (int)((w - 2 * padding) * (e->total_ms / summary.entries[0].total_ms)), line_h - scale};
+		SDL_SetRenderDrawColor(ctx->renderer, 64, 96, 192, 160);
+		SDL_RenderFillRect(ctx->renderer, &bar);
+
+		if(trace_counters_enabled && e->counted && e->cycles) {
+			snprintf(line, sizeof(line), "%-14.14s %4dx %8.1f ms IPC %.2f", e->name, e->count, e->total_ms, (double)e->instructions / e->cycles);
+		}else {
+			snprintf(line, sizeof(line), "%-14.14s %4dx %8.1f ms", e->name, e->count, e->total_ms);
+		}
+
+		SDL_SetRenderDrawColor(ctx->renderer, 255, 255, 255, 255);
+		hudfont_draw(ctx->renderer, x, y, scale, line);
+	}
+}
+
 RETCODE on_draw(SDLContext *ctx)
 {
+	TRACE_SCOPE("draw");
+
 	int tex_w, tex_h;
+	int i;
 
 	/* Get zoom factor and animate zoom animation (if pending) */
 	float zoom_f = ctx->zoom_factor + ctx->zoom_animation_amount * ((float)1-quadratic_easing(ctx->zoom_animation_progress, 0, 1, 1));
@@ -282,28 +695,57 @@ RETCODE on_draw(SDLContext *ctx)
 		}
 	}
 
-	/* Get texture's size so we can calculate where to place it on the screen */
-	SDL_QueryTexture(ctx->orig_image, NULL, NULL, &tex_w, &tex_h);
-	tex_w = (int)((float)tex_w * zoom_f);
-	tex_h = (int)((float)tex_h * zoom_f);
+	/* Get image's size so we can calculate where to place it on the screen */
+	tex_w = (int)((float)ctx->image_w * zoom_f);
+	tex_h = (int)((float)ctx->image_h * zoom_f);
+
+	/* Panning moves the image in the opposite direction */
+	int pan_x = (int)(ctx->pan.x * zoom_f);
+	int pan_y = (int)(ctx->pan.y * zoom_f);
 
 	if(ctx->dual_view) {
-		int cx = ctx->renderer_size.x / 2;
-		int cy = ctx->renderer_size.y / 2 - tex_h / 2;
+		int cx = ctx->renderer_size.x / 2 - pan_x;
+		int cy = ctx->renderer_size.y / 2 - tex_h / 2 - pan_y;
 
 		/* Center the image on the screen */
 		SDL_Rect target_rect1 = {cx - tex_w, cy, tex_w, tex_h};
 		SDL_Rect target_rect2 = {cx, cy, tex_w, tex_h};
 
 		/* Draw textures on the backbuffer */
-		SDL_RenderCopy(ctx->renderer, ctx->orig_image, NULL, &target_rect1);
-		SDL_RenderCopy(ctx->renderer, ctx->filtered_image, NULL, &target_rect2);
+		update_viewport(ctx, &target_rect2, zoom_f);
+
+		/**
+		 * The worker swaps in the source set by apply_filter() when it's done with the old one,
+		 * and rebuilds the levels it filters from; they're uploaded while it can't change them.
+		 */
+		pyramid_lock(&ctx->worker->pyramid);
+
+		int serial = SDL_AtomicGet(&ctx->worker->source_serial);
+		if(serial != ctx->orig_serial) {
+			for(i=0; i<PYRAMID_MAX_LEVELS; i++) {
+				tiletex_invalidate(&ctx->orig_levels[i], NULL);
+			}
+
+			ctx->orig_serial = serial;
+		}
+
+		draw_level(&ctx->worker->pyramid, ctx->orig_levels, ctx->display_level, &target_rect1);
+		pyramid_unlock(&ctx->worker->pyramid);
+
+		draw_filtered(ctx, &target_rect2, zoom_f);
 	}else {
 		/* Center the image on the screen */
-		SDL_Rect target_rect = {ctx->renderer_size.x / 2 - tex_w / 2, ctx->renderer_size.y / 2 - tex_h / 2, tex_w, tex_h};
+		SDL_Rect target_rect = {ctx->renderer_size.x / 2 - tex_w / 2 - pan_x, ctx->renderer_size.y / 2 - tex_h / 2 - pan_y, tex_w, tex_h};
 
 		/* Draw texture on the backbuffer */
-		SDL_RenderCopy(ctx->renderer, ctx->filtered_image, NULL, &target_rect);
+		update_viewport(ctx, &target_rect, zoom_f);
+		draw_filtered(ctx, &target_rect, zoom_f);
+	}
+
+	/* Release the tiles far from what was drawn, so video memory stays bounded */
+	for(i=0; i<PYRAMID_MAX_LEVELS; i++) {
+		tiletex_evict(&ctx->orig_levels[i]);
+		tiletex_evict(&ctx->filtered_levels[i]);
 	}
 
 	/* Draw histograms */
@@ -311,22 +753,166 @@ RETCODE on_draw(SDLContext *ctx)
 		const int hist_padding = 15;
 		const int hist_height = (int)((float)((ctx->renderer_size.x - hist_padding) / 3 - 10) * 0.55555);
 		SDL_Rect hist_rect = {hist_padding, hist_padding, ctx->renderer_size.x - hist_padding, hist_height};
-		int hist_w = hist_rect.w / 3 - 10;
 
-		/* Draw red histogram */
-		SDL_Rect tmp_rect = {hist_rect.x + 5, hist_rect.y, hist_w, hist_rect.h};
-		SDL_Color tmp_color = {255, 0, 0, 1};
-		draw_histogram(ctx, tmp_rect, tmp_color, &ctx->histograms[0]);
+		if(update_histogram_overlay(ctx, hist_rect.w, hist_rect.h) == RC_OK) {
+			SDL_RenderCopy(ctx->renderer, ctx->histogram_overlay, NULL, &hist_rect);
+		}else {
+			draw_histograms(ctx, hist_rect);
+		}
+	}
+
+	if(ctx->show_hud) {
+		draw_hud(ctx);
+	}
 
-		/* Draw green histogram */
-		SDL_Rect tmp_rect2 = {hist_rect.x + 10 + hist_w, hist_rect.y, hist_w, hist_rect.h};
-		SDL_Color tmp_color2 = {0, 255, 0, 1};
-		draw_histogram(ctx, tmp_rect2, tmp_color2, &ctx->histograms[1]);
+	return RC_OK;
+}
 
-		/* Draw blue histogram */
-		SDL_Rect tmp_rect3 = {hist_rect.x + 15 + hist_w * 2, hist_rect.y, hist_w, hist_rect.h};
-		SDL_Color tmp_color3 = {0, 0, 255, 1};
-		draw_histogram(ctx, tmp_rect3, tmp_color3, &ctx->histograms[2]);
+/* Key of the results of filters applied to a history snapshot in the filter cache */
+uint64_t state_key(SDLContext *ctx, uint32_t state)
+{
+	return filtercache_hash(&state, sizeof(state), ctx->source_id);
+}
+
+/* Makes the filtered bitmap the current snapshot of the history, so the next filter is applied to it */
+RETCODE commit_filtered(SDLContext *ctx, const char *label)
+{
+	RETCODE rc = history_push(&ctx->history, ctx->filtered, ctx->filtered_stride, label);
+
+	if(failed(rc)) {
+		printf("Can't add \"%s\" to the undo history (rc=%d).\n", label, rc);
+	}
+
+	return rc;
+}
+
+/* Shows the current snapshot of the history after an undo or redo, dropping the filter in progress */
+RETCODE show_history_step(SDLContext *ctx)
+{
+	filterjob_cancel(ctx->worker);
+	ctx->show_preview = 0;
+
+	RETCODE rc = history_get(&ctx->history, ctx->filtered, ctx->filtered_stride);
+	filtered_changed(ctx, NULL);
+
+	histogram_extract_bitmap(ctx->filtered, ctx->filtered_stride, ctx->image_w, ctx->image_h, &ctx->histograms[0], &ctx->histograms[1], &ctx->histograms[2]);
+	ctx->histograms_changed = 1;
+
+	return rc;
+}
+
+/**
+ * Applies a filter to the current image: shows a cached result or hands the filter
+ * to the worker, superseding the one in progress.
+ */
+RETCODE apply_filter(SDLContext *ctx, const char *filter_name)
+{
+	uint32_t state = history_current_id(&ctx->history);
+
+	/* The worker still holds the image the last filter was applied to (or the one before an undo) */
+	if(ctx->worker_state != state) {
+		filterjob_set_source(ctx->worker, ctx->filtered, ctx->filtered_stride);
+		ctx->worker_state = state;
+	}
+
+	const FilterJobResult *r = filtercache_lookup(&ctx->cache, state_key(ctx, state), filter_name, 0);
+
+	if(r) {
+		printf("Applying image filter \"%s\" (cached).\n", filter_name);
+
+		/* A late result of another filter must not replace this one */
+		filterjob_cancel(ctx->worker);
+
+		paste_filtered(ctx, r->pixels, r->stride, &r->rect);
+
+		ctx->show_preview = 0;
+		set_histograms(ctx, r->histograms);
+
+		return commit_filtered(ctx, filter_name);
+	}
+
+	printf("Applying image filter \"%s\".\n", filter_name);
+	filterjob_submit(ctx->worker, filter_name);
+
+	/* Tiles of the previous filter must not be drawn over the new preview */
+	if(ctx->tile_valid) {
+		memset(ctx->tile_valid, 0, ctx->worker->tile_cols * ctx->worker->tile_rows);
+	}
+
+	return RC_OK;
+}
+
+/* Uploads a result of the worker to the preview texture or copies it into the filtered bitmap */
+RETCODE on_filter_done(SDLContext *ctx)
+{
+	FilterJobResult *r;
+	int w, h;
+
+	if(filterjob_take_result(ctx->worker, &r) != RC_OK) {
+		/* Superseded by a newer request */
+		return RC_FALSE;
+	}
+
+	if(failed(r->rc)) {
+		RETCODE rc = r->rc;
+
+		printf("Filter failed (rc=%d).\n", rc);
+		filterjob_free_result(r);
+		return rc;
+	}
+
+	switch(r->kind) {
+	case FILTERJOB_PREVIEW:
+		/* (Re)create the preview texture if its size differs */
+		if(ctx->preview_image && (SDL_QueryTexture(ctx->preview_image, NULL, NULL, &w, &h) != 0 || w != r->w || h != r->h)) {
+			memtrack_texture_destroyed(MEM_TEXTURES, ctx->preview_image);
+			SDL_DestroyTexture(ctx->preview_image);
+			ctx->preview_image = NULL;
+		}
+
+		if(!ctx->preview_image) {
+			ctx->preview_image = SDL_CreateTexture(ctx->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, r->w, r->h);
+			memtrack_texture_created(MEM_TEXTURES, ctx->preview_image);
+		}
+
+		TraceSpan upload = trace_span_begin("upload");
+
+		if(ctx->preview_image && SDL_UpdateTexture(ctx->preview_image, NULL, r->pixels, r->stride) == 0) {
+			ctx->show_preview = 1;
+			set_histograms(ctx, r->histograms);
+		}
+
+		trace_span_end(&upload);
+		break;
+
+	case FILTERJOB_FULL:
+		paste_filtered(ctx, r->pixels, r->stride, &r->rect);
+		ctx->show_preview = 0;
+		set_histograms(ctx, r->histograms);
+		break;
+
+	case FILTERJOB_TILE:
+		/* Shown over the preview as soon as it arrives, only its part of the texture tiles is updated */
+		paste_filtered(ctx, r->pixels, r->stride, &r->rect);
+		ctx->tile_valid[(r->rect.y / FILTERJOB_TILE_SIZE) * ctx->worker->tile_cols + r->rect.x / FILTERJOB_TILE_SIZE] = 1;
+		break;
+
+	case FILTERJOB_ASSEMBLED:
+		/* Every tile is in the filtered bitmap already */
+		ctx->show_preview = 0;
+		set_histograms(ctx, r->histograms);
+		break;
+	}
+
+	/**
+	 * A full result becomes the next step of the history. It is also cached for the
+	 * image it was applied to, so applying the filter there again is only a copy.
+	 */
+	if(r->kind == FILTERJOB_FULL || r->kind == FILTERJOB_ASSEMBLED) {
+		commit_filtered(ctx, r->filter);
+		filtercache_insert(&ctx->cache, state_key(ctx, ctx->worker_state), r->filter, 0, r);
+	}else {
+		filterjob_free_result(r);
 	}
 
 	return RC_OK;
@@ -335,6 +921,11 @@ RETCODE on_draw(SDLContext *ctx)
 RETCODE on_key_down(SDLContext *ctx, SDL_Keycode kc)
 {
 #define zoom_step	0.15
+	/* The HUD shows what the last key (other than its own ones) has cost */
+	if(kc != SDLK_t && kc != SDLK_i && kc != SDLK_p) {
+		ctx->operation_start = SDL_GetPerformanceCounter();
+	}
+
 	switch(kc) {
 	case SDLK_KP_PLUS:
 		//ctx->zoom_factor += zoom_step;
@@ -356,11 +947,46 @@ RETCODE on_key_down(SDLContext *ctx, SDL_Keycode kc)
 		break;
 
 	case SDLK_0:
+		/* The filters can still be redone */
 		printf("Reseting to original image.\n");
-		copy_texture(ctx->orig_image, ctx->filtered_image);
-		histogram_extract(ctx->filtered_image, &ctx->histograms[0], &ctx->histograms[1], &ctx->histograms[2]);
+		history_jump(&ctx->history, 0);
+		show_history_step(ctx);
+		break;
+
+	case SDLK_z:
+		if(ctx->history.count > 0) {
+			const char *label = history_current_label(&ctx->history);
+
+			if(history_undo(&ctx->history) == RC_OK) {
+				printf("Undo \"%s\".\n", label);
+				show_history_step(ctx);
+			}
+		}
 		break;
 
+	case SDLK_y:
+		if(history_redo(&ctx->history) == RC_OK) {
+			printf("Redo \"%s\".\n", history_current_label(&ctx->history));
+			show_history_step(ctx);
+		}
+		break;
+
+	case SDLK_LEFT:
+	case SDLK_RIGHT:
+	case SDLK_UP:
+	case SDLK_DOWN: {
+		/* Pan by an eighth of the window */
+		float zoom = ctx->zoom_factor > 0 ? ctx->zoom_factor : 1;
+		int step_x = (int)(ctx->renderer_size.x / 8 / zoom);
+		int step_y = (int)(ctx->renderer_size.y / 8 / zoom);
+
+		if(kc == SDLK_LEFT) ctx->pan.x -= step_x;
+		if(kc == SDLK_RIGHT) ctx->pan.x += step_x;
+		if(kc == SDLK_UP) ctx->pan.y -= step_y;
+		if(kc == SDLK_DOWN) ctx->pan.y += step_y;
+		break;
+	}
+
 	case SDLK_h:
 		/* Toggle histograms' visibility */
 		ctx->show_histograms = !ctx->show_histograms;
@@ -369,12 +995,63 @@ RETCODE on_key_down(SDLContext *ctx, SDL_Keycode kc)
 	case SDLK_s:
 		/* Save filtered image to PGM file */
 		printf("Saving image to file \"%s\"...\n", "output.pgm");
-		image_save_to_file("output.pgm", "pgm", ctx->filtered_image);
+		image_save_bitmap_to_file("output.pgm", "pgm", ctx->filtered, ctx->filtered_stride, ctx->image_w, ctx->image_h);
 		break;
 
 	case SDLK_d:
 		ctx->dual_view = !ctx->dual_view;
 		break;
+
+	case SDLK_t:
+		/* Record spans until T is pressed again, then write them for chrome://tracing */
+		if(!ctx->tracing) {
+			printf("Tracing (press T again to write \"%s\")...\n", "trace.json");
+			trace_reset();
+		}else {
+			trace_export("trace.json");
+		}
+
+		ctx->tracing = !ctx->tracing;
+		trace_enable(ctx->tracing || ctx->show_hud);
+		break;
+
+	case SDLK_i:
+		ctx->show_hud = !ctx->show_hud;
+		trace_enable(ctx->tracing || ctx->show_hud);
+		break;
+
+	case SDLK_p:
+		/* Hardware counters in the spans (shown in the HUD and the trace) */
+		if(trace_counters_enabled) {
+			trace_enable_counters(0);
+			printf("Hardware counters off.\n");
+		}else if(failed(trace_enable_counters(1))) {
+			printf("No hardware counters: %s.\n", perfcnt_error());
+		}else {
+			printf("Hardware counters on.\n");
+		}
+		break;
+
+	case SDLK_m:
+		/* Memory of every subsystem, including the textures and the undo history */
+		memtrack_print_summary();
+		bufpool_print_stats();
+		break;
+
+	case SDLK_g:
+		/* Gradient magnitude (both Sobel derivatives in one pass) */
+		apply_filter(ctx, "gradient_sobel");
+		break;
+
+	case SDLK_c:
+		/* Canny edge detector */
+		apply_filter(ctx, "canny");
+		break;
+
+	case SDLK_b:
+		/* Edge-preserving bilateral filter */
+		apply_filter(ctx, "bilateral");
+		break;
 	}
 
 	/* Handle keys [1..9] for applying filters */
@@ -382,9 +1059,7 @@ RETCODE on_key_down(SDLContext *ctx, SDL_Keycode kc)
 		Filter2D *f;
 
 		if(filter_find_by_id(kc - SDLK_1, &f) == RC_OK) {
-			printf("Applying image filter \"%s\".\n", f->name);
-			filter_apply_to_texture(ctx->orig_image, ctx->filtered_image, f->name);
-			histogram_extract(ctx->filtered_image, &ctx->histograms[0], &ctx->histograms[1], &ctx->histograms[2]);
+			apply_filter(ctx, f->name);
 		}
 	}
 
@@ -399,8 +1074,17 @@ RETCODE mainloop(SDLContext *ctx)
 
 	/* While application is running */
 	while(!quit) {
+		/* Sleep until an event arrives, unless a frame is due; waking up to check the kernel files only if there are any */
+		int has_event = ctx->needs_redraw ? SDL_PollEvent(&event) :
+				kernels_watching() ? SDL_WaitEventTimeout(&event, KERNELS_POLL_MS) : SDL_WaitEvent(&event);
+
+		/* Cached results may come from the old coefficients of a reloaded kernel */
+		if(kernels_poll() == RC_OK) {
+			filtercache_clear(&ctx->cache);
+		}
+
 		/* Handle events in the queue */
-		while(SDL_PollEvent(&event) != 0) {
+		while(has_event) {
 			switch(event.type) {
 			case SDL_QUIT:
 				quit = 1;
@@ -411,10 +1095,42 @@ RETCODE mainloop(SDLContext *ctx)
 					quit = 1;
 				else
 					on_key_down(ctx, event.key.keysym.sym);
+
+				ctx->needs_redraw = 1;
+				break;
+
+			case SDL_WINDOWEVENT:
+				/* The window was uncovered or resized */
+				ctx->needs_redraw = 1;
+				break;
+
+			case SDL_RENDER_TARGETS_RESET:
+			case SDL_RENDER_DEVICE_RESET:
+				/* Contents of the histogram overlay are lost */
+				ctx->histograms_changed = 1;
+				ctx->needs_redraw = 1;
+				break;
+
+			default:
+				if(event.type == ctx->worker_event) {
+					on_filter_done(ctx);
+					ctx->needs_redraw = 1;
+				}
 				break;
 			}
+
+			has_event = SDL_PollEvent(&event);
+		}
+
+		if(quit || !ctx->needs_redraw) {
+			continue;
 		}
 
+		ctx->needs_redraw = 0;
+
+		Uint64 frame_start = SDL_GetPerformanceCounter();
+		TraceSpan frame = trace_span_begin("frame");
+
         /* Use black for background color */
 		if (SDL_SetRenderDrawColor(ctx->renderer, 0, 0, 0, 255) != 0) {
 			return RC_FAIL;
@@ -433,7 +1149,17 @@ RETCODE mainloop(SDLContext *ctx)
 		}
 
 		/* Present back buffer */
+		TraceSpan present = trace_span_begin("present");
 		SDL_RenderPresent(ctx->renderer);
+		trace_span_end(&present);
+
+		trace_span_end(&frame);
+		ctx->frame_ms = (double)(SDL_GetPerformanceCounter() - frame_start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+		/* Keep drawing frames until the zoom animation ends */
+		if(ctx->zoom_animation_progress > 0) {
+			ctx->needs_redraw = 1;
+		}
 	}
 
 	return RC_OK;
@@ -453,6 +1179,40 @@ int main(int argc, char** argv){
 		return 0;
 	}
 
+	/* Kernels defined in files join the built-in matrices in every mode */
+	kernels_load(KERNELS_DEFAULT_PATH);
+
+	/* Times the variants of every matrix and stores the fastest ones */
+	if(strcmp(argv[1], "--tune") == 0) {
+		return autotune_main(argc, argv);
+	}
+
+	/* Every mode uses the decisions of an earlier --tune, or tunes on first use */
+	autotune_load(AUTOTUNE_DEFAULT_FILE);
+
+	/* Frames piped through stdin and stdout */
+	if(strcmp(argv[1], "--stream") == 0) {
+		return stream_main(argc, argv);
+	}
+
+	if(strcmp(argv[1], "--bench") == 0) {
+		return bench_main(argc, argv);
+	}
+
+	/* Filtering daemon and its load generator */
+	if(strcmp(argv[1], "--daemon") == 0) {
+		return filterd_main(argc, argv);
+	}
+
+	if(strcmp(argv[1], "--filterd-load") == 0) {
+		return filterd_load_main(argc, argv);
+	}
+
+	/* Options on the command line select the windowless batch mode */
+	if(argv[1][0] == '-') {
+		return batch_main(argc, argv);
+	}
+
 	SDL_Rect wnd_rect = {SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 890, 680};
 	SDL_Point texture_size = {512, 512};
 
@@ -480,17 +1240,25 @@ int main(int argc, char** argv){
 		printf("done\n");
 	}
 
-	copy_texture(ctx->orig_image, ctx->filtered_image);
-	histogram_extract(ctx->filtered_image, &ctx->histograms[0], &ctx->histograms[1], &ctx->histograms[2]);
+	histogram_extract_bitmap(ctx->filtered, ctx->filtered_stride, ctx->image_w, ctx->image_h, &ctx->histograms[0], &ctx->histograms[1], &ctx->histograms[2]);
 
 	/* Print navigation info */
 	printf("\nUse the following keys for the respective operation...\n");
 	printf("[+/-] Zoom in/out (from the num pad)\n");
-	printf("[1..9] Apply filters\n");
+	printf("[Arrows] Pan the image\n");
+	printf("[1..9] Apply filters (each to the result of the previous one)\n");
 	printf("[0] Reset to original image\n");
+	printf("[Z/Y] Undo/redo the last filter\n");
+	printf("[G] Gradient magnitude\n");
+	printf("[C] Canny edge detector\n");
+	printf("[B] Bilateral filter\n");
 	printf("[H] Toggle histograms\n");
 	printf("[D] Toggle dual image view\n");
 	printf("[S] Save filtered image\n");
+	printf("[T] Start/stop tracing (written to trace.json)\n");
+	printf("[I] Toggle the timing HUD\n");
+	printf("[P] Toggle hardware counters in the HUD and the trace\n");
+	printf("[M] Print the memory used by each subsystem\n");
 	printf("[Q] Quit\n");
 	printf("\nPress any key to continue...\n");
 	//getch();
@@ -0,0 +1,551 @@
+/*
+ * match.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "match.h"
+#include "fft.h"
+#include "threadpool.h"
+#include "memtrack.h"
+
+#define bytes_per_pixel 4
+
+/* Columns of the integral images accumulated by one task */
+#define MATCH_COLUMN_BLOCK	256
+
+/* Windows whose variance per pixel is below this are treated as flat */
+#define MATCH_MIN_VARIANCE	1e-3
+
+const MatchParams match_default_params = {
+	.min_score = 0.5f,
+	.min_distance = 0,
+};
+
+typedef struct {
+	const float *img;
+	int img_stride;
+	int w, h;
+
+	const float *tmpl;
+	int tmpl_stride;
+	int tw, th;
+
+	float img_mean, tmpl_mean;
+	double tmpl_energy;
+
+	/* Integral images of the pixel values and their squares, (w + 1) x (h + 1) */
+	double *sum, *sqsum;
+
+	/* Spectrum of the image in the real part and the template in the imaginary part */
+	Complex *spectrum;
+	int fw, fh;
+
+	float *scores;
+	int scores_stride;
+
+	int band_h;
+} MatchJob;
+
+typedef struct {
+	const float *scores;
+	int sw, sh;
+
+	float min_score;
+	int radius;
+
+	/* Best candidates of each band, sorted by decreasing score */
+	MatchResult *candidates;
+	int *candidate_count;
+	int max_results;
+
+	int band_h;
+} MatchPeakJob;
+
+typedef struct {
+	const uint8_t *src;
+	int stride;
+	int w;
+	float *out;
+	int band_h, h;
+} MatchLumaJob;
+
+static void match_luma_proc(void *arg, int band)
+{
+	MatchLumaJob *job = arg;
+	int i, j;
+	int y1 = (band + 1) * job->band_h > job->h ? job->h : (band + 1) * job->band_h;
+	const float third = 1.0f / 3;
+
+	for(j=band * job->band_h; j<y1; j++) {
+		const uint8_t *p = job->src + (size_t)j * job->stride;
+		float *out = job->out + (size_t)j * job->w;
+
+		for(i=0; i<job->w; i++, p += bytes_per_pixel) {
+			out[i] = (float)(p[1] + p[2] + p[3]) * third;
+		}
+	}
+}
+
+/* Gray level of a 32-bit bitmap as a float plane */
+static void match_luma(const void *src, int stride, int w, int h, float *out)
+{
+	MatchLumaJob job = {
+		.src = src,
+		.stride = stride,
+		.w = w,
+		.h = h,
+		.out = out,
+	};
+
+	int bands = threadpool_split_rows(h, &job.band_h);
+	threadpool_parallel_for(bands, match_luma_proc, &job);
+}
+
+/* Integral images, first pass: running sums along each row */
+static void match_integral_rows_proc(void *arg, int band)
+{
+	MatchJob *job = arg;
+	int i, j;
+	int y1 = (band + 1) * job->band_h > job->h ? job->h : (band + 1) * job->band_h;
+	const int iw = job->w + 1;
+
+	for(j=band * job->band_h; j<y1; j++) {
+		const float *p = job->img + (size_t)j * job->img_stride;
+		double *s = job->sum + (size_t)(j + 1) * iw;
+		double *sq = job->sqsum + (size_t)(j + 1) * iw;
+		double acc = 0, acc_sq = 0;
+
+		s[0] = sq[0] = 0;
+
+		for(i=0; i<job->w; i++) {
+			acc += p[i];
+			acc_sq += (double)p[i] * p[i];
+
+			s[i + 1] = acc;
+			sq[i + 1] = acc_sq;
+		}
+	}
+}
+
+/* Integral images, second pass: running sums down a block of columns */
+static void match_integral_columns_proc(void *arg, int block)
+{
+	MatchJob *job = arg;
+	int i, j;
+	const int iw = job->w + 1;
+	const int x0 = block * MATCH_COLUMN_BLOCK;
+	const int x1 = x0 + MATCH_COLUMN_BLOCK > iw ? iw : x0 + MATCH_COLUMN_BLOCK;
+
+	for(j=1; j<=job->h; j++) {
+		double *s = job->sum + (size_t)j * iw;
+		double *sq = job->sqsum + (size_t)j * iw;
+
+		for(i=x0; i<x1; i++) {
+			s[i] += s[i - iw];
+			sq[i] += sq[i - iw];
+		}
+	}
+}
+
+/* Packs the zero-mean image and template in the real and imaginary parts of one array */
+static void match_pack_proc(void *arg, int band)
+{
+	MatchJob *job = arg;
+	int i, j;
+	int y1 = (band + 1) * job->band_h > job->fh ? job->fh : (band + 1) * job->band_h;
+
+	for(j=band * job->band_h; j<y1; j++) {
+		Complex *row = job->spectrum + (size_t)j * job->fw;
+
+		memset(row, 0, job->fw * sizeof(Complex));
+
+		if(j < job->h) {
+			const float *p = job->img + (size_t)j * job->img_stride;
+
+			for(i=0; i<job->w; i++) {
+				row[i].re = p[i] - job->img_mean;
+			}
+		}
+
+		if(j < job->th) {
+			const float *t = job->tmpl + (size_t)j * job->tmpl_stride;
+
+			for(i=0; i<job->tw; i++) {
+				row[i].im = t[i] - job->tmpl_mean;
+			}
+		}
+	}
+}
+
+/**
+ * Replaces the packed spectrum Z with the cross spectrum F * conj(T). Since the image
+ * and the template are real, F(k) = (Z(k) + conj(Z(-k))) / 2 and T(k) = (Z(k) - conj(Z(-k))) / 2i,
+ * and the product is Hermitian, so row v and its mirror row are computed together.
+ */
+static void match_cross_spectrum_proc(void *arg, int v)
+{
+	MatchJob *job = arg;
+	int u;
+	const int fw = job->fw;
+	const int mv = (job->fh - v) % job->fh;
+	Complex *row = job->spectrum + (size_t)v * fw;
+	Complex *mirror = job->spectrum + (size_t)mv * fw;
+
+	for(u=0; u<fw; u++) {
+		const int mu = (fw - u) % fw;
+
+		/* A row which is its own mirror holds both elements of the pair */
+		if(v == mv && mu < u) {
+			continue;
+		}
+
+		const Complex a = row[u];
+		const Complex b = mirror[mu];
+
+		float fr = (a.re + b.re) * 0.5f;
+		float fi = (a.im - b.im) * 0.5f;
+		float tr = (a.im + b.im) * 0.5f;
+		float ti = (b.re - a.re) * 0.5f;
+
+		/* (fr + i*fi) * (tr - i*ti) */
+		float pr = fr * tr + fi * ti;
+		float pi = fi * tr - fr * ti;
+
+		row[u].re = pr;
+		row[u].im = pi;
+		mirror[mu].re = pr;
+		mirror[mu].im = -pi;
+	}
+}
+
+static inline double match_rect_sum(const double *s, int iw, int x, int y, int w, int h)
+{
+	return s[(size_t)(y + h) * iw + x + w] - s[(size_t)y * iw + x + w] - s[(size_t)(y + h) * iw + x] + s[(size_t)y * iw + x];
+}
+
+/* Normalizes the correlation by the local energy of the image */
+static void match_score_proc(void *arg, int band)
+{
+	MatchJob *job = arg;
+	int i, j;
+	const int sw = job->w - job->tw + 1;
+	const int sh = job->h - job->th + 1;
+	const int iw = job->w + 1;
+	const double n = (double)job->tw * job->th;
+	int y1 = (band + 1) * job->band_h > sh ? sh : (band + 1) * job->band_h;
+
+	for(j=band * job->band_h; j<y1; j++) {
+		const Complex *corr = job->spectrum + (size_t)j * job->fw;
+		float *out = job->scores + (size_t)j * job->scores_stride;
+
+		for(i=0; i<sw; i++) {
+			double s = match_rect_sum(job->sum, iw, i, j, job->tw, job->th);
+			double sq = match_rect_sum(job->sqsum, iw, i, j, job->tw, job->th);
+			double var = sq - s * s / n;
+
+			if(var < MATCH_MIN_VARIANCE * n) {
+				out[i] = 0;
+				continue;
+			}
+
+			double score = corr[i].re / sqrt(var * job->tmpl_energy);
+
+			out[i] = score > 1 ? 1 : score < -1 ? -1 : (float)score;
+		}
+	}
+}
+
+RETCODE match_ncc_plane(const float *img, int img_stride, int w, int h, const float *tmpl, int tmpl_stride,
+		int tw, int th, float *scores, int scores_stride)
+{
+	RETCODE rc = RC_OK;
+	int i, j;
+
+	if(!img || !tmpl || !scores || tw < 1 || th < 1 || tw > w || th > h) {
+		return RC_INVALIDARG;
+	}
+
+	MatchJob job = {
+		.img = img,
+		.img_stride = img_stride,
+		.w = w,
+		.h = h,
+		.tmpl = tmpl,
+		.tmpl_stride = tmpl_stride,
+		.tw = tw,
+		.th = th,
+		.fw = fft_size(w),
+		.fh = fft_size(h),
+		.scores = scores,
+		.scores_stride = scores_stride,
+	};
+
+	/* Template statistics */
+	double t_sum = 0, t_sqsum = 0;
+
+	for(j=0; j<th; j++) {
+		for(i=0; i<tw; i++) {
+			double v = tmpl[(size_t)j * tmpl_stride + i];
+
+			t_sum += v;
+			t_sqsum += v * v;
+		}
+	}
+
+	job.tmpl_mean = (float)(t_sum / ((double)tw * th));
+	job.tmpl_energy = t_sqsum - t_sum * t_sum / ((double)tw * th);
+
+	if(job.tmpl_energy < MATCH_MIN_VARIANCE * tw * th) {
+		/* A flat template correlates equally with everything */
+		return RC_INVALIDARG;
+	}
+
+	job.sum = memtrack_malloc(MEM_FILTER, (size_t)(w + 1) * (h + 1) * sizeof(double));
+	job.sqsum = memtrack_malloc(MEM_FILTER, (size_t)(w + 1) * (h + 1) * sizeof(double));
+	job.spectrum = memtrack_malloc(MEM_FILTER, (size_t)job.fw * job.fh * sizeof(Complex));
+
+	if(!job.sum || !job.sqsum || !job.spectrum) {
+		rc = RC_OUTOFMEM;
+		goto cleanup;
+	}
+
+	/* Local energy terms */
+	int bands = threadpool_split_rows(h, &job.band_h);
+
+	memset(job.sum, 0, (w + 1) * sizeof(double));
+	memset(job.sqsum, 0, (w + 1) * sizeof(double));
+	threadpool_parallel_for(bands, match_integral_rows_proc, &job);
+	threadpool_parallel_for((w + MATCH_COLUMN_BLOCK) / MATCH_COLUMN_BLOCK, match_integral_columns_proc, &job);
+
+	/* Subtracting the mean of the image doesn't change the correlation with a zero-mean template, but keeps the FFT precise */
+	job.img_mean = (float)(job.sum[(size_t)(w + 1) * (h + 1) - 1] / ((double)w * h));
+
+	/* Numerator: correlation of the image with the zero-mean template */
+	bands = threadpool_split_rows(job.fh, &job.band_h);
+	threadpool_parallel_for(bands, match_pack_proc, &job);
+
+	rc = fft_2d(job.spectrum, job.fw, job.fh, 0);
+	if(failed(rc)) goto cleanup;
+
+	threadpool_parallel_for(job.fh / 2 + 1, match_cross_spectrum_proc, &job);
+
+	rc = fft_2d(job.spectrum, job.fw, job.fh, 1);
+	if(failed(rc)) goto cleanup;
+
+	bands = threadpool_split_rows(h - th + 1, &job.band_h);
+	threadpool_parallel_for(bands, match_score_proc, &job);
+
+cleanup:
+	memtrack_free(job.sum);
+	memtrack_free(job.sqsum);
+	memtrack_free(job.spectrum);
+
+	return rc;
+}
+
+/* A peak is the largest score within the suppression radius; ties go to the first in raster order */
+static int match_is_peak(const MatchPeakJob *job, int x, int y, int radius)
+{
+	int i, j;
+	const float v = job->scores[(size_t)y * job->sw + x];
+	int x0 = x - radius < 0 ? 0 : x - radius;
+	int y0 = y - radius < 0 ? 0 : y - radius;
+	int x1 = x + radius >= job->sw ? job->sw - 1 : x + radius;
+	int y1 = y + radius >= job->sh ? job->sh - 1 : y + radius;
+
+	for(j=y0; j<=y1; j++) {
+		const float *row = job->scores + (size_t)j * job->sw;
+
+		for(i=x0; i<=x1; i++) {
+			if(row[i] > v || (row[i] == v && (j < y || (j == y && i < x)))) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+static void match_peaks_proc(void *arg, int band)
+{
+	MatchPeakJob *job = arg;
+	int i, j, k;
+	int y1 = (band + 1) * job->band_h > job->sh ? job->sh : (band + 1) * job->band_h;
+	MatchResult *best = job->candidates + (size_t)band * job->max_results;
+	int count = 0;
+
+	for(j=band * job->band_h; j<y1; j++) {
+		const float *row = job->scores + (size_t)j * job->sw;
+
+		for(i=0; i<job->sw; i++) {
+			float v = row[i];
+
+			if(v < job->min_score || (count == job->max_results && v <= best[count - 1].score)) {
+				continue;
+			}
+
+			/* Cheap 3x3 test first, the whole suppression window only for survivors */
+			if(!match_is_peak(job, i, j, 1) || !match_is_peak(job, i, j, job->radius)) {
+				continue;
+			}
+
+			if(count < job->max_results) {
+				count++;
+			}
+
+			for(k=count - 1; k>0 && best[k - 1].score < v; k--) {
+				best[k] = best[k - 1];
+			}
+
+			best[k].x = i;
+			best[k].y = j;
+			best[k].score = v;
+		}
+	}
+
+	job->candidate_count[band] = count;
+}
+
+static int match_compare_score(const void *a, const void *b)
+{
+	float sa = ((const MatchResult*)a)->score;
+	float sb = ((const MatchResult*)b)->score;
+
+	return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+RETCODE match_template(const void *src, int stride, int w, int h, const void *tmpl, int tmpl_stride, int tw, int th,
+		const MatchParams *params, MatchResult *results, int max_results, int *count)
+{
+	RETCODE rc = RC_OK;
+	int b, i, k;
+
+	if(!src || !tmpl || !results || !count || max_results < 1 || tw < 1 || th < 1 || tw > w || th > h) {
+		return RC_INVALIDARG;
+	}
+
+	if(!params) {
+		params = &match_default_params;
+	}
+
+	*count = 0;
+
+	const int sw = w - tw + 1;
+	const int sh = h - th + 1;
+
+	float *img_plane = memtrack_malloc(MEM_FILTER, (size_t)w * h * sizeof(float));
+	float *tmpl_plane = memtrack_malloc(MEM_FILTER, (size_t)tw * th * sizeof(float));
+	float *scores = memtrack_malloc(MEM_FILTER, (size_t)sw * sh * sizeof(float));
+	MatchResult *candidates = NULL;
+	int *candidate_count = NULL;
+
+	if(!img_plane || !tmpl_plane || !scores) {
+		rc = RC_OUTOFMEM;
+		goto cleanup;
+	}
+
+	match_luma(src, stride, w, h, img_plane);
+	match_luma(tmpl, tmpl_stride, tw, th, tmpl_plane);
+
+	rc = match_ncc_plane(img_plane, w, w, h, tmpl_plane, tw, tw, th, scores, sw);
+	if(failed(rc)) goto cleanup;
+
+	/* Top-K peaks of each band */
+	MatchPeakJob job = {
+		.scores = scores,
+		.sw = sw,
+		.sh = sh,
+		.min_score = params->min_score,
+		.radius = params->min_distance > 0 ? params->min_distance : (tw < th ? tw : th) / 2,
+		.max_results = max_results,
+	};
+
+	if(job.radius < 1) {
+		job.radius = 1;
+	}
+
+	int bands = threadpool_split_rows(sh, &job.band_h);
+
+	candidates = memtrack_malloc(MEM_FILTER, (size_t)bands * max_results * sizeof(MatchResult));
+	candidate_count = memtrack_malloc(MEM_FILTER, bands * sizeof(int));
+
+	if(!candidates || !candidate_count) {
+		rc = RC_OUTOFMEM;
+		goto cleanup;
+	}
+
+	job.candidates = candidates;
+	job.candidate_count = candidate_count;
+	threadpool_parallel_for(bands, match_peaks_proc, &job);
+
+	/* Merge the bands. Peaks already dominate their window, so only ties across band seams are dropped here */
+	int total = 0;
+
+	for(b=0; b<bands; b++) {
+		memmove(candidates + total, candidates + (size_t)b * max_results, candidate_count[b] * sizeof(MatchResult));
+		total += candidate_count[b];
+	}
+
+	qsort(candidates, total, sizeof(MatchResult), match_compare_score);
+
+	for(i=0; i<total && *count<max_results; i++) {
+		for(k=0; k<*count; k++) {
+			if(abs(results[k].x - candidates[i].x) <= job.radius && abs(results[k].y - candidates[i].y) <= job.radius) {
+				break;
+			}
+		}
+
+		if(k == *count) {
+			results[(*count)++] = candidates[i];
+		}
+	}
+
+cleanup:
+	memtrack_free(img_plane);
+	memtrack_free(tmpl_plane);
+	memtrack_free(scores);
+	memtrack_free(candidates);
+	memtrack_free(candidate_count);
+
+	return rc;
+}
+
+RETCODE match_texture(SDL_Texture *src, SDL_Texture *tmpl, const MatchParams *params,
+		MatchResult *results, int max_results, int *count)
+{
+	void *src_pixels, *tmpl_pixels;
+	int src_stride, tmpl_stride;
+	int w, h, tw, th;
+	RETCODE rc;
+
+	if(!src || !tmpl || src == tmpl) {
+		return RC_INVALIDARG;
+	}
+
+	if(SDL_QueryTexture(src, NULL, NULL, &w, &h) != 0 ||
+			SDL_QueryTexture(tmpl, NULL, NULL, &tw, &th) != 0) {
+		return RC_FAIL;
+	}
+
+	if(SDL_LockTexture(src, NULL, &src_pixels, &src_stride) != 0) {
+		return RC_FAIL;
+	}
+
+	if(SDL_LockTexture(tmpl, NULL, &tmpl_pixels, &tmpl_stride) != 0) {
+		SDL_UnlockTexture(src);
+		return RC_FAIL;
+	}
+
+	rc = match_template(src_pixels, src_stride, w, h, tmpl_pixels, tmpl_stride, tw, th, params, results, max_results, count);
+
+	SDL_UnlockTexture(src);
+	SDL_UnlockTexture(tmpl);
+
+	return rc;
+}
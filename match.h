@@ -0,0 +1,59 @@
+/*
+ * match.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef MATCH_H_
+#define MATCH_H_
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "common.h"
+
+typedef struct {
+	/* Top-left corner of the matched area */
+	int x, y;
+
+	/* Normalized cross-correlation in [-1..1] */
+	float score;
+} MatchResult;
+
+typedef struct {
+	/* Matches with a lower score are ignored */
+	float min_score;
+
+	/**
+	 * Two matches are at least this many pixels apart (in both directions).
+	 * 0 selects half the smaller side of the template.
+	 */
+	int min_distance;
+} MatchParams;
+
+/* Parameters used when NULL is passed to match_template() */
+extern const MatchParams match_default_params;
+
+/**
+ * Computes the zero-mean normalized cross-correlation of a template with every
+ * position of an image. Both are float planes (strides are in floats). The
+ * numerator is evaluated through FFT correlation and the local energy of the image
+ * through integral images, so the cost doesn't depend on the template size.
+ * scores receives (w - tw + 1) x (h - th + 1) values; flat areas score 0.
+ */
+RETCODE match_ncc_plane(const float *img, int img_stride, int w, int h, const float *tmpl, int tmpl_stride,
+		int tw, int th, float *scores, int scores_stride);
+
+/**
+ * Finds the best `max_results` positions of a template on a 32-bit bitmap, using the
+ * gray level of both. The results are sorted by decreasing score and their number is
+ * returned in *count.
+ */
+RETCODE match_template(const void *src, int stride, int w, int h, const void *tmpl, int tmpl_stride, int tw, int th,
+		const MatchParams *params, MatchResult *results, int max_results, int *count);
+
+/* Template matching between the contents of two streaming textures */
+RETCODE match_texture(SDL_Texture *src, SDL_Texture *tmpl, const MatchParams *params,
+		MatchResult *results, int max_results, int *count);
+
+#endif /* MATCH_H_ */
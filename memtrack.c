@@ -0,0 +1,216 @@
+/*
+ * memtrack.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "memtrack.h"
+
+/* Kept in front of every block, the size keeps the returned memory aligned like malloc's */
+#define MEMTRACK_HEADER_SIZE	16
+
+typedef struct {
+	size_t size;
+	int subsystem;
+} MemHeader;
+
+static const char *memtrack_names[MEM_SUBSYSTEM_COUNT] = {"images", "codec", "filter", "histogram", "cache", "textures"};
+
+static SDL_SpinLock stats_lock;
+static MemStats stats;
+
+static SDL_SpinLock tls_lock;
+static SDL_TLSID memtrack_tls;
+
+static inline MemHeader *memtrack_header(void *p)
+{
+	return (MemHeader*)((uint8_t*)p - MEMTRACK_HEADER_SIZE);
+}
+
+MemOp *memtrack_current_op(void)
+{
+	return memtrack_tls ? SDL_TLSGet(memtrack_tls) : NULL;
+}
+
+MemOp *memtrack_set_op(MemOp *op)
+{
+	/* Nothing to set until the first operation began */
+	if(!memtrack_tls) {
+		if(!op) return NULL;
+
+		SDL_AtomicLock(&tls_lock);
+		if(!memtrack_tls) memtrack_tls = SDL_TLSCreate();
+		SDL_AtomicUnlock(&tls_lock);
+	}
+
+	MemOp *prev = SDL_TLSGet(memtrack_tls);
+	SDL_TLSSet(memtrack_tls, op, NULL);
+
+	return prev;
+}
+
+void memtrack_add(MemSubsystem subsystem, int64_t bytes)
+{
+	MemOp *op;
+
+	SDL_AtomicLock(&stats_lock);
+
+	stats.current[subsystem] += bytes;
+	stats.total += bytes;
+
+	if(bytes > 0) {
+		stats.allocations[subsystem]++;
+
+		if(stats.current[subsystem] > stats.peak[subsystem]) stats.peak[subsystem] = stats.current[subsystem];
+		if(stats.total > stats.total_peak) stats.total_peak = stats.total;
+	}
+
+	SDL_AtomicUnlock(&stats_lock);
+
+	for(op = memtrack_current_op(); op; op = op->parent) {
+		SDL_AtomicLock(&op->lock);
+
+		op->current += bytes;
+
+		if(bytes > 0) {
+			op->allocations++;
+			if(op->current > op->peak) op->peak = op->current;
+		}
+
+		SDL_AtomicUnlock(&op->lock);
+	}
+}
+
+void *memtrack_malloc(MemSubsystem subsystem, size_t size)
+{
+	uint8_t *base = malloc(size + MEMTRACK_HEADER_SIZE);
+
+	if(!base) return NULL;
+
+	MemHeader *h = (MemHeader*)base;
+	h->size = size;
+	h->subsystem = subsystem;
+
+	memtrack_add(subsystem, (int64_t)size);
+
+	return base + MEMTRACK_HEADER_SIZE;
+}
+
+void *memtrack_calloc(MemSubsystem subsystem, size_t count, size_t size)
+{
+	if(size && count > ((size_t)-1 - MEMTRACK_HEADER_SIZE) / size) {
+		return NULL;
+	}
+
+	void *p = memtrack_malloc(subsystem, count * size);
+
+	if(p) memset(p, 0, count * size);
+
+	return p;
+}
+
+void *memtrack_realloc(MemSubsystem subsystem, void *p, size_t size)
+{
+	if(!p) {
+		return memtrack_malloc(subsystem, size);
+	}
+
+	MemHeader *h = memtrack_header(p);
+	size_t old_size = h->size;
+	int old_subsystem = h->subsystem;
+
+	uint8_t *base = realloc(h, size + MEMTRACK_HEADER_SIZE);
+	if(!base) return NULL;
+
+	h = (MemHeader*)base;
+	h->size = size;
+	h->subsystem = subsystem;
+
+	memtrack_add(old_subsystem, -(int64_t)old_size);
+	memtrack_add(subsystem, (int64_t)size);
+
+	return base + MEMTRACK_HEADER_SIZE;
+}
+
+void memtrack_free(void *p)
+{
+	if(!p) {
+		return;
+	}
+
+	MemHeader *h = memtrack_header(p);
+
+	memtrack_add(h->subsystem, -(int64_t)h->size);
+	free(h);
+}
+
+static int64_t memtrack_texture_bytes(SDL_Texture *texture)
+{
+	int w, h;
+
+	if(!texture || SDL_QueryTexture(texture, NULL, NULL, &w, &h) != 0) {
+		return 0;
+	}
+
+	return (int64_t)w * h * 4;
+}
+
+void memtrack_texture_created(MemSubsystem subsystem, SDL_Texture *texture)
+{
+	int64_t bytes = memtrack_texture_bytes(texture);
+
+	if(bytes) memtrack_add(subsystem, bytes);
+}
+
+void memtrack_texture_destroyed(MemSubsystem subsystem, SDL_Texture *texture)
+{
+	int64_t bytes = memtrack_texture_bytes(texture);
+
+	if(bytes) memtrack_add(subsystem, -bytes);
+}
+
+void memtrack_op_begin(MemOp *op, const char *name)
+{
+	memset(op, 0, sizeof(MemOp));
+	op->name = name;
+	op->parent = memtrack_set_op(op);
+}
+
+void memtrack_op_end(MemOp *op)
+{
+	memtrack_set_op(op->parent);
+}
+
+void memtrack_get_stats(MemStats *out)
+{
+	SDL_AtomicLock(&stats_lock);
+	*out = stats;
+	SDL_AtomicUnlock(&stats_lock);
+}
+
+const char *memtrack_subsystem_name(MemSubsystem subsystem)
+{
+	return subsystem >= 0 && subsystem < MEM_SUBSYSTEM_COUNT ? memtrack_names[subsystem] : "unknown";
+}
+
+void memtrack_print_summary(void)
+{
+	MemStats s;
+	int i;
+
+	memtrack_get_stats(&s);
+
+	printf("Memory          current      peak  allocations\n");
+
+	for(i=0; i<MEM_SUBSYSTEM_COUNT; i++) {
+		printf("  %-10s %8.1f MB %6.1f MB %12llu\n", memtrack_names[i], s.current[i] / (1024.0 * 1024.0),
+				s.peak[i] / (1024.0 * 1024.0), (unsigned long long)s.allocations[i]);
+	}
+
+	printf("  %-10s %8.1f MB %6.1f MB\n", "total", s.total / (1024.0 * 1024.0), s.total_peak / (1024.0 * 1024.0));
+}
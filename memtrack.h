@@ -0,0 +1,93 @@
+/*
+ * memtrack.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef MEMTRACK_H_
+#define MEMTRACK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "common.h"
+
+typedef enum {
+	/* Bitmaps handed out by bufpool (the buffers it caches aren't in use) */
+	MEM_IMAGES = 0,
+
+	/* Image handlers and their row buffers */
+	MEM_CODEC,
+
+	/* Filter registries and the scratch planes of the filters, resampling and matching */
+	MEM_FILTER,
+
+	MEM_HISTOGRAM,
+
+	/* Filter cache entries, undo history and pyramid bookkeeping */
+	MEM_CACHE,
+
+	/* Textures of the viewer, estimated at 4 bytes per pixel */
+	MEM_TEXTURES,
+
+	MEM_SUBSYSTEM_COUNT,
+} MemSubsystem;
+
+typedef struct {
+	int64_t current[MEM_SUBSYSTEM_COUNT];
+	int64_t peak[MEM_SUBSYSTEM_COUNT];
+	uint64_t allocations[MEM_SUBSYSTEM_COUNT];
+
+	/* All the subsystems together; the peak is of the sum, not the sum of the peaks */
+	int64_t total;
+	int64_t total_peak;
+} MemStats;
+
+/**
+ * Memory allocated during an operation (loading and filtering a file, a filter run
+ * in the viewer) by the thread which began it and by the thread pool iterations it
+ * started. `current` is the net amount since the beginning, so it becomes negative
+ * when the operation releases memory allocated before; `peak` is its maximum.
+ * Operations may nest, the allocations count for the enclosing ones too.
+ */
+typedef struct MemOp {
+	const char *name;
+	struct MemOp *parent;
+
+	SDL_SpinLock lock;
+	int64_t current;
+	int64_t peak;
+	uint64_t allocations;
+} MemOp;
+
+/* Like malloc() and friends, the memory is counted for `subsystem` until freed with memtrack_free() */
+void *memtrack_malloc(MemSubsystem subsystem, size_t size);
+void *memtrack_calloc(MemSubsystem subsystem, size_t count, size_t size);
+void *memtrack_realloc(MemSubsystem subsystem, void *p, size_t size);
+void memtrack_free(void *p);
+
+/* Counts memory managed elsewhere (bufpool, textures), negative `bytes` when it's released */
+void memtrack_add(MemSubsystem subsystem, int64_t bytes);
+
+/* Counts a texture after it's created and before it's destroyed. NULL is ignored */
+void memtrack_texture_created(MemSubsystem subsystem, SDL_Texture *texture);
+void memtrack_texture_destroyed(MemSubsystem subsystem, SDL_Texture *texture);
+
+/* Makes `op` the current operation of the calling thread until memtrack_op_end() */
+void memtrack_op_begin(MemOp *op, const char *name);
+void memtrack_op_end(MemOp *op);
+
+/* Operation of the calling thread (or NULL); the thread pool passes it on to the iterations */
+MemOp *memtrack_current_op(void);
+
+/* Sets the operation of the calling thread and returns the previous one */
+MemOp *memtrack_set_op(MemOp *op);
+
+void memtrack_get_stats(MemStats *out);
+const char *memtrack_subsystem_name(MemSubsystem subsystem);
+
+/* Prints the current and peak memory of every subsystem */
+void memtrack_print_summary(void);
+
+#endif /* MEMTRACK_H_ */
@@ -0,0 +1,295 @@
+/*
+ * perfcnt.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "common.h"
+#include "perfcnt.h"
+
+static const char *perfcnt_names[PERFCNT_COUNT] = {"cycles", "instructions", "llc_misses", "branch_misses"};
+
+/* Reason of the last failure, only used for messages */
+static char perfcnt_last_error[192] = "not opened";
+static SDL_SpinLock perfcnt_error_lock;
+
+const char *perfcnt_name(PerfCounter counter)
+{
+	return counter >= 0 && counter < PERFCNT_COUNT ? perfcnt_names[counter] : "unknown";
+}
+
+const char *perfcnt_error(void)
+{
+	return perfcnt_last_error;
+}
+
+void perfcnt_diff(const PerfValues *start, const PerfValues *end, PerfValues *out)
+{
+	int c;
+
+	memset(out, 0, sizeof(PerfValues));
+	out->valid = start->valid & end->valid;
+
+	for(c=0; c<PERFCNT_COUNT; c++) {
+		if((out->valid & (1u << c)) && end->values[c] > start->values[c]) {
+			out->values[c] = end->values[c] - start->values[c];
+		}
+	}
+}
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const uint64_t perfcnt_configs[PERFCNT_COUNT] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+/* Layout of a group read with the times enabled and running */
+typedef struct {
+	uint64_t nr;
+	uint64_t time_enabled;
+	uint64_t time_running;
+	uint64_t values[PERFCNT_COUNT];
+} PerfGroupData;
+
+static void perfcnt_set_error(int err)
+{
+	int paranoid = -1;
+
+	FILE *f = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+	if(f) {
+		if(fscanf(f, "%d", &paranoid) != 1) paranoid = -1;
+		fclose(f);
+	}
+
+	SDL_AtomicLock(&perfcnt_error_lock);
+
+	if(err == ENOENT || err == EOPNOTSUPP) {
+		snprintf(perfcnt_last_error, sizeof(perfcnt_last_error), "the CPU counters aren't available (virtual machine?)");
+	}else if(err == ENOSYS) {
+		snprintf(perfcnt_last_error, sizeof(perfcnt_last_error), "perf_event_open() isn't supported (container or old kernel?)");
+	}else if(err == EACCES || err == EPERM) {
+		snprintf(perfcnt_last_error, sizeof(perfcnt_last_error), "not permitted, kernel.perf_event_paranoid is %d (2 or less is needed)", paranoid);
+	}else {
+		snprintf(perfcnt_last_error, sizeof(perfcnt_last_error), "perf_event_open() failed (%s)", strerror(err));
+	}
+
+	SDL_AtomicUnlock(&perfcnt_error_lock);
+}
+
+static int perfcnt_open_event(PerfCounter counter, pid_t tid, int group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = perfcnt_configs[counter];
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	/* Without privileges only the user mode of own processes may be counted */
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (int)syscall(SYS_perf_event_open, &attr, tid, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* Opens the counters of a thread as a group led by the first one which opens; returns the opened ones */
+static unsigned perfcnt_open_group(pid_t tid, int *fds)
+{
+	unsigned valid = 0;
+	int c, leader = -1;
+
+	for(c=0; c<PERFCNT_COUNT; c++) {
+		fds[c] = perfcnt_open_event(c, tid, leader);
+
+		if(fds[c] < 0) {
+			perfcnt_set_error(errno);
+			continue;
+		}
+
+		if(leader < 0) leader = fds[c];
+		valid |= 1u << c;
+	}
+
+	return valid;
+}
+
+static void perfcnt_close_group(int *fds)
+{
+	int c;
+
+	for(c=0; c<PERFCNT_COUNT; c++) {
+		if(fds[c] >= 0) close(fds[c]);
+		fds[c] = -1;
+	}
+}
+
+/* Opens the groups of the threads; threads whose counters differ from the first one are left out */
+static RETCODE perfcnt_open_tids(PerfCounters *pc, const pid_t *tids, int count)
+{
+	int i;
+
+	memset(pc, 0, sizeof(PerfCounters));
+
+	pc->fds = malloc((size_t)count * PERFCNT_COUNT * sizeof(int));
+	if(!pc->fds) return RC_OUTOFMEM;
+
+	for(i=0; i<count; i++) {
+		int *fds = pc->fds + pc->threads * PERFCNT_COUNT;
+		unsigned valid = perfcnt_open_group(tids[i], fds);
+
+		if(valid == 0 || (pc->threads > 0 && valid != pc->valid)) {
+			perfcnt_close_group(fds);
+			continue;
+		}
+
+		pc->valid = valid;
+		pc->threads++;
+	}
+
+	if(pc->threads == 0) {
+		perfcnt_close(pc);
+		return RC_NOTIMPL;
+	}
+
+	return RC_OK;
+}
+
+RETCODE perfcnt_open_thread(PerfCounters *pc)
+{
+	pid_t self = 0;
+
+	return perfcnt_open_tids(pc, &self, 1);
+}
+
+RETCODE perfcnt_open_process(PerfCounters *pc)
+{
+	struct dirent *entry;
+	pid_t *tids = NULL;
+	int count = 0, capacity = 0;
+
+	DIR *dir = opendir("/proc/self/task");
+	if(!dir) {
+		perfcnt_set_error(errno);
+		memset(pc, 0, sizeof(PerfCounters));
+		return RC_NOTIMPL;
+	}
+
+	while((entry = readdir(dir)) != NULL) {
+		if(entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+			continue;
+		}
+
+		if(count == capacity) {
+			capacity = capacity ? capacity * 2 : 32;
+			pid_t *p = realloc(tids, capacity * sizeof(pid_t));
+
+			if(!p) break;
+			tids = p;
+		}
+
+		tids[count++] = (pid_t)atoi(entry->d_name);
+	}
+
+	closedir(dir);
+
+	RETCODE rc = count > 0 ? perfcnt_open_tids(pc, tids, count) : RC_NOTIMPL;
+	free(tids);
+
+	return rc;
+}
+
+RETCODE perfcnt_read(const PerfCounters *pc, PerfValues *out)
+{
+	PerfGroupData data;
+	int i, c, k;
+
+	memset(out, 0, sizeof(PerfValues));
+
+	if(pc->threads == 0) {
+		return RC_NOTIMPL;
+	}
+
+	for(i=0; i<pc->threads; i++) {
+		const int *fds = pc->fds + i * PERFCNT_COUNT;
+		int leader = -1;
+
+		for(c=0; c<PERFCNT_COUNT && leader < 0; c++) {
+			leader = fds[c];
+		}
+
+		if(read(leader, &data, sizeof(data)) < (ssize_t)(3 * sizeof(uint64_t))) {
+			return RC_FAIL;
+		}
+
+		/* Not scheduled at all (yet), e.g. the thread hasn't run since the counters were opened */
+		if(data.time_running == 0) {
+			continue;
+		}
+
+		/* The values follow the order in which the group members were opened */
+		double scale = (double)data.time_enabled / data.time_running;
+
+		for(c=0, k=0; c<PERFCNT_COUNT && k<(int)data.nr; c++) {
+			if(pc->valid & (1u << c)) {
+				out->values[c] += (uint64_t)(data.values[k++] * scale);
+			}
+		}
+	}
+
+	out->valid = pc->valid;
+	return RC_OK;
+}
+
+void perfcnt_close(PerfCounters *pc)
+{
+	int i;
+
+	for(i=0; i<pc->threads; i++) {
+		perfcnt_close_group(pc->fds + i * PERFCNT_COUNT);
+	}
+
+	free(pc->fds);
+	memset(pc, 0, sizeof(PerfCounters));
+}
+
+#else
+
+RETCODE perfcnt_open_thread(PerfCounters *pc)
+{
+	memset(pc, 0, sizeof(PerfCounters));
+	snprintf(perfcnt_last_error, sizeof(perfcnt_last_error), "the CPU counters need Linux (perf_event_open)");
+
+	return RC_NOTIMPL;
+}
+
+RETCODE perfcnt_open_process(PerfCounters *pc)
+{
+	return perfcnt_open_thread(pc);
+}
+
+RETCODE perfcnt_read(const PerfCounters *pc, PerfValues *out)
+{
+	memset(out, 0, sizeof(PerfValues));
+	return RC_NOTIMPL;
+}
+
+void perfcnt_close(PerfCounters *pc)
+{
+}
+
+#endif
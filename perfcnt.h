@@ -0,0 +1,69 @@
+/*
+ * perfcnt.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef PERFCNT_H_
+#define PERFCNT_H_
+
+#include <stdint.h>
+#include "common.h"
+
+typedef enum {
+	PERFCNT_CYCLES = 0,
+	PERFCNT_INSTRUCTIONS,
+
+	/* Misses of the last level cache, each one a line read from memory */
+	PERFCNT_LLC_MISSES,
+
+	PERFCNT_BRANCH_MISSES,
+	PERFCNT_COUNT,
+} PerfCounter;
+
+typedef struct {
+	uint64_t values[PERFCNT_COUNT];
+
+	/* Bit (1 << PerfCounter) is set for every counter which was measured */
+	unsigned valid;
+} PerfValues;
+
+/**
+ * Hardware counters of one thread or of all the threads of the process (user mode
+ * only). The counters of each thread are a group, so they are scheduled together;
+ * if the CPU has to multiplex them, the values are scaled to the whole time.
+ */
+typedef struct {
+	int *fds;
+	int threads;
+
+	/* Counters opened for every thread */
+	unsigned valid;
+} PerfCounters;
+
+/* Counts the calling thread */
+RETCODE perfcnt_open_thread(PerfCounters *pc);
+
+/**
+ * Counts every thread of the process running at the time of the call (start the
+ * thread pool first). Threads created later aren't counted.
+ */
+RETCODE perfcnt_open_process(PerfCounters *pc);
+
+/* Sums the counters of all the threads; values only grow, so measure with two reads */
+RETCODE perfcnt_read(const PerfCounters *pc, PerfValues *out);
+void perfcnt_close(PerfCounters *pc);
+
+/* out = end - start, for the counters valid in both */
+void perfcnt_diff(const PerfValues *start, const PerfValues *end, PerfValues *out);
+
+const char *perfcnt_name(PerfCounter counter);
+
+/**
+ * Why the counters couldn't be opened (e.g. no PMU in a virtual machine or a container,
+ * or perf_event_paranoid too high). The open functions return RC_NOTIMPL then.
+ */
+const char *perfcnt_error(void);
+
+#endif /* PERFCNT_H_ */
@@ -0,0 +1,271 @@
+/*
+ * pyramid.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <string.h>
+#include "pyramid.h"
+#include "threadpool.h"
+#include "bufpool.h"
+#include "trace.h"
+#include "memtrack.h"
+
+#define bytes_per_pixel 4
+
+typedef struct {
+	const uint8_t *src;
+	int src_stride;
+	int w, h;
+
+	uint8_t *dst;
+	int dst_stride;
+	int dw, dh;
+
+	PyramidFilter filter;
+
+	int band_h;
+	RETCODE rc;
+} PyramidJob;
+
+static inline int pyramid_clamp(int v, int max)
+{
+	return v < 0 ? 0 : v > max ? max : v;
+}
+
+static void pyramid_reduce_proc(void *arg, int band)
+{
+	PyramidJob *job = arg;
+	int i, x, y, c;
+	int y1 = (band + 1) * job->band_h > job->dh ? job->dh : (band + 1) * job->band_h;
+	const int n = job->w * bytes_per_pixel;
+
+	/* Vertically filtered source row, the sums fit 16 bits for both kernels */
+	uint16_t *row = memtrack_malloc(MEM_CACHE, n * sizeof(uint16_t));
+	if(!row) {
+		job->rc = RC_OUTOFMEM;
+		return;
+	}
+
+	for(y=band * job->band_h; y<y1; y++) {
+		uint8_t *d = job->dst + (size_t)y * job->dst_stride;
+
+		if(job->filter == PYRAMID_BOX) {
+			const uint8_t *s0 = job->src + (size_t)(2 * y) * job->src_stride;
+			const uint8_t *s1 = job->src + (size_t)pyramid_clamp(2 * y + 1, job->h - 1) * job->src_stride;
+
+			for(i=0; i<n; i++) {
+				row[i] = s0[i] + s1[i];
+			}
+
+			for(x=0; x<job->dw; x++) {
+				const uint16_t *a = row + 2 * x * bytes_per_pixel;
+				const uint16_t *b = row + pyramid_clamp(2 * x + 1, job->w - 1) * bytes_per_pixel;
+
+				for(c=0; c<bytes_per_pixel; c++) {
+					d[x * bytes_per_pixel + c] = (uint8_t)((a[c] + b[c] + 2) >> 2);
+				}
+			}
+		}else {
+			const uint8_t *s[5];
+
+			for(i=0; i<5; i++) {
+				s[i] = job->src + (size_t)pyramid_clamp(2 * y - 2 + i, job->h - 1) * job->src_stride;
+			}
+
+			for(i=0; i<n; i++) {
+				row[i] = s[0][i] + 4 * (s[1][i] + s[3][i]) + 6 * s[2][i] + s[4][i];
+			}
+
+			for(x=0; x<job->dw; x++) {
+				const uint16_t *p[5];
+
+				for(i=0; i<5; i++) {
+					p[i] = row + pyramid_clamp(2 * x - 2 + i, job->w - 1) * bytes_per_pixel;
+				}
+
+				for(c=0; c<bytes_per_pixel; c++) {
+					uint32_t v = p[0][c] + 4 * (p[1][c] + p[3][c]) + 6 * p[2][c] + p[4][c];
+
+					d[x * bytes_per_pixel + c] = (uint8_t)((v + 128) >> 8);
+				}
+			}
+		}
+	}
+
+	memtrack_free(row);
+}
+
+RETCODE pyramid_reduce(const void *src, int src_stride, int w, int h, void *dst, int dst_stride, PyramidFilter filter)
+{
+	TRACE_SCOPE("pyramid");
+
+	if(!src || !dst || w <= 0 || h <= 0) {
+		return RC_INVALIDARG;
+	}
+
+	PyramidJob job = {
+		.src = src,
+		.src_stride = src_stride,
+		.w = w,
+		.h = h,
+		.dst = dst,
+		.dst_stride = dst_stride,
+		.dw = (w + 1) / 2,
+		.dh = (h + 1) / 2,
+		.filter = filter,
+		.rc = RC_OK,
+	};
+
+	int bands = threadpool_split_rows(job.dh, &job.band_h);
+	threadpool_parallel_for(bands, pyramid_reduce_proc, &job);
+
+	return job.rc;
+}
+
+RETCODE pyramid_init(Pyramid *p, PyramidFilter filter)
+{
+	memset(p, 0, sizeof(Pyramid));
+	p->filter = filter;
+	p->lock = SDL_CreateMutex();
+
+	return p->lock ? RC_OK : RC_OUTOFMEM;
+}
+
+void pyramid_free(Pyramid *p)
+{
+	int i;
+
+	for(i=1; i<PYRAMID_MAX_LEVELS; i++) {
+		bufpool_free(p->levels[i].pixels);
+	}
+
+	if(p->lock) SDL_DestroyMutex(p->lock);
+	memset(p, 0, sizeof(Pyramid));
+}
+
+RETCODE pyramid_set_base(Pyramid *p, const void *pixels, int stride, int w, int h)
+{
+	int i;
+
+	SDL_LockMutex(p->lock);
+
+	PyramidLevel *base = &p->levels[0];
+	int same_size = base->w == w && base->h == h;
+
+	base->pixels = (uint8_t*)pixels;
+	base->stride = stride;
+	base->w = pixels ? w : 0;
+	base->h = pixels ? h : 0;
+
+	p->count = pixels ? 1 : 0;
+	p->built = p->count;
+
+	/* Level sizes; the buffers are kept for a base of the same size */
+	for(i=1; pixels && i<PYRAMID_MAX_LEVELS; i++) {
+		PyramidLevel *prev = &p->levels[i - 1];
+		PyramidLevel *l = &p->levels[i];
+
+		if(prev->w == 1 && prev->h == 1) {
+			break;
+		}
+
+		if(!same_size) {
+			bufpool_free(l->pixels);
+			l->pixels = NULL;
+		}
+
+		l->w = (prev->w + 1) / 2;
+		l->h = (prev->h + 1) / 2;
+		l->stride = bufpool_stride(l->w);
+		p->count++;
+	}
+
+	for(; i<PYRAMID_MAX_LEVELS; i++) {
+		bufpool_free(p->levels[i].pixels);
+		memset(&p->levels[i], 0, sizeof(PyramidLevel));
+	}
+
+	SDL_UnlockMutex(p->lock);
+	return RC_OK;
+}
+
+void pyramid_lock(Pyramid *p)
+{
+	SDL_LockMutex(p->lock);
+}
+
+void pyramid_unlock(Pyramid *p)
+{
+	SDL_UnlockMutex(p->lock);
+}
+
+void pyramid_invalidate(Pyramid *p)
+{
+	SDL_LockMutex(p->lock);
+	p->built = p->count ? 1 : 0;
+	SDL_UnlockMutex(p->lock);
+}
+
+RETCODE pyramid_get_level(Pyramid *p, int level, PyramidLevel *out)
+{
+	RETCODE rc = RC_OK;
+
+	SDL_LockMutex(p->lock);
+
+	if(level < 0 || level >= p->count) {
+		rc = RC_INVALIDARG;
+		goto unlock;
+	}
+
+	/* Each level is reduced from the previous one */
+	while(p->built <= level) {
+		PyramidLevel *prev = &p->levels[p->built - 1];
+		PyramidLevel *l = &p->levels[p->built];
+
+		if(!l->pixels) {
+			l->pixels = bufpool_alloc((size_t)l->stride * l->h);
+
+			if(!l->pixels) {
+				rc = RC_OUTOFMEM;
+				goto unlock;
+			}
+		}
+
+		rc = pyramid_reduce(prev->pixels, prev->stride, prev->w, prev->h, l->pixels, l->stride, p->filter);
+		if(failed(rc)) goto unlock;
+
+		p->built++;
+	}
+
+	*out = p->levels[level];
+
+unlock:
+	SDL_UnlockMutex(p->lock);
+	return rc;
+}
+
+int pyramid_level_for_scale(const Pyramid *p, float scale)
+{
+	int level = 0;
+
+	while(level + 1 < p->count && scale <= 0.5f) {
+		scale *= 2;
+		level++;
+	}
+
+	return level;
+}
+
+int pyramid_level_for_size(const Pyramid *p, int max_size)
+{
+	int level = 0;
+
+	while(level + 1 < p->count && (p->levels[level].w > max_size || p->levels[level].h > max_size)) {
+		level++;
+	}
+
+	return level;
+}
@@ -0,0 +1,80 @@
+/*
+ * pyramid.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef PYRAMID_H_
+#define PYRAMID_H_
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "common.h"
+
+/* Most levels of a pyramid, including the base */
+#define PYRAMID_MAX_LEVELS	16
+
+typedef enum {
+	/* Average of 2x2 pixels */
+	PYRAMID_BOX = 0,
+
+	/* Separable [1 4 6 4 1] / 16 kernel before decimation (Burt-Adelson) */
+	PYRAMID_GAUSSIAN,
+} PyramidFilter;
+
+typedef struct {
+	uint8_t *pixels;
+	int stride;
+	int w, h;
+} PyramidLevel;
+
+typedef struct {
+	PyramidFilter filter;
+
+	/* Level 0 is the base bitmap (not owned), each next one is half the size of the previous */
+	PyramidLevel levels[PYRAMID_MAX_LEVELS];
+	int count;
+
+	/* Levels [0..built) hold valid pixels */
+	int built;
+
+	/* Levels are built on demand from any thread */
+	SDL_mutex *lock;
+} Pyramid;
+
+RETCODE pyramid_init(Pyramid *p, PyramidFilter filter);
+void pyramid_free(Pyramid *p);
+
+/**
+ * Sets the 32-bit base bitmap. It isn't copied and must stay valid while the
+ * pyramid uses it. NULL detaches the base. The other levels are rebuilt lazily.
+ */
+RETCODE pyramid_set_base(Pyramid *p, const void *pixels, int stride, int w, int h);
+
+/* Marks the levels above the base as stale after the base pixels have changed */
+void pyramid_invalidate(Pyramid *p);
+
+/* Returns a level, building it (and the ones below it) if needed */
+RETCODE pyramid_get_level(Pyramid *p, int level, PyramidLevel *out);
+
+/**
+ * Holds the lock of the pyramid (it can be taken again by the same thread), so no other
+ * thread sets the base or rebuilds a level while the pixels of a level are read.
+ */
+void pyramid_lock(Pyramid *p);
+void pyramid_unlock(Pyramid *p);
+
+/* Finest level which isn't magnified when drawn at `scale` times the base size */
+int pyramid_level_for_scale(const Pyramid *p, float scale);
+
+/* Finest level whose larger side is at most max_size pixels */
+int pyramid_level_for_size(const Pyramid *p, int max_size);
+
+/**
+ * Halves a 32-bit bitmap in both directions (the odd last row or column is
+ * clamped). The output rows are computed in parallel.
+ */
+RETCODE pyramid_reduce(const void *src, int src_stride, int w, int h, void *dst, int dst_stride, PyramidFilter filter);
+
+#endif /* PYRAMID_H_ */
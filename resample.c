@@ -0,0 +1,400 @@
+/*
+ * resample.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <string.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "resample.h"
+#include "threadpool.h"
+#include "trace.h"
+#include "memtrack.h"
+
+#define bytes_per_pixel 4
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* Per output sample: first source sample, number of taps and their weights */
+typedef struct {
+	int *start;
+	int *count;
+	float *weights;
+
+	/* Stride of the weights of one output sample */
+	int taps;
+} ResampleTable;
+
+typedef struct {
+	const uint8_t *src;
+	int src_stride;
+	uint8_t *dst;
+	int dst_stride;
+	int dst_w, dst_h;
+
+	ResampleTable *tx;
+	ResampleTable *ty;
+
+	int band_h;
+	RETCODE rc;
+} ResampleJob;
+
+static const char *resample_filter_names[] = {"box", "bilinear", "bicubic", "lanczos3"};
+
+/* Half width of each kernel at scale 1 */
+static const float resample_filter_support[] = {0.5f, 1.0f, 2.0f, 3.0f};
+
+static inline float resample_sinc(float x)
+{
+	if(x == 0) return 1;
+
+	x *= (float)M_PI;
+	return sinf(x) / x;
+}
+
+static float resample_kernel(ResampleFilter filter, float x)
+{
+	/* Bicubic with a = -0.5 (Catmull-Rom) */
+	const float a = -0.5f;
+
+	if(x < 0) x = -x;
+
+	switch(filter) {
+	case RESAMPLE_BOX:
+		return x < 0.5f ? 1 : 0;
+
+	case RESAMPLE_BILINEAR:
+		return x < 1 ? 1 - x : 0;
+
+	case RESAMPLE_BICUBIC:
+		if(x < 1) return ((a + 2) * x - (a + 3)) * x * x + 1;
+		if(x < 2) return (((x - 5) * x + 8) * x - 4) * a;
+		return 0;
+
+	case RESAMPLE_LANCZOS3:
+		return x < 3 ? resample_sinc(x) * resample_sinc(x / 3) : 0;
+	}
+
+	return 0;
+}
+
+static void resample_free_table(ResampleTable *t)
+{
+	memtrack_free(t->start);
+	memtrack_free(t->count);
+	memtrack_free(t->weights);
+}
+
+/* Precomputes the taps of every output sample along one axis */
+static RETCODE resample_build_table(int in_n, int out_n, ResampleFilter filter, ResampleTable *t)
+{
+	int i, k;
+	float scale = (float)in_n / out_n;
+
+	/* When downscaling the kernel is stretched to cover all the source samples */
+	float filter_scale = scale < 1 ? 1 : scale;
+	float support = resample_filter_support[filter] * filter_scale;
+
+	t->taps = (int)ceilf(support) * 2 + 1;
+	t->start = memtrack_malloc(MEM_FILTER, out_n * sizeof(int));
+	t->count = memtrack_malloc(MEM_FILTER, out_n * sizeof(int));
+	t->weights = memtrack_malloc(MEM_FILTER, (size_t)out_n * t->taps * sizeof(float));
+
+	if(!t->start || !t->count || !t->weights) {
+		resample_free_table(t);
+		return RC_OUTOFMEM;
+	}
+
+	for(i=0; i<out_n; i++) {
+		float center = (i + 0.5f) * scale;
+		float *w = t->weights + (size_t)i * t->taps;
+		float sum = 0;
+
+		int lo = (int)(center - support + 0.5f);
+		int hi = (int)(center + support + 0.5f);
+		if(lo < 0) lo = 0;
+		if(hi > in_n) hi = in_n;
+		if(hi - lo > t->taps) hi = lo + t->taps;
+
+		for(k=0; k<hi-lo; k++) {
+			w[k] = resample_kernel(filter, (k + lo - center + 0.5f) / filter_scale);
+			sum += w[k];
+		}
+
+		if(sum == 0) {
+			/* Degenerate case - take the nearest sample */
+			lo = (int)center < in_n ? (int)center : in_n - 1;
+			hi = lo + 1;
+			w[0] = 1;
+			sum = 1;
+		}
+
+		for(k=0; k<hi-lo; k++) {
+			w[k] /= sum;
+		}
+
+		t->start[i] = lo;
+		t->count[i] = hi - lo;
+	}
+
+	return RC_OK;
+}
+
+/* Horizontal pass of one source row into a row of float pixels */
+static void resample_horizontal(const uint8_t *src, float *out, const ResampleTable *t, int out_w)
+{
+	int x, k;
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+#endif
+
+	for(x=0; x<out_w; x++) {
+		const uint8_t *p = src + t->start[x] * 4;
+		const float *w = t->weights + (size_t)x * t->taps;
+
+#ifdef __SSE2__
+		/* The four components of a pixel are one vector */
+		__m128 acc = _mm_setzero_ps();
+
+		for(k=0; k<t->count[x]; k++, p += 4) {
+			__m128i px = _mm_cvtsi32_si128(*(const int32_t*)p);
+			__m128 v = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(px, zero), zero));
+
+			acc = _mm_add_ps(acc, _mm_mul_ps(v, _mm_set1_ps(w[k])));
+		}
+
+		_mm_storeu_ps(out + x * 4, acc);
+#else
+		float acc[4] = {0, 0, 0, 0};
+
+		for(k=0; k<t->count[x]; k++, p += 4) {
+			acc[0] += w[k] * p[0];
+			acc[1] += w[k] * p[1];
+			acc[2] += w[k] * p[2];
+			acc[3] += w[k] * p[3];
+		}
+
+		memcpy(out + x * 4, acc, sizeof(acc));
+#endif
+	}
+}
+
+static inline uint8_t resample_to_byte(float v)
+{
+	if(v <= 0) return 0;
+	if(v >= 255) return 255;
+
+	return (uint8_t)lrintf(v);
+}
+
+/* Vertical pass: weighted sum of `count` float rows written as 8-bit components */
+static void resample_vertical(float **rows, const float *w, int count, int n, uint8_t *dst)
+{
+	int i = 0, k;
+
+#ifdef __SSE2__
+	/* Four pixels per iteration, packed into 16 bytes */
+	for(; i + 16 <= n; i += 16) {
+		__m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+		__m128 a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+
+		for(k=0; k<count; k++) {
+			const float *r = rows[k] + i;
+			__m128 wk = _mm_set1_ps(w[k]);
+
+			a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(r), wk));
+			a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(r + 4), wk));
+			a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_loadu_ps(r + 8), wk));
+			a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_loadu_ps(r + 12), wk));
+		}
+
+		/* Round and saturate to [0..255] */
+		__m128i lo = _mm_packs_epi32(_mm_cvtps_epi32(a0), _mm_cvtps_epi32(a1));
+		__m128i hi = _mm_packs_epi32(_mm_cvtps_epi32(a2), _mm_cvtps_epi32(a3));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+
+	for(; i<n; i++) {
+		float acc = 0;
+
+		for(k=0; k<count; k++) {
+			acc += w[k] * rows[k][i];
+		}
+
+		dst[i] = resample_to_byte(acc);
+	}
+}
+
+static void resample_band_proc(void *arg, int band)
+{
+	ResampleJob *job = arg;
+	int y, k;
+	int y0 = band * job->band_h;
+	int y1 = y0 + job->band_h > job->dst_h ? job->dst_h : y0 + job->band_h;
+	const int ring_size = job->ty->taps;
+	const int n = job->dst_w * 4;
+
+	/* Ring of horizontally filtered source rows, slot s holds source row ring_row[s] */
+	float *ring = memtrack_malloc(MEM_FILTER, (size_t)ring_size * n * sizeof(float));
+	int *ring_row = memtrack_malloc(MEM_FILTER, ring_size * sizeof(int));
+	float **rows = memtrack_malloc(MEM_FILTER, ring_size * sizeof(float*));
+
+	if(!ring || !ring_row || !rows) {
+		job->rc = RC_OUTOFMEM;
+		goto cleanup;
+	}
+
+	for(k=0; k<ring_size; k++) {
+		ring_row[k] = -1;
+	}
+
+	for(y=y0; y<y1; y++) {
+		int start = job->ty->start[y];
+		int count = job->ty->count[y];
+
+		/* The windows of consecutive output rows overlap, so most rows are already in the ring */
+		for(k=0; k<count; k++) {
+			int r = start + k;
+			int slot = r % ring_size;
+			float *row = ring + (size_t)slot * n;
+
+			if(ring_row[slot] != r) {
+				resample_horizontal(job->src + (size_t)r * job->src_stride, row, job->tx, job->dst_w);
+				ring_row[slot] = r;
+			}
+
+			rows[k] = row;
+		}
+
+		resample_vertical(rows, job->ty->weights + (size_t)y * job->ty->taps, count, n,
+				job->dst + (size_t)y * job->dst_stride);
+	}
+
+cleanup:
+	memtrack_free(ring);
+	memtrack_free(ring_row);
+	memtrack_free(rows);
+}
+
+RETCODE resample(const void *src, int src_stride, int src_w, int src_h,
+		void *dst, int dst_stride, int dst_w, int dst_h, ResampleFilter filter)
+{
+	TRACE_SCOPE("resample");
+
+	ResampleTable tx, ty;
+	RETCODE rc;
+
+	if(!src || !dst || src_w <= 0 || src_h <= 0 || dst_w <= 0 || dst_h <= 0) {
+		return RC_INVALIDARG;
+	}
+
+	if(filter < RESAMPLE_BOX || filter > RESAMPLE_LANCZOS3) {
+		return RC_INVALIDARG;
+	}
+
+	rc = resample_build_table(src_w, dst_w, filter, &tx);
+	if(failed(rc)) return rc;
+
+	rc = resample_build_table(src_h, dst_h, filter, &ty);
+	if(failed(rc)) {
+		resample_free_table(&tx);
+		return rc;
+	}
+
+	ResampleJob job = {
+		.src = src,
+		.src_stride = src_stride,
+		.dst = dst,
+		.dst_stride = dst_stride,
+		.dst_w = dst_w,
+		.dst_h = dst_h,
+		.tx = &tx,
+		.ty = &ty,
+		.rc = RC_OK,
+	};
+
+	int bands = threadpool_split_rows(dst_h, &job.band_h);
+	threadpool_parallel_for(bands, resample_band_proc, &job);
+
+	resample_free_table(&tx);
+	resample_free_table(&ty);
+
+	return job.rc;
+}
+
+RETCODE resample_texture(SDL_Texture *src, SDL_Texture *dst, ResampleFilter filter)
+{
+	void *src_pixels, *dst_pixels;
+	int src_stride, dst_stride;
+	int src_w, src_h, dst_w, dst_h;
+	RETCODE rc;
+
+	if(!src || !dst || src == dst) {
+		return RC_INVALIDARG;
+	}
+
+	if(SDL_QueryTexture(src, NULL, NULL, &src_w, &src_h) != 0 ||
+			SDL_QueryTexture(dst, NULL, NULL, &dst_w, &dst_h) != 0) {
+		return RC_FAIL;
+	}
+
+	if(SDL_LockTexture(src, NULL, &src_pixels, &src_stride) != 0) {
+		return RC_FAIL;
+	}
+
+	if(SDL_LockTexture(dst, NULL, &dst_pixels, &dst_stride) != 0) {
+		SDL_UnlockTexture(src);
+		return RC_FAIL;
+	}
+
+	rc = resample(src_pixels, src_stride, src_w, src_h, dst_pixels, dst_stride, dst_w, dst_h, filter);
+
+	SDL_UnlockTexture(src);
+	SDL_UnlockTexture(dst);
+
+	return rc;
+}
+
+RETCODE resample_fit_size(int w, int h, int max_dim, int *out_w, int *out_h)
+{
+	if(w <= 0 || h <= 0 || max_dim <= 0) {
+		return RC_INVALIDARG;
+	}
+
+	if(w >= h) {
+		*out_w = max_dim;
+		*out_h = (int)((int64_t)h * max_dim * 2 / w + 1) / 2;
+	}else {
+		*out_h = max_dim;
+		*out_w = (int)((int64_t)w * max_dim * 2 / h + 1) / 2;
+	}
+
+	if(*out_w < 1) *out_w = 1;
+	if(*out_h < 1) *out_h = 1;
+
+	return RC_OK;
+}
+
+RETCODE resample_find_by_name(const char *name, ResampleFilter *out)
+{
+	int i;
+
+	for(i=0; i<(int)(sizeof(resample_filter_names) / sizeof(resample_filter_names[0])); i++) {
+		if(strcmp(resample_filter_names[i], name) != 0)
+			continue;
+
+		*out = (ResampleFilter)i;
+		return RC_OK;
+	}
+
+	return RC_FAIL;
+}
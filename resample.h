@@ -0,0 +1,40 @@
+/*
+ * resample.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef RESAMPLE_H_
+#define RESAMPLE_H_
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "common.h"
+
+typedef enum {
+	RESAMPLE_BOX = 0,
+	RESAMPLE_BILINEAR,
+	RESAMPLE_BICUBIC,
+	RESAMPLE_LANCZOS3,
+} ResampleFilter;
+
+/**
+ * Resizes a 32-bit bitmap to dst_w x dst_h. The filter is applied separably:
+ * horizontally into float rows and then vertically, both with precomputed
+ * weight tables. When downscaling, the kernel is stretched by the scale factor
+ * so all the source pixels contribute. All four components are resampled.
+ */
+RETCODE resample(const void *src, int src_stride, int src_w, int src_h,
+		void *dst, int dst_stride, int dst_w, int dst_h, ResampleFilter filter);
+
+/* Resamples the whole content of one streaming texture into another one */
+RETCODE resample_texture(SDL_Texture *src, SDL_Texture *dst, ResampleFilter filter);
+
+/* Size of a thumbnail whose larger side is max_dim, preserving the aspect ratio */
+RETCODE resample_fit_size(int w, int h, int max_dim, int *out_w, int *out_h);
+
+/* Finds a filter by its name ("box", "bilinear", "bicubic" or "lanczos3") */
+RETCODE resample_find_by_name(const char *name, ResampleFilter *out);
+
+#endif /* RESAMPLE_H_ */
@@ -0,0 +1,224 @@
+/*
+ * separable.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <string.h>
+#include <math.h>
+#include "separable.h"
+#include "threadpool.h"
+#include "memtrack.h"
+
+/* Width of a group of adjacent lines processed together when blurring across lines */
+#define LINE_GROUP	512
+
+typedef struct {
+	const float *src;
+	float *dst;
+	int n, count;
+	int elem_stride, line_stride;
+	const float *kernel;
+	int radius;
+	EdgeMode edge;
+
+	int lines_per_task;
+	RETCODE rc;
+} SeparableJob;
+
+/* Maps a sample index lying outside [0..n) according to the edge mode. Returns -1 for zero samples */
+static inline int separable_edge_index(int i, int n, EdgeMode edge)
+{
+	if(i >= 0 && i < n) {
+		return i;
+	}
+
+	switch(edge) {
+	case EDGE_WRAP:
+		i %= n;
+		return i < 0 ? i + n : i;
+
+	case EDGE_CLAMP:
+		return i < 0 ? 0 : n - 1;
+
+	default:
+		return -1;
+	}
+}
+
+/* Convolves a contiguous, already padded line */
+static void separable_convolve_padded(const float *padded, float *out, int n, const float *kernel, int radius)
+{
+	int i, t;
+
+	for(i=0; i<n; i++) {
+		out[i] = kernel[0] * padded[i];
+	}
+
+	for(t=1; t<=2*radius; t++) {
+		const float k = kernel[t];
+		const float *p = padded + t;
+
+		for(i=0; i<n; i++) {
+			out[i] += k * p[i];
+		}
+	}
+}
+
+/* Lines whose samples are scattered in memory are gathered in a padded buffer, convolved and scattered back */
+static void separable_line_proc(void *arg, int task)
+{
+	SeparableJob *job = arg;
+	int i, l;
+	int l0 = task * job->lines_per_task;
+	int l1 = l0 + job->lines_per_task > job->count ? job->count : l0 + job->lines_per_task;
+	const int n = job->n, r = job->radius, es = job->elem_stride;
+
+	float *padded = memtrack_malloc(MEM_FILTER, (2 * n + 2 * r) * sizeof(float));
+	if(!padded) {
+		job->rc = RC_OUTOFMEM;
+		return;
+	}
+
+	float *out = padded + n + 2 * r;
+
+	for(l=l0; l<l1; l++) {
+		const float *s = job->src + (size_t)l * job->line_stride;
+		float *d = job->dst + (size_t)l * job->line_stride;
+
+		for(i=-r; i<n+r; i++) {
+			int k = separable_edge_index(i, n, job->edge);
+			padded[i + r] = k < 0 ? 0 : s[(size_t)k * es];
+		}
+
+		if(es == 1) {
+			separable_convolve_padded(padded, d, n, job->kernel, r);
+		}else {
+			separable_convolve_padded(padded, out, n, job->kernel, r);
+
+			for(i=0; i<n; i++) {
+				d[(size_t)i * es] = out[i];
+			}
+		}
+	}
+
+	memtrack_free(padded);
+}
+
+/* Adjacent lines are convolved together, so the inner loop runs over contiguous memory */
+static void separable_group_proc(void *arg, int task)
+{
+	SeparableJob *job = arg;
+	int p, t, l;
+	int l0 = task * LINE_GROUP;
+	int lc = l0 + LINE_GROUP > job->count ? job->count - l0 : LINE_GROUP;
+	const int n = job->n, r = job->radius;
+	const size_t es = job->elem_stride;
+
+	for(p=0; p<n; p++) {
+		float *d = job->dst + p * es + l0;
+		int first = 1;
+
+		for(t=-r; t<=r; t++) {
+			int k = separable_edge_index(p + t, n, job->edge);
+			if(k < 0) continue;
+
+			const float w = job->kernel[t + r];
+			const float *s = job->src + k * es + l0;
+
+			if(first) {
+				for(l=0; l<lc; l++) d[l] = w * s[l];
+				first = 0;
+			}else {
+				for(l=0; l<lc; l++) d[l] += w * s[l];
+			}
+		}
+
+		/* All the taps fell outside a zero-padded line */
+		if(first) {
+			memset(d, 0, lc * sizeof(float));
+		}
+	}
+}
+
+RETCODE separable_convolve_lines(const float *src, float *dst, int n, int count, int elem_stride, int line_stride,
+		const float *kernel, int radius, EdgeMode edge)
+{
+	if(!src || !dst || !kernel || n <= 0 || count <= 0 || radius < 0 || radius > SEPARABLE_MAX_RADIUS) {
+		return RC_INVALIDARG;
+	}
+
+	SeparableJob job = {
+		.src = src,
+		.dst = dst,
+		.n = n,
+		.count = count,
+		.elem_stride = elem_stride,
+		.line_stride = line_stride,
+		.kernel = kernel,
+		.radius = radius,
+		.edge = edge,
+		.rc = RC_OK,
+	};
+
+	if(elem_stride != 1 && line_stride == 1) {
+		threadpool_parallel_for((count + LINE_GROUP - 1) / LINE_GROUP, separable_group_proc, &job);
+	}else {
+		int tasks = threadpool_split_rows(count, &job.lines_per_task);
+		threadpool_parallel_for(tasks, separable_line_proc, &job);
+	}
+
+	return job.rc;
+}
+
+RETCODE separable_gaussian_kernel(float sigma, float *kernel, int max_radius, int *radius)
+{
+	int i;
+	float sum = 0;
+
+	if(sigma <= 0 || !kernel || !radius || max_radius < 0) {
+		return RC_INVALIDARG;
+	}
+
+	int r = (int)ceilf(3 * sigma);
+	if(r > max_radius) r = max_radius;
+
+	for(i=-r; i<=r; i++) {
+		kernel[i + r] = expf(-(float)(i * i) / (2 * sigma * sigma));
+		sum += kernel[i + r];
+	}
+
+	for(i=0; i<=2*r; i++) {
+		kernel[i] /= sum;
+	}
+
+	*radius = r;
+	return RC_OK;
+}
+
+RETCODE separable_gaussian_blur(const float *src, float *dst, int stride, int w, int h, float sigma, EdgeMode edge)
+{
+	float kernel[2 * SEPARABLE_MAX_RADIUS + 1];
+	int radius;
+	RETCODE rc;
+
+	rc = separable_gaussian_kernel(sigma, kernel, SEPARABLE_MAX_RADIUS, &radius);
+	if(failed(rc)) return rc;
+
+	float *tmp = memtrack_malloc(MEM_FILTER, (size_t)stride * h * sizeof(float));
+	if(!tmp) {
+		return RC_OUTOFMEM;
+	}
+
+	/* Horizontal pass over the rows, then vertical pass over the columns */
+	rc = separable_convolve_lines(src, tmp, w, h, 1, stride, kernel, radius, edge);
+
+	if(succeeded(rc)) {
+		rc = separable_convolve_lines(tmp, dst, h, w, stride, 1, kernel, radius, edge);
+	}
+
+	memtrack_free(tmp);
+	return rc;
+}
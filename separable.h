@@ -0,0 +1,46 @@
+/*
+ * separable.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef SEPARABLE_H_
+#define SEPARABLE_H_
+
+#include <stdint.h>
+#include "common.h"
+
+/* Largest radius of a 1D kernel */
+#define SEPARABLE_MAX_RADIUS	64
+
+typedef enum {
+	/* Samples past the edge are taken from the opposite side (like filter_apply()) */
+	EDGE_WRAP = 0,
+
+	/* Samples past the edge repeat the edge sample */
+	EDGE_CLAMP,
+
+	/* Samples past the edge are zero */
+	EDGE_ZERO,
+} EdgeMode;
+
+/**
+ * Convolves `count` lines of `n` float samples with a 1D kernel of 2*radius+1 taps.
+ * Consecutive samples of a line are `elem_stride` floats apart and consecutive lines
+ * are `line_stride` floats apart, so the same routine blurs along any axis of a 2D
+ * plane or a 3D grid. The lines are processed in parallel. src and dst must not overlap.
+ */
+RETCODE separable_convolve_lines(const float *src, float *dst, int n, int count, int elem_stride, int line_stride,
+		const float *kernel, int radius, EdgeMode edge);
+
+/**
+ * Fills `kernel` with a normalized Gaussian of the given sigma. The radius is 3*sigma,
+ * limited to max_radius, and is returned in *radius.
+ */
+RETCODE separable_gaussian_kernel(float sigma, float *kernel, int max_radius, int *radius);
+
+/* Gaussian blur of a float plane (stride is in floats). src and dst must not overlap */
+RETCODE separable_gaussian_blur(const float *src, float *dst, int stride, int w, int h, float sigma, EdgeMode edge);
+
+#endif /* SEPARABLE_H_ */
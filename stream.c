@@ -0,0 +1,613 @@
+/*
+ * stream.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+#include "common.h"
+#include "stream.h"
+#include "filters.h"
+#include "bufpool.h"
+
+#define bytes_per_pixel 4
+
+/* Largest width or height accepted from a frame header */
+#define STREAM_MAX_SIZE		65536
+
+typedef struct {
+	/* Ping-pong bitmaps of the filter chain, cur is the one holding the result */
+	uint8_t *buf[2];
+	int cur;
+
+	int index;
+
+	/* When the frame was read completely */
+	Uint64 read_time;
+} StreamFrame;
+
+/**
+ * Bounded single producer, single consumer ring of frames. The indices are advanced
+ * without a lock; the semaphore counts the queued frames so an empty queue puts the
+ * consumer to sleep. Only STREAM_MAX_FRAMES - 1 frames exist (plus the NULL marking
+ * the end of the stream), so the producer never finds it full.
+ */
+typedef struct {
+	StreamFrame *items[STREAM_MAX_FRAMES];
+	SDL_atomic_t head, tail;
+	SDL_sem *count;
+} StreamQueue;
+
+typedef struct {
+	const StreamOptions *opt;
+	FILE *in, *out;
+	int w, h, stride;
+
+	/* Bytes of a frame in the file format */
+	size_t frame_bytes;
+
+	/* Maximum gray value of the PGM frames; the header of the first one is read before the threads start */
+	int maxval;
+	int header_read;
+
+	/* Frames are allocated once and passed around: free -> read -> filtered -> free */
+	StreamFrame frames[STREAM_MAX_FRAMES];
+	int frame_count;
+	StreamQueue free_frames, read_frames, filtered_frames;
+
+	/* Frame in the file format, one for each I/O stage */
+	uint8_t *read_raw, *write_raw;
+
+	/* Set on the first error: the reader stops and the writer only recycles the frames */
+	SDL_atomic_t stop;
+	SDL_atomic_t rc;
+
+	/* Statistics, updated by the writer */
+	int written;
+	Uint64 first_read, last_written;
+	double latency_sum, latency_max;
+} StreamPipeline;
+
+static void stream_print_usage(const char *argv0)
+{
+	const char *fn = strrchr(argv0, '\\');
+	fn = fn ? fn + 1 : argv0;
+
+	fprintf(stderr, "Usage: \"%s --stream [-F pgm|gray8|rgba] [-s <w>x<h>] [-f <filter>[,<filter>...]] [-i <input>] [-o <output>] [-q <frames>] [-v]\"\n", fn);
+	fprintf(stderr, "  -F  Frame format: concatenated binary PGM (P5, default), raw gray8 or raw RGBA\n");
+	fprintf(stderr, "  -s  Frame size of the raw formats\n");
+	fprintf(stderr, "  -f  Filters applied to every frame in order\n");
+	fprintf(stderr, "  -i  Input file or named pipe (default stdin)\n");
+	fprintf(stderr, "  -o  Output file or named pipe (default stdout)\n");
+	fprintf(stderr, "  -q  Frames in flight, 3..%d (default %d)\n", STREAM_MAX_FRAMES - 1, STREAM_DEFAULT_FRAMES);
+	fprintf(stderr, "  -v  Print the latency of every frame\n");
+}
+
+static RETCODE stream_queue_init(StreamQueue *q)
+{
+	memset(q, 0, sizeof(StreamQueue));
+	q->count = SDL_CreateSemaphore(0);
+
+	return q->count ? RC_OK : RC_OUTOFMEM;
+}
+
+static void stream_queue_push(StreamQueue *q, StreamFrame *f)
+{
+	int tail = SDL_AtomicGet(&q->tail);
+
+	q->items[tail % STREAM_MAX_FRAMES] = f;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&q->tail, tail + 1);
+
+	SDL_SemPost(q->count);
+}
+
+static StreamFrame *stream_queue_pop(StreamQueue *q)
+{
+	SDL_SemWait(q->count);
+
+	int head = SDL_AtomicGet(&q->head);
+	SDL_MemoryBarrierAcquire();
+	StreamFrame *f = q->items[head % STREAM_MAX_FRAMES];
+	SDL_AtomicSet(&q->head, head + 1);
+
+	return f;
+}
+
+/* Stops the pipeline, keeping the first error */
+static void stream_fail(StreamPipeline *p, RETCODE rc)
+{
+	SDL_AtomicCAS(&p->rc, RC_OK, rc);
+	SDL_AtomicSet(&p->stop, 1);
+}
+
+/* Ends the input with an error; the frames read before it are still filtered and written */
+static void stream_input_error(StreamPipeline *p, RETCODE rc)
+{
+	SDL_AtomicCAS(&p->rc, RC_OK, rc);
+}
+
+/* Skips whitespace and comments of a PNM header. Returns the next character */
+static int stream_pnm_skip(FILE *f)
+{
+	int c;
+
+	for(;;) {
+		c = fgetc(f);
+
+		if(c == '#') {
+			while(c != '\n' && c != EOF) c = fgetc(f);
+			continue;
+		}
+
+		if(c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+			return c;
+		}
+	}
+}
+
+/* Reads a decimal value of a PNM header, consuming the single character after it */
+static int stream_pnm_int(FILE *f, int *value)
+{
+	int c = stream_pnm_skip(f);
+
+	if(c < '0' || c > '9') {
+		return 0;
+	}
+
+	for(*value = 0; c >= '0' && c <= '9'; c = fgetc(f)) {
+		*value = *value * 10 + (c - '0');
+		if(*value > STREAM_MAX_SIZE) return 0;
+	}
+
+	/* A comment may follow the value directly */
+	while(c == '#') {
+		while(c != '\n' && c != EOF) c = fgetc(f);
+		c = fgetc(f);
+	}
+
+	return 1;
+}
+
+/**
+ * Reads the header of a P5 frame without seeking, so it works on pipes.
+ * Returns RC_FALSE at the end of the stream.
+ */
+static RETCODE stream_read_pgm_header(FILE *f, int *w, int *h, int *maxval)
+{
+	int c = fgetc(f);
+
+	while(c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+		c = fgetc(f);
+	}
+
+	if(c == EOF) {
+		return RC_FALSE;
+	}
+
+	if(c != 'P' || fgetc(f) != '5') {
+		return RC_INVALIDDATA;
+	}
+
+	if(!stream_pnm_int(f, w) || !stream_pnm_int(f, h) || !stream_pnm_int(f, maxval) || *w <= 0 || *h <= 0) {
+		return RC_INVALIDDATA;
+	}
+
+	/* 16-bit samples */
+	if(*maxval <= 0 || *maxval > 255) {
+		return RC_NOTIMPL;
+	}
+
+	return RC_OK;
+}
+
+/* Converts a frame in the file format into the 32-bit bitmap of a frame */
+static void stream_unpack(const StreamPipeline *p, const uint8_t *raw, uint8_t *pixels)
+{
+	int i, j;
+
+	for(j=0; j<p->h; j++) {
+		uint8_t *d = pixels + (size_t)j * p->stride;
+
+		if(p->opt->format == STREAM_RGBA) {
+			const uint8_t *s = raw + (size_t)j * p->w * 4;
+
+			for(i=0; i<p->w; i++, s += 4, d += bytes_per_pixel) {
+				d[0] = s[3];
+				d[1] = s[2];
+				d[2] = s[1];
+				d[3] = s[0];
+			}
+		}else {
+			const uint8_t *s = raw + (size_t)j * p->w;
+
+			for(i=0; i<p->w; i++, d += bytes_per_pixel) {
+				uint8_t v = p->maxval == 255 ? s[i] : (uint8_t)(s[i] * 255 / p->maxval);
+
+				d[0] = 255;
+				d[1] = v;
+				d[2] = v;
+				d[3] = v;
+			}
+		}
+	}
+}
+
+/* Converts the result of a frame into the file format; gray is the average of R/G/B like the PGM writer */
+static void stream_pack(const StreamPipeline *p, const uint8_t *pixels, uint8_t *raw)
+{
+	int i, j;
+
+	for(j=0; j<p->h; j++) {
+		const uint8_t *s = pixels + (size_t)j * p->stride;
+
+		if(p->opt->format == STREAM_RGBA) {
+			uint8_t *d = raw + (size_t)j * p->w * 4;
+
+			for(i=0; i<p->w; i++, s += bytes_per_pixel, d += 4) {
+				d[0] = s[3];
+				d[1] = s[2];
+				d[2] = s[1];
+				d[3] = s[0];
+			}
+		}else {
+			uint8_t *d = raw + (size_t)j * p->w;
+
+			for(i=0; i<p->w; i++, s += bytes_per_pixel) {
+				d[i] = (uint8_t)(((int)s[1] + s[2] + s[3]) / 3);
+			}
+		}
+	}
+}
+
+/* Stage 1: reads the frames */
+static int stream_reader_proc(void *arg)
+{
+	StreamPipeline *p = arg;
+	int index;
+
+	for(index=0; !SDL_AtomicGet(&p->stop); index++) {
+		RETCODE rc = RC_OK;
+
+		if(p->opt->format == STREAM_PGM && !p->header_read) {
+			int w, h;
+
+			rc = stream_read_pgm_header(p->in, &w, &h, &p->maxval);
+			if(rc == RC_FALSE) break;
+
+			if(succeeded(rc) && (w != p->w || h != p->h)) {
+				fprintf(stderr, "Frame %d has a different size (%dx%d).\n", index, w, h);
+				rc = RC_INVALIDDATA;
+			}
+
+			if(failed(rc)) {
+				stream_input_error(p, rc);
+				break;
+			}
+		}
+
+		p->header_read = 0;
+
+		size_t got = fread(p->read_raw, 1, p->frame_bytes, p->in);
+
+		/* The raw formats end where a frame would start */
+		if(got == 0 && p->opt->format != STREAM_PGM) {
+			break;
+		}
+
+		if(got != p->frame_bytes) {
+			fprintf(stderr, "Frame %d is truncated.\n", index);
+			stream_input_error(p, RC_INVALIDDATA);
+			break;
+		}
+
+		Uint64 read_time = SDL_GetPerformanceCounter();
+
+		StreamFrame *f = stream_queue_pop(&p->free_frames);
+
+		stream_unpack(p, p->read_raw, f->buf[0]);
+		f->cur = 0;
+		f->index = index;
+		f->read_time = read_time;
+
+		stream_queue_push(&p->read_frames, f);
+	}
+
+	stream_queue_push(&p->read_frames, NULL);
+	return 0;
+}
+
+/* Stage 3: writes the results and returns the frames to the reader */
+static int stream_writer_proc(void *arg)
+{
+	StreamPipeline *p = arg;
+	StreamFrame *f;
+
+	while((f = stream_queue_pop(&p->filtered_frames)) != NULL) {
+		if(!SDL_AtomicGet(&p->stop)) {
+			stream_pack(p, f->buf[f->cur], p->write_raw);
+
+			if(p->opt->format == STREAM_PGM) {
+				fprintf(p->out, "P5\n%d %d\n255\n", p->w, p->h);
+			}
+
+			if(fwrite(p->write_raw, 1, p->frame_bytes, p->out) != p->frame_bytes || fflush(p->out) != 0) {
+				fprintf(stderr, "Failed to write frame %d.\n", f->index);
+				stream_fail(p, RC_FAIL);
+			}else {
+				Uint64 now = SDL_GetPerformanceCounter();
+				double latency = (double)(now - f->read_time) * 1000.0 / SDL_GetPerformanceFrequency();
+
+				if(p->written == 0) p->first_read = f->read_time;
+				p->last_written = now;
+				p->written++;
+				p->latency_sum += latency;
+				if(latency > p->latency_max) p->latency_max = latency;
+
+				if(p->opt->verbose) {
+					fprintf(stderr, "Frame %d: %.2f ms\n", f->index, latency);
+				}
+			}
+		}
+
+		stream_queue_push(&p->free_frames, f);
+	}
+
+	return 0;
+}
+
+/* Stage 2: runs the filter chain on the frames */
+static void stream_filter_frames(StreamPipeline *p)
+{
+	const StreamOptions *opt = p->opt;
+	StreamFrame *f;
+	int i;
+
+	while((f = stream_queue_pop(&p->read_frames)) != NULL) {
+		/* Filters don't touch the alpha component, so start both bitmaps from the frame */
+		if(opt->filter_count > 0 && !SDL_AtomicGet(&p->stop)) {
+			memcpy(f->buf[1], f->buf[0], (size_t)p->stride * p->h);
+		}
+
+		for(i=0; i<opt->filter_count && !SDL_AtomicGet(&p->stop); i++) {
+			RETCODE rc = filter_apply_by_name(f->buf[f->cur], f->buf[!f->cur], p->stride, p->w, p->h, opt->filters[i]);
+
+			if(failed(rc)) {
+				fprintf(stderr, "Filter \"%s\" failed (rc=%d).\n", opt->filters[i], rc);
+				stream_fail(p, rc);
+				break;
+			}
+
+			f->cur = !f->cur;
+		}
+
+		stream_queue_push(&p->filtered_frames, f);
+	}
+
+	stream_queue_push(&p->filtered_frames, NULL);
+}
+
+RETCODE stream_run(const StreamOptions *opt, FILE *in, FILE *out)
+{
+	StreamPipeline *p;
+	SDL_Thread *reader = NULL, *writer = NULL;
+	RETCODE rc = RC_OK;
+	int i;
+
+	p = calloc(1, sizeof(StreamPipeline));
+	if(!p) return RC_OUTOFMEM;
+
+	p->opt = opt;
+	p->in = in;
+	p->out = out;
+	p->w = opt->w;
+	p->h = opt->h;
+	p->maxval = 255;
+	SDL_AtomicSet(&p->rc, RC_OK);
+
+	/* The frames are allocated for the size of the first PGM frame */
+	if(opt->format == STREAM_PGM) {
+		rc = stream_read_pgm_header(in, &p->w, &p->h, &p->maxval);
+
+		if(rc == RC_FALSE) {
+			fprintf(stderr, "No frames.\n");
+			free(p);
+			return RC_OK;
+		}
+
+		if(failed(rc)) {
+			fprintf(stderr, "Invalid PGM frame header (rc=%d).\n", rc);
+			free(p);
+			return rc;
+		}
+
+		p->header_read = 1;
+	}
+
+	if(p->w <= 0 || p->h <= 0) {
+		free(p);
+		return RC_INVALIDARG;
+	}
+
+	p->frame_bytes = (size_t)p->w * p->h * (opt->format == STREAM_RGBA ? 4 : 1);
+	p->read_raw = malloc(p->frame_bytes);
+	p->write_raw = malloc(p->frame_bytes);
+
+	if(!p->read_raw || !p->write_raw) {
+		rc = RC_OUTOFMEM;
+		goto cleanup;
+	}
+
+	/* No memory is allocated per frame: the same frames go around the pipeline */
+	p->frame_count = opt->frames;
+	for(i=0; i<p->frame_count; i++) {
+		p->frames[i].buf[0] = bufpool_alloc_bitmap(p->w, p->h, &p->stride);
+		p->frames[i].buf[1] = bufpool_alloc_bitmap(p->w, p->h, &p->stride);
+
+		if(!p->frames[i].buf[0] || !p->frames[i].buf[1]) {
+			rc = RC_OUTOFMEM;
+			goto cleanup;
+		}
+	}
+
+	rc = stream_queue_init(&p->free_frames);
+	if(succeeded(rc)) rc = stream_queue_init(&p->read_frames);
+	if(succeeded(rc)) rc = stream_queue_init(&p->filtered_frames);
+	if(failed(rc)) goto cleanup;
+
+	for(i=0; i<p->frame_count; i++) {
+		stream_queue_push(&p->free_frames, &p->frames[i]);
+	}
+
+	writer = SDL_CreateThread(stream_writer_proc, "stream_writer", p);
+	if(!writer) {
+		rc = RC_FAIL;
+		goto cleanup;
+	}
+
+	reader = SDL_CreateThread(stream_reader_proc, "stream_reader", p);
+	if(!reader) {
+		/* An empty stream lets the writer finish */
+		stream_fail(p, RC_FAIL);
+		stream_queue_push(&p->read_frames, NULL);
+	}
+
+	stream_filter_frames(p);
+
+	if(reader) SDL_WaitThread(reader, NULL);
+	SDL_WaitThread(writer, NULL);
+
+	rc = SDL_AtomicGet(&p->rc);
+
+	double seconds = (double)(p->last_written - p->first_read) / SDL_GetPerformanceFrequency();
+
+	fprintf(stderr, "Streamed %d frames of %dx%d in %.2f s: %.1f fps, latency %.2f ms average, %.2f ms max\n",
+			p->written, p->w, p->h, seconds, p->written > 1 && seconds > 0 ? (p->written - 1) / seconds : 0.0,
+			p->written ? p->latency_sum / p->written : 0.0, p->latency_max);
+
+cleanup:
+	for(i=0; i<p->frame_count; i++) {
+		bufpool_free(p->frames[i].buf[0]);
+		bufpool_free(p->frames[i].buf[1]);
+	}
+
+	if(p->free_frames.count) SDL_DestroySemaphore(p->free_frames.count);
+	if(p->read_frames.count) SDL_DestroySemaphore(p->read_frames.count);
+	if(p->filtered_frames.count) SDL_DestroySemaphore(p->filtered_frames.count);
+
+	free(p->read_raw);
+	free(p->write_raw);
+	free(p);
+
+	return rc;
+}
+
+/* Splits a comma separated list of filter names. The names point inside `list` */
+static RETCODE stream_parse_filters(char *list, StreamOptions *opt)
+{
+	char *name = strtok(list, ",");
+
+	while(name) {
+		if(opt->filter_count >= BATCH_MAX_FILTERS) {
+			return RC_INVALIDARG;
+		}
+
+		opt->filters[opt->filter_count++] = name;
+		name = strtok(NULL, ",");
+	}
+
+	return RC_OK;
+}
+
+int stream_main(int argc, char **argv)
+{
+	StreamOptions opt;
+	FILE *in = stdin, *out = stdout;
+	int i;
+
+	memset(&opt, 0, sizeof(opt));
+	opt.format = STREAM_PGM;
+	opt.frames = STREAM_DEFAULT_FRAMES;
+
+	/* argv[1] is --stream */
+	for(i=2; i<argc; i++) {
+		if(strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			if(failed(stream_parse_filters(argv[++i], &opt))) {
+				fprintf(stderr, "Too many filters (at most %d).\n", BATCH_MAX_FILTERS);
+				return 1;
+			}
+		}else if(strcmp(argv[i], "-F") == 0 && i + 1 < argc) {
+			i++;
+
+			if(strcmp(argv[i], "pgm") == 0) {
+				opt.format = STREAM_PGM;
+			}else if(strcmp(argv[i], "gray8") == 0) {
+				opt.format = STREAM_GRAY8;
+			}else if(strcmp(argv[i], "rgba") == 0) {
+				opt.format = STREAM_RGBA;
+			}else {
+				fprintf(stderr, "Unknown frame format \"%s\".\n", argv[i]);
+				return 1;
+			}
+		}else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			if(sscanf(argv[++i], "%dx%d", &opt.w, &opt.h) != 2 || opt.w <= 0 || opt.h <= 0 ||
+					opt.w > STREAM_MAX_SIZE || opt.h > STREAM_MAX_SIZE) {
+				fprintf(stderr, "Invalid size \"%s\".\n", argv[i]);
+				return 1;
+			}
+		}else if(strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+			opt.input = argv[++i];
+		}else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			opt.output = argv[++i];
+		}else if(strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+			opt.frames = atoi(argv[++i]);
+
+			if(opt.frames < 3 || opt.frames >= STREAM_MAX_FRAMES) {
+				fprintf(stderr, "Invalid frame count \"%s\".\n", argv[i]);
+				return 1;
+			}
+		}else if(strcmp(argv[i], "-v") == 0) {
+			opt.verbose = 1;
+		}else {
+			stream_print_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(opt.format != STREAM_PGM && opt.w == 0) {
+		fprintf(stderr, "The raw formats need the frame size (-s).\n");
+		return 1;
+	}
+
+#ifdef _WIN32
+	/* The frames are binary */
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	if(opt.input && (in = fopen(opt.input, "rb")) == NULL) {
+		fprintf(stderr, "Can't open \"%s\".\n", opt.input);
+		return 1;
+	}
+
+	if(opt.output && (out = fopen(opt.output, "wb")) == NULL) {
+		fprintf(stderr, "Can't create \"%s\".\n", opt.output);
+		if(in != stdin) fclose(in);
+		return 1;
+	}
+
+	RETCODE rc = stream_run(&opt, in, out);
+
+	if(in != stdin) fclose(in);
+	if(out != stdout) fclose(out);
+
+	return failed(rc) ? 1 : 0;
+}
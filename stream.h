@@ -0,0 +1,63 @@
+/*
+ * stream.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <SDL2/SDL.h>
+#include "common.h"
+#include "batch.h"
+
+/* Frames in the pipeline when no -q option is given: one being read, filtered and written, and a spare one */
+#define STREAM_DEFAULT_FRAMES	4
+
+/* Capacity of the queues between the stages, so at most this many frames */
+#define STREAM_MAX_FRAMES		16
+
+typedef enum {
+	/* Concatenated binary PGM (P5) frames, the size is read from the first one */
+	STREAM_PGM = 0,
+
+	/* Raw 8-bit gray frames of a size given on the command line */
+	STREAM_GRAY8,
+
+	/* Raw frames of R, G, B, A bytes of a size given on the command line */
+	STREAM_RGBA,
+} StreamFormat;
+
+typedef struct {
+	/* Filters applied to every frame in order */
+	char *filters[BATCH_MAX_FILTERS];
+	int filter_count;
+
+	StreamFormat format;
+
+	/* Frame size of the raw formats */
+	int w, h;
+
+	/* Input and output files (named pipes), NULL for stdin and stdout */
+	char *input;
+	char *output;
+
+	/* Frames in flight */
+	int frames;
+
+	/* Print the latency of every frame */
+	int verbose;
+} StreamOptions;
+
+/**
+ * Entry point of the streaming mode (--stream). Frames are read, filtered and written
+ * by three stages running at the same time; the statistics go to stderr, since
+ * stdout may carry the frames. Returns the process exit code.
+ */
+int stream_main(int argc, char **argv);
+
+/* Runs the pipeline on open files, which don't need to be seekable */
+RETCODE stream_run(const StreamOptions *opt, FILE *in, FILE *out);
+
+#endif /* STREAM_H_ */
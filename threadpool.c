@@ -0,0 +1,244 @@
+/*
+ * threadpool.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <SDL2/SDL.h>
+#include "threadpool.h"
+#include "memtrack.h"
+
+/* How many bands per thread are produced by threadpool_split_rows() */
+#define BANDS_PER_THREAD	4
+
+typedef struct ThreadPoolJob {
+	ThreadPoolProc proc;
+	void *arg;
+	int count;
+
+	/* Index of the next iteration to be claimed */
+	SDL_atomic_t next;
+
+	/* Threads which are currently executing iterations of this job */
+	int users;
+
+	/* Memory allocated by the iterations counts for the operation of the caller */
+	MemOp *memop;
+
+	struct ThreadPoolJob *next_job;
+} ThreadPoolJob;
+
+static SDL_atomic_t pool_state;
+static SDL_Thread **pool_threads;
+static int pool_thread_count;
+
+static SDL_mutex *pool_lock;
+static SDL_cond *pool_work_cond;
+static SDL_cond *pool_done_cond;
+static ThreadPoolJob *pool_queue;
+static int pool_quit;
+
+static void threadpool_run_job(ThreadPoolJob *job)
+{
+	int i;
+
+	while((i = SDL_AtomicAdd(&job->next, 1)) < job->count) {
+		job->proc(job->arg, i);
+	}
+}
+
+/* Removes a job from the queue (if it is still there). Must be called under pool_lock */
+static void threadpool_unlink_job(ThreadPoolJob *job)
+{
+	ThreadPoolJob **p = &pool_queue;
+
+	while(*p) {
+		if(*p == job) {
+			*p = job->next_job;
+			return;
+		}
+
+		p = &(*p)->next_job;
+	}
+}
+
+static int threadpool_worker(void *unused)
+{
+	SDL_LockMutex(pool_lock);
+
+	while(!pool_quit) {
+		ThreadPoolJob *job = NULL, **p = &pool_queue;
+
+		/**
+		 * Drop jobs which have no iterations left to claim and take the newest of the rest.
+		 * Nested loops (e.g. the tiles of a big image processed by another iteration) are
+		 * queued later than the loops they are part of, so they are finished first and
+		 * their callers don't sit waiting while the idle threads start more outer iterations.
+		 */
+		while(*p) {
+			if(SDL_AtomicGet(&(*p)->next) >= (*p)->count) {
+				*p = (*p)->next_job;
+				continue;
+			}
+
+			job = *p;
+			p = &(*p)->next_job;
+		}
+
+		if(!job) {
+			SDL_CondWait(pool_work_cond, pool_lock);
+			continue;
+		}
+
+		job->users++;
+		SDL_UnlockMutex(pool_lock);
+
+		MemOp *memop = memtrack_set_op(job->memop);
+		threadpool_run_job(job);
+		memtrack_set_op(memop);
+
+		SDL_LockMutex(pool_lock);
+		threadpool_unlink_job(job);
+
+		if(--job->users == 0) {
+			SDL_CondBroadcast(pool_done_cond);
+		}
+	}
+
+	SDL_UnlockMutex(pool_lock);
+	return 0;
+}
+
+static void threadpool_init(void)
+{
+	int i;
+
+	/* Fast path - the pool is already running */
+	if(SDL_AtomicGet(&pool_state) == 2) {
+		return;
+	}
+
+	/* Only one thread performs the initialization, the others wait for it */
+	if(!SDL_AtomicCAS(&pool_state, 0, 1)) {
+		while(SDL_AtomicGet(&pool_state) != 2) {
+			SDL_Delay(0);
+		}
+
+		return;
+	}
+
+	pool_lock = SDL_CreateMutex();
+	pool_work_cond = SDL_CreateCond();
+	pool_done_cond = SDL_CreateCond();
+
+	/* The thread calling threadpool_parallel_for() also does work, so spawn one less */
+	int cpu_count = SDL_GetCPUCount();
+	pool_thread_count = 0;
+	pool_threads = malloc(cpu_count * sizeof(SDL_Thread*));
+
+	for(i=0; i<cpu_count-1 && pool_threads; i++) {
+		pool_threads[pool_thread_count] = SDL_CreateThread(threadpool_worker, "filter_worker", NULL);
+
+		if(pool_threads[pool_thread_count] != NULL) {
+			pool_thread_count++;
+		}
+	}
+
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&pool_state, 2);
+}
+
+void __attribute__((destructor)) threadpool_finalize(void)
+{
+	int i;
+
+	if(SDL_AtomicGet(&pool_state) != 2) {
+		return;
+	}
+
+	SDL_LockMutex(pool_lock);
+	pool_quit = 1;
+	SDL_CondBroadcast(pool_work_cond);
+	SDL_UnlockMutex(pool_lock);
+
+	for(i=0; i<pool_thread_count; i++) {
+		SDL_WaitThread(pool_threads[i], NULL);
+	}
+
+	free(pool_threads);
+	SDL_DestroyCond(pool_work_cond);
+	SDL_DestroyCond(pool_done_cond);
+	SDL_DestroyMutex(pool_lock);
+}
+
+RETCODE threadpool_parallel_for(int count, ThreadPoolProc proc, void *arg)
+{
+	int i;
+
+	if(!proc || count < 0) {
+		return RC_INVALIDARG;
+	}
+
+	threadpool_init();
+
+	/* Not worth waking up the workers */
+	if(count == 1 || pool_thread_count == 0) {
+		for(i=0; i<count; i++) {
+			proc(arg, i);
+		}
+
+		return RC_OK;
+	}
+
+	ThreadPoolJob job = {
+		.proc = proc,
+		.arg = arg,
+		.count = count,
+		.users = 1,
+		.memop = memtrack_current_op(),
+		.next_job = NULL,
+	};
+	SDL_AtomicSet(&job.next, 0);
+
+	/* Append the job at the end of the queue and wake up the workers */
+	SDL_LockMutex(pool_lock);
+	ThreadPoolJob **p = &pool_queue;
+	while(*p) p = &(*p)->next_job;
+	*p = &job;
+	SDL_CondBroadcast(pool_work_cond);
+	SDL_UnlockMutex(pool_lock);
+
+	/* Take part in the loop */
+	threadpool_run_job(&job);
+
+	/* Once all the iterations are claimed, wait for the workers still executing some of them */
+	SDL_LockMutex(pool_lock);
+	threadpool_unlink_job(&job);
+	job.users--;
+
+	while(job.users > 0) {
+		SDL_CondWait(pool_done_cond, pool_lock);
+	}
+	SDL_UnlockMutex(pool_lock);
+
+	return RC_OK;
+}
+
+int threadpool_get_thread_count(void)
+{
+	threadpool_init();
+	return pool_thread_count + 1;
+}
+
+int threadpool_split_rows(int h, int *band_h)
+{
+	int bands = threadpool_get_thread_count() * BANDS_PER_THREAD;
+
+	if(bands > h) bands = h;
+	if(bands < 1) bands = 1;
+
+	*band_h = (h + bands - 1) / bands;
+	return (h + *band_h - 1) / *band_h;
+}
@@ -0,0 +1,33 @@
+/*
+ * threadpool.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <stdint.h>
+#include "common.h"
+
+/* Procedure executed for each index of a parallel loop */
+typedef void (*ThreadPoolProc)(void *arg, int index);
+
+/**
+ * Calls proc(arg, i) for every i in [0..count) using the worker threads
+ * and blocks until all the calls have returned. The calling thread takes
+ * part in the loop too, so it is safe to call this routine from a worker.
+ */
+RETCODE threadpool_parallel_for(int count, ThreadPoolProc proc, void *arg);
+
+/* Number of threads which execute parallel loops (including the caller) */
+int threadpool_get_thread_count(void);
+
+/**
+ * Splits `h` rows in bands suitable for a parallel loop. The returned
+ * value is the band count and *band_h receives the height of one band.
+ */
+int threadpool_split_rows(int h, int *band_h);
+
+#endif /* THREADPOOL_H_ */
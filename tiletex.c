@@ -0,0 +1,295 @@
+/*
+ * tiletex.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <malloc.h>
+#include <string.h>
+#include "tiletex.h"
+#include "trace.h"
+#include "memtrack.h"
+
+#define bytes_per_pixel 4
+
+RETCODE tiletex_init(TiledTexture *t, SDL_Renderer *renderer)
+{
+	SDL_RendererInfo info;
+
+	memset(t, 0, sizeof(TiledTexture));
+	t->renderer = renderer;
+	t->tile_size = TILETEX_TILE_SIZE;
+
+	if(SDL_GetRendererInfo(renderer, &info) != 0) {
+		return RC_FAIL;
+	}
+
+	/* Zero means there is no limit */
+	if(info.max_texture_width > 0 && info.max_texture_width < t->tile_size) {
+		t->tile_size = info.max_texture_width;
+	}
+
+	if(info.max_texture_height > 0 && info.max_texture_height < t->tile_size) {
+		t->tile_size = info.max_texture_height;
+	}
+
+	return RC_OK;
+}
+
+static void tiletex_destroy_tile(TiledTexture *t, int index)
+{
+	if(t->tiles[index] != NULL) {
+		memtrack_texture_destroyed(MEM_TEXTURES, t->tiles[index]);
+		SDL_DestroyTexture(t->tiles[index]);
+		t->tiles[index] = NULL;
+		t->resident--;
+	}
+}
+
+void tiletex_free(TiledTexture *t)
+{
+	int i;
+
+	for(i=0; i<t->cols * t->rows; i++) {
+		tiletex_destroy_tile(t, i);
+	}
+
+	memtrack_free(t->tiles);
+	memtrack_free(t->dirty);
+
+	t->tiles = NULL;
+	t->dirty = NULL;
+	t->cols = t->rows = 0;
+	t->pixels = NULL;
+	t->w = t->h = 0;
+}
+
+/* Area of the source covered by a tile */
+static void tiletex_tile_rect(const TiledTexture *t, int col, int row, SDL_Rect *rect)
+{
+	rect->x = col * t->tile_size;
+	rect->y = row * t->tile_size;
+	rect->w = t->w - rect->x < t->tile_size ? t->w - rect->x : t->tile_size;
+	rect->h = t->h - rect->y < t->tile_size ? t->h - rect->y : t->tile_size;
+}
+
+RETCODE tiletex_set_source(TiledTexture *t, const void *pixels, int stride, int w, int h)
+{
+	if(!pixels) {
+		tiletex_free(t);
+		return RC_OK;
+	}
+
+	if(w != t->w || h != t->h || !t->tiles) {
+		tiletex_free(t);
+
+		t->cols = (w + t->tile_size - 1) / t->tile_size;
+		t->rows = (h + t->tile_size - 1) / t->tile_size;
+		t->tiles = memtrack_calloc(MEM_TEXTURES, t->cols * t->rows, sizeof(SDL_Texture*));
+		t->dirty = memtrack_calloc(MEM_TEXTURES, t->cols * t->rows, sizeof(SDL_Rect));
+
+		if(!t->tiles || !t->dirty) {
+			tiletex_free(t);
+			return RC_OUTOFMEM;
+		}
+
+		t->w = w;
+		t->h = h;
+	}
+
+	t->pixels = pixels;
+	t->stride = stride;
+	tiletex_invalidate(t, NULL);
+
+	return RC_OK;
+}
+
+void tiletex_invalidate(TiledTexture *t, const SDL_Rect *rect)
+{
+	SDL_Rect all = {0, 0, t->w, t->h};
+	SDL_Rect tile_rect, part;
+	int i, j;
+
+	if(!t->tiles) {
+		return;
+	}
+
+	if(!rect) {
+		rect = &all;
+	}
+
+	int c1 = (rect->x + rect->w - 1) / t->tile_size;
+	int r1 = (rect->y + rect->h - 1) / t->tile_size;
+
+	for(j=rect->y / t->tile_size; j<=r1 && j<t->rows; j++) {
+		for(i=rect->x / t->tile_size; i<=c1 && i<t->cols; i++) {
+			int index = j * t->cols + i;
+
+			/* Tiles which aren't resident are uploaded whole when created */
+			if(!t->tiles[index]) {
+				continue;
+			}
+
+			tiletex_tile_rect(t, i, j, &tile_rect);
+
+			if(!SDL_IntersectRect(rect, &tile_rect, &part)) {
+				continue;
+			}
+
+			part.x -= tile_rect.x;
+			part.y -= tile_rect.y;
+
+			if(t->dirty[index].w > 0) {
+				SDL_UnionRect(&t->dirty[index], &part, &t->dirty[index]);
+			}else {
+				t->dirty[index] = part;
+			}
+		}
+	}
+}
+
+/* Creates a missing tile or uploads the changed part of a resident one */
+static SDL_Texture *tiletex_get_tile(TiledTexture *t, int col, int row)
+{
+	int index = row * t->cols + col;
+	SDL_Rect tile_rect;
+
+	tiletex_tile_rect(t, col, row, &tile_rect);
+
+	if(!t->tiles[index]) {
+		t->tiles[index] = SDL_CreateTexture(t->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, tile_rect.w, tile_rect.h);
+
+		if(!t->tiles[index]) {
+			return NULL;
+		}
+
+		memtrack_texture_created(MEM_TEXTURES, t->tiles[index]);
+		t->resident++;
+		t->dirty[index].x = t->dirty[index].y = 0;
+		t->dirty[index].w = tile_rect.w;
+		t->dirty[index].h = tile_rect.h;
+	}
+
+	SDL_Rect *d = &t->dirty[index];
+
+	if(d->w > 0) {
+		TRACE_SCOPE("upload");
+
+		const uint8_t *p = t->pixels + (size_t)(tile_rect.y + d->y) * t->stride + (size_t)(tile_rect.x + d->x) * bytes_per_pixel;
+
+		if(SDL_UpdateTexture(t->tiles[index], d, p, t->stride) != 0) {
+			return NULL;
+		}
+
+		d->w = d->h = 0;
+	}
+
+	return t->tiles[index];
+}
+
+RETCODE tiletex_draw(TiledTexture *t, const SDL_Rect *src, const SDL_Rect *dst)
+{
+	SDL_Rect all = {0, 0, t->w, t->h};
+	SDL_Rect tile_rect, part;
+	int out_w, out_h;
+	int i, j;
+
+	if(!t->pixels || !dst) {
+		return RC_INVALIDARG;
+	}
+
+	if(!src) {
+		src = &all;
+	}
+
+	if(src->w <= 0 || src->h <= 0 || dst->w <= 0 || dst->h <= 0) {
+		return RC_OK;
+	}
+
+	if(SDL_GetRendererOutputSize(t->renderer, &out_w, &out_h) != 0) {
+		return RC_FAIL;
+	}
+
+	float sx = (float)dst->w / src->w;
+	float sy = (float)dst->h / src->h;
+
+	/* Part of src which lands inside the output */
+	int x0 = src->x + (int)((0 - dst->x) / sx);
+	int y0 = src->y + (int)((0 - dst->y) / sy);
+	int x1 = src->x + (int)((out_w - dst->x) / sx) + 1;
+	int y1 = src->y + (int)((out_h - dst->y) / sy) + 1;
+
+	if(x0 < src->x) x0 = src->x;
+	if(y0 < src->y) y0 = src->y;
+	if(x1 > src->x + src->w) x1 = src->x + src->w;
+	if(y1 > src->y + src->h) y1 = src->y + src->h;
+
+	if(x1 <= x0 || y1 <= y0) {
+		return RC_OK;
+	}
+
+	int c0 = x0 / t->tile_size, c1 = (x1 - 1) / t->tile_size;
+	int r0 = y0 / t->tile_size, r1 = (y1 - 1) / t->tile_size;
+
+	/* Remember the drawn tiles for tiletex_evict() */
+	if(!t->seen) {
+		t->seen = 1;
+		t->seen_c0 = c0; t->seen_c1 = c1;
+		t->seen_r0 = r0; t->seen_r1 = r1;
+	}else {
+		if(c0 < t->seen_c0) t->seen_c0 = c0;
+		if(c1 > t->seen_c1) t->seen_c1 = c1;
+		if(r0 < t->seen_r0) t->seen_r0 = r0;
+		if(r1 > t->seen_r1) t->seen_r1 = r1;
+	}
+
+	for(j=r0; j<=r1; j++) {
+		for(i=c0; i<=c1; i++) {
+			tiletex_tile_rect(t, i, j, &tile_rect);
+
+			if(!SDL_IntersectRect(src, &tile_rect, &part)) {
+				continue;
+			}
+
+			SDL_Texture *tex = tiletex_get_tile(t, i, j);
+			if(!tex) {
+				return RC_FAIL;
+			}
+
+			/* Round both edges, so neighbouring tiles don't leave gaps */
+			int dx0 = dst->x + (int)((part.x - src->x) * sx);
+			int dy0 = dst->y + (int)((part.y - src->y) * sy);
+			int dx1 = dst->x + (int)((part.x + part.w - src->x) * sx);
+			int dy1 = dst->y + (int)((part.y + part.h - src->y) * sy);
+			SDL_Rect dst_rect = {dx0, dy0, dx1 - dx0, dy1 - dy0};
+
+			part.x -= tile_rect.x;
+			part.y -= tile_rect.y;
+
+			SDL_RenderCopy(t->renderer, tex, &part, &dst_rect);
+		}
+	}
+
+	return RC_OK;
+}
+
+void tiletex_evict(TiledTexture *t)
+{
+	int i, j;
+
+	if(t->resident > 0) {
+		for(j=0; j<t->rows; j++) {
+			for(i=0; i<t->cols; i++) {
+				if(t->seen && i >= t->seen_c0 - TILETEX_KEEP_MARGIN && i <= t->seen_c1 + TILETEX_KEEP_MARGIN &&
+						j >= t->seen_r0 - TILETEX_KEEP_MARGIN && j <= t->seen_r1 + TILETEX_KEEP_MARGIN) {
+					continue;
+				}
+
+				tiletex_destroy_tile(t, j * t->cols + i);
+			}
+		}
+	}
+
+	t->seen = 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * tiletex.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef TILETEX_H_
+#define TILETEX_H_
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "common.h"
+
+/* Side of the tiles, reduced to the largest texture the renderer supports */
+#define TILETEX_TILE_SIZE	1024
+
+/* Tiles kept resident around the area drawn in the last frame, in tiles */
+#define TILETEX_KEEP_MARGIN	1
+
+typedef struct {
+	SDL_Renderer *renderer;
+	int tile_size;
+
+	/* 32-bit source bitmap (not owned) */
+	const uint8_t *pixels;
+	int stride;
+	int w, h;
+
+	/* Grid of streaming textures, NULL for tiles which aren't uploaded */
+	int cols, rows;
+	SDL_Texture **tiles;
+
+	/* Part of each resident tile (in tile pixels) which differs from the source, w = 0 if none */
+	SDL_Rect *dirty;
+	int resident;
+
+	/* Range of tiles drawn since the last tiletex_evict() */
+	int seen;
+	int seen_c0, seen_c1, seen_r0, seen_r1;
+} TiledTexture;
+
+/**
+ * Prepares an empty tiled texture. The tile size is chosen from the limits of the
+ * renderer, so images larger than the biggest texture can still be drawn.
+ */
+RETCODE tiletex_init(TiledTexture *t, SDL_Renderer *renderer);
+
+/* Destroys the tiles and frees the grid */
+void tiletex_free(TiledTexture *t);
+
+/**
+ * Sets the 32-bit bitmap drawn by the tiled texture. It isn't copied and must stay
+ * valid while it is set. NULL detaches it and destroys the tiles. Resident tiles of
+ * a bitmap of the same size are kept and marked as changed.
+ */
+RETCODE tiletex_set_source(TiledTexture *t, const void *pixels, int stride, int w, int h);
+
+/* Marks an area of the source (NULL for all of it) as changed, so it is uploaded again when drawn */
+void tiletex_invalidate(TiledTexture *t, const SDL_Rect *rect);
+
+/**
+ * Draws the `src` area of the source (NULL for the whole bitmap) to `dst`. Only the
+ * tiles which fall inside the renderer's output are touched: missing ones are created
+ * and changed ones are updated before they are drawn.
+ */
+RETCODE tiletex_draw(TiledTexture *t, const SDL_Rect *src, const SDL_Rect *dst);
+
+/**
+ * Destroys the tiles farther than TILETEX_KEEP_MARGIN tiles from the ones drawn since
+ * the previous call (all of them if none was drawn). Called once per frame, it caps the
+ * video memory to roughly the tiles covering the window.
+ */
+void tiletex_evict(TiledTexture *t);
+
+#endif /* TILETEX_H_ */
@@ -0,0 +1,295 @@
+/*
+ * trace.c
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "common.h"
+#include "trace.h"
+
+typedef struct {
+	const char *name;
+	Uint64 start;
+	Uint64 end;
+
+	/* Hardware counter deltas of the span, bits of the measured ones in `counted` */
+	unsigned counted;
+	uint64_t counters[PERFCNT_COUNT];
+} TraceEvent;
+
+/**
+ * Spans of one thread, kept until the process exits (a thread of the pool may
+ * still be finishing a span then). Only the owner writes it: the event is stored
+ * first and then published by incrementing `count`, so readers never wait for it.
+ * A reader may see an event being overwritten after the buffer wrapped; such
+ * events are mostly dropped by the start/end checks.
+ */
+typedef struct TraceBuffer {
+	struct TraceBuffer *next;
+	int index;
+	SDL_threadID thread;
+
+	/* Events written so far, the last TRACE_BUFFER_EVENTS of them are kept */
+	SDL_atomic_t count;
+
+	/* Counters of the thread, opened once when first needed */
+	int counters_opened;
+	PerfCounters counters;
+
+	TraceEvent events[TRACE_BUFFER_EVENTS];
+} TraceBuffer;
+
+volatile int trace_enabled;
+volatile int trace_counters_enabled;
+
+static TraceBuffer *trace_buffers;
+static SDL_atomic_t trace_buffer_count;
+static SDL_TLSID trace_tls;
+static SDL_threadID trace_main_thread;
+static Uint64 trace_epoch;
+
+static void trace_init(void)
+{
+	/* The thread turning tracing on first is named "main" in the export */
+	if(!trace_tls) {
+		trace_tls = SDL_TLSCreate();
+		trace_main_thread = SDL_ThreadID();
+		trace_epoch = SDL_GetPerformanceCounter();
+	}
+}
+
+void trace_enable(int enable)
+{
+	if(enable) trace_init();
+
+	trace_enabled = enable && trace_tls;
+}
+
+void trace_reset(void)
+{
+	trace_epoch = SDL_GetPerformanceCounter();
+}
+
+static TraceBuffer *trace_get_buffer(void)
+{
+	TraceBuffer *buf = SDL_TLSGet(trace_tls);
+
+	if(buf) return buf;
+
+	buf = malloc(sizeof(TraceBuffer));
+	if(!buf) return NULL;
+
+	buf->index = SDL_AtomicAdd(&trace_buffer_count, 1);
+	buf->thread = SDL_ThreadID();
+	buf->counters_opened = 0;
+	SDL_AtomicSet(&buf->count, 0);
+
+	/* Buffers are only ever added to the front of the list */
+	do {
+		buf->next = SDL_AtomicGetPtr((void**)&trace_buffers);
+	}while(!SDL_AtomicCASPtr((void**)&trace_buffers, buf->next, buf));
+
+	SDL_TLSSet(trace_tls, buf, NULL);
+
+	return buf;
+}
+
+RETCODE trace_enable_counters(int enable)
+{
+	uint64_t values[PERFCNT_COUNT];
+
+	if(!enable) {
+		trace_counters_enabled = 0;
+		return RC_OK;
+	}
+
+	trace_init();
+
+	/* The other threads open theirs lazily and record spans without counters if they can't */
+	if(!trace_tls || failed(trace_read_counters(values))) {
+		return RC_NOTIMPL;
+	}
+
+	trace_counters_enabled = 1;
+	return RC_OK;
+}
+
+RETCODE trace_read_counters(uint64_t *values)
+{
+	TraceBuffer *buf = trace_get_buffer();
+	PerfValues v;
+
+	if(!buf) return RC_OUTOFMEM;
+
+	if(!buf->counters_opened) {
+		perfcnt_open_thread(&buf->counters);
+		buf->counters_opened = 1;
+	}
+
+	if(buf->counters.valid == 0) {
+		return RC_NOTIMPL;
+	}
+
+	RETCODE rc = perfcnt_read(&buf->counters, &v);
+	if(failed(rc)) return rc;
+
+	memcpy(values, v.values, sizeof(v.values));
+	return RC_OK;
+}
+
+void trace_record(const char *name, Uint64 start, Uint64 end, const uint64_t *counters)
+{
+	TraceBuffer *buf = trace_get_buffer();
+	PerfValues now;
+	int c;
+
+	if(!buf) return;
+
+	int n = SDL_AtomicGet(&buf->count);
+	TraceEvent *e = &buf->events[n % TRACE_BUFFER_EVENTS];
+
+	e->name = name;
+	e->start = start;
+	e->end = end;
+	e->counted = 0;
+
+	if(counters && succeeded(perfcnt_read(&buf->counters, &now))) {
+		e->counted = now.valid;
+
+		for(c=0; c<PERFCNT_COUNT; c++) {
+			e->counters[c] = now.values[c] > counters[c] ? now.values[c] - counters[c] : 0;
+		}
+	}
+
+	SDL_AtomicSet(&buf->count, n + 1);
+}
+
+/* Range [*first, *last) of the events still kept in `buf` */
+static void trace_event_range(TraceBuffer *buf, int *first, int *last)
+{
+	*last = SDL_AtomicGet(&buf->count);
+	*first = *last > TRACE_BUFFER_EVENTS ? *last - TRACE_BUFFER_EVENTS : 0;
+}
+
+/* Copies event i of `buf`; returns 0 if it began before `since` or was being overwritten */
+static int trace_read_event(TraceBuffer *buf, int i, Uint64 since, TraceEvent *e)
+{
+	*e = buf->events[i % TRACE_BUFFER_EVENTS];
+
+	return e->name && e->start >= since && e->end >= e->start;
+}
+
+static int trace_compare_entries(const void *a, const void *b)
+{
+	double ta = ((const TraceSummaryEntry*)a)->total_ms, tb = ((const TraceSummaryEntry*)b)->total_ms;
+
+	return ta > tb ? -1 : ta < tb ? 1 : 0;
+}
+
+RETCODE trace_summarize(Uint64 since, TraceSummary *out)
+{
+	double ms_per_tick = 1000.0 / SDL_GetPerformanceFrequency();
+	TraceBuffer *buf;
+	TraceEvent e;
+	int i, j, first, last;
+
+	memset(out, 0, sizeof(TraceSummary));
+
+	for(buf = SDL_AtomicGetPtr((void**)&trace_buffers); buf; buf = buf->next) {
+		trace_event_range(buf, &first, &last);
+
+		for(j=first; j<last; j++) {
+			if(!trace_read_event(buf, j, since, &e)) continue;
+
+			/* The names are literals, so most lookups match the pointer */
+			for(i=0; i<out->count; i++) {
+				if(out->entries[i].name == e.name || strcmp(out->entries[i].name, e.name) == 0) break;
+			}
+
+			if(i == out->count) {
+				if(out->count == TRACE_SUMMARY_MAX) continue;
+
+				out->entries[out->count++].name = e.name;
+			}
+
+			out->entries[i].count++;
+			out->entries[i].total_ms += (e.end - e.start) * ms_per_tick;
+
+			if((e.counted & (1u << PERFCNT_CYCLES)) && (e.counted & (1u << PERFCNT_INSTRUCTIONS))) {
+				out->entries[i].counted++;
+				out->entries[i].cycles += e.counters[PERFCNT_CYCLES];
+				out->entries[i].instructions += e.counters[PERFCNT_INSTRUCTIONS];
+			}
+		}
+	}
+
+	qsort(out->entries, out->count, sizeof(TraceSummaryEntry), trace_compare_entries);
+
+	return RC_OK;
+}
+
+RETCODE trace_export(const char *filename)
+{
+	double us_per_tick = 1000000.0 / SDL_GetPerformanceFrequency();
+	Uint64 epoch = trace_epoch;
+	TraceBuffer *buf;
+	TraceEvent e;
+	int i, c, first, last, events = 0;
+
+	FILE *f = fopen(filename, "w");
+	if(!f) return RC_FAIL;
+
+	fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+	for(buf = SDL_AtomicGetPtr((void**)&trace_buffers); buf; buf = buf->next) {
+		if(buf->thread == trace_main_thread) {
+			fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"main\"}},\n", buf->index);
+		}else {
+			fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}},\n", buf->index, buf->index);
+		}
+
+		/* Complete ("X") events, the viewer nests them by their times */
+		trace_event_range(buf, &first, &last);
+
+		for(i=first; i<last; i++) {
+			if(!trace_read_event(buf, i, epoch, &e)) continue;
+
+			fprintf(f, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+					e.name, buf->index, (e.start - epoch) * us_per_tick, (e.end - e.start) * us_per_tick);
+
+			/* Counters are shown in the details of the span */
+			if(e.counted) {
+				const char *sep = "";
+
+				fprintf(f, ", \"args\": {");
+
+				for(c=0; c<PERFCNT_COUNT; c++) {
+					if(!(e.counted & (1u << c))) continue;
+
+					fprintf(f, "%s\"%s\": %llu", sep, perfcnt_name(c), (unsigned long long)e.counters[c]);
+					sep = ", ";
+				}
+
+				fprintf(f, "}");
+			}
+
+			fprintf(f, "},\n");
+			events++;
+		}
+	}
+
+	/* The metadata event closes the list, so every event above can end with a comma */
+	fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"CourseWork_DIP\"}}\n]}\n");
+
+	RETCODE rc = ferror(f) ? RC_FAIL : RC_OK;
+	fclose(f);
+
+	printf("Wrote %d trace events to \"%s\".\n", events, filename);
+
+	return rc;
+}
@@ -0,0 +1,117 @@
+/*
+ * trace.h
+ *
+ *  Created on: 18.10.2026 .
+ *      Author: Anton Angelov
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <SDL2/SDL.h>
+#include "common.h"
+#include "perfcnt.h"
+
+/* Spans kept per thread, older ones are overwritten */
+#define TRACE_BUFFER_EVENTS	16384
+
+/* Span names in a summary */
+#define TRACE_SUMMARY_MAX	16
+
+/* Span being measured; name is NULL if tracing was off when it began */
+typedef struct {
+	const char *name;
+	Uint64 start;
+
+	/* Hardware counters of the thread at the beginning, if `counted` */
+	int counted;
+	uint64_t counters[PERFCNT_COUNT];
+} TraceSpan;
+
+typedef struct {
+	const char *name;
+	int count;
+	double total_ms;
+
+	/* Sums over the spans measured with counters (`counted` of them) */
+	int counted;
+	uint64_t cycles;
+	uint64_t instructions;
+} TraceSummaryEntry;
+
+/* Time spent in each span name (all threads together), the largest first */
+typedef struct {
+	TraceSummaryEntry entries[TRACE_SUMMARY_MAX];
+	int count;
+} TraceSummary;
+
+/* Nonzero while spans are recorded. Tested inline, so a disabled span is a load and a branch */
+extern volatile int trace_enabled;
+
+/* Nonzero while spans also count cycles, instructions and misses of their thread */
+extern volatile int trace_counters_enabled;
+
+void trace_enable(int enable);
+
+/**
+ * Turns the hardware counters of the spans on or off. Each thread opens its own
+ * counters when it records a span the first time. Fails with RC_NOTIMPL if the
+ * calling thread can't count (see perfcnt_error()); spans are then recorded without.
+ */
+RETCODE trace_enable_counters(int enable);
+
+/* Spans which began before this call aren't exported */
+void trace_reset(void);
+
+/**
+ * Adds a finished span to the buffer of the calling thread (no locks are taken).
+ * `counters` are the values of trace_read_counters() at the start, or NULL.
+ */
+void trace_record(const char *name, Uint64 start, Uint64 end, const uint64_t *counters);
+
+/* Current hardware counters of the calling thread, opened on the first call */
+RETCODE trace_read_counters(uint64_t *values);
+
+static inline TraceSpan trace_span_begin(const char *name)
+{
+	TraceSpan span;
+
+	span.name = NULL;
+
+	if(trace_enabled) {
+		span.name = name;
+		span.counted = trace_counters_enabled && succeeded(trace_read_counters(span.counters));
+		span.start = SDL_GetPerformanceCounter();
+	}
+
+	return span;
+}
+
+static inline void trace_span_end(TraceSpan *span)
+{
+	if(span->name) {
+		trace_record(span->name, span->start, SDL_GetPerformanceCounter(), span->counted ? span->counters : NULL);
+	}
+}
+
+/**
+ * Measures the rest of the enclosing block as a span named `name` (a string literal).
+ * It must not be jumped over by a goto into the block. Building with -DNO_TRACE
+ * removes the spans completely.
+ */
+#ifdef NO_TRACE
+#define TRACE_SCOPE(name)
+#else
+#define TRACE_CONCAT_(a, b)	a##b
+#define TRACE_CONCAT(a, b)	TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) \
+	TraceSpan TRACE_CONCAT(trace_span_, __LINE__) __attribute__((cleanup(trace_span_end), unused)) = trace_span_begin(name)
+#endif
+
+/* Sums the spans which began at or after `since` (a performance counter value) by name */
+RETCODE trace_summarize(Uint64 since, TraceSummary *out);
+
+/* Writes the recorded spans as Chrome trace JSON (chrome://tracing, ui.perfetto.dev) */
+RETCODE trace_export(const char *filename);
+
+#endif /* TRACE_H_ */